@@ -1,6 +1,11 @@
 #ifndef FIXED64_H
 #define	FIXED64_H
 
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+#include <stdio.h>
+
 double const half_scale = (1ULL<<32);
 double const fractional_scale = half_scale * half_scale;
 
@@ -8,21 +13,46 @@ double const fractional_scale = half_scale * half_scale;
 // implementation, unfortunately it's GPLv2 so I can't just use it but can
 // look at some of the ideas.
 
+// Everything here is integer arithmetic with fully defined rounding (results of *, / and sqrt are
+// truncated towards zero), so results are bit-identical on every machine and compiler. That's the
+// point of it: the deterministic physics mode keeps its state in these.
+// Conversions from double are exact for the fraction bits a double has; conversions to double round.
+
+// 64x64 -> 128 bit unsigned multiply
+inline void fixedMulU64(uint64_t a, uint64_t b, uint64_t* o_hi, uint64_t* o_lo) {
+#if defined(__SIZEOF_INT128__)
+  unsigned __int128 const p = (unsigned __int128)a * b;
+  *o_hi = (uint64_t)(p >> 64);
+  *o_lo = (uint64_t)p;
+#else
+  uint64_t const a_lo = a & 0xffffffffULL, a_hi = a >> 32;
+  uint64_t const b_lo = b & 0xffffffffULL, b_hi = b >> 32;
+  uint64_t const ll = a_lo * b_lo;
+  uint64_t const lh = a_lo * b_hi;
+  uint64_t const hl = a_hi * b_lo;
+  uint64_t const hh = a_hi * b_hi;
+  uint64_t const mid = (ll >> 32) + (lh & 0xffffffffULL) + (hl & 0xffffffffULL);
+  *o_lo = (mid << 32) | (ll & 0xffffffffULL);
+  *o_hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+#endif
+}
+
 class Fixed64
 {
 public:
-  Fixed64(Fixed64 const& other) :
-    integral_part(other.integral_part),
-    fractional_part(other.fractional_part)
-  {}
+  // Defaulted so Fixed64 stays trivially copyable and can live in ortable columns
+  Fixed64(Fixed64 const& other) = default;
   Fixed64() :
     integral_part(0),
     fractional_part(0)
   {}
-  Fixed64(int64_t integral, int64_t fractional) :
+  Fixed64(int64_t integral, uint64_t fractional) :
     integral_part(integral),
     fractional_part(fractional)
-  { printBinary(); }
+  {}
+  Fixed64& operator=(Fixed64 const& other) = default;
+
+  static Fixed64 fromInt(int64_t v) { return Fixed64(v, 0); }
   static Fixed64 fromDouble(double v) {
     // both of these are negative if v is negative
     double integral_part_d;
@@ -37,30 +67,25 @@ public:
       // TODO what happens if I remove the abs() above and just do fractional_part = (uint64_t)(fractional_part_d * fractional_scale) ?
       fractional_part = ~((uint64_t)(fractional_part_d * fractional_scale)) + 1;
     }
-    printf("fromDouble id: %e fd: %e ii: %ld fi: %ld\n", integral_part_d, fractional_part_d, integral_part, fractional_part);
     return Fixed64(integral_part, fractional_part);
   }
   static double toDouble(Fixed64 v) {
     double integral_part_d = (double)v.integral_part;
     double fractional_part_d = (double)v.fractional_part / fractional_scale;
-    printf("toDouble ii: %ld fi: %ld id: %e fd: %e\n", v.integral_part, v.fractional_part, integral_part_d, fractional_part_d);
     return integral_part_d + fractional_part_d;
   }
-  void printBinary() const {
-    std::stringstream ss;
-    for (int i = 63; i >= 0; --i) {
-      ss << ((((uint64_t)integral_part) & (1ULL << i)) ? "1" : "0");
-    }
-    ss << ".";
-    for (int i = 63; i >= 0; --i) {
-      ss << (((fractional_part) & (1ULL << i)) ? "1" : "0");
-    }
-    printf("%s\n", ss.str().c_str());
-  }
-  Fixed64 operator+(Fixed64 const& rhs) {
+  // Rounds towards negative infinity
+  static int64_t toInt(Fixed64 v) { return v.integral_part; }
+
+  // Raw two's complement bits, for hashing and serialisation
+  int64_t getIntegralPart() const { return integral_part; }
+  uint64_t getFractionalPart() const { return fractional_part; }
+
+  Fixed64 operator+(Fixed64 const& rhs) const {
      int64_t const int_lhs = integral_part;
      int64_t const int_rhs = rhs.integral_part;
-     int64_t const int_sum = int_lhs + int_rhs;
+     // Unsigned so wrapping on overflow is defined
+     int64_t const int_sum = (int64_t)((uint64_t)int_lhs + (uint64_t)int_rhs);
 
     uint64_t const frac_lhs = fractional_part;
     uint64_t const frac_rhs = rhs.fractional_part;
@@ -70,22 +95,213 @@ public:
     uint64_t const carry = (frac_lhs & frac_rhs) | ((frac_lhs ^ frac_rhs) & ~frac_sum);
     // TODO celestia bigfix does this: uint64_t const carry = frac_sum < frac_rhs;
 
-    return Fixed64(int_sum + (carry >> 63), frac_sum);
+    return Fixed64((int64_t)((uint64_t)int_sum + (carry >> 63)), frac_sum);
   }
   Fixed64 operator-() const {
     return Fixed64(~integral_part, ~fractional_part) + Fixed64(0, 1);
   }
-  Fixed64 operator-(Fixed64 const& rhs) {
+  Fixed64 operator-(Fixed64 const& rhs) const {
     return *this + (-rhs);
   }
-  // TODO operator*, operator/
+
+  Fixed64 operator*(Fixed64 const& rhs) const {
+    bool const negative = isNegative() != rhs.isNegative();
+    Fixed64 const a = abs();
+    Fixed64 const b = rhs.abs();
+    uint64_t const a_hi = (uint64_t)a.integral_part, a_lo = a.fractional_part;
+    uint64_t const b_hi = (uint64_t)b.integral_part, b_lo = b.fractional_part;
+
+    // Product is 256 bits with the binary point at bit 128; we want bits 64..191.
+    uint64_t ll_hi, ll_lo, lh_hi, lh_lo, hl_hi, hl_lo, hh_hi, hh_lo;
+    fixedMulU64(a_lo, b_lo, &ll_hi, &ll_lo);
+    fixedMulU64(a_lo, b_hi, &lh_hi, &lh_lo);
+    fixedMulU64(a_hi, b_lo, &hl_hi, &hl_lo);
+    fixedMulU64(a_hi, b_hi, &hh_hi, &hh_lo);
+
+    uint64_t lo = ll_hi;
+    uint64_t hi = hh_lo;
+    lo += lh_lo; hi += (lo < lh_lo);
+    lo += hl_lo; hi += (lo < hl_lo);
+    hi += lh_hi + hl_hi;
+
+    Fixed64 const r((int64_t)hi, lo);
+    return negative ? -r : r;
+  }
+
+  Fixed64 operator/(Fixed64 const& rhs) const {
+    assert(!rhs.isZero());
+    if (rhs.isZero()) { return Fixed64(); }
+    bool const negative = isNegative() != rhs.isNegative();
+    Fixed64 const a = abs();
+    Fixed64 const b = rhs.abs();
+    uint64_t const b_hi = (uint64_t)b.integral_part, b_lo = b.fractional_part;
+
+    // Long division of the 192 bit (a << 64) by the 128 bit b. Both magnitudes are at most 2^127 so
+    // the remainder always fits in 128 bits.
+    uint64_t const num[3] = { (uint64_t)a.integral_part, a.fractional_part, 0 };
+    uint64_t rem_hi = 0, rem_lo = 0;
+    uint64_t q_hi = 0, q_lo = 0;
+    int bit = 191;
+    // Skip leading zeroes
+    while (bit >= 0 && !(num[2 - bit / 64] & (1ULL << (bit % 64)))) { --bit; }
+    for (; bit >= 0; --bit) {
+      uint64_t const in = (num[2 - bit / 64] >> (bit % 64)) & 1;
+      rem_hi = (rem_hi << 1) | (rem_lo >> 63);
+      rem_lo = (rem_lo << 1) | in;
+      q_hi = (q_hi << 1) | (q_lo >> 63);
+      q_lo <<= 1;
+      if (rem_hi > b_hi || (rem_hi == b_hi && rem_lo >= b_lo)) {
+        uint64_t const borrow = rem_lo < b_lo;
+        rem_lo -= b_lo;
+        rem_hi -= b_hi + borrow;
+        q_lo |= 1;
+      }
+    }
+
+    Fixed64 const r((int64_t)q_hi, q_lo);
+    return negative ? -r : r;
+  }
+
+  // Division by a small integer, much cheaper than the general case
+  Fixed64 divInt(int64_t d) const {
+    assert(d != 0);
+    if (d == 0) { return Fixed64(); }
+    bool const negative = isNegative() != (d < 0);
+    Fixed64 const a = abs();
+    uint64_t const ud = d < 0 ? (uint64_t)0 - (uint64_t)d : (uint64_t)d;
+    uint64_t const hi = (uint64_t)a.integral_part;
+    uint64_t const q_hi = hi / ud;
+    uint64_t rem = hi % ud;
+#if defined(__SIZEOF_INT128__)
+    uint64_t const q_lo = (uint64_t)((((unsigned __int128)rem << 64) | a.fractional_part) / ud);
+#else
+    uint64_t q_lo = 0;
+    for (int bit = 63; bit >= 0; --bit) {
+      uint64_t const top = rem >> 63;
+      rem = (rem << 1) | ((a.fractional_part >> bit) & 1);
+      q_lo <<= 1;
+      if (top || rem >= ud) {
+        rem -= ud;
+        q_lo |= 1;
+      }
+    }
+#endif
+    Fixed64 const r((int64_t)q_hi, q_lo);
+    return negative ? -r : r;
+  }
+
+  Fixed64& operator+=(Fixed64 const& rhs) { return *this = *this + rhs; }
+  Fixed64& operator-=(Fixed64 const& rhs) { return *this = *this - rhs; }
+  Fixed64& operator*=(Fixed64 const& rhs) { return *this = *this * rhs; }
+  Fixed64& operator/=(Fixed64 const& rhs) { return *this = *this / rhs; }
+
+  bool operator==(Fixed64 const& rhs) const { return integral_part == rhs.integral_part && fractional_part == rhs.fractional_part; }
+  bool operator!=(Fixed64 const& rhs) const { return !(*this == rhs); }
+  bool operator<(Fixed64 const& rhs) const {
+    return integral_part < rhs.integral_part || (integral_part == rhs.integral_part && fractional_part < rhs.fractional_part);
+  }
+  bool operator>(Fixed64 const& rhs) const { return rhs < *this; }
+  bool operator<=(Fixed64 const& rhs) const { return !(rhs < *this); }
+  bool operator>=(Fixed64 const& rhs) const { return !(*this < rhs); }
+
+  bool isNegative() const { return integral_part < 0; }
+  bool isZero() const { return integral_part == 0 && fractional_part == 0; }
+  Fixed64 abs() const { return isNegative() ? -*this : *this; }
+
+  // Multiply by 2^shift, truncating towards zero
+  Fixed64 scaleBy2(int shift) const {
+    if (shift == 0) { return *this; }
+    Fixed64 const a = abs();
+    uint64_t hi = (uint64_t)a.integral_part, lo = a.fractional_part;
+    if (shift > 0) {
+      assert(shift < 64);
+      hi = (hi << shift) | (lo >> (64 - shift));
+      lo <<= shift;
+    } else {
+      int const s = -shift;
+      if (s >= 128) { hi = 0; lo = 0; }
+      else if (s >= 64) { lo = hi >> (s - 64); hi = 0; }
+      else { lo = (lo >> s) | (hi << (64 - s)); hi >>= s; }
+    }
+    Fixed64 const r((int64_t)hi, lo);
+    return isNegative() ? -r : r;
+  }
+
+  // Digit by digit square root, so there's no dependence on the FPU. Truncated; negative values give 0.
+  static Fixed64 sqrt(Fixed64 v) {
+    assert(!v.isNegative());
+    if (v.isNegative() || v.isZero()) { return Fixed64(); }
+
+    // sqrt(x / 2^64) * 2^64 = sqrt(x * 2^64), so take the integer sqrt of the 192 bit (raw << 64).
+    // The result is at most 96 bits and the remainder at most 97 bits.
+    uint64_t const num[3] = { (uint64_t)v.integral_part, v.fractional_part, 0 };
+    uint64_t root_hi = 0, root_lo = 0;
+    uint64_t rem_hi = 0, rem_lo = 0;
+    for (int pair = 95; pair >= 0; --pair) {
+      int const bit = 2 * pair;
+      uint64_t const in = (num[2 - bit / 64] >> (bit % 64)) & 3;
+      // rem = (rem << 2) | in
+      rem_hi = (rem_hi << 2) | (rem_lo >> 62);
+      rem_lo = (rem_lo << 2) | in;
+      // trial = (root << 2) | 1
+      uint64_t const trial_hi = (root_hi << 2) | (root_lo >> 62);
+      uint64_t const trial_lo = (root_lo << 2) | 1;
+      // root <<= 1
+      root_hi = (root_hi << 1) | (root_lo >> 63);
+      root_lo <<= 1;
+      if (rem_hi > trial_hi || (rem_hi == trial_hi && rem_lo >= trial_lo)) {
+        uint64_t const borrow = rem_lo < trial_lo;
+        rem_lo -= trial_lo;
+        rem_hi -= trial_hi + borrow;
+        root_lo |= 1;
+      }
+    }
+    return Fixed64((int64_t)root_hi, root_lo);
+  }
+
+  // Sine and cosine of an angle given in turns (1 = full circle). Only the fraction matters, so
+  // there's no range reduction error however big the angle gets.
+  static void sinCosTurns(Fixed64 turns, Fixed64* o_sin, Fixed64* o_cos) {
+    uint64_t const frac = turns.fractional_part;
+    int const quadrant = (int)(frac >> 62);
+    // Angle within the quadrant, in radians in [0, tau/4)
+    Fixed64 const x = Fixed64(0, frac << 2) * tauOver4();
+
+    // Taylor series; by x^27/27! the terms are below the precision
+    Fixed64 const x2 = x * x;
+    Fixed64 s = x;
+    Fixed64 c = fromInt(1);
+    Fixed64 term_s = x;
+    Fixed64 term_c = fromInt(1);
+    for (int n = 1; n <= 13; ++n) {
+      term_s = -(term_s * x2).divInt((2 * n) * (2 * n + 1));
+      term_c = -(term_c * x2).divInt((2 * n - 1) * (2 * n));
+      s += term_s;
+      c += term_c;
+    }
+
+    switch (quadrant) {
+      case 0: *o_sin =  s; *o_cos =  c; break;
+      case 1: *o_sin =  c; *o_cos = -s; break;
+      case 2: *o_sin = -s; *o_cos = -c; break;
+      default: *o_sin = -c; *o_cos =  s; break;
+    }
+  }
+
+  static void sinCos(Fixed64 radians, Fixed64* o_sin, Fixed64* o_cos) {
+    sinCosTurns(radians * invTau(), o_sin, o_cos);
+  }
+
+  // Truncated to 64 fraction bits; not derived from the double constants
+  static Fixed64 tauOver4() { return Fixed64(1, 0x921FB54442D18469ULL); } // pi/2
+  static Fixed64 invTau() { return Fixed64(0, 0x28BE60DB9391054AULL); } // 1/(2 pi)
 
 private:
    int64_t integral_part;
   uint64_t fractional_part;
 };
 
-void assert_equal(char const* msg, double t, double u) {
+inline void assert_equal(char const* msg, double t, double u) {
   if (t != u) {
     printf("Assertion failed: %s: saw values %e and %e (difference: %e).\n", msg, t, u, t-u);
     assert(false);
@@ -146,7 +362,57 @@ inline void run_tests() {
   ASSERT_EQ(Fixed64::toDouble(Fixed64::fromDouble(2.625) - Fixed64::fromDouble(2.625)), 0.0);
   ASSERT_EQ(Fixed64::toDouble(Fixed64::fromDouble(2.625) + Fixed64::fromDouble(2.625)), 5.25);
 
-  // TODO tests for large integers
+  // Large integers
+  ASSERT_EQ(Fixed64::toDouble(Fixed64::fromDouble(4e12) + Fixed64::fromDouble(4e12)), 8e12);
+  ASSERT_EQ(Fixed64::toDouble(Fixed64::fromDouble(-4e12) - Fixed64::fromDouble(4e12)), -8e12);
+
+  // Multiplication
+  ASSERT_EQ(Fixed64::toDouble(Fixed64::fromDouble(2.0) * Fixed64::fromDouble(3.0)), 6.0);
+  ASSERT_EQ(Fixed64::toDouble(Fixed64::fromDouble(-2.0) * Fixed64::fromDouble(3.0)), -6.0);
+  ASSERT_EQ(Fixed64::toDouble(Fixed64::fromDouble(-0.5) * Fixed64::fromDouble(-0.25)), 0.125);
+  ASSERT_EQ(Fixed64::toDouble(Fixed64::fromDouble(1.5) * Fixed64::fromDouble(-2.625)), -3.9375);
+  ASSERT_EQ(Fixed64::toDouble(Fixed64::fromDouble(1e6) * Fixed64::fromDouble(1e6)), 1e12);
+  ASSERT_EQ(Fixed64::toDouble(Fixed64::fromDouble(1e-6) * Fixed64::fromDouble(0.0)), 0.0);
+
+  // Division
+  ASSERT_EQ(Fixed64::toDouble(Fixed64::fromDouble(6.0) / Fixed64::fromDouble(3.0)), 2.0);
+  ASSERT_EQ(Fixed64::toDouble(Fixed64::fromDouble(1.0) / Fixed64::fromDouble(-4.0)), -0.25);
+  ASSERT_EQ(Fixed64::toDouble(Fixed64::fromDouble(-3.9375) / Fixed64::fromDouble(1.5)), -2.625);
+  ASSERT_EQ(Fixed64::toDouble(Fixed64::fromDouble(1e12) / Fixed64::fromDouble(1e-3)), 1e15);
+  ASSERT_EQ(Fixed64::toDouble(Fixed64::fromDouble(-7.5).divInt(3)), -2.5);
+  ASSERT_EQ(Fixed64::toDouble((Fixed64::fromDouble(1.0) / Fixed64::fromDouble(3.0)) * Fixed64::fromDouble(3.0)), 1.0);
+
+  // Square root
+  ASSERT_EQ(Fixed64::toDouble(Fixed64::sqrt(Fixed64::fromDouble(0.0))), 0.0);
+  ASSERT_EQ(Fixed64::toDouble(Fixed64::sqrt(Fixed64::fromDouble(4.0))), 2.0);
+  ASSERT_EQ(Fixed64::toDouble(Fixed64::sqrt(Fixed64::fromDouble(0.25))), 0.5);
+  ASSERT_EQ(Fixed64::toDouble(Fixed64::sqrt(Fixed64::fromDouble(1e18))), 1e9);
+  assert(fabs(Fixed64::toDouble(Fixed64::sqrt(Fixed64::fromDouble(2.0))) - sqrt(2.0)) < 1e-15);
+
+  // Comparison
+  assert(Fixed64::fromDouble(-0.5) < Fixed64::fromDouble(0.25));
+  assert(Fixed64::fromDouble(-1.5) < Fixed64::fromDouble(-1.25));
+  assert(Fixed64::fromDouble(3.0) > Fixed64::fromDouble(2.75));
+  assert(Fixed64::fromDouble(2.0) == Fixed64::fromInt(2));
+
+  // Trig, to double precision
+  {
+    Fixed64 s, c;
+    Fixed64::sinCosTurns(Fixed64::fromDouble(0.0), &s, &c);
+    ASSERT_EQ(Fixed64::toDouble(s), 0.0);
+    ASSERT_EQ(Fixed64::toDouble(c), 1.0);
+    Fixed64::sinCosTurns(Fixed64::fromDouble(0.5), &s, &c);
+    ASSERT_EQ(Fixed64::toDouble(s), 0.0);
+    ASSERT_EQ(Fixed64::toDouble(c), -1.0);
+    Fixed64::sinCosTurns(Fixed64::fromDouble(-0.25), &s, &c);
+    ASSERT_EQ(Fixed64::toDouble(s), -1.0);
+    Fixed64::sinCos(Fixed64::fromDouble(1.0), &s, &c);
+    assert(fabs(Fixed64::toDouble(s) - sin(1.0)) < 1e-15);
+    assert(fabs(Fixed64::toDouble(c) - cos(1.0)) < 1e-15);
+    Fixed64::sinCos(Fixed64::fromDouble(-1000.0), &s, &c);
+    assert(fabs(Fixed64::toDouble(s) - sin(-1000.0)) < 1e-13);
+    assert(fabs(Fixed64::toDouble(c) - cos(-1000.0)) < 1e-13);
+  }
 
   printf("All tests passed.\n");
 }
@@ -39,6 +39,10 @@
 #include "orPhysics.h"
 #include "orCamera.h"
 #include "orEntity.h"
+#include "orTransfer.h"
+#include "orConjunction.h"
+#include "orTask/task.h"
+#include "orProfile/gpuTimer.h"
 
 // TODO forward decl for SDL_GLContext?
 
@@ -57,6 +61,9 @@ public:
     int windowHeight;
     int renderWidth;
     int renderHeight;
+
+    int traceFrames; // Capture a trace of this many frames from the start, if not 0
+    char const* tracePath;
   };
 
   // TODO Eigen::Vectors are SSE magic. Want those and also some plain old data types.
@@ -76,23 +83,33 @@ private:
     void ShutdownState();
     void ShutdownRender();
 
+  // Runs the steps below as a task graph; see there for what can overlap
   void RunOneStep();
 
-  void PollEvents();
+  void PollEvents(orTask::ThreadIdx _threadIdx);
     void HandleEvent(SDL_Event const& _event);
 
-  void HandleInput();
+  void HandleInput(orTask::ThreadIdx _threadIdx);
+
+  void ApplyCommands(orTask::ThreadIdx _threadIdx);
 
-  void UpdateState();
+  void UpdateState_Physics(orTask::ThreadIdx _threadIdx);
     void UpdateState_Bodies(double const dt);
-    void UpdateState_CamTargets(double const dt);
-    void UpdateState_RenderObjects(double const dt);
+  void UpdateState_CamTargets(orTask::ThreadIdx _threadIdx);
+  void UpdateState_Camera(orTask::ThreadIdx _threadIdx);
+  void UpdateState_RenderObjects(orTask::ThreadIdx _threadIdx);
+  void UpdateState_Highlight(orTask::ThreadIdx _threadIdx);
+  void UpdateState_Conjunctions(orTask::ThreadIdx _threadIdx);
+  void UpdateState_DebugText(orTask::ThreadIdx _threadIdx);
 
-  void RenderState();
+  // Copies what the renderer needs out of the systems
+  void PublishState(orTask::ThreadIdx _threadIdx);
+
+  void RenderState(orTask::ThreadIdx _threadIdx);
 
 private:
   // TODO change all methods to start with lowercase
-  Vector3d CalcPlayerThrust(PhysicsSystem::ParticleBody const& playerBody);
+  Vector3d CalcPlayerThrust(orbital::Id<PhysicsSystem::ParticleBody> playerBodyId);
   orbital::Id<EntitySystem::Body> spawnBody(
     std::string const& name,
     double const radius,
@@ -110,6 +127,19 @@ private:
 
   void updateOrbitHighlight();
 
+  template <void (orApp::*STEP)(orTask::ThreadIdx)>
+  static void runStep(orTask::ThreadIdx _threadIdx, void* _app) { (static_cast<orApp*>(_app)->*STEP)(_threadIdx); }
+
+  template <void (orApp::*STEP)(orTask::ThreadIdx)>
+  orTask::WorkItem stepWork() { return orTask::WorkItem(&runStep<STEP>, this); }
+
+  void requestTransferSearch(orbital::Id<EntitySystem::Body> departBodyId, orbital::Id<EntitySystem::Body> arriveBodyId);
+  void spawnFleet(orbital::Id<EntitySystem::Body> parentBodyId, int count);
+
+  // Only at the sync point in ApplyCommands
+  bool saveSnapshot(char const* path) const;
+  bool loadSnapshot(char const* path);
+
 private:
   // TODO finish implementing title screen, etc
   enum AppScreen { Screen_Title, Screen_Level } m_appScreen;
@@ -125,10 +155,13 @@ private:
   } m_mainLevel;
 
   Timer::PerfTime m_lastFrameDuration;
+  double m_frameDt; // Sim seconds this frame; set before the frame's tasks start
   bool m_running;
 
   Rnd64 m_rnd;
 
+  orTask::TaskScheduler* m_taskScheduler;
+
   double m_simTime;
 
   Config m_config;
@@ -136,6 +169,12 @@ private:
   // Simulation options
   bool m_paused;
   bool m_singleStep;
+  bool m_showSchedulerStats; // In the debug text
+  bool m_showArenaStats; // In the debug text
+
+  // Set by input, done at the next sync point
+  bool m_saveRequested;
+  bool m_loadRequested;
 
   //// Camera ////
 
@@ -178,6 +217,8 @@ private:
   // TODO make into an id-handle thing
   RenderSystem::FrameBuffer m_frameBuffer;
 
+  GpuTimers m_gpuTimers;
+
   // Rendering options
   bool m_wireframe;
 
@@ -188,6 +229,11 @@ private:
   double m_timeScale;
   PhysicsSystem::IntegrationMethod m_integrationMethod;
 
+  //// Structural changes ////
+
+  // Makes and removes recorded during a frame, applied together at the top of the next update
+  orbital::CommandBuffer m_commandBuffer;
+
   //// Entities ////
 
   EntitySystem m_entitySystem;
@@ -209,6 +255,15 @@ private:
   orbital::Id<EntitySystem::Body> m_uranusBodyId;
   orbital::Id<EntitySystem::Body> m_plutoBodyId;
 
+  //// Transfer planning ////
+
+  TransferPlanner* m_transferPlanner;
+  TransferPlanner::Search const* m_transferSearch;
+
+  //// Conjunction screening ////
+
+  ConjunctionScreener* m_conjunctionScreener;
+
 #if 0
   int m_comPoiId;
   int m_lagrangePoiIds[5];
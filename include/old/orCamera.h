@@ -26,7 +26,15 @@ public:
 
   DECLARE_SYSTEM_TYPE(Target, Targets);
 
+  void save(orbital::SnapshotWriter& _writer) const;
+  bool check(orbital::SnapshotReader const& _reader) const; // Whether load() would succeed
+  bool load(orbital::SnapshotReader const& _reader);
+
   Eigen::Matrix4d calcScreenMatrix( int width, int height ) const;
   Eigen::Matrix4d calcProjMatrix( orbital::Id<Camera> cameraId, int width, int height, double minZ, double maxZ, double aspect ) const;
   Eigen::Matrix4d calcCameraMatrix( orbital::Id<Camera> cameraId, orbital::Id<Target> targetId, Vector3d up ) const;
-}; // class CameraSystem
\ No newline at end of file
+}; // class CameraSystem
+
+// Targets have names, so can't be saved as bytes
+void snapshotWriteObjects(orbital::SnapshotWriter& _writer, CameraSystem::Target const* _targets, uint32_t _count);
+bool snapshotReadObjects(orbital::SnapshotReader::Cursor& _cursor, CameraSystem::Target* o_targets, uint32_t _count);
\ No newline at end of file
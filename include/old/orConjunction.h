@@ -0,0 +1,131 @@
+#pragma once
+
+#include "orStd.h"
+#include "orMath.h"
+
+#include "orPhysics.h"
+
+#include "orTask/taskScheduler.h"
+
+#include <vector>
+
+// Close approach ("conjunction") screening between particle bodies over a prediction horizon.
+//
+// Each body is predicted forwards on its osculating conic around its current SOI parent, sampled at
+// numIntervals+1 evenly spaced times. Intervals need to be short compared to the orbital periods
+// involved or the bounding boxes get big and we stop pruning much. For each interval we build a bounding box around each body's path
+// and sweep-and-prune the boxes to find candidate pairs, then root-find the time of closest approach
+// (zero of d/dt |dr|^2) for each candidate against the exact conic propagation. This avoids the
+// O(N^2 T) all-pairs check.
+//
+// Screening runs in the background on the task scheduler; the main thread only takes a snapshot of
+// the body states when a run starts, so this never holds up a frame. Results from the last completed
+// run stay available while the next one is running.
+//
+// TODO predictions ignore user thrust; should include planned maneuvers once we have nodes
+// TODO bodies that change SOI during the horizon are predicted on the wrong conic after the change
+class ConjunctionScreener {
+public:
+  struct Params {
+    Params() : m_horizon(6 * 60 * 60), m_numIntervals(256), m_threshold(10e3) {}
+
+    double m_horizon; // seconds
+    int m_numIntervals;
+    double m_threshold; // meters; report approaches closer than this
+  };
+
+  struct Event {
+    orbital::Id<PhysicsSystem::ParticleBody> m_bodyA;
+    orbital::Id<PhysicsSystem::ParticleBody> m_bodyB;
+    double m_time; // sim time of closest approach
+    double m_missDistance; // meters
+  };
+
+  ConjunctionScreener(orTask::TaskScheduler& _scheduler, PhysicsSystem const& _physicsSystem);
+  ~ConjunctionScreener();
+
+  // Snapshots the given bodies and starts screening in the background. Must not already be running.
+  void start(int _threadIdx, double _simTime, Params const& _params, std::vector< orbital::Id<PhysicsSystem::ParticleBody> > const& _bodyIds);
+
+  bool isRunning() const;
+
+  // Call once a frame; picks up the results of a finished run. Returns true if there are new results.
+  bool poll();
+
+  // Events from the last completed run, sorted by time.
+  std::vector<Event> const& getEvents() const { return m_events; }
+
+private:
+  enum Phase {
+    Phase_Parents, // Sample SOI parent trajectories
+    Phase_Intervals, // Sample body trajectories, prune and refine
+    Phase_Count
+  };
+
+  // Each interval job samples every body at the interval boundaries itself, rather than storing samples
+  // for the whole horizon up front; N * T samples gets too big with lots of ships.
+  enum {
+    INTERVALS_PER_JOB = 8
+  };
+
+  struct Job {
+    ConjunctionScreener* m_screener;
+    Phase m_phase;
+    int m_begin;
+    int m_end;
+    std::vector<Event> m_events; // Output of Phase_Intervals
+  };
+
+  struct Parent {
+    orbital::Id<PhysicsSystem::GravBody> m_gravBodyId;
+    double m_mu;
+    std::vector<orEphemerisJPL> m_chain; // Ephemerides from this body up to the root; sum of these is the position
+  };
+
+  struct BodyState {
+    orbital::Id<PhysicsSystem::ParticleBody> m_id;
+    int m_parentIdx;
+    orEphemerisCartesian m_cart; // At start time, relative to the SOI parent
+  };
+
+  struct Box {
+    double m_min[3];
+    double m_max[3];
+  };
+
+  void startPhase(int _threadIdx, Phase _phase);
+  void finishPhase(int _threadIdx);
+  static void runJob(orTask::ThreadIdx _threadIdx, void* _userData);
+
+  void sampleParents(int _begin, int _end);
+  void screenIntervals(int _begin, int _end, std::vector<Event>& o_events) const;
+  void mergeEvents();
+
+  double sampleTime(int _k) const { return m_startTime + m_params.m_horizon * _k / m_params.m_numIntervals; }
+  void calcParentCartesian(int _parentIdx, double _t, orEphemerisCartesian& o_cart) const;
+  void calcRelativeState(int _bodyA, int _bodyB, double _t, Vector3d& o_dr, Vector3d& o_dv) const;
+  bool refinePair(int _bodyA, int _bodyB, int _k, Event& o_event) const;
+
+  orTask::TaskScheduler& m_scheduler;
+  PhysicsSystem const& m_physicsSystem;
+
+  // Snapshot for the current run
+  double m_startTime;
+  Params m_params;
+  std::vector<Parent> m_parents;
+  std::vector<BodyState> m_bodies;
+
+  // Parent trajectory samples, [idx * (numIntervals + 1) + k]
+  std::vector<orEphemerisCartesian> m_parentSamples;
+
+  std::vector<Job> m_jobs;
+  Phase m_phase;
+  int m_pendingJobs;
+  int m_running;
+  int m_complete;
+
+  std::vector<Event> m_workEvents;
+  std::vector<Event> m_events;
+
+  orTask::TaskGroup m_group;
+};
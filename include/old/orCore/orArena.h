@@ -0,0 +1,174 @@
+#pragma once
+
+#include "orStd.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include <vector>
+
+namespace orbital {
+
+// Linear allocator: allocating bumps a pointer, and everything is freed at once by reset(), or back
+// to a mark by rewind(). Nothing is destructed, so only put things in it that don't need it.
+//
+// Address space is reserved up front and committed a chunk at a time as it's used, like
+// PagedIdArray, so a mostly unused arena costs next to nothing. Committed memory is kept over resets.
+// Running out of reservation is an error in debug; in release, further allocations come from the
+// heap until the next reset rather than failing.
+//
+// Not thread safe; see FrameArenas for one per thread.
+class Arena {
+public:
+  explicit Arena(size_t _reserveBytes);
+  ~Arena();
+
+  // Alignment is at least 16 whatever's asked for, so Eigen fixed size types can go in it too
+  void* alloc(size_t _size, size_t _align);
+
+  // Uninitialised
+  template <typename T>
+  T* allocArray(size_t const _count) { return static_cast<T*>(alloc(_count * sizeof(T), alignof(T))); }
+
+  // Copy of a NUL terminated string
+  char const* copyString(char const* const _str) {
+    size_t const size = strlen(_str) + 1;
+    return static_cast<char const*>(memcpy(alloc(size, 1), _str, size));
+  }
+
+  size_t mark() const { return m_used; }
+  // Frees everything allocated since the mark. Anything from the heap stays until reset().
+  void rewind(size_t const _mark) { ensure(_mark <= m_used); m_used = _mark; }
+  void reset();
+
+  size_t used() const { return m_used + m_overflowBytes; }
+  size_t peak() const { return m_peak; } // Most used() since the last reset(); can be set back for measuring
+  void setPeak(size_t const _peak) { m_peak = _peak; }
+
+  // Rewinds to where it was on construction, when it goes out of scope: for temporaries in a function.
+  // Don't wait for a task group inside one: the thread runs other tasks meanwhile, and whatever they
+  // allocate and keep would be rewound over.
+  class Scope {
+  public:
+    explicit Scope(Arena& _arena) : m_arena(_arena), m_mark(_arena.mark()) {}
+    ~Scope() { m_arena.rewind(m_mark); }
+  private:
+    Scope(Scope const&);
+    Scope& operator=(Scope const&);
+    Arena& m_arena;
+    size_t m_mark;
+  };
+
+private:
+  Arena(Arena const&);
+  Arena& operator=(Arena const&);
+
+  void* allocOverflow(size_t _size, size_t _align);
+
+  char* m_base;
+  size_t m_reserved;
+  size_t m_committed;
+  size_t m_used;
+  size_t m_peak;
+
+  std::vector<void*> m_overflow; // Heap blocks, freed on reset()
+  size_t m_overflowBytes;
+};
+
+// Which system memory from the frame arenas is counted against; see FrameArenaScope
+enum ArenaSystem {
+  ArenaSystem_Physics,
+  ArenaSystem_Render,
+  ArenaSystem_Tasks,
+  ArenaSystem_Count
+};
+
+enum ArenaLifetime {
+  ArenaLifetime_Frame, // Freed at the end of the frame
+  ArenaLifetime_TwoFrames // Freed at the end of the next frame; for what the renderer draws while the next frame updates
+};
+
+// An arena per thread for short lived memory, freed every frame, so the frame loop doesn't have to
+// go through malloc.
+//
+// Only for memory that's done with by the end of the frame's tasks (or the next frame's, for
+// ArenaLifetime_TwoFrames). Not for anything background jobs (e.g. transfer searches) use: those
+// run across frames, and EndFrame() could free their memory from under them.
+class FrameArenas {
+public:
+  // The calling thread's; made on first use
+  static Arena& Get(ArenaLifetime _lifetime = ArenaLifetime_Frame);
+
+  // Call at the sync point between frames, when no frame tasks are running. Frees this frame's memory
+  // (and the last frame's two frame memory) on every thread, and updates the stats.
+  static void EndFrame();
+
+  // Frees every thread's arenas; only once nothing uses them any more
+  static void StaticShutdown();
+
+  // Bytes, summed over threads, of each system's peak use during FrameArenaScopes
+  struct Stats {
+    size_t frameBytes[ArenaSystem_Count]; // Last frame
+    size_t peakBytes[ArenaSystem_Count]; // Any frame so far
+    size_t totalPeakBytes; // Whole arenas, in scopes or not; any frame so far
+  };
+  static Stats const& GetStats();
+
+  static char const* SystemName(ArenaSystem _system);
+
+  struct ThreadArenas; // A thread's arenas and stats
+
+private:
+  friend class FrameArenaScope;
+  static ThreadArenas& GetThreadArenas();
+};
+
+// Counts the peak use of the calling thread's frame arenas while it's in scope against a system.
+// Scopes nest; an outer one's peak includes the inner ones', so only the innermost counts are
+// exclusive. Tasks run while a thread waits inside a scope count towards it too.
+class FrameArenaScope {
+public:
+  explicit FrameArenaScope(ArenaSystem _system);
+  ~FrameArenaScope();
+
+private:
+  FrameArenaScope(FrameArenaScope const&);
+  FrameArenaScope& operator=(FrameArenaScope const&);
+
+  ArenaSystem m_system;
+  FrameArenas::ThreadArenas& m_arenas;
+  size_t m_startUsed[2]; // Frame, two frame
+  size_t m_outerPeak[2];
+};
+
+// STL allocator on an arena. Deallocating does nothing; the memory goes when the arena is reset.
+// Defaults to the calling thread's frame arena, so e.g. FrameVector<int> v; just works. A container
+// must only allocate on the thread that owns its arena.
+template <typename T>
+class ArenaAllocator {
+public:
+  typedef T value_type;
+
+  ArenaAllocator() : m_arena(&FrameArenas::Get()) {}
+  explicit ArenaAllocator(Arena& _arena) : m_arena(&_arena) {}
+  template <typename U>
+  ArenaAllocator(ArenaAllocator<U> const& _other) : m_arena(_other.arena()) {}
+
+  T* allocate(size_t const _count) { return m_arena->allocArray<T>(_count); }
+  void deallocate(T*, size_t) {}
+
+  Arena* arena() const { return m_arena; }
+
+  template <typename U>
+  bool operator==(ArenaAllocator<U> const& _other) const { return m_arena == _other.arena(); }
+  template <typename U>
+  bool operator!=(ArenaAllocator<U> const& _other) const { return m_arena != _other.arena(); }
+
+private:
+  Arena* m_arena;
+};
+
+template <typename T>
+using FrameVector = std::vector< T, ArenaAllocator<T> >;
+
+} // namespace orbital
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "orStd.h"
+#include "orCore/orSystem.h"
+
+#include <vector>
+
+namespace orbital {
+
+// Structural changes (makes and removes) recorded during an update and applied together at a sync point.
+//
+// Making or removing objects directly moves things around in the dense arrays, which invalidates references
+// and breaks loops over the objects. Recording them here instead means everything stays put until apply(),
+// and each array gets its changes as one batch: one compaction pass for all the removes, rather than a
+// move-last per remove.
+//
+// make() hands back the new Id straight away, so it can be stored in other objects being made in the same
+// batch; the object itself appears (has() is true, get works) after apply(). Objects are made before any
+// are removed, so removing an object made in the same batch works.
+//
+// Systems with storage other than a plain PagedIdArray (e.g. PhysicsSystem's particle tables) add their
+// own Queue type and get it with getQueue().
+class CommandBuffer {
+public:
+  CommandBuffer() {}
+  ~CommandBuffer() {
+    for (size_t i = 0; i < m_queues.size(); ++i) {
+      delete m_queues[i].queue;
+    }
+  }
+
+  CommandBuffer(CommandBuffer const&) = delete;
+  CommandBuffer& operator=(CommandBuffer const&) = delete;
+
+  struct Queue {
+    virtual ~Queue() {}
+    virtual void applyMakes() = 0;
+    virtual void applyRemoves() = 0;
+    virtual bool empty() const = 0;
+  };
+
+  template<typename T, uint32_t MAX_OBJECTS>
+  Id<T> make(PagedIdArray<T, MAX_OBJECTS>& _array, T const& _init) {
+    return getQueue< IdArrayQueue<T, MAX_OBJECTS> >(&_array, _array).make(_init);
+  }
+
+  template<typename T, uint32_t MAX_OBJECTS>
+  void remove(PagedIdArray<T, MAX_OBJECTS>& _array, Id<T> _id) {
+    getQueue< IdArrayQueue<T, MAX_OBJECTS> >(&_array, _array).remove(_id);
+  }
+
+  // Finds the queue for _key (usually the storage it changes), or makes one with Q(_arg) on first use.
+  // Queues are applied in the order they were first used.
+  template<typename Q, typename A>
+  Q& getQueue(void const* _key, A& _arg) {
+    for (size_t i = 0; i < m_queues.size(); ++i) {
+      if (m_queues[i].key == _key) { return *static_cast<Q*>(m_queues[i].queue); }
+    }
+    Q* const queue = new Q(_arg);
+    QueueEntry const entry = { _key, queue };
+    m_queues.push_back(entry);
+    return *queue;
+  }
+
+  bool empty() const {
+    for (size_t i = 0; i < m_queues.size(); ++i) {
+      if (!m_queues[i].queue->empty()) { return false; }
+    }
+    return true;
+  }
+
+  // The sync point: nothing may be holding references or iterating over any of the arrays.
+  // Queues are kept (emptied) for the next frame, so their buffers don't get reallocated every frame.
+  void apply() {
+    for (size_t i = 0; i < m_queues.size(); ++i) {
+      m_queues[i].queue->applyMakes();
+    }
+    for (size_t i = 0; i < m_queues.size(); ++i) {
+      m_queues[i].queue->applyRemoves();
+    }
+  }
+
+private:
+  template<typename T, uint32_t MAX_OBJECTS>
+  struct IdArrayQueue : public Queue {
+    explicit IdArrayQueue(PagedIdArray<T, MAX_OBJECTS>& _array) : m_array(_array) {}
+
+    Id<T> make(T const& _init) {
+      Id<T> const id = id_array::reserve_id(m_array);
+      m_makes.push_back(id);
+      m_makeInits.push_back(_init);
+      return id;
+    }
+
+    void remove(Id<T> _id) { m_removes.push_back(_id); }
+
+    virtual void applyMakes() {
+      if (m_makes.empty()) { return; }
+      uint32_t const first = id_array::num_objects(m_array);
+      id_array::add_reserved(m_array, m_makes.data(), (uint32_t)m_makes.size());
+      T* const objects = id_array::objects(m_array);
+      for (size_t i = 0; i < m_makeInits.size(); ++i) {
+        objects[first + i] = m_makeInits[i];
+      }
+      m_makes.clear();
+      m_makeInits.clear();
+    }
+
+    virtual void applyRemoves() {
+      if (m_removes.empty()) { return; }
+      id_array::remove_batch(m_array, m_removes.data(), (uint32_t)m_removes.size(), m_keep);
+      m_removes.clear();
+    }
+
+    virtual bool empty() const { return m_makes.empty() && m_removes.empty(); }
+
+    PagedIdArray<T, MAX_OBJECTS>& m_array;
+    std::vector< Id<T> > m_makes;
+    std::vector<T> m_makeInits;
+    std::vector< Id<T> > m_removes;
+    std::vector<uint8_t> m_keep;
+  };
+
+  struct QueueEntry {
+    void const* key;
+    Queue* queue;
+  };
+  std::vector<QueueEntry> m_queues;
+};
+
+} // namespace orbital
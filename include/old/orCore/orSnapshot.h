@@ -0,0 +1,295 @@
+#pragma once
+
+#include "orStd.h"
+#include "orCore/orSystem.h"
+#include "orPlatform/file.h"
+#include "ortable/ortable.h"
+
+#include <string.h>
+
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace orbital {
+
+// Binary save files.
+//
+// A snapshot is a header and then blocks, usually one per system, each with a tag, a version and a
+// checksum of its contents. Inside a block everything is a sequence of items, each padded to 8
+// bytes: small values, strings, and bulk arrays. Bulk arrays (the dense objects, sparse indices and
+// generations of each id array, the lanes of each table) are never copied or converted on save;
+// they're written straight from where they live with one gathered write. On load the file is mapped
+// and the arrays are memcpy'd straight back, so both are about as fast as the disk.
+//
+// Saved arrays only load into the same build: objects are raw bytes, so a change to any saved struct
+// needs its block's version bumping. Objects that aren't trivially copyable (ones with strings) are
+// written with snapshotWriteObjects() / snapshotReadObjects() overloads from their system instead.
+//
+// Only save at a sync point: nothing may change the arrays until save() returns, and there mustn't
+// be any deferred makes pending.
+//
+// Loading overwrites a system's arrays as it goes, so a snapshot that fails partway would leave the
+// systems inconsistent. Every read has a check that walks the same items without changing anything;
+// check every system's block first, and then loading can't fail.
+inline constexpr uint32_t snapshotTag(char const a, char const b, char const c, char const d) {
+  return (uint32_t)(uint8_t)a | ((uint32_t)(uint8_t)b << 8) | ((uint32_t)(uint8_t)c << 16) | ((uint32_t)(uint8_t)d << 24);
+}
+
+// Checksum of _size bytes, as if followed by zeroes up to a multiple of 8. Not cryptographic, just
+// catches truncated or damaged files; a word at a time, so it keeps up with the disk.
+uint64_t snapshotChecksum(void const* _data, size_t _size, uint64_t _checksum);
+
+class SnapshotWriter {
+public:
+  SnapshotWriter();
+
+  // Everything written until the next beginBlock() goes in this block
+  void beginBlock(uint32_t _tag, uint32_t _version);
+
+  // Copied into the snapshot; for small things
+  void write(void const* _data, size_t _size);
+  template <typename T>
+  void writeValue(T const& _value) {
+    static_assert(std::is_trivially_copyable<T>::value, "Only plain data can be saved as bytes");
+    write(&_value, sizeof(T));
+  }
+  void writeString(std::string const& _str);
+
+  // Not copied: _data must stay put and unchanged until save() returns
+  void writeBulk(void const* _data, size_t _size);
+
+  bool save(char const* _path);
+
+private:
+  SnapshotWriter(SnapshotWriter const&) = delete;
+  SnapshotWriter& operator=(SnapshotWriter const&) = delete;
+
+  void addPiece(bool _owned, void const* _data, size_t _size);
+  void pad(size_t _size);
+
+  struct Piece {
+    bool owned; // If so, offset is into m_buffer, which can move while we're writing
+    size_t offset;
+    void const* data;
+    size_t size;
+  };
+
+  struct Block {
+    size_t headerPiece;
+    size_t firstPiece;
+  };
+
+  std::vector<uint8_t> m_buffer;
+  std::vector<Piece> m_pieces;
+  std::vector<Block> m_blocks;
+};
+
+class SnapshotReader {
+public:
+  SnapshotReader();
+  ~SnapshotReader();
+
+  // Maps the file, and checks the header and every block's checksum.
+  bool open(char const* _path);
+
+  // Reads the items of one block, in the order they were written. Reading past the end of the
+  // block, or a string or array that runs past it, just sets ok to false.
+  class Cursor {
+  public:
+    Cursor() : m_pos(NULL), m_end(NULL), m_ok(false) {}
+    Cursor(uint8_t const* _begin, uint8_t const* _end) : m_pos(_begin), m_end(_end), m_ok(true) {}
+
+    bool ok() const { return m_ok; }
+
+    bool read(void* _data, size_t _size) {
+      void const* const p = readBulk(_size);
+      if (p) { memcpy(_data, p, _size); }
+      return p != NULL;
+    }
+    template <typename T>
+    bool readValue(T* o_value) {
+      static_assert(std::is_trivially_copyable<T>::value, "Only plain data can be loaded as bytes");
+      return read(o_value, sizeof(T));
+    }
+    bool readString(std::string* o_str);
+
+    // Points into the mapped file; valid as long as the reader. NULL (and ok() false) if there isn't
+    // that much left.
+    void const* readBulk(size_t _size);
+
+  private:
+    uint8_t const* m_pos;
+    uint8_t const* m_end;
+    bool m_ok;
+  };
+
+  // False if there's no such block
+  bool findBlock(uint32_t _tag, uint32_t* o_version, Cursor* o_cursor) const;
+
+private:
+  SnapshotReader(SnapshotReader const&) = delete;
+  SnapshotReader& operator=(SnapshotReader const&) = delete;
+
+  struct BlockInfo {
+    uint32_t tag;
+    uint32_t version;
+    uint8_t const* begin;
+    uint8_t const* end;
+  };
+
+  orPlatform::MappedFile m_file;
+  std::vector<BlockInfo> m_blocks;
+};
+
+// Id arrays
+
+namespace snapshot_detail {
+
+  template <typename T>
+  inline void writeObjects(SnapshotWriter& _writer, T const* const _objects, uint32_t const _count, std::true_type /*trivial*/) {
+    _writer.writeBulk(_objects, _count * sizeof(T));
+  }
+
+  template <typename T>
+  inline void writeObjects(SnapshotWriter& _writer, T const* const _objects, uint32_t const _count, std::false_type /*trivial*/) {
+    snapshotWriteObjects(_writer, _objects, _count);
+  }
+
+  template <typename T>
+  inline bool readObjects(SnapshotReader::Cursor& _cursor, T* const o_objects, uint32_t const _count, std::true_type /*trivial*/) {
+    return _cursor.read(o_objects, _count * sizeof(T));
+  }
+
+  template <typename T>
+  inline bool readObjects(SnapshotReader::Cursor& _cursor, T* const o_objects, uint32_t const _count, std::false_type /*trivial*/) {
+    return snapshotReadObjects(_cursor, o_objects, _count);
+  }
+
+  template <typename T>
+  inline bool checkObjects(SnapshotReader::Cursor& _cursor, uint32_t const _count, std::true_type /*trivial*/) {
+    return _cursor.readBulk(_count * sizeof(T)) != NULL;
+  }
+
+  // These are variable size, so have to be read one at a time to find the end
+  template <typename T>
+  inline bool checkObjects(SnapshotReader::Cursor& _cursor, uint32_t const _count, std::false_type /*trivial*/) {
+    T scratch;
+    for (uint32_t i = 0; i < _count; ++i) {
+      if (!snapshotReadObjects(_cursor, &scratch, 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+} // namespace snapshot_detail
+
+// The whole array including free slots, so ids (and generations) come back exactly as they were.
+template <typename T, uint32_t MAX_OBJECTS>
+inline void writeIdArray(SnapshotWriter& _writer, PagedIdArray<T, MAX_OBJECTS> const& _array) {
+  typedef PagedIdArray<T, MAX_OBJECTS> Array;
+  // Reserved ids aren't on the freelist, and wouldn't be on load either
+  for (uint32_t i = 0; i < _array._capacity; ++i) {
+    ensure(_array._indices[i].next_free != Array::RESERVED_IDX, "Saving with deferred makes pending!");
+  }
+
+  _writer.writeValue((uint32_t)sizeof(T));
+  _writer.writeValue(_array._num_objects);
+  _writer.writeValue(_array._capacity);
+  _writer.writeValue(_array._freelist_enqueue);
+  _writer.writeValue(_array._freelist_dequeue);
+  _writer.writeBulk(_array._indices, _array._capacity * sizeof(typename Array::Index));
+  _writer.writeBulk(_array._sparse_from_dense, _array._capacity * sizeof(uint32_t));
+  snapshot_detail::writeObjects(_writer, _array._objects, _array._num_objects, std::is_trivially_copyable<T>());
+}
+
+// Whether readIdArray() would succeed; moves the cursor past the array
+template <typename T, uint32_t MAX_OBJECTS>
+inline bool checkIdArray(SnapshotReader::Cursor& _cursor, PagedIdArray<T, MAX_OBJECTS> const&, uint32_t* o_numObjects = NULL) {
+  typedef PagedIdArray<T, MAX_OBJECTS> Array;
+
+  uint32_t objectSize = 0;
+  uint32_t numObjects = 0;
+  uint32_t capacity = 0;
+  uint32_t freelistEnqueue = 0;
+  uint32_t freelistDequeue = 0;
+  _cursor.readValue(&objectSize);
+  _cursor.readValue(&numObjects);
+  _cursor.readValue(&capacity);
+  _cursor.readValue(&freelistEnqueue);
+  _cursor.readValue(&freelistDequeue);
+  if (!_cursor.ok() || objectSize != sizeof(T) || capacity > MAX_OBJECTS || numObjects > capacity) {
+    return false;
+  }
+
+  if (!_cursor.readBulk(capacity * sizeof(typename Array::Index))
+   || !_cursor.readBulk(capacity * sizeof(uint32_t))
+   || !snapshot_detail::checkObjects<T>(_cursor, numObjects, std::is_trivially_copyable<T>())) {
+    return false;
+  }
+  if (o_numObjects) {
+    *o_numObjects = numObjects;
+  }
+  return true;
+}
+
+// Replaces the contents of _array. Slots the array has past the saved ones are freed.
+template <typename T, uint32_t MAX_OBJECTS>
+inline bool readIdArray(SnapshotReader::Cursor& _cursor, PagedIdArray<T, MAX_OBJECTS>& _array) {
+  typedef PagedIdArray<T, MAX_OBJECTS> Array;
+  uint32_t const invalidIdx = Array::INVALID_IDX;
+
+  uint32_t objectSize = 0;
+  uint32_t numObjects = 0;
+  uint32_t capacity = 0;
+  uint32_t freelistEnqueue = invalidIdx;
+  uint32_t freelistDequeue = invalidIdx;
+  _cursor.readValue(&objectSize);
+  _cursor.readValue(&numObjects);
+  _cursor.readValue(&capacity);
+  _cursor.readValue(&freelistEnqueue);
+  _cursor.readValue(&freelistDequeue);
+  if (!_cursor.ok() || objectSize != sizeof(T) || capacity > MAX_OBJECTS || numObjects > capacity) {
+    return false;
+  }
+
+  while (_array._capacity < capacity) {
+    _array.grow();
+  }
+
+  if (!_cursor.read(_array._indices, capacity * sizeof(typename Array::Index))
+   || !_cursor.read(_array._sparse_from_dense, capacity * sizeof(uint32_t))
+   || !snapshot_detail::readObjects(_cursor, _array._objects, numObjects, std::is_trivially_copyable<T>())) {
+    return false;
+  }
+  _array._num_objects = numObjects;
+  _array._freelist_enqueue = freelistEnqueue;
+  _array._freelist_dequeue = freelistDequeue;
+
+  // Free any slots we had past the saved ones, onto the end of the saved freelist
+  for (uint32_t i = capacity; i < _array._capacity; ++i) {
+    _array._indices[i].dense_idx = invalidIdx;
+    _array._indices[i].next_free = invalidIdx;
+    _array._sparse_from_dense[i] = invalidIdx;
+    if (_array._freelist_dequeue == invalidIdx) {
+      _array._freelist_dequeue = i;
+    } else {
+      _array._indices[_array._freelist_enqueue].next_free = i;
+    }
+    _array._freelist_enqueue = i;
+  }
+  return true;
+}
+
+// Tables: just the rows in use, a lane at a time
+
+void writeTable(SnapshotWriter& _writer, ortable::Table const& _table);
+
+// Whether readTable() would succeed; moves the cursor past the table
+bool checkTable(SnapshotReader::Cursor& _cursor, ortable::Table const& _table, size_t* o_size = NULL);
+
+// The table must already have the same attributes as the saved one
+bool readTable(SnapshotReader::Cursor& _cursor, ortable::Table& _table);
+
+} // namespace orbital
@@ -3,7 +3,10 @@
 
 #include "SDL_assert.h"
 #include "orStd.h"
+#include "orPlatform/memory.h"
 #include <stdint.h>
+#include <new>
+#include <vector>
 
 // TODO make() invalidates existing references but I'm holding on to them!! (while constructing objects)
 // go through code and make sure I don't hold onto references unsafely
@@ -49,18 +52,20 @@ template <typename T>
 struct Id {
   inline constexpr Id() noexcept :
     generation { 0 },
-    sparse_idx { UINT16_MAX }
+    sparse_idx { UINT32_MAX }
   {}
 
-  inline constexpr Id(uint16_t generation_, uint16_t sparse_idx_) noexcept :
+  inline constexpr Id(uint16_t generation_, uint32_t sparse_idx_) noexcept :
     generation { generation_ },
     sparse_idx { sparse_idx_ }
   {}
 
-  inline constexpr explicit operator bool() const noexcept { return sparse_idx != UINT16_MAX; }
+  inline constexpr explicit operator bool() const noexcept { return sparse_idx != UINT32_MAX; }
+  inline constexpr bool operator==(Id const& o) const noexcept { return sparse_idx == o.sparse_idx && generation == o.generation; }
+  inline constexpr bool operator!=(Id const& o) const noexcept { return !(*this == o); }
 
   uint16_t generation;
-  uint16_t sparse_idx;
+  uint32_t sparse_idx; // 32 bits so PagedIdArray can go past 64K objects
 };
   
 template <typename T, uint32_t MAX_OBJECTS = 32*1024>
@@ -115,6 +120,130 @@ struct IdArray {
   
 };
 
+// Like IdArray, but with no fixed capacity up front, and ids that go past 64K objects.
+// Address space for MAX_OBJECTS is reserved at construction, but memory is only committed (and slots
+// initialised) a chunk at a time as objects are added, so a mostly empty array costs next to nothing.
+// Growing never moves objects; they stay contiguous in dense order for iteration, as with IdArray.
+// Memory is never decommitted, we just keep the high water mark.
+// TODO decommit on clear / shrink?
+template <typename T, uint32_t MAX_OBJECTS = 1024*1024>
+struct PagedIdArray {
+  static_assert(MAX_OBJECTS < UINT32_MAX, "Object count too large for PagedIdArray!");
+
+  enum : uint32_t {
+    INVALID_IDX = UINT32_MAX,
+    RESERVED_IDX = UINT32_MAX - 1, // next_free of a slot given out by reserve_id() but not added yet
+    GROW_OBJECTS = 1024 // Slots initialised per grow; commit is rounded up to whole pages
+  };
+
+  struct Index {
+    uint32_t dense_idx;
+    uint32_t next_free;
+    uint16_t generation;
+  };
+
+  uint32_t _num_objects;
+  uint32_t _capacity; // Slots committed and initialised, in all three arrays
+
+  Index* _indices;
+  T* _objects;
+  uint32_t* _sparse_from_dense;
+
+  uint32_t _freelist_enqueue;
+  uint32_t _freelist_dequeue; // INVALID_IDX when the freelist is empty and we need to grow
+
+  PagedIdArray() :
+    _num_objects {0},
+    _capacity {0},
+    _indices { static_cast<Index*>(reserve(sizeof(Index))) },
+    _objects { static_cast<T*>(reserve(sizeof(T))) },
+    _sparse_from_dense { static_cast<uint32_t*>(reserve(sizeof(uint32_t))) },
+    _freelist_enqueue { INVALID_IDX },
+    _freelist_dequeue { INVALID_IDX }
+  {
+  }
+
+  ~PagedIdArray() {
+    for (uint32_t i = 0; i < _capacity; ++i) {
+      _objects[i].~T();
+    }
+    orPlatform::releaseMemory(_indices, reservedBytes(sizeof(Index)));
+    orPlatform::releaseMemory(_objects, reservedBytes(sizeof(T)));
+    orPlatform::releaseMemory(_sparse_from_dense, reservedBytes(sizeof(uint32_t)));
+  }
+
+  // Owns its reservation; copying would need a deep copy and nobody wants one yet
+  PagedIdArray(PagedIdArray const&) = delete;
+  PagedIdArray& operator=(PagedIdArray const&) = delete;
+
+  inline T* begin() {
+    return &_objects[0];
+  }
+  inline T const* begin() const {
+    return &_objects[0];
+  }
+  inline T* end() {
+    return &_objects[_num_objects];
+  }
+  inline T const* end() const {
+    return &_objects[_num_objects];
+  }
+
+  // Commits and initialises the next chunk of slots, and puts them on the end of the freelist.
+  void grow() {
+    ensure(_capacity < MAX_OBJECTS); // out of space!
+    uint32_t const old_capacity = _capacity;
+    uint32_t const new_capacity = (MAX_OBJECTS - old_capacity < GROW_OBJECTS) ? MAX_OBJECTS : old_capacity + GROW_OBJECTS;
+
+    commit(_indices, sizeof(Index), old_capacity, new_capacity);
+    commit(_objects, sizeof(T), old_capacity, new_capacity);
+    commit(_sparse_from_dense, sizeof(uint32_t), old_capacity, new_capacity);
+
+    for (uint32_t i = old_capacity; i < new_capacity; ++i) {
+      _indices[i].generation = 0;
+      _indices[i].dense_idx = INVALID_IDX;
+      _indices[i].next_free = i+1;
+      new (&_objects[i]) T();
+      _sparse_from_dense[i] = INVALID_IDX;
+    }
+    _indices[new_capacity-1].next_free = INVALID_IDX;
+
+    if (_freelist_dequeue == INVALID_IDX) {
+      _freelist_dequeue = old_capacity;
+    } else {
+      _indices[_freelist_enqueue].next_free = old_capacity;
+    }
+    _freelist_enqueue = new_capacity-1;
+    _capacity = new_capacity;
+  }
+
+private:
+  static size_t roundToPage(size_t const bytes) {
+    size_t const page = orPlatform::memoryPageSize();
+    return (bytes + page - 1) / page * page;
+  }
+
+  static size_t reservedBytes(size_t const elem_size) {
+    return roundToPage(elem_size * MAX_OBJECTS);
+  }
+
+  static void* reserve(size_t const elem_size) {
+    void* const p = orPlatform::reserveMemory(reservedBytes(elem_size));
+    ensure(p != NULL);
+    return p;
+  }
+
+  // Commits the pages covering elements [old_count, new_count); the page holding old_count may already be committed.
+  static void commit(void* const base, size_t const elem_size, uint32_t const old_count, uint32_t const new_count) {
+    size_t const begin = roundToPage(elem_size * old_count);
+    size_t const end = roundToPage(elem_size * new_count);
+    if (end > begin) {
+      bool const ok = orPlatform::commitMemory(static_cast<char*>(base) + begin, end - begin);
+      ensure(ok);
+    }
+  }
+};
+
 namespace id_array {
   
   template<typename T, uint32_t MAX_OBJECTS>
@@ -273,10 +402,239 @@ namespace id_array {
     uint32_t next_dense_idx = (dense_idx + 1) % num_objects(a);
     return get_id(a, &objects(a)[next_dense_idx]);
   }
+  // PagedIdArray versions of the above
+
+  template<typename T, uint32_t MAX_OBJECTS>
+  inline auto num_objects(PagedIdArray<T, MAX_OBJECTS> const& a) noexcept {
+    return a._num_objects;
+  }
+
+  template<typename T, uint32_t MAX_OBJECTS>
+  inline auto objects(PagedIdArray<T, MAX_OBJECTS>& a) noexcept {
+    return &a._objects[0];
+  }
+
+  template<typename T, uint32_t MAX_OBJECTS>
+  inline auto objects(PagedIdArray<T, MAX_OBJECTS> const& a) noexcept {
+    return static_cast<T const*>(&a._objects[0]);
+  }
+
+  template<typename T, uint32_t MAX_OBJECTS>
+  inline T* begin(PagedIdArray<T, MAX_OBJECTS>& a) {
+    return &a._objects[0];
+  }
+
+  template<typename T, uint32_t MAX_OBJECTS>
+  inline T const* begin(PagedIdArray<T, MAX_OBJECTS> const& a) {
+    return &a._objects[0];
+  }
+
+  template<typename T, uint32_t MAX_OBJECTS>
+  inline T* end(PagedIdArray<T, MAX_OBJECTS>& a) {
+    return &a._objects[a._num_objects];
+  }
+
+  template<typename T, uint32_t MAX_OBJECTS>
+  inline T const* end(PagedIdArray<T, MAX_OBJECTS> const& a) {
+    return &a._objects[a._num_objects];
+  }
+
+  // Unlike IdArray, ids past the committed slots are fine to ask about; they just aren't there.
+  template<typename T, uint32_t MAX_OBJECTS>
+  inline bool has(PagedIdArray<T, MAX_OBJECTS> const& a, Id<T> const id) {
+    if (id.sparse_idx >= a._capacity) { return false; }
+    auto& in = a._indices[id.sparse_idx];
+    return in.generation == id.generation
+        && in.dense_idx != PagedIdArray<T, MAX_OBJECTS>::INVALID_IDX;
+  }
+
+  template<typename T, uint32_t MAX_OBJECTS>
+  inline bool has(PagedIdArray<T, MAX_OBJECTS> const& a, T const* const p) {
+    return &a._objects[0] <= p && p < &a._objects[a._num_objects] // contained
+        && (reinterpret_cast<uintptr_t>(p) - reinterpret_cast<uintptr_t>(&a._objects[0])) % sizeof(T) == 0; // aligned
+  }
+
+  template<typename T, uint32_t MAX_OBJECTS>
+  inline T& get_object(PagedIdArray<T, MAX_OBJECTS>& a, Id<T> const id) {
+    ensure(has(a, id));
+    return a._objects[a._indices[id.sparse_idx].dense_idx];
+  }
+
+  template<typename T, uint32_t MAX_OBJECTS>
+  inline T const& get_object(PagedIdArray<T, MAX_OBJECTS> const& a, Id<T> const id) {
+    ensure(has(a, id));
+    return a._objects[a._indices[id.sparse_idx].dense_idx];
+  }
+
+  template<typename T, uint32_t MAX_OBJECTS>
+  inline auto get_idx(PagedIdArray<T, MAX_OBJECTS> const& a, Id<T> const id) {
+    ensure(has(a, id));
+    return a._indices[id.sparse_idx].dense_idx;
+  }
+
+  template<typename T, uint32_t MAX_OBJECTS>
+  inline auto get_id(PagedIdArray<T, MAX_OBJECTS> const& a, T const* const p) {
+    ensure(has(a, p));
+    ptrdiff_t const dense_idx = p - &a._objects[0];
+    Id<T> id;
+    id.sparse_idx = a._sparse_from_dense[dense_idx];
+    id.generation = a._indices[id.sparse_idx].generation;
+    return id;
+  }
+
+  // Never moves existing objects, so unlike IdArray references stay valid across add().
+  template<typename T, uint32_t MAX_OBJECTS>
+  inline auto add(PagedIdArray<T, MAX_OBJECTS>& a) {
+    if (a._freelist_dequeue == PagedIdArray<T, MAX_OBJECTS>::INVALID_IDX) {
+      a.grow();
+    }
+
+    auto const sparse_idx = a._freelist_dequeue;
+    auto& in = a._indices[sparse_idx];
+    auto const dense_idx = a._num_objects;
+
+    a._num_objects += 1;
+    a._freelist_dequeue = in.next_free;
+    if (a._freelist_dequeue == PagedIdArray<T, MAX_OBJECTS>::INVALID_IDX) {
+      a._freelist_enqueue = PagedIdArray<T, MAX_OBJECTS>::INVALID_IDX;
+    }
+
+    in.generation += 1;
+    in.dense_idx = dense_idx;
+    in.next_free = PagedIdArray<T, MAX_OBJECTS>::INVALID_IDX;
+
+    a._sparse_from_dense[dense_idx] = sparse_idx;
+
+    return Id<T>(in.generation, sparse_idx);
+  }
+
+  template<typename T, uint32_t MAX_OBJECTS>
+  inline void remove(PagedIdArray<T, MAX_OBJECTS>& a, Id<T> const id) {
+    ensure(has(a, id));
+    uint32_t const INVALID_IDX = PagedIdArray<T, MAX_OBJECTS>::INVALID_IDX;
+
+    auto const sparse_idx = id.sparse_idx;
+    auto const dense_idx = a._indices[sparse_idx].dense_idx;
+
+    // Compact dense array by moving last object into free slot, as in IdArray
+    auto const moved_dense_idx = a._num_objects-1;
+    auto const moved_sparse_idx = a._sparse_from_dense[moved_dense_idx];
+
+    a._num_objects -= 1;
+
+    a._objects[dense_idx] = a._objects[moved_dense_idx];
+    a._sparse_from_dense[dense_idx] = moved_sparse_idx;
+    a._sparse_from_dense[moved_dense_idx] = INVALID_IDX;
+
+    a._indices[moved_sparse_idx].dense_idx = dense_idx;
+
+    // Clear the sparse entry for the removed object and put it on the end of the freelist.
+    // Reusing slots oldest first makes it less likely a stale handle sees its generation come round again.
+    a._indices[sparse_idx].dense_idx = INVALID_IDX;
+    a._indices[sparse_idx].next_free = INVALID_IDX;
+    if (a._freelist_dequeue == INVALID_IDX) {
+      a._freelist_dequeue = sparse_idx;
+    } else {
+      a._indices[a._freelist_enqueue].next_free = sparse_idx;
+    }
+    a._freelist_enqueue = sparse_idx;
+  }
+
+  // Deferred adds, for CommandBuffer. Takes a slot and gives out its id now, but the object doesn't
+  // exist (has() is false) until add_reserved() is called with the id.
+  template<typename T, uint32_t MAX_OBJECTS>
+  inline Id<T> reserve_id(PagedIdArray<T, MAX_OBJECTS>& a) {
+    if (a._freelist_dequeue == PagedIdArray<T, MAX_OBJECTS>::INVALID_IDX) {
+      a.grow();
+    }
+
+    auto const sparse_idx = a._freelist_dequeue;
+    auto& in = a._indices[sparse_idx];
+
+    a._freelist_dequeue = in.next_free;
+    if (a._freelist_dequeue == PagedIdArray<T, MAX_OBJECTS>::INVALID_IDX) {
+      a._freelist_enqueue = PagedIdArray<T, MAX_OBJECTS>::INVALID_IDX;
+    }
+
+    in.generation += 1;
+    in.dense_idx = PagedIdArray<T, MAX_OBJECTS>::INVALID_IDX;
+    in.next_free = PagedIdArray<T, MAX_OBJECTS>::RESERVED_IDX;
+
+    return Id<T>(in.generation, sparse_idx);
+  }
+
+  // Adds objects for reserved ids, on the end of the dense array in the order given.
+  // Every reserved slot already has dense space committed for it, so this never grows.
+  template<typename T, uint32_t MAX_OBJECTS>
+  inline void add_reserved(PagedIdArray<T, MAX_OBJECTS>& a, Id<T> const* const ids, uint32_t const count) {
+    uint32_t const RESERVED_IDX = PagedIdArray<T, MAX_OBJECTS>::RESERVED_IDX;
+    for (uint32_t i = 0; i < count; ++i) {
+      auto& in = a._indices[ids[i].sparse_idx];
+      ensure(in.generation == ids[i].generation && in.next_free == RESERVED_IDX);
+
+      auto const dense_idx = a._num_objects;
+      a._num_objects += 1;
+
+      in.dense_idx = dense_idx;
+      in.next_free = PagedIdArray<T, MAX_OBJECTS>::INVALID_IDX;
+      a._sparse_from_dense[dense_idx] = ids[i].sparse_idx;
+    }
+  }
+
+  // Removes a batch of objects with one compaction pass, rather than a move per remove.
+  // Unlike remove(), the survivors keep their order. Ids that aren't there (or are repeated) are skipped.
+  // o_keep gets a flag per old dense index saying whether it survived, so arrays kept in step with
+  // this one (e.g. ortable::Table) can compact the same way.
+  template<typename T, uint32_t MAX_OBJECTS>
+  inline void remove_batch(PagedIdArray<T, MAX_OBJECTS>& a, Id<T> const* const ids, uint32_t const count, std::vector<uint8_t>& o_keep) {
+    uint32_t const INVALID_IDX = PagedIdArray<T, MAX_OBJECTS>::INVALID_IDX;
+
+    o_keep.assign(a._num_objects, 1);
+    for (uint32_t i = 0; i < count; ++i) {
+      if (!has(a, ids[i])) { continue; }
+      auto const sparse_idx = ids[i].sparse_idx;
+      o_keep[a._indices[sparse_idx].dense_idx] = 0;
+
+      a._indices[sparse_idx].dense_idx = INVALID_IDX;
+      a._indices[sparse_idx].next_free = INVALID_IDX;
+      if (a._freelist_dequeue == INVALID_IDX) {
+        a._freelist_dequeue = sparse_idx;
+      } else {
+        a._indices[a._freelist_enqueue].next_free = sparse_idx;
+      }
+      a._freelist_enqueue = sparse_idx;
+    }
+
+    uint32_t out = 0;
+    for (uint32_t dense_idx = 0; dense_idx < a._num_objects; ++dense_idx) {
+      if (!o_keep[dense_idx]) { continue; }
+      if (out != dense_idx) {
+        a._objects[out] = a._objects[dense_idx];
+        a._sparse_from_dense[out] = a._sparse_from_dense[dense_idx];
+        a._indices[a._sparse_from_dense[out]].dense_idx = out;
+      }
+      ++out;
+    }
+    for (uint32_t dense_idx = out; dense_idx < a._num_objects; ++dense_idx) {
+      a._sparse_from_dense[dense_idx] = INVALID_IDX;
+    }
+    a._num_objects = out;
+  }
+
+  template<typename T, uint32_t MAX_OBJECTS>
+  auto next_id(PagedIdArray<T, MAX_OBJECTS> const& a, Id<T> id) {
+    ensure(has(a, id));
+    uint32_t dense_idx = get_idx(a, id);
+    uint32_t next_dense_idx = (dense_idx + 1) % num_objects(a);
+    return get_id(a, &objects(a)[next_dense_idx]);
+  }
 }
 
 } // namespace orbital
 
+#include "orCore/orCommandBuffer.h"
+#include "orCore/orSnapshot.h"
+
 // TODO get rid of the macro
 // TODO can I express both const overloads in one in C++14?
 #define DECLARE_SYSTEM_TYPE(T_SINGULAR, T_PLURAL)\
@@ -286,8 +644,10 @@ public:\
   T_SINGULAR&       get ## T_SINGULAR ( ::orbital::Id<T_SINGULAR> id)       { return ::orbital::id_array::get_object( m_instanced ## T_PLURAL, id ); }\
   T_SINGULAR const& get ## T_SINGULAR ( ::orbital::Id<T_SINGULAR> id) const { return ::orbital::id_array::get_object( m_instanced ## T_PLURAL, id ); }\
   auto next ## T_SINGULAR ( ::orbital::Id< T_SINGULAR > id ) const { return ::orbital::id_array::next_id( m_instanced ## T_PLURAL, id ); }\
+  auto make ## T_SINGULAR ## Deferred ( ::orbital::CommandBuffer& commands, T_SINGULAR const& init = T_SINGULAR() ) { return commands.make( m_instanced ## T_PLURAL, init ); }\
+  void remove ## T_SINGULAR ## Deferred ( ::orbital::CommandBuffer& commands, ::orbital::Id<T_SINGULAR> id ) { commands.remove( m_instanced ## T_PLURAL, id ); }\
 private:\
-  ::orbital::IdArray<T_SINGULAR> m_instanced ## T_PLURAL;\
+  ::orbital::PagedIdArray<T_SINGULAR> m_instanced ## T_PLURAL;\
 public:
 
 
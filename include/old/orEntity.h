@@ -6,6 +6,8 @@
 #include "orRender.h"
 #include "orCamera.h" // TODO don't like this dependency
 
+#include "orTask/taskScheduler.h"
+
 class CameraSystem;
 
 class EntitySystem {
@@ -22,10 +24,13 @@ public:
   }
 
   struct Ship {
+    Ship() : m_orbitVersion(0) {}
+
     orbital::Id<PhysicsSystem::ParticleBody> m_particleBodyId;
     orbital::Id<RenderSystem::Point> m_pointId;
     orbital::Id<RenderSystem::Orbit> m_orbitId;
     orbital::Id<CameraSystem::Target> m_cameraTargetId;
+    uint32_t m_orbitVersion; // Of the orbit last copied to m_orbitId
   };
   DECLARE_SYSTEM_TYPE(Ship, Ships);
 
@@ -33,11 +38,14 @@ public:
 
   // TODO rename, collides with Physics::Body
   struct Body {
+    Body() : m_orbitVersion(0) {}
+
     orbital::Id<PhysicsSystem::GravBody> m_gravBodyId;
     orbital::Id<RenderSystem::Sphere>  m_sphereId;
     orbital::Id<RenderSystem::Orbit>   m_orbitId;
     orbital::Id<CameraSystem::Target>  m_cameraTargetId;
     orbital::Id<RenderSystem::Label3D> m_label3DId;
+    uint32_t m_orbitVersion; // Of the orbit last copied to m_orbitId
   };
   
   DECLARE_SYSTEM_TYPE(Body, Bodies);
@@ -49,13 +57,30 @@ public:
   };
   DECLARE_SYSTEM_TYPE(Poi, Pois);
 
+  void getShipParticleBodyIds(std::vector< orbital::Id<PhysicsSystem::ParticleBody> >& o_ids) const;
+
+  // Closest point on a ship's orbit to a ray, e.g. for mouse hover
+  struct OrbitPick {
+    orbital::Id<Ship> m_shipId;
+    double m_trueAnomaly;
+    double m_time; // Time from now until the ship reaches this point
+    double m_rayDistance; // Perpendicular distance from the ray
+    double m_rayDepth; // Distance along the ray
+    orVec3 m_pos;
+  };
+
+  // Picks against every ship's osculating orbit at once. Uses the orbits computed in updateRenderObjects.
+  void pickShipOrbits(orRay3 const& _ray, std::vector<OrbitPick>& o_picks) const;
+
   void updateCamTargets(double const _dt, const orVec3 _origin);
-  void updateRenderObjects(double const _dt, const orVec3 _origin);
+  // Runs its loops over ships in parallel on _scheduler; _threadIdx is the calling thread's
+  void updateRenderObjects(orTask::TaskScheduler& _scheduler, orTask::ThreadIdx const _threadIdx, double const _dt, const orVec3 _origin);
 
-private:
-  // TODO not happy this lives here
-  void updateOrbit(PhysicsSystem::Body const& body, PhysicsSystem::GravBody const& parentBody, orEphemerisHybrid& o_params);
+  void save(orbital::SnapshotWriter& _writer) const;
+  bool check(orbital::SnapshotReader const& _reader) const; // Whether load() would succeed
+  bool load(orbital::SnapshotReader const& _reader);
 
+private:
   CameraSystem& m_cameraSystem;
   RenderSystem& m_renderSystem;
   PhysicsSystem& m_physicsSystem;
@@ -9,6 +9,7 @@
 #define	ORMATH_H
 
 # include <cmath>
+# include <algorithm>
 # include <Eigen/Eigen>
 
 using Eigen::Vector3d;
@@ -21,6 +22,8 @@ using Eigen::Vector3d;
 
 #include "constants.h"
 
+#include "Fixed64.h"
+
 struct orVec2 {
   orVec2() {
     for (int i = 0; i < 2; ++i) {
@@ -80,6 +83,48 @@ struct orVec3 {
   double data[3];
 }; // struct orVec3
 
+struct orMat4 {
+  orMat4() {
+    for (int i = 0; i < 16; ++i) {
+      data[i] = 0;
+    }
+  }
+
+  orMat4(Eigen::Matrix4d const& m) {
+    double const* mdata = m.data();
+    for (int i = 0; i < 16; ++i) {
+      data[i] = mdata[i];
+    }
+  }
+
+  operator Eigen::Matrix4d() const {
+    return Eigen::Matrix4d(data);
+  }
+
+  double data[16]; // Column major, same as Eigen
+}; // struct orMat4
+
+struct orFixedVec3 {
+  orFixedVec3() {}
+
+  static orFixedVec3 fromVec3(orVec3 const& v) {
+    orFixedVec3 r;
+    for (int i = 0; i < 3; ++i) {
+      r.data[i] = Fixed64::fromDouble(v.data[i]);
+    }
+    return r;
+  }
+
+  orVec3 toVec3() const {
+    return orVec3(Fixed64::toDouble(data[0]), Fixed64::toDouble(data[1]), Fixed64::toDouble(data[2]));
+  }
+
+  Fixed64&       operator[] (int i)       { return data[i]; }
+  Fixed64 const& operator[] (int i) const { return data[i]; }
+
+  Fixed64 data[3];
+}; // struct orFixedVec3
+
 struct orRay3 {
   orVec3 pos;
   orVec3 dir;
@@ -137,13 +182,212 @@ inline double computeEccentricAnomaly(
   do
   {
     double const delta_mean_anomaly_rad = mean_anomaly_rad - (eccentric_anomaly_rad - eccentricity * sin(eccentric_anomaly_rad));
-    double const delta_eccentric_anomaly_rad = delta_mean_anomaly_rad / (1 - eccentricity * cos(eccentric_anomaly_rad));
+    // NOTE this used to redeclare delta_eccentric_anomaly_rad here, shadowing the loop variable, so we only ever did one iteration
+    delta_eccentric_anomaly_rad = delta_mean_anomaly_rad / (1 - eccentricity * cos(eccentric_anomaly_rad));
     eccentric_anomaly_rad += delta_eccentric_anomaly_rad;
-  } while (delta_eccentric_anomaly_rad > tolerance_rad);
+  } while (fabs(delta_eccentric_anomaly_rad) > tolerance_rad);
 
   return eccentric_anomaly_rad;
 }
 
+// Stumpff functions C(z) and S(z) for the universal variable formulation.
+// Series expansions near z = 0 where the closed forms lose all their precision.
+inline double stumpffC(double const z) {
+  if (z > 1e-6) {
+    return (1 - cos(sqrt(z))) / z;
+  } else if (z < -1e-6) {
+    return (cosh(sqrt(-z)) - 1) / -z;
+  } else {
+    return 1.0/2.0 - z/24.0 + z*z/720.0;
+  }
+}
+
+inline double stumpffS(double const z) {
+  if (z > 1e-6) {
+    double const sz = sqrt(z);
+    return (sz - sin(sz)) / (sz * sz * sz);
+  } else if (z < -1e-6) {
+    double const sz = sqrt(-z);
+    return (sinh(sz) - sz) / (sz * sz * sz);
+  } else {
+    return 1.0/6.0 - z/120.0 + z*z/5040.0;
+  }
+}
+
+// Propagate a state (relative to the parent) forwards by dt on a Kepler conic. Works for any eccentricity.
+// Universal variable method from Curtis, "Orbital Mechanics for Engineering Students", Algorithms 3.3 and 3.4.
+inline void propagateKepler(
+  Vector3d const& r0,
+  Vector3d const& v0,
+  double const mu,
+  double const dt,
+  Vector3d& o_r,
+  Vector3d& o_v
+) {
+  double const r0_mag = r0.norm();
+  double const v0_mag = v0.norm();
+  double const vr0 = r0.dot(v0) / r0_mag;
+  double const sqrt_mu = sqrt(mu);
+  // Reciprocal of the semi-major axis; -ve for hyperbolic orbits
+  double const alpha = 2 / r0_mag - v0_mag * v0_mag / mu;
+
+  // Solve the universal Kepler equation for the universal anomaly chi
+  double chi = sqrt_mu * fabs(alpha) * dt;
+  for (int i = 0; i < 64; ++i) {
+    double const z = alpha * chi * chi;
+    double const C = stumpffC(z);
+    double const S = stumpffS(z);
+    double const F = r0_mag * vr0 / sqrt_mu * chi * chi * C + (1 - alpha * r0_mag) * chi * chi * chi * S + r0_mag * chi - sqrt_mu * dt;
+    double const dFdchi = r0_mag * vr0 / sqrt_mu * chi * (1 - alpha * chi * chi * S) + (1 - alpha * r0_mag) * chi * chi * C + r0_mag;
+    double const delta = F / dFdchi;
+    chi -= delta;
+    if (fabs(delta) < 1e-12 * (1 + fabs(chi))) {
+      break;
+    }
+  }
+
+  double const z = alpha * chi * chi;
+  double const C = stumpffC(z);
+  double const S = stumpffS(z);
+
+  // Lagrange coefficients
+  double const f = 1 - chi * chi / r0_mag * C;
+  double const g = dt - chi * chi * chi / sqrt_mu * S;
+  o_r = f * r0 + g * v0;
+
+  double const r_mag = o_r.norm();
+  double const f_dot = sqrt_mu / (r_mag * r0_mag) * (alpha * chi * chi * chi * S - chi);
+  double const g_dot = 1 - chi * chi / r_mag * C;
+  o_v = f_dot * r0 + g_dot * v0;
+}
+
+// Auxiliary function y(z) from the universal variable Lambert formulation
+inline double lambertY(double const z, double const r1_mag, double const r2_mag, double const A) {
+  return r1_mag + r2_mag + A * (z * stumpffS(z) - 1) / sqrt(stumpffC(z));
+}
+
+// Lambert's problem: find the conic that takes a body from r1 to r2 in time tof around a parent with
+// gravitational parameter mu. Outputs the velocities at either end of the transfer.
+// Universal variable method from Curtis, "Orbital Mechanics for Engineering Students", Algorithm 5.2,
+// with the Newton iteration safeguarded by bisection since the plain version wanders off on long transfers.
+// Always picks the prograde (+Z angular momentum) zero-revolution solution.
+// Returns false if there is no solution (degenerate 0 or 180 degree transfer, or no convergence).
+// TODO multi-revolution solutions, see Matlab/lambert/lambert.m
+inline bool solveLambert(
+  Vector3d const& r1,
+  Vector3d const& r2,
+  double const tof,
+  double const mu,
+  Vector3d& o_v1,
+  Vector3d& o_v2
+) {
+  double const r1_mag = r1.norm();
+  double const r2_mag = r2.norm();
+
+  if (tof <= 0 || r1_mag <= 0 || r2_mag <= 0) {
+    return false;
+  }
+
+  double const cos_dtheta = std::max(-1.0, std::min(1.0, r1.dot(r2) / (r1_mag * r2_mag)));
+  double dtheta = acos(cos_dtheta);
+  if (r1.cross(r2).z() < 0) {
+    dtheta = M_TAU - dtheta;
+  }
+
+  // TODO arbitrary threshold; near 180 degrees the transfer plane is undefined
+  if (1 - cos_dtheta < 1e-12 || fabs(sin(dtheta)) < 1e-9) {
+    return false;
+  }
+
+  double const A = sin(dtheta) * sqrt(r1_mag * r2_mag / (1 - cos_dtheta));
+  double const sqrt_mu_tof = sqrt(mu) * tof;
+
+  // Bracket the root. Flight time goes to infinity as z approaches (2 pi)^2 from below (single revolution limit)
+  // and to zero as z goes to -infinity (very fast hyperbolic transfer).
+  double z_hi = M_TAU * M_TAU * (1 - 1e-9);
+  double z_lo = -M_TAU * M_TAU;
+
+  // y(z) < 0 is outside the valid domain; when A > 0 that means z is too low and when A < 0 it
+  // means z is too high, so we treat it as a time of flight residual of the matching sign.
+  double F_lo = 0;
+  for (int i = 0; i < 64; ++i) {
+    double const y = lambertY(z_lo, r1_mag, r2_mag, A);
+    if (y < 0) {
+      F_lo = (A > 0) ? -sqrt_mu_tof : sqrt_mu_tof;
+    } else {
+      double const C = stumpffC(z_lo);
+      F_lo = pow(y / C, 1.5) * stumpffS(z_lo) + A * sqrt(y) - sqrt_mu_tof;
+    }
+    if (F_lo < 0) {
+      break;
+    }
+    z_hi = z_lo;
+    z_lo *= 2;
+  }
+
+  if (F_lo >= 0) {
+    return false;
+  }
+
+  double z = 0.5 * (z_lo + z_hi);
+  double y = 0;
+  bool converged = false;
+  for (int i = 0; i < 100; ++i) {
+    y = lambertY(z, r1_mag, r2_mag, A);
+    if (y < 0) {
+      if (A > 0) { z_lo = z; } else { z_hi = z; }
+      z = 0.5 * (z_lo + z_hi);
+      continue;
+    }
+
+    double const C = stumpffC(z);
+    double const S = stumpffS(z);
+    double const F = pow(y / C, 1.5) * S + A * sqrt(y) - sqrt_mu_tof;
+
+    if (fabs(F) < 1e-11 * sqrt_mu_tof) {
+      converged = true;
+      break;
+    }
+
+    if (F < 0) { z_lo = z; } else { z_hi = z; }
+
+    double dFdz;
+    if (fabs(z) < 1e-6) {
+      dFdz = sqrt(2.0) / 40.0 * pow(y, 1.5) + A / 8.0 * (sqrt(y) + A * sqrt(1 / (2 * y)));
+    } else {
+      dFdz = pow(y / C, 1.5) * (1 / (2 * z) * (C - 3 * S / (2 * C)) + 3 * S * S / (4 * C))
+           + A / 8.0 * (3 * S / C * sqrt(y) + A * sqrt(C / y));
+    }
+
+    double const z_newton = z - F / dFdz;
+    if (dFdz > 0 && z_newton > z_lo && z_newton < z_hi) {
+      z = z_newton;
+    } else {
+      z = 0.5 * (z_lo + z_hi);
+    }
+
+    if (z_hi - z_lo < 1e-14 * (1 + fabs(z))) {
+      converged = true;
+      y = lambertY(z, r1_mag, r2_mag, A);
+      break;
+    }
+  }
+
+  if (!converged || y <= 0) {
+    return false;
+  }
+
+  // Lagrange coefficients
+  double const f = 1 - y / r1_mag;
+  double const g = A * sqrt(y / mu);
+  double const g_dot = 1 - y / r2_mag;
+
+  o_v1 = (r2 - f * r1) / g;
+  o_v2 = (g_dot * r2 - r1) / g;
+
+  return true;
+}
+
 } // namespace orMath
 
 inline boost::posix_time::ptime getGameStartDate() {
@@ -287,13 +531,15 @@ inline void ephemerisHybridFromCartesian(
   o_params.y_dir = y_dir;
 }
 
+// Elements advanced from J2000 to sim_time, and the time in centuries since J2000 that was used.
 // TODO this is no good, posix time wraps after 2080 or so
 // Should store m_simTime as seconds since J2000
 // Would also need a way to display times far enough into the future without going through posix time
-inline void ephemerisCartesianFromJPL(
+inline void ephemerisJPLAtTime(
   orEphemerisJPL const& elements_t0,
   double sim_time,
-  orEphemerisCartesian& o_cart
+  orEphemerisJPL& o_e,
+  double& o_t_C
 ) {
   // Compute time in centuries since J2000
 
@@ -310,9 +556,12 @@ inline void ephemerisCartesianFromJPL(
   e.longitude_of_perihelion_deg += e.longitude_of_perihelion_deg_per_C * t_C;
   e.longitude_of_ascending_node_deg += e.longitude_of_ascending_node_deg_per_C * t_C;
 
-  // arg: argument
-  double const arg_of_perihelion_deg = e.longitude_of_perihelion_deg - e.longitude_of_ascending_node_deg;
+  o_e = e;
+  o_t_C = t_C;
+}
 
+// e is elements from ephemerisJPLAtTime
+inline double eccentricAnomalyFromJPL(orEphemerisJPL const& e, double t_C) {
   // NOTE assuming error_f needs deg->rad conversion, since all other angles in the paper needed it
   double const error_f_rad = e.error_f_deg * t_C * RAD_PER_DEG;
 
@@ -323,7 +572,36 @@ inline void ephemerisCartesianFromJPL(
 
   double const mean_anomaly_rad = orWrap(mean_anomaly_deg * RAD_PER_DEG, -0.5 * M_TAU, +0.5 * M_TAU);
 
-  double const eccentric_anomaly_rad = orMath::computeEccentricAnomaly(mean_anomaly_rad, e.eccentricity);
+  return orMath::computeEccentricAnomaly(mean_anomaly_rad, e.eccentricity);
+}
+
+// Rotation from the orbital frame (periapsis along X, orbit in the XY plane) to the inertial frame
+inline Eigen::Matrix3d rotationFromJPL(orEphemerisJPL const& e) {
+  // arg: argument
+  double const arg_of_perihelion_deg = e.longitude_of_perihelion_deg - e.longitude_of_ascending_node_deg;
+
+  Eigen::Matrix3d rot_inertial_frame;
+  rot_inertial_frame = Eigen::AngleAxisd(-e.longitude_of_ascending_node_deg * RAD_PER_DEG, Eigen::Vector3d::UnitZ())
+                     * Eigen::AngleAxisd(-e.inclination_deg * RAD_PER_DEG, Eigen::Vector3d::UnitX())
+                     * Eigen::AngleAxisd(-arg_of_perihelion_deg * RAD_PER_DEG, Eigen::Vector3d::UnitZ());
+  return rot_inertial_frame;
+}
+
+inline double trueAnomalyFromEccentricAnomaly(double eccentric_anomaly_rad, double eccentricity) {
+  // From wikipedia article on True Anomaly
+  return 2 * atan2(sqrt(1+eccentricity) * sin(eccentric_anomaly_rad / 2), sqrt(1-eccentricity) * cos(eccentric_anomaly_rad / 2));
+}
+
+inline void ephemerisCartesianFromJPL(
+  orEphemerisJPL const& elements_t0,
+  double sim_time,
+  orEphemerisCartesian& o_cart
+) {
+  orEphemerisJPL e;
+  double t_C;
+  ephemerisJPLAtTime(elements_t0, sim_time, e, t_C);
+
+  double const eccentric_anomaly_rad = eccentricAnomalyFromJPL(e, t_C);
 
   double const semi_major_axis_meters = METERS_PER_AU * e.semi_major_axis_AU;
   double const x_orbital = semi_major_axis_meters * (cos(eccentric_anomaly_rad) - e.eccentricity);
@@ -331,10 +609,7 @@ inline void ephemerisCartesianFromJPL(
 
   Eigen::Vector3d r_orbital(x_orbital, y_orbital, 0);
 
-  Eigen::Matrix3d rot_inertial_frame;
-  rot_inertial_frame = Eigen::AngleAxisd(-e.longitude_of_ascending_node_deg * RAD_PER_DEG, Eigen::Vector3d::UnitZ())
-                     * Eigen::AngleAxisd(-e.inclination_deg * RAD_PER_DEG, Eigen::Vector3d::UnitX())
-                     * Eigen::AngleAxisd(-arg_of_perihelion_deg * RAD_PER_DEG, Eigen::Vector3d::UnitZ());
+  Eigen::Matrix3d const rot_inertial_frame = rotationFromJPL(e);
 
   // Mean motion n = sqrt(mu / (a*a*a))
   // n * n = mu / (a * a * a)
@@ -351,8 +626,7 @@ inline void ephemerisCartesianFromJPL(
   double const n = mean_longitude_rad_per_s - longitude_of_perihelion_rad_per_s;
   double const mu = n * n * a * a * a;
   double const p = semi_major_axis_meters * (1 - e.eccentricity * e.eccentricity);
-  // From wikipedia article on True Anomaly
-  double const true_anomaly_rad = 2 * atan2(sqrt(1+e.eccentricity) * sin(eccentric_anomaly_rad / 2), sqrt(1-e.eccentricity) * cos(eccentric_anomaly_rad / 2));
+  double const true_anomaly_rad = trueAnomalyFromEccentricAnomaly(eccentric_anomaly_rad, e.eccentricity);
   // From Orbital Mechanics Ch 3
   // TODO totally arbitrary thresholds, and haven't given thought to correct behaviour
   // when only one of them is close to 0...
@@ -368,6 +642,111 @@ inline void ephemerisCartesianFromJPL(
   o_cart.vel = rot_inertial_frame * v_orbital;
 }
 
+// The conic straight from the elements, rather than ephemerisCartesianFromJPL then ephemerisHybridFromCartesian.
+// Same conventions as ephemerisHybridFromCartesian: the body is at p / (1 + e cos theta) * -(cos theta x_dir + sin theta y_dir)
+// from its parent, and theta decreases as it goes round. Elements change over centuries, so apart from theta
+// (see trueAnomalyOnConic) this can be reused for a long time.
+inline void ephemerisHybridFromJPL(
+  orEphemerisJPL const& elements_t0,
+  double sim_time,
+  orEphemerisHybrid& o_params
+) {
+  orEphemerisJPL e;
+  double t_C;
+  ephemerisJPLAtTime(elements_t0, sim_time, e, t_C);
+
+  double const eccentric_anomaly_rad = eccentricAnomalyFromJPL(e, t_C);
+  Eigen::Matrix3d const rot_inertial_frame = rotationFromJPL(e);
+
+  o_params.p = METERS_PER_AU * e.semi_major_axis_AU * (1 - e.eccentricity * e.eccentricity);
+  o_params.e = e.eccentricity;
+  o_params.theta = -trueAnomalyFromEccentricAnomaly(eccentric_anomaly_rad, e.eccentricity);
+  o_params.x_dir = orVec3(Vector3d(-rot_inertial_frame.col(0)));
+  o_params.y_dir = orVec3(Vector3d(rot_inertial_frame.col(1)));
+}
+
+// True anomaly of a point at rel_pos from the parent, on a conic with these params.
+// Much cheaper than recomputing the whole conic when only the body's position along it has changed.
+inline double trueAnomalyOnConic(orEphemerisHybrid const& params, Vector3d const& rel_pos) {
+  return atan2(-rel_pos.dot(Vector3d(params.y_dir)), -rel_pos.dot(Vector3d(params.x_dir)));
+}
+
+// Same as the position part of ephemerisCartesianFromJPL, but entirely in fixed point so the result
+// is bit-identical on every machine. Time is in centuries since J2000.
+inline void ephemerisPositionFromJPLFixed(
+  orEphemerisJPL const& elements_t0,
+  Fixed64 const t_C,
+  orFixedVec3& o_pos
+) {
+  Fixed64 const semi_major_axis_AU = Fixed64::fromDouble(elements_t0.semi_major_axis_AU) + Fixed64::fromDouble(elements_t0.semi_major_axis_AU_per_C) * t_C;
+  Fixed64 const e = Fixed64::fromDouble(elements_t0.eccentricity) + Fixed64::fromDouble(elements_t0.eccentricity_per_C) * t_C;
+  Fixed64 const inclination_deg = Fixed64::fromDouble(elements_t0.inclination_deg) + Fixed64::fromDouble(elements_t0.inclination_deg_per_C) * t_C;
+  Fixed64 const mean_longitude_deg = Fixed64::fromDouble(elements_t0.mean_longitude_deg) + Fixed64::fromDouble(elements_t0.mean_longitude_deg_per_C) * t_C;
+  Fixed64 const longitude_of_perihelion_deg = Fixed64::fromDouble(elements_t0.longitude_of_perihelion_deg) + Fixed64::fromDouble(elements_t0.longitude_of_perihelion_deg_per_C) * t_C;
+  Fixed64 const longitude_of_ascending_node_deg = Fixed64::fromDouble(elements_t0.longitude_of_ascending_node_deg) + Fixed64::fromDouble(elements_t0.longitude_of_ascending_node_deg_per_C) * t_C;
+
+  Fixed64 const arg_of_perihelion_deg = longitude_of_perihelion_deg - longitude_of_ascending_node_deg;
+
+  // Angles go to sin/cos in turns, which avoids any range reduction
+  Fixed64 error_s, error_c;
+  Fixed64::sinCosTurns((Fixed64::fromDouble(elements_t0.error_f_deg) * t_C).divInt(360), &error_s, &error_c);
+
+  Fixed64 const mean_anomaly_deg = mean_longitude_deg - longitude_of_perihelion_deg
+    + Fixed64::fromDouble(elements_t0.error_b_deg) * t_C * t_C
+    + Fixed64::fromDouble(elements_t0.error_c_deg) * error_c
+    + Fixed64::fromDouble(elements_t0.error_s_deg) * error_s;
+
+  // Mean anomaly in [0, tau)
+  Fixed64 const mean_anomaly_turns = mean_anomaly_deg.divInt(360);
+  Fixed64 const tau = Fixed64::tauOver4().scaleBy2(2);
+  Fixed64 const mean_anomaly_rad = Fixed64(0, mean_anomaly_turns.getFractionalPart()) * tau;
+
+  // Newton's method on Kepler's equation, fixed iteration count so every machine does the same work.
+  // Converges well within this for the planets' eccentricities.
+  Fixed64 sin_E, cos_E;
+  Fixed64::sinCos(mean_anomaly_rad, &sin_E, &cos_E);
+  Fixed64 E = mean_anomaly_rad + e * sin_E;
+  for (int i = 0; i < 6; ++i) {
+    Fixed64::sinCos(E, &sin_E, &cos_E);
+    E -= (E - e * sin_E - mean_anomaly_rad) / (Fixed64::fromInt(1) - e * cos_E);
+  }
+  Fixed64::sinCos(E, &sin_E, &cos_E);
+
+  Fixed64 const semi_major_axis_meters = semi_major_axis_AU * Fixed64::fromDouble(METERS_PER_AU);
+  Fixed64 const x_orbital = semi_major_axis_meters * (cos_E - e);
+  Fixed64 const y_orbital = semi_major_axis_meters * Fixed64::sqrt(Fixed64::fromInt(1) - e * e) * sin_E;
+
+  // Rz(-node) * Rx(-inclination) * Rz(-arg_of_perihelion), as in the double version
+  Fixed64 sin_w, cos_w, sin_i, cos_i, sin_n, cos_n;
+  Fixed64::sinCosTurns(arg_of_perihelion_deg.divInt(360), &sin_w, &cos_w);
+  Fixed64::sinCosTurns(inclination_deg.divInt(360), &sin_i, &cos_i);
+  Fixed64::sinCosTurns(longitude_of_ascending_node_deg.divInt(360), &sin_n, &cos_n);
+
+  Fixed64 const x1 =  cos_w * x_orbital + sin_w * y_orbital;
+  Fixed64 const y1 = -sin_w * x_orbital + cos_w * y_orbital;
+
+  Fixed64 const y2 =  cos_i * y1;
+  Fixed64 const z2 = -sin_i * y1;
+
+  o_pos[0] =  cos_n * x1 + sin_n * y2;
+  o_pos[1] = -sin_n * x1 + cos_n * y2;
+  o_pos[2] = z2;
+}
+
+// Valid true anomaly range for drawing/picking an orbit; same limits as sampleOrbit
+inline double getTrueAnomalyRange(orEphemerisHybrid const& params) {
+  double const delta = .0001;
+  double const HAX_RANGE = .9; // limit range to stay out of very large values
+
+  if (params.e < 1 - delta) { // ellipse
+    return .5 * M_TAU;
+  } else if (params.e < 1 + delta) { // parabola
+    return .5 * M_TAU * HAX_RANGE;
+  } else { // hyperbola
+    return acos(-1/params.e) * HAX_RANGE;
+  }
+}
+
 inline void sampleOrbit(
   orEphemerisHybrid const& params,
   orVec3 const& origin, // Added on to every position in result
@@ -375,17 +754,7 @@ inline void sampleOrbit(
   orVec3* const o_posData,
   double* const o_trueAnomalyData = NULL
 ) {
-    double const delta = .0001;
-    double const HAX_RANGE = .9; // limit range to stay out of very large values
-
-    double range_rad;
-    if (params.e < 1 - delta) { // ellipse
-        range_rad = .5 * M_TAU;
-    } else if (params.e < 1 + delta) { // parabola
-        range_rad = .5 * M_TAU * HAX_RANGE;
-    } else { // hyperbola
-        range_rad = acos(-1/params.e) * HAX_RANGE;
-    }
+    double const range_rad = getTrueAnomalyRange(params);
     double const mint = -range_rad;
     double const maxt = range_rad;
 
@@ -415,6 +784,117 @@ inline void sampleOrbit(
     }
 }
 
+// Point on an orbit at true anomaly theta, offset by w0, and its first and second derivatives wrt theta.
+// Same parameterisation as sampleOrbit: r(theta) * (-cos(theta) x_dir - sin(theta) y_dir)
+inline void conicPointDerivatives(
+  orEphemerisHybrid const& params,
+  Vector3d const& x_dir,
+  Vector3d const& y_dir,
+  Vector3d const& w0,
+  double const theta,
+  Vector3d& o_w,
+  Vector3d& o_dw,
+  Vector3d& o_ddw
+) {
+  double const c = cos(theta);
+  double const s = sin(theta);
+  double const k = 1 + params.e * c;
+  double const r = params.p / k;
+  double const dr = params.p * params.e * s / (k * k);
+  double const ddr = params.p * params.e * (c * k + 2 * params.e * s * s) / (k * k * k);
+
+  Vector3d const u = -c * x_dir - s * y_dir;
+  Vector3d const du = s * x_dir - c * y_dir;
+
+  o_w = w0 + r * u;
+  o_dw = dr * u + r * du;
+  o_ddw = ddr * u + 2 * dr * du - r * u;
+}
+
+// Find the point on an orbit closest to a ray (perpendicular distance to the ray's line, as in orRayPointDistance).
+// Bracket the minimum by coarse sampling, then Newton iterate on the derivative of the squared distance
+// wrt true anomaly, falling back to bisection when Newton leaves the bracket.
+// Returns the true anomaly; optionally outputs the position and distance from the ray.
+inline double findClosestTrueAnomalyToRay(
+  orEphemerisHybrid const& params,
+  orVec3 const& origin,
+  orRay3 const& ray,
+  orVec3* const o_pos = NULL,
+  double* const o_dist = NULL
+) {
+  Vector3d const x_dir(params.x_dir);
+  Vector3d const y_dir(params.y_dir);
+  Vector3d const ray_dir = Vector3d(ray.dir).normalized();
+  Vector3d const w0 = Vector3d(origin) - Vector3d(ray.pos); // parent position relative to the ray
+
+  double const range_rad = getTrueAnomalyRange(params);
+
+  // Squared distance from the line is D = w.w - (w.d)^2
+  enum { NUM_COARSE_STEPS = 64 };
+  int best_i = 0;
+  double best_dist2 = DBL_MAX;
+  for (int i = 0; i <= NUM_COARSE_STEPS; ++i) {
+    double const theta = orLerp(-range_rad, range_rad, (double)i / NUM_COARSE_STEPS);
+    Vector3d w, dw, ddw;
+    conicPointDerivatives(params, x_dir, y_dir, w0, theta, w, dw, ddw);
+    double const wd = w.dot(ray_dir);
+    double const dist2 = w.squaredNorm() - wd * wd;
+    if (dist2 < best_dist2) {
+      best_dist2 = dist2;
+      best_i = i;
+    }
+  }
+
+  double const step = 2 * range_rad / NUM_COARSE_STEPS;
+  double const best_theta = orLerp(-range_rad, range_rad, (double)best_i / NUM_COARSE_STEPS);
+  double lo = best_theta - step;
+  double hi = best_theta + step;
+  // Ellipses wrap around; for open orbits stay inside the valid range
+  if (params.e >= 1) {
+    lo = std::max(lo, -range_rad);
+    hi = std::min(hi, range_rad);
+  }
+
+  double theta = best_theta;
+  for (int i = 0; i < 32; ++i) {
+    Vector3d w, dw, ddw;
+    conicPointDerivatives(params, x_dir, y_dir, w0, theta, w, dw, ddw);
+    double const wd = w.dot(ray_dir);
+    double const dwd = dw.dot(ray_dir);
+    double const dD = 2 * (w.dot(dw) - wd * dwd);
+    double const ddD = 2 * (dw.dot(dw) + w.dot(ddw) - dwd * dwd - wd * ddw.dot(ray_dir));
+
+    if (dD > 0) { hi = theta; } else { lo = theta; }
+
+    double next = (ddD > 0) ? theta - dD / ddD : 0.5 * (lo + hi);
+    if (!(next > lo && next < hi)) {
+      next = 0.5 * (lo + hi);
+    }
+
+    // TODO arbitrary threshold
+    bool const done = fabs(next - theta) < 1e-12;
+    theta = next;
+    if (done) {
+      break;
+    }
+  }
+
+  theta = orWrap(theta, -.5 * M_TAU, +.5 * M_TAU);
+
+  if (o_pos || o_dist) {
+    Vector3d w, dw, ddw;
+    conicPointDerivatives(params, x_dir, y_dir, w0, theta, w, dw, ddw);
+    if (o_pos) {
+      *o_pos = orVec3(Vector3d(w + Vector3d(ray.pos)));
+    }
+    if (o_dist) {
+      *o_dist = ray_dir.cross(w).norm();
+    }
+  }
+
+  return theta;
+}
+
 inline double getMeanAnomalyFromTrueAnomaly(orEphemerisHybrid const& eph, double true_anomaly)
 {
   // TODO probably want better test with some thresholds, maybe special case for eph.e near 1
@@ -3,12 +3,17 @@
 #include "orStd.h"
 #include "orMath.h"
 
+#include "orCore/orArena.h"
 #include "orCore/orSystem.h"
+#include "ortable/ortable.h"
 
 #include <vector>
 
 class PhysicsSystem {
 public:
+  PhysicsSystem();
+  ~PhysicsSystem();
+
   struct Body
   {
     Body() : m_pos(), m_vel() {}
@@ -17,26 +22,99 @@ public:
     orVec3 m_vel;
   };
 
-  struct ParticleBody : public Body
-  {
-    ParticleBody() : Body(), m_userAcc() {}
-    orVec3 m_userAcc;
+  struct GravBody;
+
+  // Particle body state is stored by column in m_particleTable, x/y/z in separate lanes, so the
+  // integrator can work on whole lanes at once. A body's row is its dense index in m_particleBodyIds.
+  // ParticleBody itself is only the id type; use the accessors below.
+  //
+  // Only the integrated ("hot") state is in m_particleTable. Things derived from it that only the UI and
+  // rendering want (SOI parent, osculating orbit) are in m_particleDerivedTable, same rows, and are
+  // only computed when asked for, at most once per update() per body.
+  //
+  // The osculating orbit of a coasting body barely changes, so it's kept until the body thrusts, is moved
+  // by hand, changes SOI, or drifts off it (perturbations from other bodies); otherwise only theta is
+  // updated. Its version changes whenever the rest is recomputed, so users can skip copying it.
+  struct ParticleBody {};
+
+  enum OrbitLane {
+    OrbitLane_P = 0,
+    OrbitLane_E,
+    OrbitLane_Theta,
+    OrbitLane_XDir, // 3 lanes
+    OrbitLane_YDir = OrbitLane_XDir + 3, // 3 lanes
+    OrbitLane_Count = OrbitLane_YDir + 3
+  };
+
+  struct ParticleColumns {
+    ortable::Column<double> m_pos;
+    ortable::Column<double> m_vel;
+    ortable::Column<double> m_userAcc;
+
+    // Authoritative state in IntegrationMethod_FixedLeapfrog; m_pos and m_vel are copies for everyone
+    // else. Loaded from m_pos and m_vel when not valid, e.g. after switching from another method.
+    ortable::Column<Fixed64> m_fixedPos;
+    ortable::Column<Fixed64> m_fixedVel;
+    ortable::Column<uint8_t> m_fixedValid;
+  };
 
-    // Computed each frame
-    orVec3 m_soiParentPos;
-    orEphemerisHybrid m_osculatingOrbit;
+  struct ParticleDerivedColumns {
+    ortable::Column<uint32_t> m_serial; // m_stateSerial when last computed; 0 if never
+    ortable::Column< orbital::Id<GravBody> > m_soiParentId;
+    ortable::Column<double> m_soiParentPos;
+    ortable::Column<double> m_osculatingOrbit; // OrbitLane_Count lanes
+    ortable::Column<uint8_t> m_orbitValid; // Cleared by thrust etc; see above
+    ortable::Column<uint32_t> m_orbitVersion; // Bumped when the orbit (other than theta) is recomputed; 0 if never
   };
 
-  DECLARE_SYSTEM_TYPE(ParticleBody, ParticleBodies);
+  uint32_t numParticleBodies() const { return orbital::id_array::num_objects(m_particleBodyIds); }
+  orbital::Id<ParticleBody> makeParticleBody();
+  void makeParticleBodies(uint32_t _count, std::vector< orbital::Id<ParticleBody> >& o_ids);
+  void removeParticleBody(orbital::Id<ParticleBody> _id);
+  orbital::Id<ParticleBody> nextParticleBody(orbital::Id<ParticleBody> _id) const { return orbital::id_array::next_id(m_particleBodyIds, _id); }
+
+  // Recorded in _commands and applied at its next apply(); the id can be used (e.g. stored in an entity)
+  // straight away, but the body only exists after that. Removes compact the tables in one pass.
+  orbital::Id<ParticleBody> makeParticleBodyDeferred(orbital::CommandBuffer& _commands, orVec3 const& _pos, orVec3 const& _vel);
+  void removeParticleBodyDeferred(orbital::CommandBuffer& _commands, orbital::Id<ParticleBody> _id);
+
+  orVec3 getParticlePos(orbital::Id<ParticleBody> _id) const { return getParticleVec3(m_particleTable, m_particleColumns.m_pos, _id); }
+  orVec3 getParticleVel(orbital::Id<ParticleBody> _id) const { return getParticleVec3(m_particleTable, m_particleColumns.m_vel, _id); }
+  orVec3 getParticleUserAcc(orbital::Id<ParticleBody> _id) const { return getParticleVec3(m_particleTable, m_particleColumns.m_userAcc, _id); }
+
+  // Derived, computed on demand and cached in the particle's row, so even though they're const they
+  // write. Concurrent reads of different particles are fine (each only touches its own row); two
+  // threads reading the same particle at once are not. Nothing may change the particles meanwhile.
+  orbital::Id<GravBody> getParticleSoiParentId(orbital::Id<ParticleBody> _id) const;
+  orVec3 getParticleSoiParentPos(orbital::Id<ParticleBody> _id) const;
+  orEphemerisHybrid getParticleOsculatingOrbit(orbital::Id<ParticleBody> _id) const;
+  uint32_t getParticleOrbitVersion(orbital::Id<ParticleBody> _id) const;
+
+  void setParticlePos(orbital::Id<ParticleBody> _id, orVec3 const& _pos) { setParticleVec3(m_particleColumns.m_pos, _id, _pos); invalidateParticle(_id); }
+  void setParticleVel(orbital::Id<ParticleBody> _id, orVec3 const& _vel) { setParticleVec3(m_particleColumns.m_vel, _id, _vel); invalidateParticle(_id); }
+  void setParticleUserAcc(orbital::Id<ParticleBody> _id, orVec3 const& _userAcc) { setParticleVec3(m_particleColumns.m_userAcc, _id, _userAcc); }
+
+  // Sets the fixed point state directly, and the double state from it
+  void setParticleFixedState(orbital::Id<ParticleBody> _id, orFixedVec3 const& _pos, orFixedVec3 const& _vel);
+
+  // For kernels that want to work on whole lanes
+  ortable::Table const& getParticleTable() const { return m_particleTable; }
+  ParticleColumns const& getParticleColumns() const { return m_particleColumns; }
 
   struct GravBody : public Body
   {
-    GravBody() : Body(), m_radius(0), m_mass(0), m_parentBodyId() {}
+    GravBody() : Body(), m_radius(0), m_mass(0), m_parentBodyId(), m_orbit(), m_orbitTime(0), m_orbitVersion(0) {}
 
     double m_radius;
     double m_mass;
     orEphemerisJPL m_ephemeris; // constant
     orbital::Id<GravBody> m_parentBodyId;
+
+    // Conic around the parent, from m_ephemeris. Only theta is updated every update(); the rest is
+    // recomputed once a sim day or so, which bumps m_orbitVersion.
+    orEphemerisHybrid m_orbit;
+    double m_orbitTime; // Sim time the rest was computed for
+    uint32_t m_orbitVersion; // 0 if never computed
   };
 
   DECLARE_SYSTEM_TYPE(GravBody, GravBodies);
@@ -45,26 +123,64 @@ public:
     IntegrationMethod_ExplicitEuler = 0,
     IntegrationMethod_ImprovedEuler,
     IntegrationMethod_RK4,
+    IntegrationMethod_FixedLeapfrog, // Deterministic; see UpdateFixed()
     IntegrationMethod_Count
   };
 
   void update(IntegrationMethod const integrationMethod, double const t, double const dt);
-  GravBody const& findSOIGravBody(ParticleBody const& body) const;
+  GravBody const& findSOIGravBody(orVec3 const& _pos) const;
+  orbital::Id<GravBody> findSOIGravBodyId(orVec3 const& _pos) const;
+
+  // FNV-1a hash of the particle body states, bit exact. In IntegrationMethod_FixedLeapfrog this is the
+  // same on every machine given the same starting state and the same inputs (dt, user accelerations),
+  // so lockstep peers or a replay can compare hashes rather than whole states to detect a desync.
+  uint64_t stateHash() const;
+
+  // Bodies and particle state; derived data is recomputed after loading
+  void save(orbital::SnapshotWriter& _writer) const;
+  bool check(orbital::SnapshotReader const& _reader) const; // Whether load() would succeed
+  bool load(orbital::SnapshotReader const& _reader);
 
 private:
+  PhysicsSystem(PhysicsSystem const&) = delete;
+  PhysicsSystem& operator=(PhysicsSystem const&) = delete;
+
+  orVec3 getParticleVec3(ortable::Table const& _table, ortable::Column<double> _column, orbital::Id<ParticleBody> _id) const;
+  void setParticleVec3(ortable::Column<double> _column, orbital::Id<ParticleBody> _id, orVec3 const& _v);
+  void invalidateParticle(orbital::Id<ParticleBody> _id);
+  void InvalidateThrustingOrbits();
+  uint32_t derivedParticleRow(orbital::Id<ParticleBody> _id) const;
+
+  struct ParticleQueue; // CommandBuffer queue for m_particleBodyIds and both tables
+
+  orbital::PagedIdArray<ParticleBody> m_particleBodyIds;
+  ortable::Table m_particleTable;
+  ParticleColumns m_particleColumns;
+
+  // Cache, filled in by the const getters
+  mutable ortable::Table m_particleDerivedTable;
+  ParticleDerivedColumns m_particleDerivedColumns;
+  uint32_t m_stateSerial; // Bumped every update(), which invalidates all derived data
+
+void UpdateFixed(double const t, double const dt);
+void CalcParticleAccelFixed(orbital::FrameVector<orFixedVec3> const& gravPos, orbital::FrameVector<orFixedVec3> const& pos, orbital::FrameVector<orFixedVec3>& o_a);
+void CalcGravPositionsFixed(Fixed64 t_C, orbital::FrameVector<orFixedVec3>& out);
+Fixed64 CalcCenturiesSinceJ2000Fixed(double t);
+void UpdateGravBodies(double t);
+void UpdateParticleDerived(uint32_t row) const;
 
 void CalcDxDt(
   int numParticles,
   double t,
-  Eigen::Array3Xd const& x0, // initial states (pos+vel)
-  Eigen::Array3Xd& dxdt0 // output, rate of change in state
+  Eigen::ArrayXXd const& x0, // initial states (pos xyz lanes, vel xyz lanes)
+  Eigen::ArrayXXd& dxdt0 // output, rate of change in state
 );
 
 template< class P, class OA >
 void CalcAccel(
   double t,
   int numParticles,
-  P const& p, // position for each body
+  P const& p, // position for each body, one column per lane
   OA /* would be & but doesn't work with temporary from Eigen's .block() */ o_a // output, accelerations
 );
 
@@ -82,6 +198,6 @@ void CalcParticleGrav(double t, int numParticles, PP const& pp, OA /* would be &
 template< class OA >
 void CalcParticleUserAcc(int numParticles, OA /* would be & but doesn't work with temporary from Eigen's .block() */ o_a);
 
-void CalcGravEphemerisCartesian(double t, std::vector<orEphemerisCartesian>& out);
+void CalcGravEphemerisCartesian(double t, orbital::FrameVector<orEphemerisCartesian>& out);
 
 }; // class PhysicsSystem
\ No newline at end of file
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "orStd.h"
+
+#ifdef _MSC_VER
+# include "win32/fiber_win32.h"
+# else
+# include "linux/fiber_linux.h"
+#endif
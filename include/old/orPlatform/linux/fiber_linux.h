@@ -0,0 +1,89 @@
+#pragma once
+
+#include "orPlatform/memory.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ucontext.h>
+
+namespace orPlatform {
+
+// Runs on a new fiber. Must never return: switch to another fiber instead.
+typedef void (FiberFn)(void* _userData);
+
+// A stack and saved registers that a thread can switch to and back from. A fiber only ever runs on
+// one thread at a time, and here on the thread that made it.
+struct Fiber {
+  ucontext_t context;
+  char* stack; // NULL for a thread's own fiber
+  size_t stackSize; // Including the guard page
+  FiberFn* fn;
+  void* userData;
+};
+
+namespace detail {
+  // makecontext() only passes ints
+  inline void fiberStart(int const _hi, int const _lo) {
+    uint64_t const bits = ((uint64_t)(uint32_t)_hi << 32) | (uint32_t)_lo;
+    Fiber* const fiber = reinterpret_cast<Fiber*>((uintptr_t)bits);
+    fiber->fn(fiber->userData);
+  }
+} // namespace detail
+
+// Lets the calling thread switch to other fibers; what it returns is the thread's own stack, to
+// switch back to.
+inline Fiber* convertThreadToFiber() {
+  Fiber* const fiber = new Fiber();
+  fiber->stack = NULL;
+  fiber->stackSize = 0;
+  fiber->fn = NULL;
+  fiber->userData = NULL;
+  return fiber;
+}
+
+// From the thread the fiber came from, once it's back on its own stack
+inline void convertFiberToThread(Fiber* const _fiber) {
+  delete _fiber;
+}
+
+// A fiber that calls _fn(_userData) when first switched to. The stack has a guard page below it, so
+// running off the end faults rather than trampling something. Returns NULL on failure.
+inline Fiber* createFiber(size_t const _stackSize, FiberFn* const _fn, void* const _userData) {
+  size_t const page = memoryPageSize();
+  size_t const stackSize = (_stackSize + page - 1) / page * page + page;
+  char* const stack = static_cast<char*>(reserveMemory(stackSize));
+  if (!stack) { return NULL; }
+  if (!commitMemory(stack + page, stackSize - page)) {
+    releaseMemory(stack, stackSize);
+    return NULL;
+  }
+
+  Fiber* const fiber = new Fiber();
+  fiber->stack = stack;
+  fiber->stackSize = stackSize;
+  fiber->fn = _fn;
+  fiber->userData = _userData;
+
+  getcontext(&fiber->context);
+  fiber->context.uc_stack.ss_sp = stack + page;
+  fiber->context.uc_stack.ss_size = stackSize - page;
+  fiber->context.uc_link = NULL;
+  uint64_t const bits = (uint64_t)(uintptr_t)fiber;
+  makecontext(&fiber->context, (void (*)())&detail::fiberStart, 2, (int)(uint32_t)(bits >> 32), (int)(uint32_t)bits);
+  return fiber;
+}
+
+// Not the running one
+inline void deleteFiber(Fiber* const _fiber) {
+  releaseMemory(_fiber->stack, _fiber->stackSize);
+  delete _fiber;
+}
+
+// Saves the running fiber, _from, and carries on with _to. Returns when something switches back.
+// Saves and restores the signal mask too, so it's a system call each way: fine for tasks that
+// wait, not for anything per item.
+inline void switchToFiber(Fiber* const _from, Fiber* const _to) {
+  swapcontext(&_from->context, &_to->context);
+}
+
+} // namespace orPlatform
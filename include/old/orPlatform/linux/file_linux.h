@@ -0,0 +1,95 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <string>
+
+namespace orPlatform {
+
+struct FilePiece {
+  void const* data;
+  size_t size;
+};
+
+// Writes the pieces back to back as the whole of _path, without copying them into one buffer first.
+// Written to a temporary file and renamed over _path, so a failed write leaves the old file alone.
+inline bool writeFileGather( char const* const _path, FilePiece const* const _pieces, size_t const _count ) {
+  std::string const tmpPath = std::string(_path) + ".tmp";
+  int const fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) { return false; }
+
+  enum { MAX_IOV = 64 };
+  bool ok = true;
+  size_t piece = 0;
+  size_t offset = 0; // Already written of _pieces[piece]
+  while (ok && piece < _count) {
+    struct iovec iov[MAX_IOV];
+    int n = 0;
+    for (size_t i = piece; i < _count && n < MAX_IOV; ++i, ++n) {
+      size_t const skip = (i == piece) ? offset : 0;
+      iov[n].iov_base = const_cast<char*>(static_cast<char const*>(_pieces[i].data)) + skip;
+      iov[n].iov_len = _pieces[i].size - skip;
+    }
+    ssize_t const written = writev(fd, iov, n);
+    if (written < 0) {
+      ok = (errno == EINTR);
+      continue;
+    }
+    // May have been a short write
+    size_t left = (size_t)written;
+    while (piece < _count && left >= _pieces[piece].size - offset) {
+      left -= _pieces[piece].size - offset;
+      offset = 0;
+      ++piece;
+    }
+    offset += left;
+  }
+
+  ok = (close(fd) == 0) && ok;
+  if (ok) {
+    ok = (rename(tmpPath.c_str(), _path) == 0);
+  }
+  if (!ok) {
+    unlink(tmpPath.c_str());
+  }
+  return ok;
+}
+
+struct MappedFile {
+  MappedFile() : data(NULL), size(0) {}
+  void const* data;
+  size_t size;
+};
+
+// Maps the whole of _path read only. Returns false if it can't be opened, or is empty.
+inline bool mapFile( char const* const _path, MappedFile* const o_file ) {
+  int const fd = open(_path, O_RDONLY);
+  if (fd < 0) { return false; }
+  struct stat st;
+  void* p = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd); // The mapping keeps the file open
+  if (p == MAP_FAILED) { return false; }
+  o_file->data = p;
+  o_file->size = (size_t)st.st_size;
+  return true;
+}
+
+inline void unmapFile( MappedFile* const _file ) {
+  if (_file->data) {
+    munmap(const_cast<void*>(_file->data), _file->size);
+  }
+  _file->data = NULL;
+  _file->size = 0;
+}
+
+} // namespace orPlatform
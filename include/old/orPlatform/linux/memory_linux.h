@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace orPlatform {
+
+// Granularity of reserve / commit.
+inline size_t memoryPageSize() {
+  return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// Reserves _size bytes of address space without backing it with memory. Returns NULL on failure.
+inline void* reserveMemory( size_t const _size ) {
+  void* const p = mmap(NULL, _size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  return (p == MAP_FAILED) ? NULL : p;
+}
+
+// Makes part of a reserved range usable. _p and _size must be page aligned. Committed memory is zeroed.
+inline bool commitMemory( void* const _p, size_t const _size ) {
+  return mprotect(_p, _size, PROT_READ | PROT_WRITE) == 0;
+}
+
+// Releases a whole reserved range, committed or not.
+inline void releaseMemory( void* const _p, size_t const _size ) {
+  munmap(_p, _size);
+}
+
+} // namespace orPlatform
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace orPlatform {
+
+// One logical CPU. The ids are small and dense across the machine, so two CPUs with the same core
+// are SMT siblings, with the same cache share a last level cache, etc.
+struct CpuInfo {
+  int cpu; // What pinCurrentThread() takes
+  int core;
+  int cache; // Last level (L3) cache domain
+  int node; // NUMA node
+  int package;
+};
+
+namespace detail {
+  // First integer in a sysfs file, or -1
+  inline int readSysInt( char const* const _path ) {
+    FILE* const file = fopen(_path, "r");
+    if (!file) { return -1; }
+    int value = -1;
+    if (fscanf(file, "%d", &value) != 1) { value = -1; }
+    fclose(file);
+    return value;
+  }
+
+  inline bool readSysString( char const* const _path, char* const o_buf, size_t const _size ) {
+    FILE* const file = fopen(_path, "r");
+    if (!file) { return false; }
+    bool const ok = fgets(o_buf, (int)_size, file) != NULL;
+    fclose(file);
+    return ok;
+  }
+
+  // Index of _key in _keys, adding it if it's new
+  inline int denseId( std::vector<long>& _keys, long const _key ) {
+    std::vector<long>::iterator const it = std::find(_keys.begin(), _keys.end(), _key);
+    if (it != _keys.end()) { return (int)(it - _keys.begin()); }
+    _keys.push_back(_key);
+    return (int)_keys.size() - 1;
+  }
+
+  inline bool lessByPlacement( CpuInfo const& _a, CpuInfo const& _b ) {
+    if (_a.node != _b.node) { return _a.node < _b.node; }
+    if (_a.package != _b.package) { return _a.package < _b.package; }
+    if (_a.cache != _b.cache) { return _a.cache < _b.cache; }
+    if (_a.core != _b.core) { return _a.core < _b.core; }
+    return _a.cpu < _b.cpu;
+  }
+} // namespace detail
+
+// The CPUs this process may run on, sorted by node, package, cache, core, so that close CPUs are
+// next to each other. Returns false if the topology couldn't be read.
+// From /sys/devices/system/cpu; anything missing (e.g. no L3, or no NUMA) counts as shared by all.
+inline bool getCpuTopology( std::vector<CpuInfo>* const o_cpus ) {
+  o_cpus->clear();
+
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) { return false; }
+
+  std::vector<long> coreKeys, cacheKeys, nodeKeys, packageKeys;
+  char path[256];
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (!CPU_ISSET(cpu, &allowed)) { continue; }
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+    int const package = std::max(0, detail::readSysInt(path));
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+    int const core = detail::readSysInt(path);
+
+    // The last level cache is named by the first CPU sharing it
+    int cacheCpu = -1;
+    for (int index = 0; ; ++index) {
+      snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+      int const level = detail::readSysInt(path);
+      if (level < 0) { break; }
+      char shared[256];
+      snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+      if (level >= 3 && detail::readSysString(path, shared, sizeof(shared))) {
+        cacheCpu = atoi(shared);
+      }
+    }
+
+    // The node is a nodeN link in the CPU's directory
+    int node = 0;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    if (DIR* const dir = opendir(path)) {
+      while (struct dirent const* const entry = readdir(dir)) {
+        if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+          node = atoi(entry->d_name + 4);
+          break;
+        }
+      }
+      closedir(dir);
+    }
+
+    CpuInfo info;
+    info.cpu = cpu;
+    info.package = detail::denseId(packageKeys, package);
+    info.core = detail::denseId(coreKeys, (core < 0) ? -1 - cpu : (long)package * 65536 + core); // No core id: a core of its own
+    info.cache = detail::denseId(cacheKeys, (cacheCpu < 0) ? -1 - package : cacheCpu); // No L3: share the package
+    info.node = detail::denseId(nodeKeys, node);
+    o_cpus->push_back(info);
+  }
+
+  std::sort(o_cpus->begin(), o_cpus->end(), &detail::lessByPlacement);
+  return !o_cpus->empty();
+}
+
+// Keeps the calling thread on one CPU
+inline bool pinCurrentThread( int const _cpu ) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(_cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+} // namespace orPlatform
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "orStd.h"
+
+#ifdef _MSC_VER
+# include "win32/topology_win32.h"
+# else
+# include "linux/topology_linux.h"
+#endif
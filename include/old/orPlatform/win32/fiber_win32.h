@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+
+// Defined in fiber_win32.cpp to keep Windows.h out of headers
+namespace orPlatform {
+
+// Runs on a new fiber. Must never return: switch to another fiber instead.
+typedef void (FiberFn)(void* _userData);
+
+// A stack and saved registers that a thread can switch to and back from. A fiber only ever runs on
+// one thread at a time.
+struct Fiber {
+  void* handle;
+  bool ownsThread; // Made by convertThreadToFiber(); converts back when deleted
+  FiberFn* fn;
+  void* userData;
+};
+
+// Lets the calling thread switch to other fibers; what it returns is the thread's own stack, to
+// switch back to.
+Fiber* convertThreadToFiber();
+
+// From the thread the fiber came from, once it's back on its own stack
+void convertFiberToThread( Fiber* const _fiber );
+
+// A fiber that calls _fn(_userData) when first switched to. Returns NULL on failure.
+Fiber* createFiber( size_t const _stackSize, FiberFn* const _fn, void* const _userData );
+
+// Not the running one
+void deleteFiber( Fiber* const _fiber );
+
+// Saves the running fiber, _from, and carries on with _to. Returns when something switches back.
+void switchToFiber( Fiber* const _from, Fiber* const _to );
+
+} // namespace orPlatform
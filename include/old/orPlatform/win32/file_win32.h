@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+
+// Defined in file_win32.cpp to keep Windows.h out of headers
+namespace orPlatform {
+
+struct FilePiece {
+  void const* data;
+  size_t size;
+};
+
+// Writes the pieces back to back as the whole of _path, without copying them into one buffer first.
+// Written to a temporary file and renamed over _path, so a failed write leaves the old file alone.
+bool writeFileGather( char const* const _path, FilePiece const* const _pieces, size_t const _count );
+
+struct MappedFile {
+  MappedFile() : data(NULL), size(0) {}
+  void const* data;
+  size_t size;
+};
+
+// Maps the whole of _path read only. Returns false if it can't be opened, or is empty.
+bool mapFile( char const* const _path, MappedFile* const o_file );
+
+void unmapFile( MappedFile* const _file );
+
+} // namespace orPlatform
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+
+// Defined in memory_win32.cpp to keep Windows.h out of headers
+namespace orPlatform {
+
+// Granularity of reserve / commit.
+size_t memoryPageSize();
+
+// Reserves _size bytes of address space without backing it with memory. Returns NULL on failure.
+void* reserveMemory( size_t const _size );
+
+// Makes part of a reserved range usable. _p and _size must be page aligned. Committed memory is zeroed.
+bool commitMemory( void* const _p, size_t const _size );
+
+// Releases a whole reserved range, committed or not.
+void releaseMemory( void* const _p, size_t const _size );
+
+} // namespace orPlatform
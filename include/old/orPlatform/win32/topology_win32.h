@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+
+// Defined in topology_win32.cpp to keep Windows.h out of headers
+namespace orPlatform {
+
+// One logical CPU. The ids are small and dense across the machine, so two CPUs with the same core
+// are SMT siblings, with the same cache share a last level cache, etc.
+struct CpuInfo {
+  int cpu; // What pinCurrentThread() takes
+  int core;
+  int cache; // Last level (L3) cache domain
+  int node; // NUMA node
+  int package;
+};
+
+// The CPUs this process may run on, sorted by node, package, cache, core, so that close CPUs are
+// next to each other. Returns false if the topology couldn't be read.
+bool getCpuTopology( std::vector<CpuInfo>* const o_cpus );
+
+// Keeps the calling thread on one CPU
+bool pinCurrentThread( int const _cpu );
+
+} // namespace orPlatform
@@ -0,0 +1,70 @@
+#ifndef GPUTIMER_H
+#define	GPUTIMER_H
+
+#include "orProfile/perftimer.h"
+
+#include <stdint.h>
+
+// Times spans of GL commands with timestamp queries, and records them to a "GPU" PerfTimer log, so
+// they show up in Print() and in traces next to the CPU side. Results are read back a few frames
+// later, when the GPU's done with them; if it's further behind than that they're dropped rather
+// than stalling.
+//
+// Only on the thread with the GL context. Does nothing without GL 3.3 or ARB_timer_query.
+class GpuTimers
+{
+public:
+  GpuTimers();
+
+  void init();     // With the GL context current
+  void shutdown(); // Before the context goes
+
+  // Returns a handle for end(); -1 if there are no queries left this frame
+  int begin(PerfTimer::Id _id);
+  void end(int _timer);
+
+  // After swapping buffers: reads back whichever frame's results are ready
+  void endFrame();
+
+  class Scope
+  {
+  public:
+    Scope(GpuTimers& _timers, PerfTimer::Id const _id) : m_timers(_timers), m_timer(_timers.begin(_id)) {}
+    ~Scope() { m_timers.end(m_timer); }
+  private:
+    Scope(Scope const&);
+    Scope& operator=(Scope const&);
+    GpuTimers& m_timers;
+    int m_timer;
+  };
+
+private:
+  GpuTimers(GpuTimers const&);
+  GpuTimers& operator=(GpuTimers const&);
+
+  enum {
+    FRAMES_IN_FLIGHT = 4, // Results are read this many frames late
+    MAX_TIMERS = 32       // Per frame
+  };
+
+  struct Frame
+  {
+    uint32_t queries[MAX_TIMERS * 2]; // GLuint; start and end timestamps
+    PerfTimer::Id ids[MAX_TIMERS];
+    int numTimers;
+  };
+
+  bool m_enabled;
+  Frame m_frames[FRAMES_IN_FLIGHT];
+  uint32_t m_frameIdx;
+  double m_ticksPerNano; // Timer::PerfTime per GPU nanosecond
+  PerfTimer::ThreadLog* m_log;
+};
+
+// Like PERFTIMER, for the GPU time of the GL commands issued in scope
+#define GPUTIMER(_TIMERS, _NAME) \
+  static PerfTimer::Id const PERFTIMER_CONCAT(gpuTimerId, __LINE__) = PerfTimer::Intern(_NAME); \
+  GpuTimers::Scope PERFTIMER_CONCAT(gpuTimer, __LINE__)((_TIMERS), PERFTIMER_CONCAT(gpuTimerId, __LINE__));
+
+#endif	/* GPUTIMER_H */
+
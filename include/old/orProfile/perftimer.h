@@ -1,4 +1,4 @@
-/* 
+/*
  * File:   perftimer.h
  * Author: fib
  *
@@ -10,92 +10,121 @@
 
 #include "timer.h"
 
-#include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 
+#include <atomic>
 #include <map>
-#include <stack>
 #include <string>
 
+// Scoped timer, cheap enough to leave on everywhere, on any thread: see PERFTIMER.
+//
+// Names are interned once per call site, so a timer is just an id and a start time. When it goes
+// out of scope the whole span (id, start, end) goes into a ring buffer belonging to the thread; no
+// locks, no allocation. Once a frame Collect() drains every thread's ring and builds the call tree
+// from the spans' times, off the hot path. A thread's ring lives until StaticShutdown(), so time
+// things on long lived threads (the main thread, task workers), not throwaway ones.
+//
+// Spans are recorded whole when they end, so it doesn't matter that timers stop out of order when a
+// task is suspended inside one while its thread runs other tasks (see TaskSchedulerWorkStealing).
+// The span just looks like it contains whatever the thread ran meanwhile.
+//
+// For finding the odd slow frame, StartCapture() also keeps every span over some frames and writes
+// them out as a timeline (see TraceExport), along with task scheduler events and GPU times.
 class PerfTimer
 {
 public:
-  PerfTimer(char const* const _name) :
-    m_name(_name),
-    m_startTime(Timer::GetPerfTime()),
-    m_entry(Start(_name))
+  typedef uint16_t Id;
+
+  explicit PerfTimer(Id const _id) :
+    m_id(_id),
+    m_startTime(Timer::GetPerfTime())
   {
   }
-  
+
   ~PerfTimer()
   {
-    m_entry->time += Timer::GetPerfTime() - m_startTime;
-    Stop(m_entry);
+    Record(m_id, m_startTime, Timer::GetPerfTime());
+  }
+
+  // The same id for the same name. Takes a lock, so only once per call site, as PERFTIMER does.
+  // The name is kept, not copied: it has to be a literal, or live as long.
+  static Id Intern(char const* _name);
+  static char const* Name(Id _id);
+
+  enum SpanKind {
+    SpanKind_Scope,   // A PERFTIMER; goes in the tree
+    SpanKind_Task,    // Only recorded while capturing, so only in traces
+    SpanKind_Instant, // No duration (end is start); only in traces
+    SpanKind_Frame    // Collect() to Collect(), while capturing; only in traces
+  };
+
+  // Appends a span to the calling thread's ring. If Collect() hasn't been called for a long time,
+  // the oldest spans are overwritten. arg is shown with it in traces.
+  static void Record(Id _id, Timer::PerfTime _start, Timer::PerfTime _end, SpanKind _kind = SpanKind_Scope, uint32_t _arg = 0);
+  static void RecordInstant(Id const _id, uint32_t const _arg = 0)
+  {
+    Timer::PerfTime const now = Timer::GetPerfTime();
+    Record(_id, now, now, SpanKind_Instant, _arg);
   }
-  
+
+  struct ThreadLog; // A thread's ring, and its tree so far
+
+  // For Print() and traces; otherwise it's "Thread N", N in order of first use
+  static void NameThread(char const* _name);
+
+  // A log that isn't any thread's, e.g. for GPU times. Only one thread at a time may record to it.
+  static ThreadLog* AddLog(char const* _name);
+  static void Record(ThreadLog& _log, Id _id, Timer::PerfTime _start, Timer::PerfTime _end, SpanKind _kind = SpanKind_Scope, uint32_t _arg = 0);
+
   struct Entry;
-  
-  typedef std::map<std::string, Entry> Map;
+
+  typedef std::map<Id, Entry> Map;
   typedef Map::const_iterator Iter;
-  
+
+  // Totals for one path through the call tree
   struct Entry
   {
-    Entry() : name(), time(0), children() {}
-    std::string name;
+    Entry() : time(0), count(0), children() {}
     Timer::PerfTime time;
+    uint64_t count;
     Map children;
   };
-  
-  static Entry* Start(char const* const _name)
-  {
-    Entry* curEntry = s_stack.top();
-    Map& children = curEntry->children;
-    
-    children.insert(std::make_pair(_name, Entry()));
-    Entry* newEntry = &children.at(_name);
-    
-    s_stack.push(newEntry);
-    return newEntry;
-  }
-  
-  static void Stop(Entry* const _entry)
-  {
-    assert(s_stack.top() == _entry);
-    s_stack.pop();
-  }
-  
-  static void StaticInit()
-  {
-    s_startTime = Timer::GetPerfTime();
-    s_stack.push(&s_parent);
-  }
-  
-  static void StaticShutdown()
-  {
-    s_parent.time += Timer::GetPerfTime() - s_startTime;
-    s_stack.pop();
 
-    Print();
-  }
-  
-  static void Print()
-  {
-    Print(&s_parent, std::string());
-  }
-  
-  static void Print(Entry const* const _entry, std::string const& _indent);
+  static void StaticInit();
+
+  // From one thread, once a frame: adds every thread's spans since the last call to its tree
+  static void Collect();
+
+  // From any thread. Keeps everything recorded over the numFrames Collect() calls after the next
+  // one, then writes it to path on a background thread. Does nothing if a capture's under way.
+  static void StartCapture(uint32_t _numFrames, char const* _path);
+  // For recording things that are only wanted in traces, and cost too much to record all the time
+  static bool IsCapturing() { return s_capturing.load(std::memory_order_relaxed); }
+
+  // Collects, finishes any capture, prints every thread's tree, and frees everything
+  static void StaticShutdown();
+
+  static void Print();
+  static void Print(Entry const* _entry, std::string const& _indent);
 
 private:
-  char const* m_name;
+  static ThreadLog& GetThreadLog();
+  static void FinishCapture();
+
+  static std::atomic<bool> s_capturing;
+
+  Id m_id;
   Timer::PerfTime m_startTime;
-  Entry* m_entry;
-  
-  static std::stack<Entry*> s_stack;
-  static Entry s_parent;
-  static Timer::PerfTime s_startTime;
 };
 
-#define PERFTIMER(_NAME) PerfTimer perfTimer##__LINE__(_NAME);
+#define PERFTIMER_CONCAT_IMPL(_A, _B) _A##_B
+#define PERFTIMER_CONCAT(_A, _B) PERFTIMER_CONCAT_IMPL(_A, _B)
+
+// The name is interned the first time the line runs; after that it's one branch on a static
+#define PERFTIMER(_NAME) \
+  static PerfTimer::Id const PERFTIMER_CONCAT(perfTimerId, __LINE__) = PerfTimer::Intern(_NAME); \
+  PerfTimer PERFTIMER_CONCAT(perfTimer, __LINE__)(PERFTIMER_CONCAT(perfTimerId, __LINE__));
 
 #endif	/* PERFTIMER_H */
 
@@ -0,0 +1,45 @@
+#ifndef TRACEEXPORT_H
+#define	TRACEEXPORT_H
+
+#include "timer.h"
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// Writes what PerfTimer::StartCapture() kept as a Chrome Trace Event JSON file, for chrome://tracing
+// or ui.perfetto.dev: a track per thread with its scopes and tasks, scheduler events as instants,
+// a track of frames and one of GPU times.
+class TraceExport
+{
+public:
+  struct Event
+  {
+    Timer::PerfTime start;
+    Timer::PerfTime end;
+    uint32_t arg;
+    uint16_t id;    // PerfTimer::Id
+    uint8_t kind;   // PerfTimer::SpanKind
+    uint16_t track; // Into Capture::trackNames
+  };
+
+  struct Capture
+  {
+    std::string path;
+    Timer::PerfTime startTime; // Times in the file are from here
+    std::vector<std::string> trackNames;
+    std::vector<Event> events;
+  };
+
+  // Takes the capture, and writes it on a background thread. Waits for the last write first, if
+  // it hasn't finished.
+  static void WriteAsync(Capture* _capture);
+  // Call before exiting, so a write isn't cut off
+  static void WaitForWrites();
+
+  static bool Write(Capture const& _capture);
+};
+
+#endif	/* TRACEEXPORT_H */
+
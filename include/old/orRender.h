@@ -3,6 +3,7 @@
 #include "orStd.h"
 #include "orMath.h"
 #include "orGfx.h"
+#include "orCore/orArena.h"
 #include "orCore/orSystem.h"
 
 #include <vector>
@@ -169,11 +170,72 @@ public:
   DECLARE_SYSTEM_TYPE(Trail, Trails);
 #endif
 
+  struct Line {
+    Line() : m_start(), m_end(), m_col() {}
+
+    orVec3 m_start;
+    orVec3 m_end;
+
+    orVec3 m_col;
+  };
+
+  // Labels as published in a Frame. The text is copied into the publishing thread's two frame arena
+  // (see FrameArenas), which lasts as long as the renderer can be drawing the frame.
+  struct FrameLabel2D {
+    char const* m_text;
+    orVec2 m_pos;
+    orVec3 m_col;
+  };
+
+  struct FrameLabel3D {
+    char const* m_text;
+    orVec3 m_pos;
+    orVec3 m_col;
+  };
+
+  // Everything needed to draw one frame: the camera, and a copy of all the objects above.
+  //
+  // The simulation fills in objects over the frame, from whichever threads, then publishFrame() copies
+  // them out. The renderer only ever looks at published frames, so it can draw frame N on the main
+  // thread while frame N+1 is simulated. Frames are triple buffered: one being filled, one being
+  // drawn, and the latest published one, which the two sides swap theirs with. Neither side waits;
+  // the renderer redraws its frame if nothing new has been published, and a frame that's published
+  // over before the renderer picks it up is just skipped.
+  struct Frame {
+    Frame() : m_screenFromProj(), m_projFromCam(), m_camFromWorld(), m_points(), m_label2Ds(), m_label3Ds(), m_spheres(), m_orbits(), m_lines() {}
+
+    orMat4 m_screenFromProj;
+    orMat4 m_projFromCam;
+    orMat4 m_camFromWorld;
+
+    std::vector<Point> m_points;
+    std::vector<FrameLabel2D> m_label2Ds;
+    std::vector<FrameLabel3D> m_label3Ds;
+    std::vector<Sphere> m_spheres;
+    std::vector<Orbit> m_orbits;
+    std::vector<Line> m_lines; // Debug lines; only last for the one frame
+  };
+
+  // Simulation side. The frame to fill in the camera and lines for before publishing it.
+  Frame& backFrame() { return m_frames[m_backFrameIdx]; }
+  // Copies the objects into the back frame and publishes it; the back frame is then a different one
+  // with stale contents.
+  void publishFrame();
+
+  // Render side. The latest published frame, or NULL if nothing has been published yet.
+  // Stays valid until the next call.
+  Frame const* acquireFrame();
+
   void drawLine(Vector3d const start, Vector3d const end, Vector3d const col) const;
-  void render2D(int w_px, int h_px, Eigen::Matrix4d const& screenFromWorld); // TODO not the best params...
-  void render3D();
+  void render2D(Frame const& frame, int w_px, int h_px);
+  void render3D(Frame const& frame);
+
+  void render(FrameBuffer const& frameBuffer, Colour clearCol, float clearDepth, Frame const& frame); // TODO not the best params...
 
-  void render(FrameBuffer const& frameBuffer, Colour clearCol, float clearDepth, Eigen::Matrix4d const& screenMtx, Eigen::Matrix4d const& projMtx, Eigen::Matrix4d const& camMtx); // TODO not the best params...
+  // Just the objects; frames aren't saved
+  void save(orbital::SnapshotWriter& _writer) const;
+  bool check(orbital::SnapshotReader const& _reader) const; // Whether load() would succeed
+  bool load(orbital::SnapshotReader const& _reader);
 
 private:
   void drawCircle(double const radius, int const steps) const;
@@ -181,23 +243,38 @@ private:
   void drawWireSphere(Vector3d const pos, double const radius, int const slices, int const stacks) const;
   void drawAxes(Vector3d const pos, double const size) const;
 
-  void drawString(std::string const& str, int pos_x, int pos_y);
+  void drawString(char const* str, int pos_x, int pos_y);
 
-  void projectLabel3Ds(Eigen::Matrix4d const& screenFromWorld);
+  void projectLabel3Ds(Frame const& frame);
 
-  void renderPoints() const;
-  void renderLabels( int w_px, int h_px );
-  void renderSpheres() const;
-  void renderOrbits() const;
+  void renderPoints(Frame const& frame) const;
+  void renderLabels(Frame const& frame, int w_px, int h_px);
+  void renderSpheres(Frame const& frame) const;
+  void renderOrbits(Frame const& frame) const;
+  void renderLines(Frame const& frame) const;
 #if 0
   void renderTrails() const;
 #endif
 
 private:
-  // 2D labels for this frame
-  std::vector<Label2D> m_label2DBuffer;
+  // The published frame's index is in m_readyFrame, with FRAME_FRESH set until the renderer takes it
+  enum { NUM_FRAMES = 3, FRAME_INDEX_MASK = 0x3, FRAME_FRESH = 0x4 };
+  Frame m_frames[NUM_FRAMES];
+  uint32_t m_backFrameIdx; // Simulation side only
+  uint32_t m_frontFrameIdx; // Render side only
+  bool m_frontFrameValid; // Render side only; false until the first frame is published
+  uint32_t m_readyFrame; // Shared
+
+  // Projected 3D labels for the frame being drawn; the text is the frame's
+  std::vector<FrameLabel2D> m_label2DBuffer;
 
   uint32_t m_fontTextureId;
 
   SDL_Surface* m_fontImage;
 }; // class RenderSystem
+
+// Labels have text, so can't be saved as bytes
+void snapshotWriteObjects(orbital::SnapshotWriter& _writer, RenderSystem::Label2D const* _labels, uint32_t _count);
+bool snapshotReadObjects(orbital::SnapshotReader::Cursor& _cursor, RenderSystem::Label2D* o_labels, uint32_t _count);
+void snapshotWriteObjects(orbital::SnapshotWriter& _writer, RenderSystem::Label3D const* _labels, uint32_t _count);
+bool snapshotReadObjects(orbital::SnapshotReader::Cursor& _cursor, RenderSystem::Label3D* o_labels, uint32_t _count);
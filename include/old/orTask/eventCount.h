@@ -0,0 +1,78 @@
+#ifndef EVENTCOUNT_H
+#define	EVENTCOUNT_H
+
+#include "orPlatform/atomic.h"
+
+#include "boost_begin.h"
+#include <boost/thread.hpp>
+#include "boost_end.h"
+
+namespace orTask {
+
+/* Lets a thread sleep until there might be something for it to do, without missing a wakeup.
+ *
+ * The waiting thread calls prepareWait(), checks its condition one last time, and then either
+ * cancelWait()s (something turned up) or wait()s with the key. Whoever makes the condition true
+ * calls notify*() afterwards. Anything that happened before the notify is seen by the last check or
+ * wakes the wait, so there's no window to miss it in.
+ *
+ * notify*() only takes the lock if someone's waiting, so it's cheap to call on every push.
+ */
+class EventCount {
+public:
+  typedef int Key;
+
+  EventCount() : epoch_(0), waiters_(0) {}
+
+  Key prepareWait() {
+    orPlatform::atomicInc(&waiters_); // Full barrier: the caller's last check comes after this
+    return epoch_;
+  }
+
+  void cancelWait() {
+    orPlatform::atomicDec(&waiters_);
+  }
+
+  // Returns when there's been a notify since prepareWait()
+  void wait(Key const key) {
+    {
+      boost::unique_lock<boost::mutex> lock(mutex_);
+      while (epoch_ == key) {
+        cond_.wait(lock);
+      }
+    }
+    orPlatform::atomicDec(&waiters_);
+  }
+
+  void notifyOne() { notify(false); }
+  void notifyAll() { notify(true); }
+
+private:
+  EventCount(EventCount const&);
+  EventCount& operator=(EventCount const&);
+
+  void notify(bool const all) {
+    orPlatform::fullBarrier(); // Whatever the caller changed is visible before we look for waiters
+    if (waiters_ == 0) {
+      return;
+    }
+    {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      orPlatform::atomicInc(&epoch_);
+    }
+    if (all) {
+      cond_.notify_all();
+    } else {
+      cond_.notify_one();
+    }
+  }
+
+  int epoch_;
+  int waiters_;
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+};
+
+} // namespace orTask
+
+#endif	/* EVENTCOUNT_H */
@@ -0,0 +1,161 @@
+#ifndef PARALLELFOR_H
+#define	PARALLELFOR_H
+
+#include "task.h"
+#include "orPlatform/atomic.h"
+
+#include <type_traits>
+#include <vector>
+
+// Data parallel loops on top of a TaskScheduler.
+//
+// [0, count) is cut into blocks of grain items. The calling thread starts on all of them, and splits
+// what's left of its range in half whenever its own queue is empty, i.e. whenever a thread looking
+// for work would find nothing to take from it (lazy binary splitting). So a loop nobody helps with
+// costs a handful of tasks, and one that other threads steal from splits as far as they need. Splits
+// are always on block boundaries.
+//
+// parallel_reduce reduces each block on its own and then combines the block results in order, so
+// the result depends on grain but not on how many threads there are or who ran what: sums come out
+// the same on every run.
+//
+// All of them return once every item is done. The calling thread runs other tasks while it waits, so
+// they can be used from inside a task; the function objects are called concurrently, from any thread.
+//
+// e.g.
+//
+//   orTask::parallel_for(scheduler, threadIdx, m_instancedShips, 256, [&](orTask::ThreadIdx, Ship& ship) {
+//     ...
+//   });
+namespace orTask {
+
+namespace detail {
+  inline uint32_t numBlocks(uint32_t const _count, uint32_t const _grain) {
+    ensure(_grain > 0);
+    return _count / _grain + ((_count % _grain) ? 1 : 0);
+  }
+
+  template <typename BlockFn>
+  class ParallelLoop
+  {
+  public:
+    ParallelLoop(TaskScheduler& _scheduler, uint32_t const _count, uint32_t const _grain, BlockFn const& _blockFn) :
+      m_scheduler(_scheduler),
+      m_blockFn(_blockFn),
+      m_count(_count),
+      m_grain(_grain),
+      m_numBlocks(numBlocks(_count, _grain)),
+      m_splits(m_numBlocks), // Every split takes at least one block, so this is enough
+      m_numSplits(0),
+      m_group()
+    {
+    }
+
+    void run(int const _threadIdx) {
+      runRange(_threadIdx, 0, m_numBlocks);
+      m_scheduler.waitForTaskGroup(_threadIdx, &m_group);
+    }
+
+  private:
+    ParallelLoop(ParallelLoop const&);
+    ParallelLoop& operator=(ParallelLoop const&);
+
+    struct Split {
+      ParallelLoop* loop;
+      uint32_t beginBlock;
+      uint32_t endBlock;
+    };
+
+    void runRange(ThreadIdx const _threadIdx, uint32_t _beginBlock, uint32_t _endBlock) {
+      while (_beginBlock < _endBlock) {
+        if (_endBlock - _beginBlock > 1 && m_scheduler.isLocalQueueEmpty(_threadIdx)) {
+          // Nobody could take anything from us; give them the back half
+          uint32_t const midBlock = _beginBlock + (_endBlock - _beginBlock) / 2;
+          Split& split = m_splits[orPlatform::atomicInc(&m_numSplits)];
+          split.loop = this;
+          split.beginBlock = midBlock;
+          split.endBlock = _endBlock;
+          m_scheduler.submitTaskForGroup(_threadIdx, &m_group, &runSplit, &split);
+          _endBlock = midBlock;
+          continue;
+        }
+
+        uint32_t const begin = _beginBlock * m_grain;
+        uint32_t const end = (m_count - begin < m_grain) ? m_count : begin + m_grain;
+        m_blockFn(_threadIdx, _beginBlock, begin, end);
+        ++_beginBlock;
+      }
+    }
+
+    static void runSplit(ThreadIdx const _threadIdx, void* const _userData) {
+      Split const& split = *static_cast<Split const*>(_userData);
+      split.loop->runRange(_threadIdx, split.beginBlock, split.endBlock);
+    }
+
+    TaskScheduler& m_scheduler;
+    BlockFn const& m_blockFn;
+    uint32_t const m_count;
+    uint32_t const m_grain;
+    uint32_t const m_numBlocks;
+    std::vector<Split> m_splits;
+    int m_numSplits;
+    TaskGroup m_group;
+  };
+
+  template <typename BlockFn>
+  void parallelLoop(TaskScheduler& _scheduler, int const _threadIdx, uint32_t const _count, uint32_t const _grain, BlockFn const& _blockFn) {
+    if (numBlocks(_count, _grain) <= 1) {
+      // Not worth a task
+      if (_count > 0) { _blockFn((ThreadIdx)_threadIdx, 0, 0, _count); }
+      return;
+    }
+    ParallelLoop<BlockFn> loop(_scheduler, _count, _grain, _blockFn);
+    loop.run(_threadIdx);
+  }
+} // namespace detail
+
+// Calls fn(threadIdx, begin, end) for consecutive ranges of at most grain items, covering [0, count)
+template <typename Fn>
+void parallel_for_blocks(TaskScheduler& _scheduler, int const _threadIdx, uint32_t const _count, uint32_t const _grain, Fn const& _fn) {
+  detail::parallelLoop(_scheduler, _threadIdx, _count, _grain, [&_fn](ThreadIdx const threadIdx, uint32_t, uint32_t const begin, uint32_t const end) {
+    _fn(threadIdx, begin, end);
+  });
+}
+
+// Calls fn(threadIdx, object) for every object in something with contiguous begin() and end(): an
+// IdArray or PagedIdArray (in dense order), or an ortable::Span
+template <typename Container, typename Fn>
+void parallel_for(TaskScheduler& _scheduler, int const _threadIdx, Container& _container, uint32_t const _grain, Fn const& _fn) {
+  auto* const objects = _container.begin();
+  uint32_t const count = (uint32_t)(_container.end() - objects);
+  detail::parallelLoop(_scheduler, _threadIdx, count, _grain, [objects, &_fn](ThreadIdx const threadIdx, uint32_t, uint32_t const begin, uint32_t const end) {
+    for (uint32_t i = begin; i < end; ++i) {
+      _fn(threadIdx, objects[i]);
+    }
+  });
+}
+
+// Returns combine(...combine(combine(identity, r0), r1)..., rN) where rI = map(threadIdx, begin, end)
+// for block I of [0, count). combine must be associative for the result to make sense, but the
+// blocks are always combined in the same order, so it doesn't need to be exactly associative (e.g.
+// floating point addition) to get the same result every time.
+template <typename Result, typename MapFn, typename CombineFn>
+Result parallel_reduce(TaskScheduler& _scheduler, int const _threadIdx, uint32_t const _count, uint32_t const _grain,
+  Result const& _identity, MapFn const& _map, CombineFn const& _combine)
+{
+  static_assert(!std::is_same<Result, bool>::value, "Blocks write their results concurrently, and vector<bool> packs them into shared words");
+  std::vector<Result> partials(detail::numBlocks(_count, _grain), _identity);
+  detail::parallelLoop(_scheduler, _threadIdx, _count, _grain, [&partials, &_map](ThreadIdx const threadIdx, uint32_t const block, uint32_t const begin, uint32_t const end) {
+    partials[block] = _map(threadIdx, begin, end);
+  });
+
+  Result result = _identity;
+  for (size_t i = 0; i < partials.size(); ++i) {
+    result = _combine(result, partials[i]);
+  }
+  return result;
+}
+
+} // namespace orTask
+
+#endif	/* PARALLELFOR_H */
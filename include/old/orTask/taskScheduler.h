@@ -13,27 +13,122 @@ using std::list;
 #include "orPlatform/atomic.h"
 #include "task.h"
 
+#include <atomic>
+#include <vector>
+
 namespace orTask {
   // Receives the userdata specified for the task.
   struct TaskGroup;
   struct Task;
+
+  // What one thread did in the scheduler over a frame (see TaskScheduler::endTelemetryFrame)
+  struct WorkerTelemetry
+  {
+    enum Counter {
+      Counter_TasksExecuted,
+      Counter_StealAttempts,
+      Counter_EmptyVictims, // Steal attempts that found nothing
+      Counter_LostRaces,    // ...that found something, but another thread took it first
+      Counter_Steals,       // ...that took something
+      Counter_TasksStolen,  // Including the extra ones taken along with the first
+      Counter_Suspends,     // Tasks that waited for a group and were switched away from
+      Counter_WorkingTime,  // Timer::PerfTime, added when the thread changes state
+      Counter_StealingTime,
+      Counter_ParkedTime,
+      Counter_Count
+    };
+
+    WorkerTelemetry() : queueHighWater(0) {
+      for (int i = 0; i < Counter_Count; ++i) { counters[i] = 0; }
+    }
+
+    uint64_t counters[Counter_Count];
+    uint64_t queueHighWater; // Most tasks on the thread's own queue at once
+
+    static char const* counterName(Counter counter);
+  };
   
   // Abstract base class ensuring virtual destructor
   class TaskScheduler {
   public:
-    TaskScheduler(int numThreads) :
-      numThreads_(numThreads)
-    {}
-    virtual ~TaskScheduler() {}
+    TaskScheduler(int numThreads);
+    virtual ~TaskScheduler();
 
     void submitTask(int threadIdx, TaskFn* fn, void* ud) { submitTaskForGroup(threadIdx, NULL, fn, ud); }
     virtual void submitTaskForGroup(int threadIdx, TaskGroup* group, TaskFn* fn, void* ud) = 0;
+    // Only thread targetThreadIdx will run the task, e.g. for anything touching the GL context
+    virtual void submitPinnedTaskForGroup(int threadIdx, int targetThreadIdx, TaskGroup* group, TaskFn* fn, void* ud) = 0;
+    // Returns once every task in the group is done; the thread runs other tasks meanwhile
     virtual void waitForTaskGroup(int threadIdx, TaskGroup* group) = 0;
+    // True if threadIdx has nothing queued that another thread could take. Cheap, and may be out of
+    // date; for deciding when to split work (see parallelFor.h).
+    virtual bool isLocalQueueEmpty(int threadIdx) const = 0;
 
     int getNumThreads() const { return numThreads_; }
 
+    // Call between frames, from one thread: snapshots what each thread did since the last call.
+    // Threads only count into their own counters, with relaxed atomics, so this is cheap enough to
+    // leave on all the time.
+    void endTelemetryFrame();
+    // One per thread, from the last endTelemetryFrame()
+    std::vector<WorkerTelemetry> const& getFrameTelemetry() const { return m_frameTelemetry; }
+
+    // Task graphs, built with TaskSubmitter (see task.h) on top of the above.
+    // Readiness is tracked with atomic counters on each task; whichever thread completes a task's last
+    // dependency submits it, so there's no central lock or polling.
+    TaskId next_id();
+    void add_tasks(int threadIdx, size_t n, TaskMeta const* tasks);
+    // Runs other tasks until the task is complete
+    void wait(int threadIdx, TaskId id);
+
   protected:  
+    // Called whenever a group's last task is done, so threads waiting on it can be woken. The group
+    // may already be gone: only compare the pointer.
+    virtual void onGroupDone(TaskGroup const* group) = 0;
+
+    // Only from threadIdx itself
+    void addTelemetry(int threadIdx, WorkerTelemetry::Counter counter, uint64_t n) {
+      std::atomic<uint64_t>& value = m_liveTelemetry[threadIdx].counters[counter];
+      value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    void noteQueueSize(int threadIdx, size_t size) {
+      std::atomic<uint64_t>& highWater = m_liveTelemetry[threadIdx].queueHighWater;
+      if (size > highWater.load(std::memory_order_relaxed)) {
+        highWater.store(size, std::memory_order_relaxed);
+      }
+    }
+
     int numThreads_; // TODO move to implementation
+
+  private:
+    TaskScheduler(TaskScheduler const&) = delete;
+    TaskScheduler& operator=(TaskScheduler const&) = delete;
+
+    struct GraphTask;
+
+    // Graph tasks live in a ring indexed by id, so a task's slot is reused MAX_GRAPH_TASKS ids later.
+    // It has to be complete by then.
+    enum { MAX_GRAPH_TASKS = 4096 };
+    GraphTask* graphTask(TaskId id);
+
+    void startGraphTask(int threadIdx, GraphTask* task);
+    void finishGraphTask(int threadIdx, GraphTask* task);
+    static void runGraphTask(ThreadIdx threadIdx, void* userData);
+
+    GraphTask* m_graphTasks;
+    TaskId m_lastId;
+
+    // A cache line each, so threads counting don't slow each other down
+    struct LiveTelemetry
+    {
+      LiveTelemetry();
+      std::atomic<uint64_t> counters[WorkerTelemetry::Counter_Count];
+      std::atomic<uint64_t> queueHighWater; // Reset each frame
+      char pad[64];
+    };
+    LiveTelemetry* m_liveTelemetry;
+    std::vector<WorkerTelemetry> m_lastTelemetry; // Totals at the last endTelemetryFrame()
+    std::vector<WorkerTelemetry> m_frameTelemetry;
   };
   
   struct Task
@@ -51,7 +146,8 @@ namespace orTask {
     int tasks;
     
     void addTask() { orPlatform::atomicInc(&tasks); }
-    void remTask() { orPlatform::atomicDec(&tasks); }
+    // True if that was the last one
+    bool remTask() { return orPlatform::atomicDec(&tasks) == 1; }
   };
   
   struct ThreadDataBase
@@ -60,10 +156,6 @@ namespace orTask {
     // Must be filled in
     int threadIdx;
     int numThreads;
-
-    // These are default-initialised to valid values
-    boost::posix_time::time_duration activeTime;
-    boost::posix_time::time_duration inactiveTime;
   };
   
 } // namespace orTask
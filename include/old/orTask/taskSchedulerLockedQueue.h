@@ -0,0 +1,51 @@
+#ifndef TASKSCHEDULERLOCKEDQUEUE_H
+#define TASKSCHEDULERLOCKEDQUEUE_H
+
+#include "taskScheduler.h"
+
+#include <deque>
+
+
+namespace orTask {
+
+  // The simplest scheduler that works: one FIFO queue for everyone behind one lock, and a condition
+  // variable to sleep on. Threads waiting for a group run other tasks nested on their own stack.
+  //
+  // Only here as a baseline to measure TaskSchedulerWorkStealing against (see schedulerBench.cpp);
+  // every push and pop contends on the lock, so it doesn't scale. Telemetry is just tasks executed,
+  // queue size and parked time; with nested runs there's no clean split of the rest.
+  class TaskSchedulerLockedQueue :
+    public TaskScheduler
+  {
+  public:
+    // On thread 0, which is the caller's; starts the rest
+    TaskSchedulerLockedQueue(int numThreads);
+    ~TaskSchedulerLockedQueue();
+
+    // From TaskScheduler
+    void submitTaskForGroup(int threadIdx, TaskGroup* group, TaskFn* fn, void* ud);
+    void submitPinnedTaskForGroup(int threadIdx, int targetThreadIdx, TaskGroup* group, TaskFn* fn, void* ud);
+    void waitForTaskGroup(int threadIdx, TaskGroup* group);
+    bool isLocalQueueEmpty(int threadIdx) const;
+
+  protected:
+    void onGroupDone(TaskGroup const* group);
+
+  private:
+    void thread_fn(int threadIdx);
+    // Runs tasks until the group, if there is one, is done, or the scheduler's shutting down
+    void run(int threadIdx, TaskGroup const* group);
+
+    mutable boost::mutex m_mutex;
+    boost::condition_variable m_wakeup;
+    std::deque<Task> m_tasks;
+    std::vector< std::deque<Task> > m_pinnedTasks; // Per thread
+    bool m_exit;
+
+    boost::thread_group m_threads;
+  };
+
+} // namespace orTask
+
+
+#endif /* TASKSCHEDULERLOCKEDQUEUE_H */
@@ -2,9 +2,12 @@
 #define TASKSCHEDULERWORKSTEALING_H
 
 #include "taskScheduler.h"
+#include "eventCount.h"
 #include "victimPicker.h"
 #include "workStealingQueue.h"
 #include "terminationBarrier.h"
+#include "timer.h"
+#include "orPlatform/fiber.h"
 
 
 namespace orTask {
@@ -16,63 +19,169 @@ namespace orTask {
 
     typedef WorkStealingQueue<Task> Queue;
 
+    // Tasks that only one thread may run. Any thread can push, so it's locked; only touched when the
+    // count says there's something there.
+    struct PinnedQueue
+    {
+      PinnedQueue() : count(0) {}
+      boost::mutex mutex;
+      std::vector<Task> tasks;
+      int count;
+    };
+
+    // A task that waits for a group is suspended rather than holding up its thread: the thread
+    // switches to another fiber and carries on with other tasks, and switches back once the group's
+    // done. Suspended tasks only ever resume on the thread they were suspended on, so their threadIdx
+    // and anything thread local (the GL context, frame arenas) stay the same.
+    struct TaskFiber
+    {
+      TaskFiber() : fiber(NULL), waitingFor(NULL) {}
+      orPlatform::Fiber* fiber;
+      TaskGroup* waitingFor; // While suspended
+    };
+
     struct ThreadData : public ThreadDataBase
     {
       // Specific to this scheduler
+      TaskSchedulerWorkStealing* scheduler;
       std::vector< Queue* >* queues;
+      std::vector< PinnedQueue* >* pinnedQueues;
       TerminationBarrier* barrier;
       
-      VictimPicker* victimPicker;
+      VictimPicker victimPicker;
       
       enum State { STATE_WORKING, STATE_STEALING, STATE_IDLE, STATE_EXIT };
       State curState;
+
+      // Telemetry: time is only read when the state changes, and charged to the state we're leaving
+      Timer::PerfTime stateStartTime;
+
+      int cpu; // Pinned to this CPU when it starts; -1 to leave it to the OS
+
+      // Idling: after enough failed steals in a row the thread parks on its event count until it's
+      // woken by a push it might be able to take, or the group it's waiting for being done.
+      int failedSteals;
+      int parked; // 1 while parked; whoever sets it back to 0 has to wake the thread
+      TaskGroup* waitingFor; // In waitForTaskGroup without a fiber to switch to; NULL otherwise
+      EventCount wakeup;
+
+      // Fibers, all only touched by this thread. Workers run the scheduling loop on their own fiber
+      // and on pooled ones; thread 0's own fiber is the caller's, and only ever waits.
+      TaskFiber ownFiber;
+      TaskFiber* curFiber;
+      std::vector< TaskFiber* > freeFibers; // In the scheduling loop between tasks; switching to one carries on from there
+      std::vector< TaskFiber* > suspendedFibers;
+      std::vector< TaskFiber* > pooledFibers; // Every one made, to delete
+      int numSuspended; // Read by other threads, to know who to wake when a group's done
+
+      // Got its exit task. It only exits once nothing's suspended on it, so every task it started
+      // finishes; until then it carries on running and stealing tasks like normal.
+      bool exitRequested;
     };
     
     int numWorkers() const { return numThreads_ - 1; }
     
     static void thread_fn(ThreadData* threadData);
+    static void fiber_fn(void* userData);
+    static void thread_run(ThreadData* threadData, TaskGroup const* group);
+    static void thread_chargetime(ThreadData* threadData);
+    static void thread_startworking(ThreadData* threadData);
     static ThreadData::State thread_step(ThreadData* threadData);
     static ThreadData::State thread_exectask(Task const& task, ThreadData* threadData);
+    static bool thread_poppinned(ThreadData* threadData, Task* o_task);
+    static ThreadData::State thread_park(ThreadData* threadData);
+    static bool thread_haswork(ThreadData const* threadData);
+    static TaskFiber* thread_getfreefiber(ThreadData* threadData);
+    static bool thread_resumeready(ThreadData* threadData);
+    static void thread_switch(ThreadData* threadData, TaskFiber* fiber);
+    static bool thread_canexit(ThreadData const* threadData);
+    static void noop_fn(ThreadIdx threadIdx, void* userData);
+
+    // Pooled fibers' stacks. Only the pages tasks touch get memory.
+    enum { FIBER_STACK_SIZE = 512 * 1024 };
+
+    // Steals that fail in a row before parking. Spinning a little catches work that's about to be
+    // pushed, e.g. the next task in a chain, without paying for a wakeup.
+    enum { SPIN_STEALS = 64 };
+
+    // A successful steal also takes up to half of what's left on the victim, up to this many, so a
+    // thread that's run dry doesn't have to come back for every task
+    enum { STEAL_BATCH_MAX = 16 };
+
+    void wakeOne();
+    void wakeThread(ThreadData* threadData);
 
     std::vector< ThreadData > threadData;
     TerminationBarrier barrier;
 
-    enum { QUEUE_LOGCAPACITY_INITIAL = 2 };
+    enum { QUEUE_LOGCAPACITY_INITIAL = 8 }; // Big enough that a frame's worth never has to grow
     boost::thread_group threads;
 
     std::vector< Queue* > queues;
-    VictimPicker victimPicker;
+    std::vector< PinnedQueue* > pinnedQueues;
+
+    EpochDomain epochs;
 
-    Queue::HazardList hazardList;
+    int numParked;
+    int numGroupWaiters;
 
   public:
     TaskSchedulerWorkStealing(int numThreads) :
       TaskScheduler(numThreads),
       threadData(numThreads),
       barrier(numThreads),
-      victimPicker(0, numThreads-1, 32)
+      epochs(numThreads),
+      numParked(0),
+      numGroupWaiters(0)
     {
       for (int i = 0; i < numThreads; ++i) {
-        queues.push_back(new Queue(QUEUE_LOGCAPACITY_INITIAL, &hazardList));
+        queues.push_back(new Queue(QUEUE_LOGCAPACITY_INITIAL, &epochs));
+        pinnedQueues.push_back(new PinnedQueue());
         threadData[i].threadIdx = i;
         threadData[i].numThreads = numThreads_;
         
+        threadData[i].scheduler = this;
         threadData[i].queues = &queues;
+        threadData[i].pinnedQueues = &pinnedQueues;
         threadData[i].barrier = &barrier;
         
-        threadData[i].victimPicker = &victimPicker;
+        threadData[i].victimPicker.init(i, numThreads, 0);
         threadData[i].curState = ThreadData::STATE_WORKING;
+        threadData[i].stateStartTime = 0;
+        threadData[i].cpu = -1;
+        threadData[i].failedSteals = 0;
+        threadData[i].parked = 0;
+        threadData[i].waitingFor = NULL;
+        threadData[i].curFiber = &threadData[i].ownFiber;
+        threadData[i].numSuspended = 0;
+        threadData[i].exitRequested = false;
       }
-      
+
+      // Workers convert themselves when they start
+      threadData[0].ownFiber.fiber = orPlatform::convertThreadToFiber();
+
+      placeThreads();
       initThreads();
     }
 
+    // On thread 0, like the constructor
     ~TaskSchedulerWorkStealing() {
       exitThreads();
+
+      for (int threadIdx = 0; threadIdx < numThreads_; ++threadIdx) {
+        std::vector< TaskFiber* >& pooledFibers = threadData[threadIdx].pooledFibers;
+        for (size_t i = 0; i < pooledFibers.size(); ++i) {
+          orPlatform::deleteFiber(pooledFibers[i]->fiber);
+          delete pooledFibers[i];
+        }
+      }
+      orPlatform::convertFiberToThread(threadData[0].ownFiber.fiber);
       
       for (int threadIdx = 0; threadIdx < numThreads_; ++threadIdx) {
         delete queues.back();
         queues.pop_back();
+        delete pinnedQueues.back();
+        pinnedQueues.pop_back();
       }
     }
     
@@ -82,10 +191,17 @@ namespace orTask {
     // I don't really like using thread-local storage if I can avoid it.
     // From TaskScheduler
     void submitTaskForGroup(int threadIdx, TaskGroup* group, TaskFn* fn, void* ud);
+    void submitPinnedTaskForGroup(int threadIdx, int targetThreadIdx, TaskGroup* group, TaskFn* fn, void* ud);
     void waitForTaskGroup(int threadIdx, TaskGroup* group);
+    bool isLocalQueueEmpty(int threadIdx) const { return queues[threadIdx]->isEmpty(); }
   
+  protected:
+    void onGroupDone(TaskGroup const* group);
+
   private:
+    void placeThreads();
     void initThreads();
+    void drainMainThread();
     void exitThreads();
     void submitExit(int threadIdx);
   };
@@ -0,0 +1,121 @@
+#ifndef TASKSUBMITTER_H
+#define	TASKSUBMITTER_H
+
+#include "task.h"
+#include "orCore/orArena.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace orTask {
+
+class TaskSubmitter;
+
+// Child tasks are tasks which must complete before their parent is allowed to complete; they can
+// still start (and run) before their parent does.
+// Dependencies must complete before a task is allowed to start.
+// TaskIds can be used to wait for a task, add a task as a child, or add a task as a dependency.
+//
+// TODO We could allow task workitems to add new child tasks to themselves; that way, e.g the animation task can spawn a subtree of tasks, then deschedule itself rather than having to wait on them.
+class TaskBuilder { // implicit conversion to TaskId; methods return self.
+  TaskSubmitter& m_submitter;
+  TaskMeta& m_task;
+public:
+  TaskBuilder(TaskSubmitter& _submitter, TaskMeta& _task) : m_submitter(_submitter), m_task(_task) {}
+  operator TaskId() { return m_task.id; }
+
+  TaskBuilder& affinity(ThreadIdx threadId) {
+    m_task.aversion = ~(ThreadAversion(1) << threadId);
+    return *this;
+  }
+
+  // Keeps the task off every thread in the mask, e.g. ones that block on IO
+  TaskBuilder& aversion(ThreadAversion threadMask) {
+    m_task.aversion = threadMask;
+    return *this;
+  }
+
+  // dep can be from this submitter or an earlier one
+  inline TaskBuilder& depends_on(TaskId dep);
+
+  // child must be from this submitter
+  inline TaskBuilder& add_child(TaskId child);
+};
+
+// Nothing runs until the whole graph has been added: tasks are submitted together on destruction, e.g.
+//
+//   TaskId done;
+//   {
+//     TaskSubmitter submitter(scheduler, threadIdx);
+//     TaskId animation = submitter.add( animWork );
+//     TaskId gui = submitter.add( guiWork ).affinity( render_thread );
+//     TaskId scene_graph = submitter.add( sceneWork ).depends_on( animation );
+//     TaskId gui_scene = submitter.add_empty().add_child( scene_graph ).add_child( gui );
+//     done = submitter.add( renderWork ).affinity( render_thread ).depends_on( gui_scene );
+//   }
+//   scheduler.wait(threadIdx, done);
+//
+// The pending tasks are kept in the calling thread's frame arena, so a submitter has to be done with
+// within the frame it was made in; see FrameArenas.
+class TaskSubmitter {
+  TaskScheduler& m_scheduler;
+  int m_threadIdx;
+  orbital::FrameVector<TaskMeta> m_pendingAdd;
+public:
+  // threadIdx is the calling thread's
+  TaskSubmitter(TaskScheduler& _scheduler, int _threadIdx) : m_scheduler(_scheduler), m_threadIdx(_threadIdx), m_pendingAdd() {}
+  ~TaskSubmitter() { m_scheduler.add_tasks(m_threadIdx, m_pendingAdd.size(), m_pendingAdd.data()); }
+
+  TaskSubmitter(TaskSubmitter const&) = delete;
+  TaskSubmitter& operator=(TaskSubmitter const&) = delete;
+
+  TaskBuilder add(WorkItem const& work) {
+    TaskMeta& taskData = add_task();
+    taskData.work = work;
+    return TaskBuilder(*this, taskData);
+  }
+
+  TaskBuilder add_empty() {
+    TaskMeta& taskData = add_task();
+    return TaskBuilder(*this, taskData);
+  }
+
+  // TODO only to be used by TaskBuilder
+  TaskMeta& get_pending(TaskId id) {
+    // Ids only go up, so m_pendingAdd is sorted by id
+    orbital::FrameVector<TaskMeta>::iterator const it = std::lower_bound(m_pendingAdd.begin(), m_pendingAdd.end(), id, &id_less);
+    ensure(it != m_pendingAdd.end() && it->id == id, "Task not found!");
+    return *it;
+  }
+
+private:
+  static bool id_less(TaskMeta const& task, TaskId id) { return task.id < id; }
+
+  TaskMeta& add_task() {
+    // Invalidates references held by earlier TaskBuilders, which is fine as long as they're only used
+    // in a single chain of calls
+    m_pendingAdd.push_back(TaskMeta());
+    TaskMeta& taskData = m_pendingAdd.back();
+    taskData.id = m_scheduler.next_id();
+    return taskData;
+  }
+};
+
+TaskBuilder& TaskBuilder::depends_on(TaskId dep) {
+  assert(m_task.startDep == TaskId_None);
+  m_task.startDepCount++;
+  m_task.startDep = dep;
+  return *this;
+}
+
+TaskBuilder& TaskBuilder::add_child(TaskId child) {
+  m_task.endDepCount++;
+  TaskMeta& childTask = m_submitter.get_pending(child);
+  assert(childTask.parent == TaskId_None);
+  childTask.parent = m_task.id;
+  return *this;
+}
+
+} // namespace orTask
+
+#endif // TASKSUBMITTER_H
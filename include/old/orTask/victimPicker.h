@@ -26,78 +26,92 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define	VICTIMPICKER_H
 
 #include "orStd.h"
-#include "orMath.h"
-#include "rnd.h"
-
-#include "boost_begin.h"
-#include <boost/thread.hpp>
-#include "boost_end.h"
-
-#include "orPlatform/atomic.h"
 
+#include <vector>
 
 namespace orTask {
+  // Picks which thread to try stealing from next. One per thread, so nothing is shared and there's no
+  // locking: with lots of threads, a shared picker is contended exactly when everyone's out of work.
+  //
+  // Each round of attempts tries the victim we last stole from first (it had more work then, and
+  // probably still has), then our neighbours (threads whose caches we share, nearest first), then
+  // random threads.
   class VictimPicker {
   private:
-    Rnd64 rng_;
-    UniformDistribution<uint32_t> gen_;
+    int self_;
+    int numThreads_;
+    uint64_t rngState_; // xorshift64*; never 0
 
-    boost::mutex mutex_;
-    size_t size_;
-    int* buffer_;
-    size_t readPos_;
+    int lastVictim_; // -1 if none yet
+    std::vector<int> neighbours_;
+    size_t attempt_; // In this round
 
   public:
-    VictimPicker(int min, int max, size_t size) :
-      rng_(0U),
-      gen_(min, max),
-      mutex_(),
-      size_(size),
-      buffer_(new int[size_]),
-      readPos_(size_)
-    {
-      fill();
+    VictimPicker() :
+      self_(0),
+      numThreads_(1),
+      rngState_(1),
+      lastVictim_(-1),
+      neighbours_(),
+      attempt_(0)
+    {}
+
+    void init(int self, int numThreads, uint64_t seed) {
+      self_ = self;
+      numThreads_ = numThreads;
+      rngState_ = seed * 0x9E3779B97F4A7C15ULL + (uint64_t)self + 1;
+      if (rngState_ == 0) { rngState_ = 1; }
+      lastVictim_ = -1;
+      neighbours_.clear();
+      attempt_ = 0;
     }
 
-    ~VictimPicker() { delete[] buffer_; }
+    // Nearest first; not including ourselves
+    void setNeighbours(std::vector<int> const& neighbours) {
+      neighbours_ = neighbours;
+      attempt_ = 0;
+    }
 
+    // Never ourselves, unless we're the only thread
     int pick() {
-      while (true) {
-        size_t const oldPos = readPos_;
-
-        if (oldPos == size_) {
-          fill();
-          continue;
-        }
-
-        size_t const newPos = oldPos + 1;
-
-        orPlatform::readBarrier();
-        int const seenVal = buffer_[oldPos];
-
-        size_t const seenPos = orPlatform::atomicCompareAndSwap(&readPos_, oldPos, newPos);
-
-        if (seenPos == oldPos) {
-          return seenVal;
+      size_t const attempt = attempt_++;
+      if (lastVictim_ >= 0) {
+        if (attempt == 0) {
+          return lastVictim_;
         }
       }
+      size_t const neighbourIdx = attempt - (lastVictim_ >= 0 ? 1 : 0);
+      if (neighbourIdx < neighbours_.size()) {
+        return neighbours_[neighbourIdx];
+      }
+      return randomVictim();
     }
-  private:
-    void fill() {
-      boost::mutex::scoped_lock lock(mutex_);
-      // Another thread can have filled the buffer while we acquired the
-      // lock. If the buffer is still empty, this thread is responsible for
-      // filling it.
-      if (readPos_ < size_) { return; }
 
-      gen_.Generate(&rng_, size_, (uint32_t*)&buffer_[0]);
+    // Call when a steal from victim worked; starts a new round
+    void onSteal(int victim) {
+      lastVictim_ = victim;
+      attempt_ = 0;
+    }
 
-      orPlatform::writeBarrier();
+    // Call when giving up for now (e.g. before parking), so the next round starts from the top
+    void reset() {
+      attempt_ = 0;
+    }
 
-      readPos_ = 0;
+  private:
+    int randomVictim() {
+      if (numThreads_ <= 1) {
+        return self_;
+      }
+      rngState_ ^= rngState_ >> 12;
+      rngState_ ^= rngState_ << 25;
+      rngState_ ^= rngState_ >> 27;
+      uint64_t const r = rngState_ * 0x2545F4914F6CDD1DULL;
+      // Any thread but ourselves
+      int const victim = (int)((r >> 32) % (uint64_t)(numThreads_ - 1));
+      return (victim >= self_) ? victim + 1 : victim;
     }
   };
 } // namespace orTask
 
 #endif	/* VICTIMPICKER_H */
-
@@ -1,302 +1,261 @@
 #ifndef WORKSTEALINGQUEUE_H
 #define WORKSTEALINGQUEUE_H
 
-#include "orPlatform/atomic.h"
-#include "util.h"
-#include "refCount.h"
-#include <list>
+#include "orStd.h"
 
-namespace orTask {
-
-// Hazard pointers: each thread has a list of hazard pointers that are
-// references which prevent collection, and a list of pointers to be collected.
-// The thread which retires a pointer is the one which is responsible for
-// collecting it; if the thread ends before collecting, it should hand off its
-// collection list to another thread.
-
-// Since each thread will have one queue and at most one hazard pointer, we can
-// store the hazard pointer records in the queues.
+#include <atomic>
+#include <type_traits>
+#include <vector>
 
-// Since the main thread creates and destroys the queues themselves, and only
-// destroys them once all other threads have ended, the queue destructor could
-// collect any remaining items in the collection list.
+namespace orTask {
 
-template <typename T> struct HazardPointerRecord;
+// Epoch based reclamation, for the rings the queues outgrow.
+//
+// A thief may still be reading the old ring after the owner has swapped in a bigger one, so the old
+// one can't be freed straight away. Each thread has a slot. While stealing, its slot holds the global
+// epoch as it was when it started; otherwise it holds IDLE. Retiring a ring bumps the global epoch,
+// and the ring is freed once every slot is past the epoch it was retired in: anyone who started
+// stealing after that saw the new ring.
+//
+// Nothing here allocates: retired rings are linked through themselves, and the slots are fixed.
+class EpochDomain {
+public:
+  typedef uint64_t Epoch;
+  static Epoch const IDLE = ~Epoch(0);
 
-template <typename T>
-struct HazardPointerList 
-{
-  HazardPointerList() : head(NULL) {};
-  ~HazardPointerList() // only destroy when every user of the records is finished and all hazards cleared!
+  explicit EpochDomain(int numThreads) :
+    m_epoch(0),
+    m_slots(numThreads)
   {
-    HazardPointerRecord<T>* hprec = head;
-    while (hprec != NULL) {
-      ensure(hprec->pointer == NULL);
-      HazardPointerRecord<T>* nextRec = hprec->next;
-      delete hprec;
-      hprec = nextRec;
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+      m_slots[i].epoch.store(IDLE, std::memory_order_relaxed);
     }
   }
-  HazardPointerRecord<T>* head;
-};
 
-template <typename T>
-struct RetiredList
-{
-  HazardPointerList<T>* hazardList;
-  std::list<T*> retiredList;
-  
-  
-  RetiredList(HazardPointerList<T>* list) : hazardList(list) {}
-  
-  ~RetiredList() { Scan(); ensure(retiredList.empty()); } // Assuming the lists are destroyed after all threads have finished
-  
-  void RetireNode(T* node) {
-    retiredList.push_back(node);
-    Scan();
-  };
-  
-  void Scan() {
-    // Stage 1: Scan each thread's hazard pointer record and insert non-null values in hazardList
-    std::list<T*> localHazardList;
-    HazardPointerRecord<T>* hprec = hazardList->head;
-    while (hprec != NULL) {
-      T* hptr = hprec->pointer;
-      if (hptr != NULL) {
-        localHazardList.push_back(hptr);
-      }
-      hprec = hprec->next;
-    }
-
-    // Stage 2: Search hazardList
-    std::list<T*> tmpList;
-    tmpList.splice(tmpList.end(), retiredList);
-    
-    while (!tmpList.empty()) {
-      T* node = tmpList.front();
-      tmpList.pop_front();
-      
-      if(std::find(localHazardList.begin(), localHazardList.end(), node) != localHazardList.end()) {
-        retiredList.push_back(node);
-      } else {
-        delete node;
-      }
-    }
+  // Between these, nothing the thread has read from a queue will be freed
+  void enter(int threadIdx) {
+    // seq_cst: ordered before the thief's load of the ring, and after the owner's store of a new one
+    m_slots[threadIdx].epoch.store(m_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
   }
-};
 
-// One record per thread
-template <typename T>
-struct HazardPointerRecord
-{
-  HazardPointerRecord(HazardPointerList<T>* list) :
-    pointer(NULL),
-    next(NULL)
-  {
-    HazardPointerRecord* oldHead;
-    do {
-      oldHead = list->head;
-      next = oldHead;
-      orPlatform::writeBarrier();
-    } while (orPlatform::atomicCompareAndSwap(&list->head, oldHead, this) != oldHead);
+  void exit(int threadIdx) {
+    m_slots[threadIdx].epoch.store(IDLE, std::memory_order_release);
   }
-          
-  T* pointer;
-  HazardPointerRecord* next;
-};
-
-template <typename T>
-class LockFreeCircularArray
-{
-  // T must be default-constructible
-private:
-  size_t const logCapacity_;
-  std::vector<T> currentTasks_;
 
-public:
-  explicit LockFreeCircularArray(size_t logCapacity) :
-    logCapacity_(logCapacity),
-    currentTasks_(1 << logCapacity_)
-  {}
-
-  // resizing copy ctor
-  LockFreeCircularArray(LockFreeCircularArray const& oldArray, size_t bottom, size_t top) :
-    logCapacity_(oldArray.logCapacity_ + 1),
-    currentTasks_(1 << logCapacity_)
-  {
-    for (size_t i = top; i < bottom; ++i) {
-      put(i, oldArray.get(i));
-    }
+  // Call after unpublishing whatever is being retired; returns the epoch it was retired in
+  Epoch retire() {
+    return m_epoch.fetch_add(1, std::memory_order_seq_cst);
   }
 
-  ~LockFreeCircularArray() {}
-
-  size_t capacity() const { return 1 << logCapacity_; }
-
-  T& get(size_t idx) {
-    return currentTasks_[idx % capacity()];
+  // True if nothing retired in epoch can still be in use
+  bool safeToFree(Epoch epoch) const {
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+      if (m_slots[i].epoch.load(std::memory_order_seq_cst) <= epoch) {
+        return false;
+      }
+    }
+    return true;
   }
 
-  T const& get(size_t idx) const {
-    return currentTasks_[idx % capacity()];
-  }
+private:
+  EpochDomain(EpochDomain const&);
+  EpochDomain& operator=(EpochDomain const&);
+
+  // A cache line each, so threads entering and leaving don't slow each other down
+  struct Slot {
+    Slot() : epoch(IDLE) {}
+    Slot(Slot const&) : epoch(IDLE) {} // For the vector; slots are never copied once in use
+    std::atomic<Epoch> epoch;
+    char pad[64 - sizeof(std::atomic<Epoch>)];
+  };
 
-  void put(size_t idx, T const& v) {
-    get(idx) = v;
-  }
+  std::atomic<Epoch> m_epoch;
+  std::vector<Slot> m_slots;
 };
 
+// Chase-Lev work-stealing deque, with the memory orders from Le et al., "Correct and Efficient
+// Work-Stealing for Weak Memory Models" (2013).
+//
+// The owner pushes and pops at the bottom; any other thread can steal from the top. Items are
+// copied in and out, and a thief copies one out before it knows it's won it, so T has to be
+// trivially copyable.
+//
+// The ring is a power of two, allocated up front. If it fills, it's doubled (up to
+// MAX_LOG_CAPACITY) and the old one retired to the EpochDomain; the push path doesn't allocate
+// otherwise.
 template <typename T>
 class WorkStealingQueue
 {
-  // T must be Default-Constructible, for the inner circular queue.
-  // T must be Assignable, for when we resize the inner circular queue.
-private:
-  typedef LockFreeCircularArray<T> Array;
+  static_assert(std::is_trivially_copyable<T>::value, "Thieves copy items out racily, so they must be plain data");
 
 public:
-  typedef HazardPointerList< Array > HazardList;
+  enum { MAX_LOG_CAPACITY = 24 };
+
+  WorkStealingQueue(size_t logCapacity, EpochDomain* epochs) :
+    m_top(0),
+    m_bottom(0),
+    m_ring(NULL),
+    m_retired(NULL),
+    m_epochs(epochs)
+  {
+    m_ring.store(Ring::make(logCapacity), std::memory_order_relaxed);
+  }
 
-private:
-  RetiredList< Array > retired; // Retired list
-  HazardPointerRecord< Array >* hazard; // Hazard pointer
-  
-  LockFreeCircularArray<T>* tasks;
-  size_t bottom;
-  size_t top;
-public:
-  WorkStealingQueue(size_t logCapacity, HazardList* hazardList) :
-    retired(hazardList),
-    hazard(new HazardPointerRecord<Array>(hazardList)), // freed by hazardList's dtor
-    tasks(new LockFreeCircularArray<T>(logCapacity)),
-    bottom(0),
-    top(0)
-  { }
-    
+  // Only once nobody is using the queue any more
   ~WorkStealingQueue() {
-    orPlatform::fullBarrier();
-    retired.RetireNode(tasks);
+    Ring::destroy(m_ring.load(std::memory_order_relaxed));
+    while (m_retired) {
+      Ring* const next = m_retired->nextRetired;
+      Ring::destroy(m_retired);
+      m_retired = next;
+    }
   }
 
   bool isEmpty() const {
-    size_t const localTop = top;
-    size_t const localBottom = bottom;
-    orPlatform::readBarrier(); // not strictly necessary...
-    return localBottom <= localTop;
+    int64_t const top = m_top.load(std::memory_order_acquire);
+    int64_t const bottom = m_bottom.load(std::memory_order_acquire);
+    return bottom <= top;
+  }
+
+  // Can be out of date by the time it returns; only good for deciding how much to try to steal
+  size_t sizeEstimate() const {
+    int64_t const top = m_top.load(std::memory_order_acquire);
+    int64_t const bottom = m_bottom.load(std::memory_order_acquire);
+    return (bottom > top) ? (size_t)(bottom - top) : 0; // Negative while popBottom() is racing us
   }
 
-  // One thread, the owner of the queue, can call pushBottom and popBottom().
+  // One thread, the owner of the queue, can call pushBottom() and popBottom().
   // Concurrently with this, other threads can call popTop().
   void pushBottom(T const& v) {
-    size_t const oldBottom = bottom;
-    size_t const oldTop = top;
-    LockFreeCircularArray<T>* oldTasks = tasks;
-    
-    size_t const newBottom = oldBottom + 1;
-    size_t const size = oldBottom - oldTop;
-    LockFreeCircularArray<T>* newTasks = oldTasks;
-    
-    if (size + 1 >= oldTasks->capacity()) {
-      newTasks = new LockFreeCircularArray<T>(*oldTasks, oldBottom, oldTop);
-      tasks = newTasks;
-      orPlatform::fullBarrier(); // Ensure the write replacing tasks is visible before we check any other thread's hazard pointers
-      retired.RetireNode(oldTasks);
+    int64_t const bottom = m_bottom.load(std::memory_order_relaxed);
+    int64_t const top = m_top.load(std::memory_order_acquire);
+    Ring* ring = m_ring.load(std::memory_order_relaxed);
+
+    if (bottom - top > (int64_t)ring->mask) {
+      ring = grow(ring, top, bottom);
     }
-   
-    newTasks->put(oldBottom, v);
-    orPlatform::writeBarrier(); // Write buffer contents before writing bottom (allowing reading of the contents)
-    
-    bottom = newBottom;
+
+    ring->items[bottom & ring->mask] = v;
+    std::atomic_thread_fence(std::memory_order_release); // The item before the bottom that lets thieves see it
+    m_bottom.store(bottom + 1, std::memory_order_relaxed);
   }
 
-  bool popTop(T* v) {
-    size_t const oldTop = top;
-    orPlatform::readBarrier(); // Read top before reading bottom TODO why this particular order?
-    // Guarantees that if the CAS below succeeds, bottom had a value at least as up to date as top.
-    size_t const oldBottom = bottom;
-    orPlatform::readBarrier(); // Read bottom before reading tasks, ensures that we don't get a value of bottom for a task that was pushed into a new array, but the old value of the array.
-    LockFreeCircularArray<T>* oldTasks;
-    
-    // Store tasks in hazard pointer
-    do {
-      oldTasks = tasks;
-      hazard->pointer = oldTasks;
-      orPlatform::fullBarrier(); // ensure we write the hazard pointer before we read tasks again
-    } while (oldTasks != tasks);
-    
-    int const size = oldBottom - oldTop; // int because we test for < 0. We allow bottom and top to wrap, so the best we could do is test (int64)(bottom - oldTop) < 0.
-
-    if (size <= 0) {
-      hazard->pointer = NULL;
+  bool popBottom(T* v) {
+    int64_t const bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+    Ring* const ring = m_ring.load(std::memory_order_relaxed);
+    m_bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst); // Claim the item before looking at top
+    int64_t top = m_top.load(std::memory_order_relaxed);
+
+    if (top > bottom) {
+      // Empty
+      m_bottom.store(bottom + 1, std::memory_order_relaxed);
       return false;
     }
-    
-    orPlatform::readBarrier(); // Read bottom before reading buffer contents
-    
-    *v = oldTasks->get(oldTop);
-    
-    orPlatform::fullBarrier(); // Read buffer contents before writing top (if we succeed, we allow overwriting of the contents) or releasing the hazard pointer (allowing replacing the array)
-    
-    hazard->pointer = NULL;
-    
-    size_t const newTop = oldTop + 1;
-    if (orPlatform::atomicCompareAndSwap(&top, oldTop, newTop) == oldTop) {
-      return true;
+
+    *v = ring->items[bottom & ring->mask];
+    if (top < bottom) {
+      return true; // More than one item, so no thief can be after this one
     }
 
-    return false;
+    // The last item: race any thieves for it
+    bool const won = m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    m_bottom.store(bottom + 1, std::memory_order_relaxed); // Empty either way
+    return won;
   }
 
-  bool popBottom(T* v) {
-    size_t const oldBottom = bottom;
-    size_t const newBottom = oldBottom - 1;
-    bottom = newBottom;
-    
-    orPlatform::fullBarrier(); // Write bottom before reading from top. Ensures we've claimed an item in the queue.
-    
-    size_t const oldTop = top;
-    
-    LockFreeCircularArray<T>* const oldTasks = tasks;
-    
-    int const newSize = newBottom - oldTop; // int because we test for < 0. We allow bottom and top to wrap, so the best we could do is test (int64)(bottom - oldTop) < 0.
-
-    if (newSize < 0) {
-      // We tried to claim an item in the queue, but there wasn't one
-      bottom = oldTop; // Reset bottom to give an empty queue
+  // threadIdx is the calling thread's, for its EpochDomain slot. False if there was nothing to
+  // steal, or another thread got it first.
+  bool popTop(int threadIdx, T* v) {
+    int64_t top = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t const bottom = m_bottom.load(std::memory_order_acquire);
+    if (top >= bottom) {
       return false;
     }
-    
-    // No read barrier here, since only this thread will have written bottom and buffer contents
-    
-    *v = oldTasks->get(newBottom);
-    
-    // No barrier here, since only this thread would modify the buffer contents after this point
-    
-    if (newSize > 0) {
-      return true;
-    }
-    
-    // newSize == 0, so only one item in the queue. Out of a set of concurrent
-    // popTop() calls, only one can have an outdated value of bottom (before we
-    // claimed the item with bottom--) AND succeed in its CAS, because bottom is
-    // read after top in popTop(). So we only need to worry about this one
-    // concurrent popTop() conflicting with this call. We attempt to CAS the
-    // value of top; this prevents a concurrent popTop call from seeing
-    // successfully stealing the same item. If we succeed, we got the item,
-    // otherwise a concurrent stealing thread got it.
-    size_t const newTop = oldTop + 1;
-        
-    if (orPlatform::atomicCompareAndSwap(&top, oldTop, newTop) != oldTop) {
-      bottom = newTop;
+
+    m_epochs->enter(threadIdx);
+    Ring* const ring = m_ring.load(std::memory_order_seq_cst);
+    T const item = ring->items[top & ring->mask];
+    m_epochs->exit(threadIdx);
+
+    if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
       return false;
     }
-
-    bottom = newTop; // either way, the result is an empty queue
+    *v = item;
     return true;
   }
+
+private:
+  WorkStealingQueue(WorkStealingQueue const&);
+  WorkStealingQueue& operator=(WorkStealingQueue const&);
+
+  struct Ring
+  {
+    size_t mask;
+    T* items;
+    Ring* nextRetired;
+    EpochDomain::Epoch retiredEpoch;
+
+    static Ring* make(size_t logCapacity) {
+      ensure(logCapacity <= MAX_LOG_CAPACITY, "Work stealing queue too big!");
+      Ring* const ring = new Ring;
+      ring->mask = (size_t(1) << logCapacity) - 1;
+      ring->items = new T[ring->mask + 1];
+      ring->nextRetired = NULL;
+      ring->retiredEpoch = 0;
+      return ring;
+    }
+
+    static void destroy(Ring* ring) {
+      delete[] ring->items;
+      delete ring;
+    }
+  };
+
+  Ring* grow(Ring* const oldRing, int64_t const top, int64_t const bottom) {
+    size_t logCapacity = 0;
+    while ((size_t(1) << logCapacity) <= oldRing->mask) {
+      ++logCapacity;
+    }
+    Ring* const newRing = Ring::make(logCapacity + 1);
+    for (int64_t i = top; i < bottom; ++i) {
+      newRing->items[i & newRing->mask] = oldRing->items[i & oldRing->mask];
+    }
+    m_ring.store(newRing, std::memory_order_seq_cst);
+
+    oldRing->retiredEpoch = m_epochs->retire();
+    oldRing->nextRetired = m_retired;
+    m_retired = oldRing;
+    reclaim();
+    return newRing;
+  }
+
+  // Frees whatever retired rings nobody can be reading any more
+  void reclaim() {
+    Ring** link = &m_retired;
+    while (*link) {
+      Ring* const ring = *link;
+      if (m_epochs->safeToFree(ring->retiredEpoch)) {
+        *link = ring->nextRetired;
+        Ring::destroy(ring);
+      } else {
+        link = &ring->nextRetired;
+      }
+    }
+  }
+
+  // Thieves hammer top and the owner hammers bottom, so keep them apart
+  std::atomic<int64_t> m_top;
+  char m_pad0[64 - sizeof(std::atomic<int64_t>)];
+  std::atomic<int64_t> m_bottom;
+  char m_pad1[64 - sizeof(std::atomic<int64_t>)];
+
+  std::atomic<Ring*> m_ring;
+  Ring* m_retired; // Only touched by the owner
+  EpochDomain* m_epochs;
 };
 
-} // namespace lexRec
+} // namespace orTask
 
 #endif /* WORKSTEALINGQUEUE_H */
-
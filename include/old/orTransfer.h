@@ -0,0 +1,168 @@
+#pragma once
+
+#include "orStd.h"
+#include "orMath.h"
+
+#include "orPhysics.h"
+
+#include "orTask/taskScheduler.h"
+
+#include <vector>
+#include <map>
+
+// Transfer window search ("porkchop plot") between two grav bodies orbiting the same parent.
+// For a grid of (departure time, time of flight) we solve Lambert's problem between the two bodies'
+// ephemerides and record the total delta-v (departure + arrival hyperbolic excess speed).
+//
+// The search runs on the task scheduler in tiles. We start with a coarse grid and then refine in
+// passes, only refining the tiles whose best value is close to the best found so far, so cost
+// is concentrated around the minima. Results are readable while the search is running: every cell
+// holds the value of the nearest sample evaluated so far, so a heatmap fills in progressively.
+//
+// Searches are cached by query, so reopening the same plot is free. Only the last few are kept; see
+// requestSearch().
+// TODO support transfers between bodies with different parents (e.g. moon -> planet)
+class TransferPlanner {
+public:
+  struct Query {
+    Query() :
+      m_departBodyId(), m_arriveBodyId(),
+      m_departTimeMin(0), m_departTimeMax(0),
+      m_flightTimeMin(0), m_flightTimeMax(0),
+      m_numDepartSteps(128), m_numFlightSteps(128)
+    {}
+
+    orbital::Id<PhysicsSystem::GravBody> m_departBodyId;
+    orbital::Id<PhysicsSystem::GravBody> m_arriveBodyId;
+
+    // Sim time, seconds
+    double m_departTimeMin;
+    double m_departTimeMax;
+
+    // Seconds
+    double m_flightTimeMin;
+    double m_flightTimeMax;
+
+    // Grid resolution
+    int m_numDepartSteps;
+    int m_numFlightSteps;
+
+    bool operator<(Query const& _other) const;
+  };
+
+  struct Solution {
+    Solution() : m_valid(false), m_departTime(0), m_flightTime(0), m_deltaV(DBL_MAX), m_departVel(), m_arriveVel() {}
+
+    bool m_valid;
+    double m_departTime;
+    double m_flightTime;
+    double m_deltaV; // m/s, departure + arrival
+    orVec3 m_departVel; // Transfer orbit velocity at departure, relative to the parent body
+    orVec3 m_arriveVel; // Transfer orbit velocity at arrival, relative to the parent body
+  };
+
+  class Search {
+  public:
+    Query const& getQuery() const { return m_query; }
+
+    int getWidth() const { return m_query.m_numDepartSteps; }
+    int getHeight() const { return m_query.m_numFlightSteps; }
+
+    // Delta-v in m/s for each cell, row-major with one row per flight time step. FLT_MAX where there is no
+    // solution. Can be read while the search is running; values only get more accurate over time.
+    float const* getDeltaVs() const { return &m_deltaV[0]; }
+
+    double getDepartTime(int _departIdx) const;
+    double getFlightTime(int _flightIdx) const;
+
+    // Fraction of the planned work done, in [0, 1]. The plan grows as refinement passes get scheduled.
+    double getProgress() const;
+    bool isComplete() const { orPlatform::readBarrier(); return m_complete != 0; }
+
+    // Only valid once the search is complete
+    Solution const& getBestSolution() const { return m_bestSolution; }
+
+  private:
+    friend class TransferPlanner;
+
+    Search(orTask::TaskScheduler& _scheduler, Query const& _query);
+
+    enum {
+      TILE_SIZE = 16,
+      COARSE_STRIDE = 8 // Must divide TILE_SIZE
+    };
+
+    struct TileJob {
+      Search* m_search;
+      int m_tileIdx;
+    };
+
+    void startPass(int _threadIdx, int _stride);
+    void finishPass(int _threadIdx);
+    static void runTile(orTask::ThreadIdx _threadIdx, void* _userData);
+    void evaluateTile(int _tileIdx);
+
+    double evaluate(double _departTime, double _flightTime, Solution* o_solution) const;
+    void polishBestSolution();
+
+    orTask::TaskScheduler& m_scheduler;
+    Query m_query;
+
+    // Transfers are computed in the parent's frame, so we only need the two ephemerides
+    // and the parent's gravitational parameter. Copied so the tasks never touch the physics system.
+    double m_mu;
+    orEphemerisJPL m_departEphemeris;
+    orEphemerisJPL m_arriveEphemeris;
+
+    int m_numTilesX;
+    int m_numTilesY;
+
+    std::vector<float> m_deltaV;
+    // Per tile, the best value so far and the cell it was found in
+    std::vector<float> m_tileMinDeltaV;
+    std::vector<int> m_tileMinCell;
+    // Per tile, the stride it was last evaluated at, or 0 if it hasn't been yet. A tile can be skipped
+    // by a pass and then pulled in by a later one as a neighbour, so this isn't always twice m_stride.
+    std::vector<int> m_tileStride;
+
+    std::vector<TileJob> m_tileJobs;
+    int m_stride; // Sample spacing of the current pass
+    int m_pendingTiles;
+    int m_cancelled;
+    int m_complete;
+
+    // Progress, in tiles
+    int m_tilesPlanned;
+    int m_tilesDone;
+
+    Solution m_bestSolution;
+
+    orTask::TaskGroup m_group;
+
+    int m_lastRequested; // For evicting from the cache
+  };
+
+  TransferPlanner(orTask::TaskScheduler& _scheduler, PhysicsSystem const& _physicsSystem);
+  ~TransferPlanner();
+
+  // Starts a search for the given query, or returns the cached one if we already ran it.
+  // Returns NULL if the query is invalid.
+  // Only the searches from the last MAX_CACHED_SEARCHES calls are kept; older ones are cancelled and
+  // freed, so don't hold on to a search across more calls than that.
+  Search const* requestSearch(int _threadIdx, Query const& _query);
+
+  // Cancels any running searches and clears the cache.
+  void clear(int _threadIdx);
+
+  enum { MAX_CACHED_SEARCHES = 8 };
+
+private:
+  void evictOldestSearch(int _threadIdx);
+
+  orTask::TaskScheduler& m_scheduler;
+  PhysicsSystem const& m_physicsSystem;
+
+  typedef std::map<Query, Search*> SearchCache;
+  SearchCache m_searches;
+  int m_numRequests;
+};
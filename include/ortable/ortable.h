@@ -0,0 +1,113 @@
+#ifndef ORTABLE_H
+#define	ORTABLE_H
+
+#include "ortable/ortable_types.h"
+
+#include <assert.h>
+
+#include <type_traits>
+
+// Columnar tables: each attribute (position, velocity, ...) is stored as lanes (x, y, z, ...), and
+// each lane is a contiguous, aligned array over all rows. Kernels get whole lanes and can run SIMD
+// over them without gathers; rows past size up to the padded size are zero and safe to compute on.
+//
+// Rows are kept dense: removal moves the last row into the hole, same as IdArray, so a table can
+// sit alongside an IdArray with row == dense index.
+//
+// Attributes have to be added while the table is empty. Pointers into the table are invalidated by
+// anything that grows it.
+//
+// TODO let attributes be added to a non-empty table (would need a relayout)
+namespace ortable {
+
+void Init(Table* table);
+void Destroy(Table* table);
+
+// Untyped version; returns the attribute index
+size_t AddAttribute(Table* table, size_t size, size_t count);
+
+template <typename T>
+inline Column<T> AddAttribute(Table* table, size_t count) {
+  static_assert(std::is_trivially_copyable<T>::value, "Table attributes are moved with memcpy");
+  static_assert(ALIGNMENT % alignof(T) == 0, "Attribute type needs more alignment than tables give");
+  Column<T> column;
+  column.index = AddAttribute(table, sizeof(T), count);
+  return column;
+}
+
+void Reserve(Table* table, size_t capacity);
+
+// Adds count zeroed rows on the end and returns the index of the first
+size_t Append(Table* table, size_t count);
+
+// Moves the last row into row, and shrinks by one
+void SwapRemove(Table* table, size_t row);
+
+// Drops every row whose keep flag is 0, keeping the order of the rest; one pass over each lane.
+// keep has one flag per row. For removing a batch of rows at once.
+void Compact(Table* table, uint8_t const* keep);
+
+void Clear(Table* table);
+
+inline size_t Size(Table const* table) { return table->size; }
+
+// Size rounded up to a whole number of ROW_PADDING rows; kernels may run over this many
+inline size_t PaddedSize(Table const* table) { return (table->size + ROW_PADDING - 1) / ROW_PADDING * ROW_PADDING; }
+
+template <typename T>
+inline Span<T> Lane(Table* table, Column<T> column, size_t lane) {
+  Attribute const& attribute = table->attributes[column.index];
+  assert(lane < attribute.count);
+  Span<T> span;
+  span.data = reinterpret_cast<T*>(static_cast<uint8_t*>(table->buffer) + attribute.offset + lane * attribute.stride);
+  span.size = table->size;
+  return span;
+}
+
+template <typename T>
+inline Span<T const> Lane(Table const* table, Column<T> column, size_t lane) {
+  Attribute const& attribute = table->attributes[column.index];
+  assert(lane < attribute.count);
+  Span<T const> span;
+  span.data = reinterpret_cast<T const*>(static_cast<uint8_t const*>(table->buffer) + attribute.offset + lane * attribute.stride);
+  span.size = table->size;
+  return span;
+}
+
+// All lanes of one row, e.g. x, y, z of one position
+template <typename T>
+inline StridedSpan<T> Row(Table* table, Column<T> column, size_t row) {
+  Attribute const& attribute = table->attributes[column.index];
+  assert(row < table->size);
+  StridedSpan<T> span;
+  span.data = static_cast<uint8_t*>(table->buffer) + attribute.offset + row * sizeof(T);
+  span.size = attribute.count;
+  span.stride = attribute.stride;
+  return span;
+}
+
+template <typename T>
+inline StridedSpan<T const> Row(Table const* table, Column<T> column, size_t row) {
+  Attribute const& attribute = table->attributes[column.index];
+  assert(row < table->size);
+  StridedSpan<T const> span;
+  span.data = const_cast<uint8_t*>(static_cast<uint8_t const*>(table->buffer)) + attribute.offset + row * sizeof(T);
+  span.size = attribute.count;
+  span.stride = attribute.stride;
+  return span;
+}
+
+// Calls kernel(begin, end) for consecutive row ranges of at most block_rows, covering [0, size).
+// For splitting work into cache sized pieces, or into tasks.
+template <typename F>
+inline void ForEachBlock(Table const* table, size_t block_rows, F kernel) {
+  assert(block_rows > 0);
+  for (size_t begin = 0; begin < table->size; begin += block_rows) {
+    size_t const end = (table->size - begin < block_rows) ? table->size : begin + block_rows;
+    kernel(begin, end);
+  }
+}
+
+}  // namespace ortable
+
+#endif	/* ORTABLE_H */
@@ -8,15 +8,19 @@
 #ifndef ORTABLE_TYPES_H
 #define	ORTABLE_TYPES_H
 
-namespace ortable {
+#include <stddef.h>
+#include <stdint.h>
 
-struct Table {
-  void* buffer;
-  size_t size;
-  size_t capacity;
+namespace ortable {
 
+enum {
+  ALIGNMENT = 64, // Every lane starts on a cache line, which also covers any SIMD width we use
+  ROW_PADDING = 8, // Capacity is always a multiple of this, so kernels can run whole vectors past size
+  MAX_ATTRIBUTES = 16
 };
 
+// A column of the table: count lanes per row, each element size bytes.
+// Lane i is a contiguous array of capacity elements at buffer + offset + i * stride.
 struct Attribute {
   size_t size;
   size_t count;
@@ -24,7 +28,44 @@ struct Attribute {
   size_t stride;
 };
 
+// Structure of arrays storage; all attributes share one allocation and one row count.
+struct Table {
+  void* buffer; // Aligned to ALIGNMENT
+  void* allocation; // What was actually allocated; buffer is inside it
+  size_t size; // Rows in use
+  size_t capacity; // Rows allocated
+
+  Attribute attributes[MAX_ATTRIBUTES];
+  size_t num_attributes;
+};
+
+// Typed handle to an attribute
+template <typename T>
+struct Column {
+  size_t index;
+};
+
+// Contiguous run of elements, e.g. one lane of an attribute
+template <typename T>
+struct Span {
+  T* data;
+  size_t size;
+
+  T& operator[](size_t i) const { return data[i]; }
+  T* begin() const { return data; }
+  T* end() const { return data + size; }
+};
+
+// Elements stride bytes apart, e.g. the lanes of one row
+template <typename T>
+struct StridedSpan {
+  uint8_t* data; // const-ness is carried by T
+  size_t size;
+  size_t stride;
+
+  T& operator[](size_t i) const { return *reinterpret_cast<T*>(data + i * stride); }
+};
+
 }  // namespace ortable
 
 #endif	/* ORTABLE_TYPES_H */
-
@@ -0,0 +1,589 @@
+#include "history/history.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace orbital {
+namespace history {
+
+namespace {
+
+// Stream encoding
+
+inline uint64_t ZigZag(int64_t v) { return (uint64_t(v) << 1) ^ uint64_t(v >> 63); }
+inline int64_t UnZigZag(uint64_t v) { return int64_t(v >> 1) ^ -int64_t(v & 1); }
+
+inline void WriteVarint(std::vector<uint8_t>* data, uint64_t v) {
+  while (v >= 0x80) {
+    data->push_back(uint8_t(v) | 0x80);
+    v >>= 7;
+  }
+  data->push_back(uint8_t(v));
+}
+
+inline uint64_t ReadVarint(uint8_t const** p, uint8_t const* end) {
+  uint64_t v = 0;
+  int shift = 0;
+  while (true) {
+    assert(*p < end);
+    uint8_t const b = *(*p)++;
+    v |= uint64_t(b & 0x7f) << shift;
+    if (!(b & 0x80)) { return v; }
+    shift += 7;
+  }
+}
+
+// Quantization and prediction. The decoder has to reproduce the encoder's predictions exactly, so
+// both go through here.
+
+inline int64_t Quantize(double v, double quantum) { return int64_t(llround(v / quantum)); }
+
+void QuantizeState(Params const& params, EntityState const& state, int64_t* o_q) {
+  for (int i = 0; i < 3; ++i) {
+    o_q[i] = Quantize(state.pos[i], params.pos_quantum);
+    o_q[3 + i] = Quantize(state.vel[i], params.vel_quantum);
+  }
+}
+
+void DequantizeState(Params const& params, Track const& track, EntityState* o_state) {
+  o_state->id = track.id;
+  for (int i = 0; i < 3; ++i) {
+    o_state->pos[i] = track.q[i] * params.pos_quantum;
+    o_state->vel[i] = track.q[3 + i] * params.vel_quantum;
+  }
+}
+
+// Linear extrapolation from the previous two frames; frames aren't evenly spaced in general
+void Predict(Track const& track, double time, int64_t* o_pred) {
+  if (!track.has_prev || track.time == track.time_prev) {
+    memcpy(o_pred, track.q, sizeof(track.q));
+    return;
+  }
+  double const ratio = (time - track.time) / (track.time - track.time_prev);
+  for (int i = 0; i < NUM_COMPONENTS; ++i) {
+    o_pred[i] = track.q[i] + int64_t(llround(double(track.q[i] - track.q_prev[i]) * ratio));
+  }
+}
+
+void Advance(Track* track, double time, int64_t const* q) {
+  memcpy(track->q_prev, track->q, sizeof(track->q));
+  memcpy(track->q, q, sizeof(track->q));
+  track->time_prev = track->time;
+  track->time = time;
+  track->has_prev = true;
+}
+
+Track MakeTrack(EntityId id, double time, int64_t const* q) {
+  Track track;
+  track.id = id;
+  memcpy(track.q, q, sizeof(track.q));
+  memcpy(track.q_prev, q, sizeof(track.q));
+  track.time = time;
+  track.time_prev = time;
+  track.has_prev = false;
+  return track;
+}
+
+size_t ChunkBytes(Chunk const& chunk) {
+  return chunk.data.size() + chunk.times.size() * sizeof(double) + chunk.offsets.size() * sizeof(uint32_t);
+}
+
+// Decodes one frame, updating tracks from the previous frame's state (empty for a keyframe)
+uint8_t const* DecodeFrame(uint8_t const* p, uint8_t const* end, double time, std::vector<Track>* tracks) {
+  // Removed entities, as gaps between ascending indices
+  uint64_t const num_removed = ReadVarint(&p, end);
+  if (num_removed > 0) {
+    size_t next_removed = 0;
+    size_t out = 0;
+    size_t in = 0;
+    for (uint64_t r = 0; r < num_removed; ++r) {
+      next_removed = (r == 0 ? 0 : next_removed + 1) + size_t(ReadVarint(&p, end));
+      for (; in < next_removed; ++in) {
+        (*tracks)[out++] = (*tracks)[in];
+      }
+      in = next_removed + 1;
+    }
+    for (; in < tracks->size(); ++in) {
+      (*tracks)[out++] = (*tracks)[in];
+    }
+    tracks->resize(out);
+  }
+
+  size_t const num_survivors = tracks->size();
+
+  // New entities, with full state
+  uint64_t const num_added = ReadVarint(&p, end);
+  for (uint64_t a = 0; a < num_added; ++a) {
+    EntityId id;
+    id.sparse_idx = uint32_t(ReadVarint(&p, end));
+    id.generation = uint16_t(ReadVarint(&p, end));
+    int64_t q[NUM_COMPONENTS];
+    for (int i = 0; i < NUM_COMPONENTS; ++i) {
+      q[i] = UnZigZag(ReadVarint(&p, end));
+    }
+    tracks->push_back(MakeTrack(id, time, q));
+  }
+
+  // Residuals for everything that was already there
+  for (size_t k = 0; k < num_survivors; ++k) {
+    Track& track = (*tracks)[k];
+    int64_t q[NUM_COMPONENTS];
+    Predict(track, time, q);
+    for (int i = 0; i < NUM_COMPONENTS; ++i) {
+      q[i] += UnZigZag(ReadVarint(&p, end));
+    }
+    Advance(&track, time, q);
+  }
+
+  return p;
+}
+
+// Decodes the first num_frames frames of a chunk
+void DecodeFrames(Chunk const& chunk, size_t num_frames, std::vector< std::vector<Track> >* o_frames) {
+  o_frames->resize(num_frames);
+  uint8_t const* p = chunk.data.empty() ? NULL : &chunk.data[0];
+  uint8_t const* const end = p + chunk.data.size();
+  for (size_t f = 0; f < num_frames; ++f) {
+    std::vector<Track>& frame = (*o_frames)[f];
+    if (f == 0) {
+      frame.clear();
+    } else {
+      frame = (*o_frames)[f - 1];
+    }
+    p = DecodeFrame(p, end, chunk.times[f], &frame);
+  }
+}
+
+size_t FindChunk(History const* history, double time) {
+  size_t lo = 0;
+  size_t hi = history->chunks.size();
+  while (hi - lo > 1) {
+    size_t const mid = (lo + hi) / 2;
+    if (history->chunks[mid].times.front() <= time) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+size_t FindFrame(Chunk const& chunk, double time) {
+  std::vector<double>::const_iterator it = std::upper_bound(chunk.times.begin(), chunk.times.end(), time);
+  assert(it != chunk.times.begin());
+  return size_t(it - chunk.times.begin()) - 1;
+}
+
+// Makes sure the cache holds the given chunk, plus the next keyframe if there is one
+void CacheChunk(History* history, size_t chunk_idx) {
+  Chunk const& chunk = history->chunks[chunk_idx];
+  bool const has_next = chunk_idx + 1 < history->chunks.size();
+  size_t const num_frames = chunk.times.size() + (has_next ? 1 : 0);
+  if (history->cache_serial == chunk.serial && history->cache_num_frames == num_frames) {
+    return;
+  }
+
+  // Appending frames to the open chunk doesn't change the earlier ones, so just decode the new ones
+  size_t const first_new = (history->cache_serial == chunk.serial) ? history->cache_num_frames : 0;
+  if (first_new == 0) {
+    DecodeFrames(chunk, chunk.times.size(), &history->cache_frames);
+  } else {
+    std::vector< std::vector<Track> >& frames = history->cache_frames;
+    frames.resize(chunk.times.size());
+    uint8_t const* p = &chunk.data[0] + chunk.offsets[first_new];
+    uint8_t const* const end = &chunk.data[0] + chunk.data.size();
+    for (size_t f = first_new; f < chunk.times.size(); ++f) {
+      frames[f] = frames[f - 1];
+      p = DecodeFrame(p, end, chunk.times[f], &frames[f]);
+    }
+  }
+
+  if (has_next) {
+    Chunk const& next = history->chunks[chunk_idx + 1];
+    history->cache_frames.push_back(std::vector<Track>());
+    uint8_t const* p = &next.data[0];
+    DecodeFrame(p, p + next.data.size(), next.times.front(), &history->cache_frames.back());
+  }
+
+  history->cache_serial = chunk.serial;
+  history->cache_num_frames = num_frames;
+}
+
+void InvalidateCache(History* history) {
+  history->cache_serial = UINT64_MAX;
+  history->cache_num_frames = 0;
+  history->cache_frames.clear();
+}
+
+void RebuildLiveLifetimes(History* history) {
+  std::fill(history->live_lifetimes.begin(), history->live_lifetimes.end(), -1);
+  for (size_t i = 0; i < history->lifetimes.size(); ++i) {
+    Lifetime const& lifetime = history->lifetimes[i];
+    if (lifetime.alive) {
+      history->live_lifetimes[lifetime.id.sparse_idx] = int(i);
+    }
+  }
+}
+
+void EndLifetime(History* history, EntityId id) {
+  int const live = history->live_lifetimes[id.sparse_idx];
+  if (live >= 0 && history->lifetimes[live].id == id) {
+    history->lifetimes[live].alive = false;
+    history->live_lifetimes[id.sparse_idx] = -1;
+  }
+}
+
+void EvictOldChunks(History* history) {
+  bool evicted = false;
+  while (history->num_bytes > history->params.max_bytes && history->chunks.size() > 1) {
+    history->num_bytes -= ChunkBytes(history->chunks.front());
+    history->chunks.pop_front();
+    evicted = true;
+  }
+  if (!evicted) { return; }
+
+  // Forget entities that only existed in the evicted chunks
+  double const begin = BeginTime(history);
+  size_t out = 0;
+  for (size_t i = 0; i < history->lifetimes.size(); ++i) {
+    Lifetime lifetime = history->lifetimes[i];
+    if (!lifetime.alive && lifetime.end < begin) { continue; }
+    lifetime.begin = std::max(lifetime.begin, begin);
+    history->lifetimes[out++] = lifetime;
+  }
+  history->lifetimes.resize(out);
+  RebuildLiveLifetimes(history);
+}
+
+void Hermite(double h, double s, double p0, double v0, double p1, double v1, double* o_p, double* o_v) {
+  double const s2 = s * s;
+  double const s3 = s2 * s;
+  *o_p = (2*s3 - 3*s2 + 1) * p0 + (s3 - 2*s2 + s) * h * v0 + (-2*s3 + 3*s2) * p1 + (s3 - s2) * h * v1;
+  *o_v = ((6*s2 - 6*s) * p0 + (3*s2 - 4*s + 1) * h * v0 + (-6*s2 + 6*s) * p1 + (3*s2 - 2*s) * h * v1) / h;
+}
+
+}  // namespace
+
+void Init(History* history, Params const& params) {
+  assert(params.pos_quantum > 0 && params.vel_quantum > 0);
+  assert(params.frames_per_chunk > 0);
+  history->params = params;
+  history->next_serial = 0;
+  history->slot_scratch.clear();
+  history->live_lifetimes.clear();
+  Clear(history);
+}
+
+void Clear(History* history) {
+  history->chunks.clear();
+  history->num_bytes = 0;
+  history->lifetimes.clear();
+  std::fill(history->live_lifetimes.begin(), history->live_lifetimes.end(), -1);
+  history->tracks.clear();
+  InvalidateCache(history);
+}
+
+bool Record(History* history, double time, EntityState const* states, size_t count) {
+  Params const& params = history->params;
+
+  if (!Empty(history)) {
+    double const last_time = EndTime(history);
+    assert(time > last_time);
+    if (time - last_time < params.min_interval) { return false; }
+  }
+
+  bool const keyframe = Empty(history) || history->chunks.back().times.size() >= size_t(params.frames_per_chunk);
+  if (keyframe) {
+    if (!Empty(history)) {
+      Chunk& closed = history->chunks.back();
+      history->num_bytes -= ChunkBytes(closed);
+      closed.data.shrink_to_fit();
+      closed.times.shrink_to_fit();
+      closed.offsets.shrink_to_fit();
+      history->num_bytes += ChunkBytes(closed);
+    }
+    history->chunks.push_back(Chunk());
+    history->chunks.back().serial = history->next_serial++;
+  }
+
+  Chunk& chunk = history->chunks.back();
+  size_t const bytes_before = ChunkBytes(chunk);
+  chunk.times.push_back(time);
+  chunk.offsets.push_back(uint32_t(chunk.data.size()));
+
+  // Slot tables grow to the highest sparse_idx seen; everything recorded later is looked up in them
+  uint32_t max_slot = 0;
+  for (size_t j = 0; j < count; ++j) {
+    max_slot = std::max(max_slot, states[j].id.sparse_idx);
+  }
+  if (count > 0 && max_slot >= history->slot_scratch.size()) {
+    history->slot_scratch.resize(max_slot + 1, -1);
+    history->live_lifetimes.resize(max_slot + 1, -1);
+  }
+
+  std::vector<int>& slots = history->slot_scratch;
+  std::vector<uint8_t>& seen = history->seen_scratch;
+  seen.assign(count, 0);
+  for (size_t j = 0; j < count; ++j) {
+    assert(slots[states[j].id.sparse_idx] == -1); // Same slot recorded twice
+    slots[states[j].id.sparse_idx] = int(j);
+  }
+
+  std::vector<Track>& tracks = history->tracks;
+  if (keyframe) {
+    // A keyframe stores everything as added, so it has no removals; but anything gone since the
+    // previous frame still has to have its lifetime ended.
+    for (size_t k = 0; k < tracks.size(); ++k) {
+      int const j = slots[tracks[k].id.sparse_idx];
+      if (j < 0 || states[j].id != tracks[k].id) { EndLifetime(history, tracks[k].id); }
+    }
+    tracks.clear();
+  }
+
+  // Removed: tracks not matched by id
+  {
+    size_t num_removed = 0;
+    for (size_t k = 0; k < tracks.size(); ++k) {
+      int const j = slots[tracks[k].id.sparse_idx];
+      if (j < 0 || states[j].id != tracks[k].id) { ++num_removed; }
+    }
+    WriteVarint(&chunk.data, num_removed);
+    size_t prev_removed = 0;
+    bool first = true;
+    for (size_t k = 0; k < tracks.size(); ++k) {
+      int const j = slots[tracks[k].id.sparse_idx];
+      if (j >= 0 && states[j].id == tracks[k].id) {
+        seen[j] = 1;
+        continue;
+      }
+      WriteVarint(&chunk.data, first ? k : k - prev_removed - 1);
+      prev_removed = k;
+      first = false;
+      EndLifetime(history, tracks[k].id);
+    }
+  }
+
+  // Added, in the order given
+  size_t num_added = 0;
+  for (size_t j = 0; j < count; ++j) {
+    if (!seen[j]) { ++num_added; }
+  }
+  WriteVarint(&chunk.data, num_added);
+  size_t const num_tracks_before = tracks.size();
+  std::vector<Track> added;
+  added.reserve(num_added);
+  for (size_t j = 0; j < count; ++j) {
+    if (seen[j]) { continue; }
+    int64_t q[NUM_COMPONENTS];
+    QuantizeState(params, states[j], q);
+    WriteVarint(&chunk.data, states[j].id.sparse_idx);
+    WriteVarint(&chunk.data, states[j].id.generation);
+    for (int i = 0; i < NUM_COMPONENTS; ++i) {
+      WriteVarint(&chunk.data, ZigZag(q[i]));
+    }
+    added.push_back(MakeTrack(states[j].id, time, q));
+  }
+
+  // Residuals for survivors, in stored order
+  size_t out = 0;
+  for (size_t k = 0; k < num_tracks_before; ++k) {
+    Track track = tracks[k];
+    int const j = slots[track.id.sparse_idx];
+    if (j < 0 || states[j].id != track.id) { continue; }
+    int64_t q[NUM_COMPONENTS];
+    int64_t pred[NUM_COMPONENTS];
+    QuantizeState(params, states[j], q);
+    Predict(track, time, pred);
+    for (int i = 0; i < NUM_COMPONENTS; ++i) {
+      WriteVarint(&chunk.data, ZigZag(q[i] - pred[i]));
+    }
+    Advance(&track, time, q);
+    tracks[out++] = track;
+  }
+  tracks.resize(out);
+  tracks.insert(tracks.end(), added.begin(), added.end());
+
+  // Lifetimes
+  for (size_t j = 0; j < count; ++j) {
+    EntityId const id = states[j].id;
+    slots[id.sparse_idx] = -1;
+    int const live = history->live_lifetimes[id.sparse_idx];
+    if (live >= 0 && history->lifetimes[live].id == id) {
+      history->lifetimes[live].end = time;
+      continue;
+    }
+    if (live >= 0) {
+      history->lifetimes[live].alive = false;
+    }
+    Lifetime lifetime;
+    lifetime.id = id;
+    lifetime.begin = time;
+    lifetime.end = time;
+    lifetime.alive = true;
+    history->live_lifetimes[id.sparse_idx] = int(history->lifetimes.size());
+    history->lifetimes.push_back(lifetime);
+  }
+
+  history->num_bytes += ChunkBytes(chunk) - bytes_before;
+  EvictOldChunks(history);
+  return true;
+}
+
+bool Sample(History* history, double time, std::vector<EntityState>* o_states) {
+  o_states->clear();
+  if (Empty(history) || time < BeginTime(history) || time > EndTime(history)) { return false; }
+
+  size_t const chunk_idx = FindChunk(history, time);
+  CacheChunk(history, chunk_idx);
+
+  Chunk const& chunk = history->chunks[chunk_idx];
+  size_t const f = FindFrame(chunk, time);
+  std::vector<Track> const& frame_a = history->cache_frames[f];
+  double const time_a = chunk.times[f];
+
+  EntityState state;
+  if (time == time_a || f + 1 >= history->cache_frames.size()) {
+    for (size_t k = 0; k < frame_a.size(); ++k) {
+      DequantizeState(history->params, frame_a[k], &state);
+      o_states->push_back(state);
+    }
+    return true;
+  }
+
+  std::vector<Track> const& frame_b = history->cache_frames[f + 1];
+  double const time_b = (f + 1 < chunk.times.size()) ? chunk.times[f + 1] : history->chunks[chunk_idx + 1].times.front();
+  double const h = time_b - time_a;
+  double const s = (time - time_a) / h;
+
+  // Within a chunk, survivors keep their order and new entities go on the end, so we can match by
+  // walking both frames together. Across a chunk boundary the keyframe may be in any order.
+  bool const same_chunk = (f + 1 < chunk.times.size());
+  std::vector<int>& slots = history->slot_scratch;
+  if (!same_chunk) {
+    for (size_t k = 0; k < frame_b.size(); ++k) { slots[frame_b[k].id.sparse_idx] = int(k); }
+  }
+
+  size_t kb = 0;
+  for (size_t ka = 0; ka < frame_a.size(); ++ka) {
+    Track const& a = frame_a[ka];
+    DequantizeState(history->params, a, &state);
+
+    Track const* b = NULL;
+    if (same_chunk) {
+      if (kb < frame_b.size() && frame_b[kb].id == a.id) { b = &frame_b[kb++]; }
+    } else {
+      int const j = slots[a.id.sparse_idx];
+      if (j >= 0 && frame_b[j].id == a.id) { b = &frame_b[j]; }
+    }
+
+    if (b) {
+      EntityState state_b;
+      DequantizeState(history->params, *b, &state_b);
+      for (int i = 0; i < 3; ++i) {
+        Hermite(h, s, state.pos[i], state.vel[i], state_b.pos[i], state_b.vel[i], &state.pos[i], &state.vel[i]);
+      }
+    } else {
+      // Gone by the next frame; we don't know when exactly, so carry on in a straight line
+      for (int i = 0; i < 3; ++i) {
+        state.pos[i] += state.vel[i] * (time - time_a);
+      }
+    }
+    o_states->push_back(state);
+  }
+
+  if (!same_chunk) {
+    for (size_t k = 0; k < frame_b.size(); ++k) { slots[frame_b[k].id.sparse_idx] = -1; }
+  }
+  return true;
+}
+
+void Truncate(History* history, double time) {
+  if (Empty(history) || time >= EndTime(history)) { return; }
+  if (time < BeginTime(history)) {
+    Clear(history);
+    return;
+  }
+
+  size_t const chunk_idx = FindChunk(history, time);
+  while (history->chunks.size() > chunk_idx + 1) {
+    history->num_bytes -= ChunkBytes(history->chunks.back());
+    history->chunks.pop_back();
+  }
+
+  Chunk& chunk = history->chunks.back();
+  size_t const f = FindFrame(chunk, time);
+  double const last_time = chunk.times[f];
+
+  // Encoder carries on from the state at the last kept frame
+  std::vector< std::vector<Track> > frames;
+  DecodeFrames(chunk, f + 1, &frames);
+  history->tracks.swap(frames.back());
+
+  history->num_bytes -= ChunkBytes(chunk);
+  if (f + 1 < chunk.times.size()) {
+    chunk.data.resize(chunk.offsets[f + 1]);
+  }
+  chunk.times.resize(f + 1);
+  chunk.offsets.resize(f + 1);
+  history->num_bytes += ChunkBytes(chunk);
+
+  // Lifetimes are contiguous runs of frames, so anything still going at the last kept frame is
+  // exactly what's in it.
+  size_t out = 0;
+  for (size_t i = 0; i < history->lifetimes.size(); ++i) {
+    Lifetime lifetime = history->lifetimes[i];
+    if (lifetime.begin > last_time) { continue; }
+    lifetime.alive = (lifetime.end >= last_time);
+    lifetime.end = std::min(lifetime.end, last_time);
+    history->lifetimes[out++] = lifetime;
+  }
+  history->lifetimes.resize(out);
+  RebuildLiveLifetimes(history);
+
+  InvalidateCache(history);
+}
+
+void RunTests() {
+  Params params;
+  params.frames_per_chunk = 4;
+  History history;
+  Init(&history, params);
+
+  EntityState states[2];
+  memset(states, 0, sizeof(states));
+  states[0].id.sparse_idx = 0;
+  states[1].id.sparse_idx = 1;
+
+  // Entity 1 goes on the first frame of the second chunk
+  for (int f = 0; f < 4; ++f) {
+    Record(&history, f, states, 2);
+  }
+  Record(&history, 4, states, 1);
+  assert(history.chunks.size() == 2);
+  assert(history.lifetimes.size() == 2);
+  assert(history.lifetimes[0].alive && history.lifetimes[0].end == 4);
+  assert(!history.lifetimes[1].alive && history.lifetimes[1].end == 3);
+
+  std::vector<EntityState> sampled;
+  Sample(&history, 4, &sampled);
+  assert(sampled.size() == 1 && sampled[0].id == states[0].id);
+
+  // Once its chunk is evicted, it's forgotten
+  history.params.max_bytes = 0;
+  Record(&history, 5, states, 1);
+  assert(history.lifetimes.size() == 1 && history.lifetimes[0].id == states[0].id);
+}
+
+size_t NumFrames(History const* history) {
+  size_t num_frames = 0;
+  for (size_t i = 0; i < history->chunks.size(); ++i) {
+    num_frames += history->chunks[i].times.size();
+  }
+  return num_frames;
+}
+
+}  // namespace history
+}  // namespace orbital
@@ -0,0 +1,140 @@
+#ifndef ORBITALSPACE_HISTORY_H
+#define	ORBITALSPACE_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <vector>
+
+// Recorded world state over time, for rewinding and scrubbing.
+//
+// Frames are grouped into chunks. The first frame of each chunk is a keyframe with every entity's
+// full state; the rest store, per entity, the difference between its quantized state and a linear
+// prediction from the two previous frames, zigzag + varint encoded. For smoothly moving entities the
+// residuals are a byte or so per component, so a frame costs a few bytes per entity.
+// Entities can appear and disappear between any two frames; this is stored in the frame too.
+//
+// Random access is a binary search on chunk start times followed by decoding that chunk from its
+// keyframe. The last decoded chunk is cached, so scrubbing within a chunk only costs interpolation.
+// Once we go over the memory budget the oldest chunks are thrown away.
+//
+// TODO could thin out old chunks (keep keyframes only) rather than dropping them outright
+// TODO general purpose compression pass (LZ) over closed chunks?
+namespace orbital {
+namespace history {
+
+// Same layout as orbital::Id<T> so ids from the systems can be recorded directly.
+// A slot being reused with a new generation counts as a different entity.
+struct EntityId {
+  uint16_t generation;
+  uint32_t sparse_idx;
+};
+
+inline bool operator==(EntityId a, EntityId b) { return a.generation == b.generation && a.sparse_idx == b.sparse_idx; }
+inline bool operator!=(EntityId a, EntityId b) { return !(a == b); }
+
+struct EntityState {
+  EntityId id;
+  double pos[3];
+  double vel[3];
+};
+
+// Span of sim time an entity existed for, as far as the recording knows
+struct Lifetime {
+  EntityId id;
+  double begin;
+  double end; // Time of the last frame it was recorded in
+  bool alive; // Still in the most recent frame
+};
+
+struct Params {
+  Params() :
+    pos_quantum(1.0),
+    vel_quantum(1e-3),
+    min_interval(0.0),
+    frames_per_chunk(64),
+    max_bytes(64 * 1024 * 1024)
+  {}
+
+  double pos_quantum; // Position precision, in world units
+  double vel_quantum; // Velocity precision, in world units / second
+  double min_interval; // Record calls closer together than this are ignored
+  int frames_per_chunk;
+  size_t max_bytes; // Budget for encoded data; oldest chunks are evicted past this
+};
+
+enum {
+  NUM_COMPONENTS = 6 // pos xyz, vel xyz
+};
+
+struct Chunk {
+  uint64_t serial; // Unique per chunk, survives eviction
+  std::vector<double> times; // One per frame
+  std::vector<uint32_t> offsets; // Start of each frame in data
+  std::vector<uint8_t> data;
+};
+
+// Quantized state of an entity at a frame, plus the frame before for prediction
+struct Track {
+  EntityId id;
+  int64_t q[NUM_COMPONENTS];
+  int64_t q_prev[NUM_COMPONENTS];
+  double time;
+  double time_prev;
+  bool has_prev;
+};
+
+struct History {
+  Params params;
+
+  std::deque<Chunk> chunks;
+  uint64_t next_serial;
+  size_t num_bytes;
+
+  std::vector<Lifetime> lifetimes;
+  std::vector<int> live_lifetimes; // Indexed by sparse_idx, index into lifetimes or -1
+
+  // Encoder state: entities in the last recorded frame, in stored order
+  std::vector<Track> tracks;
+
+  // Decoded copy of one chunk: for each frame, the entities in stored order.
+  // Has the next chunk's keyframe on the end if there is one, for interpolating across the boundary.
+  uint64_t cache_serial;
+  size_t cache_num_frames;
+  std::vector< std::vector<Track> > cache_frames;
+
+  // Scratch
+  std::vector<int> slot_scratch;
+  std::vector<uint8_t> seen_scratch;
+};
+
+void Init(History* history, Params const& params);
+
+// Appends a frame. Time must be after the last recorded frame; use Truncate first to overwrite.
+// Returns false if the frame was skipped because of min_interval.
+bool Record(History* history, double time, EntityState const* states, size_t count);
+
+// Fills o_states with all entities that exist at the given time, interpolated between the
+// surrounding frames. Returns false if the time is outside the recorded range.
+bool Sample(History* history, double time, std::vector<EntityState>* o_states);
+
+// Throws away all frames after the given time, e.g. when resuming the sim from a rewound point.
+void Truncate(History* history, double time);
+
+void Clear(History* history);
+
+inline bool Empty(History const* history) { return history->chunks.empty(); }
+inline double BeginTime(History const* history) { return history->chunks.front().times.front(); }
+inline double EndTime(History const* history) { return history->chunks.back().times.back(); }
+
+size_t NumFrames(History const* history);
+inline size_t MemoryUsage(History const* history) { return history->num_bytes; }
+
+// Self-checks; asserts on failure
+void RunTests();
+
+}  // namespace history
+}  // namespace orbital
+
+#endif	/* ORBITALSPACE_HISTORY_H */
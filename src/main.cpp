@@ -31,6 +31,8 @@
 #include "util/logging.h"
 #include "util/timer.h"
 
+#include "history/history.h"
+
 #include "imgui.h"
 #include "imgui_impl_sdl_gl3.h"
 
@@ -474,6 +476,28 @@ glm::mat4 CamMtxFromCamParams(OrbitalCamParams const& params)
   return cam_mtx;
 }
 
+// Stand-in for a simulation until there is one here: a grid of spheres bobbing up and down
+void updateDemoWorld(double sim_time, std::vector<orbital::history::EntityState>* o_states)
+{
+  o_states->clear();
+  uint16_t idx = 0;
+  for (int x = -10; x < 10; ++x) {
+    for (int y = -10; y < 10; ++y) {
+      double const phase = 0.5 * sim_time + 0.3 * (x + y);
+      orbital::history::EntityState state;
+      state.id.generation = 0;
+      state.id.sparse_idx = idx++;
+      state.pos[0] = 3.0 * x;
+      state.pos[1] = 3.0 * y;
+      state.pos[2] = sin(phase);
+      state.vel[0] = 0.0;
+      state.vel[1] = 0.0;
+      state.vel[2] = 0.5 * cos(phase);
+      o_states->push_back(state);
+    }
+  }
+}
+
 extern "C"
 int main(int argc, char *argv[])
 {
@@ -481,6 +505,8 @@ int main(int argc, char *argv[])
 
   timer::Init();
 
+  history::RunTests();
+
   SDL_Init(SDL_INIT_VIDEO);
 
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
@@ -640,6 +666,22 @@ int main(int argc, char *argv[])
   float external_scroll = 0.0f;
   float external_scroll_max = 1000.0f;
 
+  // World history, for scrubbing in the timeline
+  history::Params history_params;
+  history_params.pos_quantum = 1e-3;
+  history_params.vel_quantum = 1e-3;
+  history_params.min_interval = 1.0 / 30.0;
+  history::History world_history;
+  history::Init(&world_history, history_params);
+
+  std::vector<history::EntityState> world;
+  double sim_time = 0.0;
+  float last_uptime = timer::UptimeSeconds();
+  // When not live, the sim is paused and we show the recorded state at scrub_time
+  bool live = true;
+  double scrub_time = 0.0;
+  float pixels_per_second = 20.0f;
+
   camParams.dist = 2.0f;
 
   LOGINFO("Starting main loop");
@@ -661,6 +703,20 @@ int main(int argc, char *argv[])
 
     ImGui_ImplSdlGL3_NewFrame();
 
+    // Update world
+    {
+      float const uptime = timer::UptimeSeconds();
+      if (live) {
+        sim_time += uptime - last_uptime;
+        updateDemoWorld(sim_time, &world);
+        history::Record(&world_history, sim_time, world.data(), world.size());
+        scrub_time = sim_time;
+      } else {
+        history::Sample(&world_history, scrub_time, &world);
+      }
+      last_uptime = uptime;
+    }
+
     // 1. Show a simple window
     // Tip: if we don't call ImGui::Begin()/ImGui::End() the widgets appears in a window automatically called "Debug"
     {
@@ -684,23 +740,61 @@ int main(int argc, char *argv[])
         ImGui::SliderFloat2("size", &size.x, 0.0f, ImGui::GetIO().DisplaySize.x);
         ImGui::SliderFloat2("size_inner", &size_inner.x, 0.0f, ImGui::GetIO().DisplaySize.x);
         ImGui::SliderFloat2("size_entities", &size_entities.x, 0.0f, ImGui::GetIO().DisplaySize.x);
+        ImGui::SliderFloat("pixels_per_second", &pixels_per_second, 1.0f, 200.0f);
+        if (ImGui::Checkbox("Live", &live) && live) {
+          // Resume from the scrubbed point, forgetting what came after
+          history::Truncate(&world_history, scrub_time);
+          sim_time = history::Empty(&world_history) ? scrub_time : history::EndTime(&world_history);
+        }
+        ImGui::SameLine();
+        ImGui::Text("%.2fs, %d frames, %.1f KB", scrub_time, (int)history::NumFrames(&world_history), history::MemoryUsage(&world_history) / 1024.0f);
+
+        double const begin_time = history::Empty(&world_history) ? 0.0 : history::BeginTime(&world_history);
+        double const end_time = history::Empty(&world_history) ? 0.0 : history::EndTime(&world_history);
+        std::vector<history::Lifetime> const& lifetimes = world_history.lifetimes;
+        float const row_height = ImGui::GetTextLineHeightWithSpacing();
+        float const rows_height = glm::max(size.y, row_height * lifetimes.size());
+
         ImGui::BeginChild("inner_timeline", size, true, ImGuiWindowFlags_ShowBorders | ImGuiWindowFlags_ForceVerticalScrollbar);
           // ImGui::Columns(2, NULL, true);
-          // TODO entity list
           // ImGui::PushItemWidth(60.0f);
-          ImGui::BeginChild("entities_column", size_entities, true, ImGuiWindowFlags_ShowBorders | ImGuiWindowFlags_NoScrollbar);
-          ImGui::Text("Entity 1");
-          ImGui::Text("Entity 2");
-          ImGui::Text("Entity 3");
+          ImGui::BeginChild("entities_column", ImVec2(size_entities.x, rows_height), true, ImGuiWindowFlags_ShowBorders | ImGuiWindowFlags_NoScrollbar);
+          for (size_t i = 0; i < lifetimes.size(); ++i) {
+            ImGui::Text("Entity %d:%d", lifetimes[i].id.sparse_idx, lifetimes[i].id.generation);
+          }
           // ImGui::NextColumn();
           ImGui::EndChild();
           ImGui::SameLine();
           // ImGui::PopItemWidth();
-          ImGui::BeginChild("timeline_timeline", size_inner, true, ImGuiWindowFlags_ShowBorders | ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_HorizontalScrollbar ); // | ImGuiWindowFlags_ForceHorizontalScrollbar);
+          ImGui::BeginChild("timeline_timeline", ImVec2(size_inner.x, rows_height), true, ImGuiWindowFlags_ShowBorders | ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_HorizontalScrollbar ); // | ImGuiWindowFlags_ForceHorizontalScrollbar);
+            // Follow the live end unless the user is looking at something else
+            if (live && external_scroll >= external_scroll_max - 1.0f) {
+              external_scroll = ImGui::GetScrollMaxX();
+            }
             ImGui::SetScrollX(external_scroll);
             external_scroll_max = ImGui::GetScrollMaxX();
-            // TODO entity timeline
-            ImGui::Text("Image of a Timeline Image of a Timeline Image of a Timeline Image of a Timeline Image of a Timeline Image of a Timeline Image of a Timeline Image of a Timeline Image of a Timeline Image of a Timeline Image of a Timeline");
+
+            // One bar per entity lifetime, and a line for the current time
+            ImVec2 const origin = ImGui::GetCursorScreenPos();
+            float const width = glm::max(1.0f, float(end_time - begin_time) * pixels_per_second);
+            ImDrawList* draw_list = ImGui::GetWindowDrawList();
+            for (size_t i = 0; i < lifetimes.size(); ++i) {
+              history::Lifetime const& lifetime = lifetimes[i];
+              float const y = origin.y + row_height * i;
+              ImVec2 const a(origin.x + float(lifetime.begin - begin_time) * pixels_per_second, y + 2.0f);
+              ImVec2 const b(origin.x + float(lifetime.end - begin_time) * pixels_per_second + 1.0f, y + row_height - 2.0f);
+              draw_list->AddRectFilled(a, b, lifetime.alive ? ImColor(90, 150, 220) : ImColor(120, 120, 120));
+            }
+            float const cursor_x = origin.x + float(scrub_time - begin_time) * pixels_per_second;
+            draw_list->AddLine(ImVec2(cursor_x, origin.y), ImVec2(cursor_x, origin.y + rows_height), ImColor(255, 200, 60));
+
+            // Click or drag to scrub; pauses the sim
+            ImGui::InvisibleButton("timeline_scrub", ImVec2(width, rows_height - ImGui::GetStyle().WindowPadding.y * 2.0f));
+            if (ImGui::IsItemActive() && !history::Empty(&world_history)) {
+              live = false;
+              double const t = begin_time + (ImGui::GetIO().MousePos.x - origin.x) / pixels_per_second;
+              scrub_time = glm::clamp(t, begin_time, end_time);
+            }
           ImGui::EndChild();
           // ImGui::Columns(1);
         ImGui::EndChild();
@@ -747,19 +841,17 @@ int main(int argc, char *argv[])
     GL_CHECK(glUniform1f(uniFcoef, Fcoef));
     GL_CHECK(glUniform1f(uniFcoef_half, Fcoef * 0.5));
 
-    for (int x = -10; x < 10; ++x) {
-      for (int y = -10; y < 10; ++y) {
-        glm::mat4 model;
-        model = glm::rotate(
-            model,
-            0.0f,
-            glm::vec3(0.0f, 0.0f, 1.0f)
-        );
-        model = glm::translate(model, glm::vec3(3.0f * x, 3.0f * y, 0.0f));
-        GL_CHECK(glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(model)));
+    for (size_t i = 0; i < world.size(); ++i) {
+      glm::mat4 model;
+      model = glm::rotate(
+          model,
+          0.0f,
+          glm::vec3(0.0f, 0.0f, 1.0f)
+      );
+      model = glm::translate(model, glm::vec3(world[i].pos[0], world[i].pos[1], world[i].pos[2]));
+      GL_CHECK(glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(model)));
 
-        GL_CHECK(glDrawElements(GL_TRIANGLES, num_elements, GL_UNSIGNED_INT, 0));
-      }
+      GL_CHECK(glDrawElements(GL_TRIANGLES, num_elements, GL_UNSIGNED_INT, 0));
     }
 
     // Render GUI
@@ -0,0 +1,134 @@
+// Compares PhysicsSystem throughput between the double RK4 path and the deterministic fixed point
+// path, and checks the fixed point path reproduces itself exactly.
+//
+// usage: physicsBench [numShips] [numSteps] [dt]
+//
+// Prints the final state hash of the fixed point run; running this on two machines (or builds
+// with different compilers / flags) should print the same hash.
+
+#include "orStd.h"
+#include "orMath.h"
+#include "orPhysics.h"
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+namespace {
+
+// Earth's elements from orApp::s_jpl_elements_t0
+orEphemerisJPL const s_earthElements = {
+  1.00000018, 0.01673163, -0.00054346, 100.46691572, 102.93005885, -5.11260389,
+  -0.00000003, -0.00003661, -0.01337178, 35999.37306329, 0.31795260, -0.24123856,
+  0, 0, 0, 0
+};
+
+void setupSystem(PhysicsSystem& physics, int numShips, std::vector< orbital::Id<PhysicsSystem::ParticleBody> >& o_shipIds) {
+  orEphemerisJPL const sunElements = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
+
+  orbital::Id<PhysicsSystem::GravBody> const sunId = physics.makeGravBody();
+  PhysicsSystem::GravBody& sun = physics.getGravBody(sunId);
+  sun.m_ephemeris = sunElements;
+  sun.m_mass = SUN_MASS;
+  sun.m_radius = SUN_RADIUS;
+
+  orEphemerisCartesian earthCart;
+  ephemerisCartesianFromJPL(s_earthElements, 0.0, earthCart);
+
+  PhysicsSystem::GravBody& earth = physics.getGravBody(physics.makeGravBody());
+  earth.m_ephemeris = s_earthElements;
+  earth.m_mass = EARTH_MASS;
+  earth.m_radius = EARTH_RADIUS;
+  earth.m_pos = earthCart.pos;
+  earth.m_vel = earthCart.vel;
+  earth.m_parentBodyId = sunId;
+
+  // Ships in circular low orbits at a spread of altitudes and inclinations.
+  // Set up in fixed point so the starting state is the same on every machine too.
+  Fixed64 const t_C = Fixed64::fromDouble(julianDateFromSimTime(0.0) - 2451545.0).divInt((int64_t)DAYS_PER_CENTURY);
+  Fixed64 const oneSecond_C = Fixed64::fromInt(1).divInt((int64_t)(SECONDS_PER_DAY * DAYS_PER_CENTURY));
+  orFixedVec3 earthPos, earthPosBefore, earthPosAfter;
+  ephemerisPositionFromJPLFixed(s_earthElements, t_C, earthPos);
+  ephemerisPositionFromJPLFixed(s_earthElements, t_C - oneSecond_C, earthPosBefore);
+  ephemerisPositionFromJPLFixed(s_earthElements, t_C + oneSecond_C, earthPosAfter);
+
+  Fixed64 const mu = Fixed64::fromDouble(GRAV_CONSTANT * EARTH_MASS);
+  physics.makeParticleBodies(numShips, o_shipIds);
+  for (int i = 0; i < numShips; ++i) {
+    Fixed64 const r = Fixed64::fromInt((int64_t)EARTH_RADIUS + 300000 + 1000 * (i % 500));
+    Fixed64 const v = Fixed64::sqrt(mu / r);
+
+    Fixed64 sinPhase, cosPhase, sinInc, cosInc;
+    Fixed64::sinCosTurns(Fixed64(0, 0x9E3779B97F4A7C15ULL * (uint64_t)i), &sinPhase, &cosPhase); // golden ratio spacing
+    Fixed64::sinCosTurns(Fixed64::fromInt(i).divInt(2 * numShips), &sinInc, &cosInc);
+
+    Fixed64 const radial[3] = { cosPhase, sinPhase * cosInc, sinPhase * sinInc };
+    Fixed64 const tangent[3] = { -sinPhase, cosPhase * cosInc, cosPhase * sinInc };
+
+    orFixedVec3 shipPos, shipVel;
+    for (int k = 0; k < 3; ++k) {
+      Fixed64 const earthVel = (earthPosAfter[k] - earthPosBefore[k]).scaleBy2(-1);
+      shipPos[k] = earthPos[k] + r * radial[k];
+      shipVel[k] = earthVel + v * tangent[k];
+    }
+    physics.setParticleFixedState(o_shipIds[i], shipPos, shipVel);
+  }
+}
+
+double runSteps(PhysicsSystem& physics, PhysicsSystem::IntegrationMethod method, int numSteps, double dt) {
+  std::chrono::high_resolution_clock::time_point const start = std::chrono::high_resolution_clock::now();
+  double t = 0;
+  for (int i = 0; i < numSteps; ++i) {
+    physics.update(method, t, dt);
+    orbital::FrameArenas::EndFrame(); // As the app does between frames
+    t += dt;
+  }
+  std::chrono::high_resolution_clock::time_point const end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  int const numShips = (argc > 1) ? atoi(argv[1]) : 1000;
+  int const numSteps = (argc > 2) ? atoi(argv[2]) : 100;
+  double const dt = (argc > 3) ? atof(argv[3]) : 1.0;
+
+  printf("%d ships, %d steps of %.3fs\n", numShips, numSteps, dt);
+
+  std::vector< orbital::Id<PhysicsSystem::ParticleBody> > shipIds;
+
+  std::unique_ptr<PhysicsSystem> doublePhysics(new PhysicsSystem());
+  setupSystem(*doublePhysics, numShips, shipIds);
+  double const doubleMs = runSteps(*doublePhysics, PhysicsSystem::IntegrationMethod_RK4, numSteps, dt);
+
+  std::unique_ptr<PhysicsSystem> fixedPhysics(new PhysicsSystem());
+  setupSystem(*fixedPhysics, numShips, shipIds);
+  printf("Initial state hash: %016llx\n", (unsigned long long)fixedPhysics->stateHash());
+  double const fixedMs = runSteps(*fixedPhysics, PhysicsSystem::IntegrationMethod_FixedLeapfrog, numSteps, dt);
+
+  // RK4 does 4 gravity evaluations a step to leapfrog's 2, so compare per evaluation too
+  double const bodySteps = (double)numShips * numSteps;
+  printf("RK4 (double):     %9.2f ms, %8.3f us/body/step, %8.3f us/body/eval\n", doubleMs, 1e3 * doubleMs / bodySteps, 1e3 * doubleMs / (4 * bodySteps));
+  printf("Leapfrog (fixed): %9.2f ms, %8.3f us/body/step, %8.3f us/body/eval\n", fixedMs, 1e3 * fixedMs / bodySteps, 1e3 * fixedMs / (2 * bodySteps));
+
+  // Divergence between the two integrators, as a sanity check on the fixed point gravity
+  double maxDiff = 0;
+  for (size_t i = 0; i < shipIds.size(); ++i) {
+    Vector3d const a(doublePhysics->getParticlePos(shipIds[i]));
+    Vector3d const b(fixedPhysics->getParticlePos(shipIds[i]));
+    maxDiff = std::max(maxDiff, (a - b).norm());
+  }
+  printf("Max position difference RK4 vs leapfrog: %.3f m\n", maxDiff);
+
+  // Determinism: same inputs again must give exactly the same state
+  std::unique_ptr<PhysicsSystem> fixedPhysics2(new PhysicsSystem());
+  setupSystem(*fixedPhysics2, numShips, shipIds);
+  runSteps(*fixedPhysics2, PhysicsSystem::IntegrationMethod_FixedLeapfrog, numSteps, dt);
+
+  uint64_t const hash = fixedPhysics->stateHash();
+  uint64_t const hash2 = fixedPhysics2->stateHash();
+  printf("Fixed state hash: %016llx %s\n", (unsigned long long)hash, (hash == hash2) ? "(reproduced)" : "(MISMATCH)");
+
+  return (hash == hash2) ? 0 : 1;
+}
@@ -0,0 +1,559 @@
+// Benchmark for the task schedulers, on standard workloads and on ones shaped like a frame of the game.
+//
+// usage: schedulerBench [maxThreads] [reps] [workload]
+//
+// Runs each workload (or just the named one) reps times on each scheduler with 1, 2, 4... up to
+// maxThreads threads, and prints for each:
+// - the median, p99 and worst time of a rep; the spread is what a frame would see
+// - throughput, in the workload's own items
+// - scheduling overhead per task run (tasks counted by the schedulers' telemetry): the thread time
+//   the rep took, threads x wall time, less the time the serial reference run took to do the same
+//   work. Idle time counts as overhead, so on few tasks with not enough parallelism it's an
+//   overestimate; for flood it's all overhead.
+// - speedup over the same scheduler on one thread
+// Every rep checks its result against a serial run, so a broken scheduler fails rather than looking fast.
+//
+// TaskSchedulerLockedQueue is the baseline: one queue behind one lock.
+
+#include "orStd.h"
+
+#include "taskSchedulerWorkStealing.h"
+#include "taskSchedulerLockedQueue.h"
+#include "parallelFor.h"
+
+#include "boost_begin.h"
+#include <boost/thread.hpp>
+#include "boost_end.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+enum SchedulerKind {
+  SchedulerKind_WorkStealing,
+  SchedulerKind_LockedQueue,
+  SchedulerKind_Count
+};
+
+char const* schedulerName(SchedulerKind const kind) {
+  switch (kind) {
+    case SchedulerKind_WorkStealing: return "WorkStealing";
+    case SchedulerKind_LockedQueue: return "LockedQueue";
+    default: return "?";
+  }
+}
+
+// On the calling thread, which becomes thread 0
+orTask::TaskScheduler* makeScheduler(SchedulerKind const kind, int const numThreads) {
+  switch (kind) {
+    case SchedulerKind_WorkStealing: return new orTask::TaskSchedulerWorkStealing(numThreads);
+    case SchedulerKind_LockedQueue: return new orTask::TaskSchedulerLockedQueue(numThreads);
+    default: return NULL;
+  }
+}
+
+double millisSince(std::chrono::high_resolution_clock::time_point const start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+uint64_t mix(uint64_t x) {
+  // splitmix64's finaliser
+  x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// A cache line each, so threads counting don't slow each other down
+struct ThreadCount {
+  ThreadCount() : n(0), sink(0) {}
+  uint64_t n;
+  uint64_t sink; // For results nothing reads, so the work isn't optimised out
+  char pad[48];
+};
+
+uint64_t sumCounts(std::vector<ThreadCount> const& counts) {
+  uint64_t total = 0;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    total += counts[i].n;
+  }
+  return total;
+}
+
+// One benchmark. setup() is untimed and does the serial reference run, recording how long that
+// took in m_serialMs; run() is timed, and returns whether it got the same answer.
+class Workload {
+public:
+  Workload() : m_serialMs(0) {}
+  virtual ~Workload() {}
+  double serialMs() const { return m_serialMs; }
+  virtual char const* name() const = 0;
+  virtual char const* itemName() const = 0;
+  virtual uint64_t itemsPerRun() const = 0;
+  virtual void setup() = 0;
+  virtual bool run(orTask::TaskScheduler& scheduler) = 0;
+
+protected:
+  double m_serialMs;
+};
+
+// Recursive fibonacci: every call above the cutoff forks one half as a task and waits for it, so
+// it's all nested waits on short tasks
+class FibWorkload : public Workload {
+public:
+  enum { N = 30, CUTOFF = 12 };
+
+  FibWorkload() : m_expected(0) {}
+  char const* name() const { return "fib"; }
+  char const* itemName() const { return "calls"; }
+  uint64_t itemsPerRun() const { return m_calls; }
+
+  void setup() {
+    m_calls = 0;
+    std::chrono::high_resolution_clock::time_point const start = std::chrono::high_resolution_clock::now();
+    m_expected = serial(N, &m_calls);
+    m_serialMs = millisSince(start);
+  }
+
+  bool run(orTask::TaskScheduler& scheduler) {
+    Call root = { &scheduler, N, 0 };
+    task(0, &root);
+    return root.result == m_expected;
+  }
+
+private:
+  struct Call {
+    orTask::TaskScheduler* scheduler;
+    int n;
+    uint64_t result;
+  };
+
+  static uint64_t serial(int const n, uint64_t* const o_calls) {
+    ++*o_calls;
+    return (n < 2) ? n : serial(n - 1, o_calls) + serial(n - 2, o_calls);
+  }
+
+  static void task(orTask::ThreadIdx const threadIdx, void* const userData) {
+    Call& call = *static_cast<Call*>(userData);
+    if (call.n < CUTOFF) {
+      uint64_t calls = 0;
+      call.result = serial(call.n, &calls);
+      return;
+    }
+    Call first = { call.scheduler, call.n - 1, 0 };
+    Call second = { call.scheduler, call.n - 2, 0 };
+    orTask::TaskGroup group;
+    call.scheduler->submitTaskForGroup(threadIdx, &group, &task, &first);
+    task(threadIdx, &second);
+    call.scheduler->waitForTaskGroup(threadIdx, &group);
+    call.result = first.result + second.result;
+  }
+
+  uint64_t m_expected;
+  uint64_t m_calls;
+};
+
+// Inclusive prefix sum, in two parallel passes: sum each block, scan the block sums serially, then
+// scan each block from its offset. Memory bound.
+class PrefixSumWorkload : public Workload {
+public:
+  enum { N = 1 << 22, GRAIN = 1 << 14 };
+
+  char const* name() const { return "prefixsum"; }
+  char const* itemName() const { return "elems"; }
+  uint64_t itemsPerRun() const { return N; }
+
+  void setup() {
+    m_in.resize(N);
+    m_expected.resize(N);
+    m_out.resize(N);
+    m_blockSums.resize(N / GRAIN);
+    for (uint32_t i = 0; i < N; ++i) {
+      m_in[i] = (uint32_t)mix(i) & 0xffff;
+    }
+    std::chrono::high_resolution_clock::time_point const start = std::chrono::high_resolution_clock::now();
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < N; ++i) {
+      sum += m_in[i];
+      m_expected[i] = sum;
+    }
+    m_serialMs = millisSince(start);
+  }
+
+  bool run(orTask::TaskScheduler& scheduler) {
+    orTask::parallel_for_blocks(scheduler, 0, N, GRAIN, [this](orTask::ThreadIdx, uint32_t const begin, uint32_t const end) {
+      uint64_t sum = 0;
+      for (uint32_t i = begin; i < end; ++i) {
+        sum += m_in[i];
+      }
+      m_blockSums[begin / GRAIN] = sum;
+    });
+
+    uint64_t offset = 0;
+    for (size_t i = 0; i < m_blockSums.size(); ++i) {
+      uint64_t const blockSum = m_blockSums[i];
+      m_blockSums[i] = offset;
+      offset += blockSum;
+    }
+
+    orTask::parallel_for_blocks(scheduler, 0, N, GRAIN, [this](orTask::ThreadIdx, uint32_t const begin, uint32_t const end) {
+      uint64_t sum = m_blockSums[begin / GRAIN];
+      for (uint32_t i = begin; i < end; ++i) {
+        sum += m_in[i];
+        m_out[i] = sum;
+      }
+    });
+
+    return m_out == m_expected;
+  }
+
+private:
+  std::vector<uint32_t> m_in;
+  std::vector<uint64_t> m_expected;
+  std::vector<uint64_t> m_out;
+  std::vector<uint64_t> m_blockSums;
+};
+
+// Unbalanced tree search: the root has many children, and every other node has either none or a
+// few, decided by hashing its id, so subtree sizes vary wildly. One task per node, all in one group,
+// submitted by whoever runs the parent; nobody waits except thread 0.
+class TreeWorkload : public Workload {
+public:
+  enum {
+    ROOT_CHILDREN = 2000,
+    CHILDREN = 4,
+    // Of 1000; with 4 children that's 0.96 expected children per node, ~25 node subtrees on average
+    // but with a long tail
+    BRANCH_PER_MILLE = 240,
+    WORK_PER_NODE = 64
+  };
+
+  TreeWorkload() : m_expected(0), m_serialSink(0), m_scheduler(NULL), m_counts(), m_group() {}
+  char const* name() const { return "tree"; }
+  char const* itemName() const { return "nodes"; }
+  uint64_t itemsPerRun() const { return m_expected; }
+
+  void setup() {
+    ThreadCount count;
+    std::chrono::high_resolution_clock::time_point const start = std::chrono::high_resolution_clock::now();
+    serial(0, &count);
+    m_serialMs = millisSince(start);
+    m_expected = count.n;
+    m_serialSink = count.sink;
+  }
+
+  bool run(orTask::TaskScheduler& scheduler) {
+    m_scheduler = &scheduler;
+    m_counts.assign(scheduler.getNumThreads(), ThreadCount());
+    Node* const root = new Node();
+    root->tree = this;
+    root->id = 0;
+    scheduler.submitTaskForGroup(0, &m_group, &task, root);
+    scheduler.waitForTaskGroup(0, &m_group);
+    return sumCounts(m_counts) == m_expected;
+  }
+
+private:
+  struct Node {
+    TreeWorkload* tree;
+    uint64_t id;
+  };
+
+  static uint32_t numChildren(uint64_t const id) {
+    if (id == 0) {
+      return ROOT_CHILDREN;
+    }
+    return (mix(id) % 1000 < BRANCH_PER_MILLE) ? (uint32_t)CHILDREN : 0;
+  }
+
+  static uint64_t childId(uint64_t const id, uint32_t const child) {
+    return mix(id * 31 + child + 1) | 1; // Never 0, the root
+  }
+
+  // Stands in for whatever a node costs to visit
+  static uint64_t visit(uint64_t const id) {
+    uint64_t x = id;
+    for (int i = 0; i < WORK_PER_NODE; ++i) {
+      x = mix(x);
+    }
+    return x;
+  }
+
+  // Visits the same nodes as the tasks, for the node count and the time it takes
+  static void serial(uint64_t const id, ThreadCount* const io_count) {
+    ++io_count->n;
+    io_count->sink ^= visit(id);
+    uint32_t const n = numChildren(id);
+    for (uint32_t i = 0; i < n; ++i) {
+      serial(childId(id, i), io_count);
+    }
+  }
+
+  static void task(orTask::ThreadIdx const threadIdx, void* const userData) {
+    Node* const node = static_cast<Node*>(userData);
+    TreeWorkload& tree = *node->tree;
+    uint64_t const id = node->id;
+    delete node;
+
+    ThreadCount& count = tree.m_counts[threadIdx];
+    ++count.n;
+    count.sink ^= visit(id);
+
+    uint32_t const n = numChildren(id);
+    for (uint32_t i = 0; i < n; ++i) {
+      Node* const child = new Node();
+      child->tree = &tree;
+      child->id = childId(id, i);
+      tree.m_scheduler->submitTaskForGroup(threadIdx, &tree.m_group, &task, child);
+    }
+  }
+
+  uint64_t m_expected;
+  uint64_t m_serialSink; // So the serial run's visits aren't optimised out
+  orTask::TaskScheduler* m_scheduler;
+  std::vector<ThreadCount> m_counts; // Nodes visited, per thread
+  orTask::TaskGroup m_group;
+};
+
+// Lots of tasks that do nothing, all submitted from thread 0: pure scheduler overhead
+class FloodWorkload : public Workload {
+public:
+  enum { TASKS = 200000 };
+
+  char const* name() const { return "flood"; }
+  char const* itemName() const { return "tasks"; }
+  uint64_t itemsPerRun() const { return TASKS; }
+
+  void setup() {}
+
+  bool run(orTask::TaskScheduler& scheduler) {
+    m_counts.assign(scheduler.getNumThreads(), ThreadCount());
+    orTask::TaskGroup group;
+    for (uint32_t i = 0; i < TASKS; ++i) {
+      scheduler.submitTaskForGroup(0, &group, &task, &m_counts[0]);
+    }
+    scheduler.waitForTaskGroup(0, &group);
+    return sumCounts(m_counts) == TASKS;
+  }
+
+private:
+  static void task(orTask::ThreadIdx const threadIdx, void* const userData) {
+    ++static_cast<ThreadCount*>(userData)[threadIdx].n;
+  }
+
+  std::vector<ThreadCount> m_counts;
+};
+
+// What a frame of the game does, roughly: gravity from a handful of bodies on many particles in
+// blocks, like OrbitalPhysics::CalcParticleGrav, then sampling points round many orbits for drawing,
+// a little Kepler solve per point, like RenderSystem's orbit plotting.
+class OrbitalWorkload : public Workload {
+public:
+  enum {
+    PARTICLES = 20000,
+    BODIES = 12,
+    PARTICLE_GRAIN = 256,
+    ORBITS = 2000,
+    SAMPLES = 128,
+    ORBIT_GRAIN = 16,
+    NEWTON_ITERATIONS = 5
+  };
+
+  char const* name() const { return "orbital"; }
+  char const* itemName() const { return "interactions"; }
+  uint64_t itemsPerRun() const { return (uint64_t)PARTICLES * BODIES + (uint64_t)ORBITS * SAMPLES; }
+
+  void setup() {
+    m_particlePos.resize(PARTICLES * 3);
+    for (uint32_t i = 0; i < PARTICLES * 3; ++i) {
+      m_particlePos[i] = unit(i) * 1e9;
+    }
+    m_bodyPos.resize(BODIES * 3);
+    m_bodyMu.resize(BODIES);
+    for (uint32_t i = 0; i < BODIES; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        m_bodyPos[i * 3 + j] = unit(1000000 + i * 3 + j) * 1e9;
+      }
+      m_bodyMu[i] = (unit(2000000 + i) + 1.0) * 1e17;
+    }
+    m_orbits.resize(ORBITS);
+    for (uint32_t i = 0; i < ORBITS; ++i) {
+      m_orbits[i].semiMajor = (unit(3000000 + i) + 1.5) * 1e8;
+      m_orbits[i].ecc = (unit(4000000 + i) + 1.0) * 0.45;
+    }
+
+    m_accel.resize(PARTICLES * 3);
+    m_points.resize(ORBITS * SAMPLES * 2);
+    std::chrono::high_resolution_clock::time_point const start = std::chrono::high_resolution_clock::now();
+    calcAccel(0, PARTICLES);
+    sampleOrbits(0, ORBITS);
+    m_serialMs = millisSince(start);
+    m_expectedAccel = m_accel;
+    m_expectedPoints = m_points;
+  }
+
+  bool run(orTask::TaskScheduler& scheduler) {
+    std::fill(m_accel.begin(), m_accel.end(), 0.0);
+    std::fill(m_points.begin(), m_points.end(), 0.0);
+    // Same per item arithmetic as the serial run, so the results match exactly
+    orTask::parallel_for_blocks(scheduler, 0, PARTICLES, PARTICLE_GRAIN, [this](orTask::ThreadIdx, uint32_t const begin, uint32_t const end) {
+      calcAccel(begin, end);
+    });
+    orTask::parallel_for_blocks(scheduler, 0, ORBITS, ORBIT_GRAIN, [this](orTask::ThreadIdx, uint32_t const begin, uint32_t const end) {
+      sampleOrbits(begin, end);
+    });
+    return m_accel == m_expectedAccel && m_points == m_expectedPoints;
+  }
+
+private:
+  struct Orbit {
+    double semiMajor;
+    double ecc;
+  };
+
+  // In [-1, 1)
+  static double unit(uint64_t const seed) {
+    return (double)(mix(seed) >> 11) / (double)(1ULL << 52) - 1.0;
+  }
+
+  void calcAccel(uint32_t const begin, uint32_t const end) {
+    for (uint32_t i = begin; i < end; ++i) {
+      double ax = 0, ay = 0, az = 0;
+      for (uint32_t b = 0; b < BODIES; ++b) {
+        double const dx = m_bodyPos[b * 3 + 0] - m_particlePos[i * 3 + 0];
+        double const dy = m_bodyPos[b * 3 + 1] - m_particlePos[i * 3 + 1];
+        double const dz = m_bodyPos[b * 3 + 2] - m_particlePos[i * 3 + 2];
+        double const r2 = dx * dx + dy * dy + dz * dz;
+        double const k = m_bodyMu[b] / (r2 * sqrt(r2));
+        ax += dx * k; ay += dy * k; az += dz * k;
+      }
+      m_accel[i * 3 + 0] = ax;
+      m_accel[i * 3 + 1] = ay;
+      m_accel[i * 3 + 2] = az;
+    }
+  }
+
+  void sampleOrbits(uint32_t const begin, uint32_t const end) {
+    double const TAU = 6.283185307179586;
+    for (uint32_t o = begin; o < end; ++o) {
+      Orbit const& orbit = m_orbits[o];
+      double const semiMinor = orbit.semiMajor * sqrt(1.0 - orbit.ecc * orbit.ecc);
+      for (uint32_t s = 0; s < SAMPLES; ++s) {
+        // Evenly spaced in time: solve Kepler's equation M = E - e sin E for E
+        double const meanAnomaly = TAU * s / SAMPLES;
+        double eccAnomaly = meanAnomaly;
+        for (int i = 0; i < NEWTON_ITERATIONS; ++i) {
+          eccAnomaly -= (eccAnomaly - orbit.ecc * sin(eccAnomaly) - meanAnomaly) / (1.0 - orbit.ecc * cos(eccAnomaly));
+        }
+        m_points[(o * SAMPLES + s) * 2 + 0] = orbit.semiMajor * (cos(eccAnomaly) - orbit.ecc);
+        m_points[(o * SAMPLES + s) * 2 + 1] = semiMinor * sin(eccAnomaly);
+      }
+    }
+  }
+
+  std::vector<double> m_particlePos;
+  std::vector<double> m_bodyPos;
+  std::vector<double> m_bodyMu;
+  std::vector<Orbit> m_orbits;
+  std::vector<double> m_accel;
+  std::vector<double> m_points;
+  std::vector<double> m_expectedAccel;
+  std::vector<double> m_expectedPoints;
+};
+
+struct Result {
+  double medianMs;
+  double p99Ms;
+  double maxMs;
+  uint64_t tasksPerRun;
+  bool ok;
+};
+
+Result bench(Workload& workload, SchedulerKind const kind, int const numThreads, int const reps) {
+  std::unique_ptr<orTask::TaskScheduler> scheduler(makeScheduler(kind, numThreads));
+
+  // Once untimed, to start the threads and warm the caches and the queues
+  bool ok = workload.run(*scheduler);
+
+  std::vector<double> times;
+  uint64_t tasks = 0;
+  scheduler->endTelemetryFrame();
+  for (int rep = 0; rep < reps; ++rep) {
+    std::chrono::high_resolution_clock::time_point const start = std::chrono::high_resolution_clock::now();
+    ok = workload.run(*scheduler) && ok;
+    times.push_back(millisSince(start));
+  }
+  scheduler->endTelemetryFrame();
+  std::vector<orTask::WorkerTelemetry> const& telemetry = scheduler->getFrameTelemetry();
+  for (size_t i = 0; i < telemetry.size(); ++i) {
+    tasks += telemetry[i].counters[orTask::WorkerTelemetry::Counter_TasksExecuted];
+  }
+
+  std::sort(times.begin(), times.end());
+  Result result;
+  result.medianMs = times[times.size() / 2];
+  result.p99Ms = times[std::min(times.size() - 1, (times.size() * 99 + 99) / 100 - 1)];
+  result.maxMs = times.back();
+  result.tasksPerRun = tasks / reps;
+  result.ok = ok;
+  return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  int const maxThreads = (argc > 1) ? atoi(argv[1]) : std::max(1, (int)boost::thread::hardware_concurrency());
+  int const reps = (argc > 2) ? std::max(1, atoi(argv[2])) : 20;
+  std::string const only = (argc > 3) ? argv[3] : "";
+
+  FibWorkload fib;
+  PrefixSumWorkload prefixSum;
+  TreeWorkload tree;
+  FloodWorkload flood;
+  OrbitalWorkload orbital;
+  Workload* const workloads[] = { &fib, &prefixSum, &tree, &flood, &orbital };
+
+  std::vector<int> threadCounts;
+  for (int threads = 1; threads < maxThreads; threads *= 2) {
+    threadCounts.push_back(threads);
+  }
+  threadCounts.push_back(maxThreads);
+
+  bool allOk = true;
+  for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); ++w) {
+    Workload& workload = *workloads[w];
+    if (!only.empty() && only != workload.name()) {
+      continue;
+    }
+    workload.setup();
+    printf("%s: %llu %s per run, %.3f ms serial, %d reps\n", workload.name(), (unsigned long long)workload.itemsPerRun(), workload.itemName(), workload.serialMs(), reps);
+    printf("  %-12s %7s %9s %9s %9s %12s %8s %16s %8s\n", "scheduler", "threads", "median ms", "p99 ms", "max ms", "M items/s", "tasks", "overhead ns/task", "speedup");
+
+    for (int k = 0; k < SchedulerKind_Count; ++k) {
+      SchedulerKind const kind = (SchedulerKind)k;
+      double singleThreadMs = 0;
+      for (size_t t = 0; t < threadCounts.size(); ++t) {
+        Result const result = bench(workload, kind, threadCounts[t], reps);
+        if (t == 0) {
+          singleThreadMs = result.medianMs;
+        }
+        double const overheadMs = threadCounts[t] * result.medianMs - workload.serialMs();
+        printf("  %-12s %7d %9.3f %9.3f %9.3f %12.2f %8llu %16.1f %7.2fx%s\n",
+          schedulerName(kind), threadCounts[t], result.medianMs, result.p99Ms, result.maxMs,
+          workload.itemsPerRun() / (result.medianMs * 1e3),
+          (unsigned long long)result.tasksPerRun,
+          result.tasksPerRun ? 1e6 * overheadMs / result.tasksPerRun : 0.0,
+          singleThreadMs / result.medianMs,
+          result.ok ? "" : "  WRONG RESULT");
+        allOk = allOk && result.ok;
+      }
+    }
+    printf("\n");
+  }
+  return allOk ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+// Stress test and throughput benchmark for orTask::WorkStealingQueue.
+//
+// usage: workStealingQueueBench [numThieves] [numItems]
+//
+// The stress test has the owner push and pop in bursts while the thieves steal, starting from a tiny
+// ring so it grows (and retires rings) along the way, and checks every item comes out exactly once.
+// Then it times the owner on its own, and thieves draining a full queue.
+
+#include "orStd.h"
+
+#include "workStealingQueue.h"
+
+#include "boost_begin.h"
+#include <boost/thread.hpp>
+#include "boost_end.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+namespace {
+
+struct Item {
+  uint32_t value;
+};
+
+typedef orTask::WorkStealingQueue<Item> Queue;
+
+double millisSince(std::chrono::high_resolution_clock::time_point const start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void thiefLoop(Queue* queue, int threadIdx, std::atomic<bool>* done, std::vector<uint32_t>* o_stolen) {
+  while (!done->load(std::memory_order_acquire) || !queue->isEmpty()) {
+    Item item;
+    if (queue->popTop(threadIdx, &item)) {
+      o_stolen->push_back(item.value);
+    }
+  }
+}
+
+bool stressTest(int const numThieves, uint32_t const numItems) {
+  orTask::EpochDomain epochs(numThieves + 1);
+  Queue queue(1, &epochs);
+
+  std::atomic<bool> done(false);
+  std::vector< std::vector<uint32_t> > stolen(numThieves);
+  boost::thread_group thieves;
+  for (int i = 0; i < numThieves; ++i) {
+    thieves.create_thread(boost::bind(&thiefLoop, &queue, i + 1, &done, &stolen[i]));
+  }
+
+  // Bursts of pushes then some pops, so the owner and thieves fight over the last few items too
+  std::vector<uint32_t> popped;
+  uint32_t next = 0;
+  uint32_t burst = 1;
+  while (next < numItems) {
+    for (uint32_t i = 0; i < burst && next < numItems; ++i) {
+      Item const item = { next++ };
+      queue.pushBottom(item);
+    }
+    for (uint32_t i = 0; i < burst / 2; ++i) {
+      Item item;
+      if (queue.popBottom(&item)) {
+        popped.push_back(item.value);
+      }
+    }
+    burst = (burst * 3 + 1) % 1000 + 1;
+  }
+  Item item;
+  while (queue.popBottom(&item)) {
+    popped.push_back(item.value);
+  }
+  done.store(true, std::memory_order_release);
+  thieves.join_all();
+
+  std::vector<uint8_t> seen(numItems, 0);
+  size_t total = 0;
+  bool ok = true;
+  for (int i = -1; i < numThieves; ++i) {
+    std::vector<uint32_t> const& values = (i < 0) ? popped : stolen[i];
+    for (size_t j = 0; j < values.size(); ++j) {
+      if (values[j] >= numItems || seen[values[j]]++) {
+        ok = false;
+      }
+    }
+    total += values.size();
+  }
+  printf("Stress: %u items, %u popped, %u stolen, %s\n", numItems, (uint32_t)popped.size(), (uint32_t)(total - popped.size()),
+    (ok && total == numItems) ? "every item exactly once" : "ITEMS LOST OR DUPLICATED");
+  return ok && total == numItems;
+}
+
+void benchOwner(uint32_t const numItems) {
+  orTask::EpochDomain epochs(1);
+  Queue queue(8, &epochs);
+
+  std::chrono::high_resolution_clock::time_point const start = std::chrono::high_resolution_clock::now();
+  uint32_t sum = 0;
+  for (uint32_t i = 0; i < numItems; i += 64) {
+    for (uint32_t j = 0; j < 64; ++j) {
+      Item const item = { i + j };
+      queue.pushBottom(item);
+    }
+    Item item;
+    while (queue.popBottom(&item)) {
+      sum += item.value;
+    }
+  }
+  double const ms = millisSince(start);
+  printf("Owner push+pop:   %9.2f ms, %7.2f ns/item (%u)\n", ms, 1e6 * ms / numItems, sum & 1);
+}
+
+void benchSteal(int const numThieves, uint32_t const numItems) {
+  orTask::EpochDomain epochs(numThieves + 1);
+  Queue queue(8, &epochs);
+  for (uint32_t i = 0; i < numItems; ++i) {
+    Item const item = { i };
+    queue.pushBottom(item);
+  }
+
+  std::atomic<bool> done(true); // Just drain it
+  std::vector< std::vector<uint32_t> > stolen(numThieves);
+  for (int i = 0; i < numThieves; ++i) {
+    stolen[i].reserve(numItems);
+  }
+  std::chrono::high_resolution_clock::time_point const start = std::chrono::high_resolution_clock::now();
+  boost::thread_group thieves;
+  for (int i = 0; i < numThieves; ++i) {
+    thieves.create_thread(boost::bind(&thiefLoop, &queue, i + 1, &done, &stolen[i]));
+  }
+  thieves.join_all();
+  double const ms = millisSince(start);
+  printf("%2d thieves steal: %9.2f ms, %7.2f ns/item\n", numThieves, ms, 1e6 * ms / numItems);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  int const numThieves = (argc > 1) ? atoi(argv[1]) : 3;
+  uint32_t const numItems = (argc > 2) ? (uint32_t)atoi(argv[2]) : 4000000;
+
+  bool const ok = stressTest(numThieves, numItems);
+  benchOwner(numItems);
+  for (int thieves = 1; thieves <= numThieves; thieves *= 2) {
+    benchSteal(thieves, numItems);
+  }
+  return ok ? 0 : 1;
+}
@@ -27,6 +27,18 @@ int main(int argc, char *argv[])
   // appConfig.renderWidth = 160;
   // appConfig.renderHeight = 144;
 
+  // -trace <frames> [path]: capture a trace of the first frames, e.g. to look at startup
+  appConfig.traceFrames = 0;
+  appConfig.tracePath = "trace.json";
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc) {
+      appConfig.traceFrames = atoi(argv[++i]);
+      if (i + 1 < argc && argv[i + 1][0] != '-') {
+        appConfig.tracePath = argv[++i];
+      }
+    }
+  }
+
   auto app = std::make_unique<orApp>(appConfig);
   app->Run();
 
@@ -3,12 +3,12 @@
 #include "orApp.h"
 
 #include "orProfile/perftimer.h"
+#include "orCore/orArena.h"
 
-#if 0
 #include "task.h"
 #include "taskScheduler.h"
+#include "taskSubmitter.h"
 #include "taskSchedulerWorkStealing.h"
-#endif
 
 #include <string>
 #include <sstream>
@@ -39,12 +39,18 @@
 orApp::orApp(Config const& config):
   m_appScreen(Screen_Title),
   m_lastFrameDuration(0),
+  m_frameDt(0.0),
   m_running(true),
   m_rnd(1123LL),
+  m_taskScheduler(NULL),
   m_simTime(0.0),
   m_config(config),
   m_paused(false),
   m_singleStep(false),
+  m_showSchedulerStats(false),
+  m_showArenaStats(false),
+  m_saveRequested(false),
+  m_loadRequested(false),
 
   m_cameraSystem(),
   m_camMode(CameraMode_ThirdPerson),
@@ -54,6 +60,7 @@ orApp::orApp(Config const& config):
 
   m_renderSystem(),
   m_frameBuffer(),
+  m_gpuTimers(),
   m_wireframe(false),
 
   m_physicsSystem(),
@@ -63,6 +70,10 @@ orApp::orApp(Config const& config):
   m_entitySystem(m_cameraSystem, m_renderSystem, m_physicsSystem),
   m_playerShipId {},
 
+  m_transferPlanner(NULL),
+  m_transferSearch(NULL),
+  m_conjunctionScreener(NULL),
+
   m_inputMode(InputMode_Default),
   m_thrusters(0),
   m_hasFocus(false),
@@ -72,6 +83,9 @@ orApp::orApp(Config const& config):
   orLog("Starting init\n");
 
   PerfTimer::StaticInit();
+  if (config.traceFrames > 0) {
+    PerfTimer::StartCapture(config.traceFrames, config.tracePath);
+  }
 
   Init();
 
@@ -92,6 +106,7 @@ orApp::~orApp()
 
   delete m_music; m_music = NULL;
 
+  orbital::FrameArenas::StaticShutdown();
   PerfTimer::StaticShutdown(); // TODO terrible code
 
   orLog("Shutdown complete\n");
@@ -118,6 +133,10 @@ void orApp::Init()
   Eigen::initParallel();
 #endif
 
+  // Thread 0 is the main thread; it only runs tasks while waiting on a group, so make sure there's
+  // at least one worker to run background work like the transfer planner.
+  m_taskScheduler = new orTask::TaskSchedulerWorkStealing(std::max(2, (int)boost::thread::hardware_concurrency()));
+
   InitState();
   InitRender();
 }
@@ -126,6 +145,7 @@ void orApp::Shutdown()
 {
   ShutdownRender();
   ShutdownState();
+  delete m_taskScheduler; m_taskScheduler = NULL;
   SDL_Quit();
 }
 
@@ -144,8 +164,10 @@ void runTests() {
   }
 }
 
-void orApp::PollEvents()
+void orApp::PollEvents(orTask::ThreadIdx)
 {
+  PERFTIMER("PollEvents");
+
   SDL_Event event;
   while (SDL_PollEvent(&event))
   {
@@ -171,29 +193,146 @@ void orApp::Run()
 
 void orApp::RunOneStep()
 {
+  m_frameDt = m_timeScale * Util::Min((double)Timer::PerfTimeToMillis(m_lastFrameDuration), 100.0) / 1000.0; // seconds
+
+  // Each step only waits for the steps whose results it reads, so e.g. conjunction screening, the
+  // camera and the debug text can overlap. Steps touching SDL or GL stay on the main thread (thread 0).
+  // Rendering draws the frame published at the end of the last update, so it doesn't wait for this
+  // frame's update at all: the main thread renders while the workers update.
+  // Everything runs against the same systems, so two steps may only overlap if neither changes
+  // anything the other reads - including the physics system's lazily derived data (orbits, SOI
+  // parents), which is filled in on first read.
+  orTask::TaskId frameDone;
   {
-    PERFTIMER("PollEvents");
-    PollEvents();
+    orbital::FrameArenaScope const arenaScope(orbital::ArenaSystem_Tasks);
+    orTask::TaskSubmitter submitter(*m_taskScheduler, 0);
+
+    orTask::TaskId const pollEvents = submitter.add(stepWork<&orApp::PollEvents>()).affinity(0);
+    orTask::TaskId const handleInput = submitter.add(stepWork<&orApp::HandleInput>()).affinity(0).depends_on(pollEvents);
+    orTask::TaskId const applyCommands = submitter.add(stepWork<&orApp::ApplyCommands>()).depends_on(handleInput);
+    orTask::TaskId const physics = submitter.add(stepWork<&orApp::UpdateState_Physics>()).depends_on(applyCommands);
+
+    // These only read the physics state
+    orTask::TaskId const conjunctions = submitter.add(stepWork<&orApp::UpdateState_Conjunctions>()).depends_on(physics);
+    orTask::TaskId const camTargets = submitter.add(stepWork<&orApp::UpdateState_CamTargets>()).depends_on(physics);
+    orTask::TaskId const camera = submitter.add(stepWork<&orApp::UpdateState_Camera>()).depends_on(camTargets);
+    orTask::TaskId const debugText = submitter.add(stepWork<&orApp::UpdateState_DebugText>()).depends_on(conjunctions);
+
+    // Render objects need the camera, and fill in derived physics data the conjunction screener reads
+    orTask::TaskId const cameraAndConjunctions = submitter.add_empty().add_child(camera).add_child(conjunctions);
+    orTask::TaskId const renderObjects = submitter.add(stepWork<&orApp::UpdateState_RenderObjects>()).depends_on(cameraAndConjunctions);
+    orTask::TaskId const highlight = submitter.add(stepWork<&orApp::UpdateState_Highlight>()).depends_on(renderObjects);
+
+    orTask::TaskId const stateDone = submitter.add_empty().add_child(highlight).add_child(debugText);
+    orTask::TaskId const publish = submitter.add(stepWork<&orApp::PublishState>()).depends_on(stateDone);
+
+    // After input, so the main thread picks up input before it starts drawing
+    orTask::TaskId const render = submitter.add(stepWork<&orApp::RenderState>()).affinity(0).depends_on(handleInput);
+
+    frameDone = submitter.add_empty().add_child(publish).add_child(render);
   }
 
-  {
-    PERFTIMER("HandleInput");
-    HandleInput();
+  // Thread 0 runs its own tasks (and steals others) while it waits
+  m_taskScheduler->wait(0, frameDone);
+
+  // Nothing's running now; next frame's debug text shows this frame's numbers
+  m_taskScheduler->endTelemetryFrame();
+  orbital::FrameArenas::EndFrame();
+  PerfTimer::Collect();
+}
+
+namespace {
+  char const* const QUICKSAVE_PATH = "quicksave.orsnap";
+
+  // What F10 captures
+  uint32_t const TRACE_CAPTURE_FRAMES = 300;
+  char const* const TRACE_CAPTURE_PATH = "trace.json";
+
+  uint32_t const APP_SNAPSHOT_TAG = orbital::snapshotTag('A', 'P', 'P', ' ');
+  uint32_t const APP_SNAPSHOT_VERSION = 1;
+
+  struct AppSnapshot {
+    double simTime;
+    orbital::Id<EntitySystem::Ship> playerShipId;
+    orbital::Id<CameraSystem::Target> cameraTargetId;
+    PhysicsSystem::IntegrationMethod integrationMethod;
+  };
+}
+
+void orApp::ApplyCommands(orTask::ThreadIdx)
+{
+  // Sync point: nothing holds references into the systems here
+  PERFTIMER("ApplyCommands");
+  m_commandBuffer.apply();
+
+  if (m_saveRequested) {
+    m_saveRequested = false;
+    saveSnapshot(QUICKSAVE_PATH);
+  }
+  if (m_loadRequested) {
+    m_loadRequested = false;
+    loadSnapshot(QUICKSAVE_PATH);
   }
+}
 
-  {
-    PERFTIMER("UpdateState");
-    UpdateState();
+bool orApp::saveSnapshot(char const* const path) const
+{
+  orbital::SnapshotWriter writer;
+  m_cameraSystem.save(writer);
+  m_renderSystem.save(writer);
+  m_physicsSystem.save(writer);
+  m_entitySystem.save(writer);
+
+  AppSnapshot const app = { m_simTime, m_playerShipId, m_cameraTargetId, m_integrationMethod };
+  writer.beginBlock(APP_SNAPSHOT_TAG, APP_SNAPSHOT_VERSION);
+  writer.writeValue(app);
+
+  if (!writer.save(path)) {
+    orErr("Failed to save '%s'\n", path);
+    return false;
+  }
+  orLog("Saved '%s'\n", path);
+  return true;
+}
+
+bool orApp::loadSnapshot(char const* const path)
+{
+  orbital::SnapshotReader reader;
+  if (!reader.open(path)) {
+    return false;
   }
 
-  {
-    PERFTIMER("RenderState");
-    RenderState();
+  // Check every block before loading any, so a snapshot we can't use leaves everything as it was
+  uint32_t version = 0;
+  orbital::SnapshotReader::Cursor cursor;
+  AppSnapshot app;
+  if (!reader.findBlock(APP_SNAPSHOT_TAG, &version, &cursor) || version != APP_SNAPSHOT_VERSION || !cursor.readValue(&app)) {
+    orErr("'%s' has no usable app state\n", path);
+    return false;
   }
+  if (!m_cameraSystem.check(reader) || !m_renderSystem.check(reader) || !m_physicsSystem.check(reader) || !m_entitySystem.check(reader)) {
+    orErr("'%s' doesn't match this build\n", path);
+    return false;
+  }
+
+  // Can't fail now: the checks read exactly what the loads do
+  if (!m_cameraSystem.load(reader) || !m_renderSystem.load(reader) || !m_physicsSystem.load(reader) || !m_entitySystem.load(reader)) {
+    ensure(false, "Snapshot partly loaded!");
+    return false;
+  }
+
+  m_simTime = app.simTime;
+  m_playerShipId = app.playerShipId;
+  m_cameraTargetId = app.cameraTargetId;
+  m_integrationMethod = app.integrationMethod;
+  orLog("Loaded '%s'\n", path);
+  return true;
 }
 
-void orApp::HandleInput()
+void orApp::HandleInput(orTask::ThreadIdx)
 {
+  PERFTIMER("HandleInput");
+
   if (!m_hasFocus) {
     return;
   }
@@ -379,6 +518,10 @@ void orApp::InitRender()
   m_renderSystem.initRender();
 
   RenderSystem::checkGLErrors();
+
+  m_gpuTimers.init();
+
+  RenderSystem::checkGLErrors();
   
 #ifdef WIN32 // TODO reimplement: set window focus
   //sf::WindowHandle winHandle = m_window->getSystemHandle();
@@ -390,6 +533,7 @@ void orApp::InitRender()
 
 void orApp::ShutdownRender()
 {
+  m_gpuTimers.shutdown();
   m_renderSystem.shutdownRender();
 
   // TODO free opengl resources
@@ -638,10 +782,10 @@ void orApp::InitState()
     orVec3 playerPos(earthPos + Vector3d(0.0, 0.0, 1.3e7));
     orVec3 playerVel(earthVel + Vector3d(5e3, 0.0, 0.0));
     {
-      PhysicsSystem::ParticleBody& playerBody = m_physicsSystem.getParticleBody(playerShip.m_particleBodyId = m_physicsSystem.makeParticleBody());
-      playerBody.m_pos = playerPos;
-      playerBody.m_vel = playerVel;
-      playerBody.m_userAcc = orVec3(0, 0, 0);
+      orbital::Id<PhysicsSystem::ParticleBody> const playerBodyId = playerShip.m_particleBodyId = m_physicsSystem.makeParticleBody();
+      m_physicsSystem.setParticlePos(playerBodyId, playerPos);
+      m_physicsSystem.setParticleVel(playerBodyId, playerVel);
+      m_physicsSystem.setParticleUserAcc(playerBodyId, orVec3(0, 0, 0));
     }
 
     {
@@ -678,10 +822,10 @@ void orApp::InitState()
     orVec3 suspectPos(earthPos + Vector3d(0.0, 0.0, 1.3e7));
     orVec3 suspectVel(earthVel + Vector3d(5e3, 0.0, 0.0));
     {
-      PhysicsSystem::ParticleBody& suspectBody = m_physicsSystem.getParticleBody(suspectShip.m_particleBodyId = m_physicsSystem.makeParticleBody());
-      suspectBody.m_pos = suspectPos;
-      suspectBody.m_vel = suspectVel;
-      suspectBody.m_userAcc = orVec3(0.0, 0.0, 0.0);
+      orbital::Id<PhysicsSystem::ParticleBody> const suspectBodyId = suspectShip.m_particleBodyId = m_physicsSystem.makeParticleBody();
+      m_physicsSystem.setParticlePos(suspectBodyId, suspectPos);
+      m_physicsSystem.setParticleVel(suspectBodyId, suspectVel);
+      m_physicsSystem.setParticleUserAcc(suspectBodyId, orVec3(0.0, 0.0, 0.0));
     }
 
     {
@@ -720,15 +864,19 @@ void orApp::InitState()
   dist.Generate(&m_rnd, 6 * m_entitySystem.numShips(), &rnds[0]);
   for (int i = 0; i < m_entitySystem.numShips(); ++i)
   {
-    PhysicsSystem::ParticleBody& shipBody = m_physicsSystem.getParticleBody(m_entitySystem.getShip(i).m_particleBodyId);
+    orbital::Id<PhysicsSystem::ParticleBody> const shipBodyId = m_entitySystem.getShip(i).m_particleBodyId;
+    orVec3 shipPos = m_physicsSystem.getParticlePos(shipBodyId);
+    orVec3 shipVel = m_physicsSystem.getParticleVel(shipBodyId);
     // could round-trip to vector, or do it in components...
-    shipBody.m_pos[0] += 6e4 * rnds[6*i  ];
-    shipBody.m_pos[1] += 6e4 * rnds[6*i+1];
-    shipBody.m_pos[2] += 6e4 * rnds[6*i+2];
-
-    shipBody.m_vel[0] += 1e2 * rnds[6*i+3];
-    shipBody.m_vel[1] += 1e2 * rnds[6*i+4];
-    shipBody.m_vel[2] += 1e2 * rnds[6*i+5];
+    shipPos[0] += 6e4 * rnds[6*i  ];
+    shipPos[1] += 6e4 * rnds[6*i+1];
+    shipPos[2] += 6e4 * rnds[6*i+2];
+
+    shipVel[0] += 1e2 * rnds[6*i+3];
+    shipVel[1] += 1e2 * rnds[6*i+4];
+    shipVel[2] += 1e2 * rnds[6*i+5];
+    m_physicsSystem.setParticlePos(shipBodyId, shipPos);
+    m_physicsSystem.setParticleVel(shipBodyId, shipVel);
   }
   delete[] rnds;
 #endif
@@ -738,11 +886,67 @@ void orApp::InitState()
   RenderSystem::Label2D& mouseLabel = m_renderSystem.getLabel2D(m_mouseLabelId = m_renderSystem.makeLabel2D());
   mouseLabel.m_col = orVec3(1.0, 0.0, 0.0);
   mouseLabel.m_text = ":O";
+
+  m_transferPlanner = new TransferPlanner(*m_taskScheduler, m_physicsSystem);
+  m_conjunctionScreener = new ConjunctionScreener(*m_taskScheduler, m_physicsSystem);
+}
+
+void orApp::requestTransferSearch(orbital::Id<EntitySystem::Body> departBodyId, orbital::Id<EntitySystem::Body> arriveBodyId)
+{
+  // TODO make the ranges configurable; for now search launches over the next two years, with a
+  // window of flight times that covers Hohmann-ish transfers to the inner planets
+  double const startDay = floor(m_simTime / SECONDS_PER_DAY);
+
+  TransferPlanner::Query query;
+  query.m_departBodyId = m_entitySystem.getBody(departBodyId).m_gravBodyId;
+  query.m_arriveBodyId = m_entitySystem.getBody(arriveBodyId).m_gravBodyId;
+  query.m_departTimeMin = startDay * SECONDS_PER_DAY;
+  query.m_departTimeMax = (startDay + 730) * SECONDS_PER_DAY;
+  query.m_flightTimeMin = 60 * SECONDS_PER_DAY;
+  query.m_flightTimeMax = 400 * SECONDS_PER_DAY;
+
+  // Thread 0 is the main thread
+  m_transferSearch = m_transferPlanner->requestSearch(0, query);
 }
 
+void orApp::spawnFleet(orbital::Id<EntitySystem::Body> parentBodyId, int count)
+{
+  // Circular orbits at a spread of altitudes, phases and inclinations. Fleet ships get a point but no
+  // orbit or camera target; drawing thousands of orbits isn't useful.
+  // All deferred, so the whole fleet goes in as one batch per system at the next sync point.
+  PhysicsSystem::GravBody const& parentBody = m_physicsSystem.getGravBody(m_entitySystem.getBody(parentBodyId).m_gravBodyId);
+  Vector3d const parentPos(parentBody.m_pos);
+  Vector3d const parentVel(parentBody.m_vel);
+  double const mu = GRAV_CONSTANT * parentBody.m_mass;
+
+  for (int i = 0; i < count; ++i) {
+    double const r = parentBody.m_radius + 300e3 + 1e3 * (i % 500);
+    double const phase = M_TAU * fmod(i * 0.6180339887498949, 1.0); // golden ratio spacing
+    double const inc = M_TAU * 0.5 * i / count;
+
+    Vector3d const radial(cos(phase), sin(phase) * cos(inc), sin(phase) * sin(inc));
+    Vector3d const tangent(-sin(phase), cos(phase) * cos(inc), cos(phase) * sin(inc));
+
+    orVec3 const pos(parentPos + r * radial);
+    orVec3 const vel(parentVel + sqrt(mu / r) * tangent);
+
+    RenderSystem::Point point;
+    point.m_pos = pos;
+    point.m_col = m_colG[4];
+
+    EntitySystem::Ship ship;
+    ship.m_particleBodyId = m_physicsSystem.makeParticleBodyDeferred(m_commandBuffer, pos, vel);
+    ship.m_pointId = m_renderSystem.makePointDeferred(m_commandBuffer, point);
+    m_entitySystem.makeShipDeferred(m_commandBuffer, ship);
+  }
+}
 
 void orApp::ShutdownState()
 {
+  // Waits for any searches still running
+  delete m_transferPlanner; m_transferPlanner = NULL;
+  m_transferSearch = NULL;
+  delete m_conjunctionScreener; m_conjunctionScreener = NULL;
 }
 
 void orApp::HandleEvent(SDL_Event const& _event)
@@ -799,6 +1003,34 @@ void orApp::HandleEvent(SDL_Event const& _event)
         m_camMode = CameraMode_ThirdPerson;
       }
 
+      if (_event.key.keysym.sym == SDLK_F3) {
+        requestTransferSearch(m_earthBodyId, m_marsBodyId);
+      }
+
+      if (_event.key.keysym.sym == SDLK_F4) {
+        spawnFleet(m_earthBodyId, 10000);
+      }
+
+      if (_event.key.keysym.sym == SDLK_F5) {
+        m_saveRequested = true;
+      }
+
+      if (_event.key.keysym.sym == SDLK_F7) {
+        m_showSchedulerStats = !m_showSchedulerStats;
+      }
+
+      if (_event.key.keysym.sym == SDLK_F8) {
+        m_showArenaStats = !m_showArenaStats;
+      }
+
+      if (_event.key.keysym.sym == SDLK_F9) {
+        m_loadRequested = true;
+      }
+
+      if (_event.key.keysym.sym == SDLK_F10) {
+        PerfTimer::StartCapture(TRACE_CAPTURE_FRAMES, TRACE_CAPTURE_PATH);
+      }
+
       if (_event.key.keysym.sym == SDLK_PAGEDOWN) {
         m_integrationMethod = PhysicsSystem::IntegrationMethod((m_integrationMethod + 1) % PhysicsSystem::IntegrationMethod_Count);
       }
@@ -897,13 +1129,13 @@ void orApp::HandleEvent(SDL_Event const& _event)
   } // switch (_event.type)
 }
 
-Vector3d orApp::CalcPlayerThrust(PhysicsSystem::ParticleBody const& playerBody)
+Vector3d orApp::CalcPlayerThrust(orbital::Id<PhysicsSystem::ParticleBody> const playerBodyId)
 {
-  PhysicsSystem::GravBody const& parentBody = m_physicsSystem.findSOIGravBody(playerBody);
+  Vector3d const playerPos(m_physicsSystem.getParticlePos(playerBodyId));
+  Vector3d const playerVel(m_physicsSystem.getParticleVel(playerBodyId));
+  PhysicsSystem::GravBody const& parentBody = m_physicsSystem.findSOIGravBody(playerPos);
   Vector3d const origin(parentBody.m_pos);
-  Vector3d const playerPos(playerBody.m_pos);
   Vector3d const originVel(parentBody.m_vel);
-  Vector3d const playerVel(playerBody.m_vel);
 
   // Calc acceleration due to gravity
   Vector3d const r = origin - playerPos;
@@ -936,10 +1168,10 @@ Vector3d orApp::CalcPlayerThrust(PhysicsSystem::ParticleBody const& playerBody)
 void orApp::UpdateState_Bodies(double const dt)
 {
   // Update player thrust
-  PhysicsSystem::ParticleBody& playerShipBody = m_physicsSystem.getParticleBody(m_entitySystem.getShip(m_playerShipId).m_particleBodyId);
-  Vector3d const userAcc = CalcPlayerThrust(playerShipBody);
+  orbital::Id<PhysicsSystem::ParticleBody> const playerShipBodyId = m_entitySystem.getShip(m_playerShipId).m_particleBodyId;
+  Vector3d const userAcc = CalcPlayerThrust(playerShipBodyId);
 
-  playerShipBody.m_userAcc = userAcc;
+  m_physicsSystem.setParticleUserAcc(playerShipBodyId, userAcc);
 
   m_physicsSystem.update(m_integrationMethod, m_simTime, dt);
 
@@ -1011,11 +1243,17 @@ void orApp::UpdateState_Bodies(double const dt)
 #endif
 }
 
-void orApp::UpdateState_CamTargets(double const dt) {
-  m_entitySystem.updateCamTargets(dt, m_cameraSystem.getCamera(m_cameraId).m_pos);
+void orApp::UpdateState_CamTargets(orTask::ThreadIdx) {
+  PERFTIMER("CamTargets");
+  m_entitySystem.updateCamTargets(m_frameDt, m_cameraSystem.getCamera(m_cameraId).m_pos);
 }
-void orApp::UpdateState_RenderObjects(double const dt) {
-  m_entitySystem.updateRenderObjects(dt, m_cameraSystem.getCamera(m_cameraId).m_pos);
+void orApp::UpdateState_RenderObjects(orTask::ThreadIdx _threadIdx) {
+  PERFTIMER("RenderObjects");
+  m_entitySystem.updateRenderObjects(*m_taskScheduler, _threadIdx, m_frameDt, m_cameraSystem.getCamera(m_cameraId).m_pos);
+}
+void orApp::UpdateState_Highlight(orTask::ThreadIdx) {
+  PERFTIMER("Highlight");
+  updateOrbitHighlight(); // TODO refactor further
 }
 
 Vector3d orApp::CamPosFromCamParams(OrbitalCamParams const& params)
@@ -1030,9 +1268,28 @@ Vector3d orApp::CamPosFromCamParams(OrbitalCamParams const& params)
   return mat * Vector3d(0.0, params.dist, 0.0);
 }
 
-void orApp::UpdateState()
+void orApp::UpdateState_Conjunctions(orTask::ThreadIdx const _threadIdx)
 {
-  double const dt = m_timeScale * Util::Min((double)Timer::PerfTimeToMillis(m_lastFrameDuration), 100.0) / 1000.0; // seconds
+  PERFTIMER("Conjunctions");
+
+  m_conjunctionScreener->poll();
+
+  // Screening runs in the background and takes as long as it takes; kick off the next run as soon
+  // as the last one is done.
+  if (!m_conjunctionScreener->isRunning()) {
+    std::vector< orbital::Id<PhysicsSystem::ParticleBody> > shipBodyIds;
+    m_entitySystem.getShipParticleBodyIds(shipBodyIds);
+
+    ConjunctionScreener::Params params;
+    m_conjunctionScreener->start(_threadIdx, m_simTime, params, shipBodyIds);
+  }
+}
+
+void orApp::UpdateState_Physics(orTask::ThreadIdx)
+{
+  PERFTIMER("Physics");
+
+  double const dt = m_frameDt;
 
   if (!m_paused) {
     double const max_single_step = 400.0; // seconds
@@ -1052,19 +1309,20 @@ void orApp::UpdateState()
     m_singleStep = false;
     m_paused = true;
   }
+}
 
-  UpdateState_CamTargets(dt);
+void orApp::UpdateState_Camera(orTask::ThreadIdx)
+{
+  PERFTIMER("Camera");
 
   {
-    // Update camera
-
     CameraSystem::Target& camTarget = m_cameraSystem.getTarget(m_cameraTargetId);
     Vector3d const camTargetPos(camTarget.m_pos);
 
     Vector3d camPos;
 
     if (m_camMode == CameraMode_FirstPerson) {
-      camPos = Vector3d(m_physicsSystem.getParticleBody(m_entitySystem.getShip(m_playerShipId).m_particleBodyId).m_pos);
+      camPos = Vector3d(m_physicsSystem.getParticlePos(m_entitySystem.getShip(m_playerShipId).m_particleBodyId));
     } else if (m_camMode == CameraMode_ThirdPerson) {
       // Camera position is based on its target's position
       // TODO so now we need the physics update to happen before the camera
@@ -1083,12 +1341,10 @@ void orApp::UpdateState()
     camera.m_pos[1] = camPosData[1];
     camera.m_pos[2] = camPosData[2];
   }
+}
 
-  UpdateState_RenderObjects(dt);
-
-  updateOrbitHighlight(); // TODO refactor further
-
-  // Update debug text
+void orApp::UpdateState_DebugText(orTask::ThreadIdx)
+{
   {
     PERFTIMER("DebugText");
 
@@ -1102,6 +1358,67 @@ void orApp::UpdateState()
 
       str << "Time Scale: " << (int)m_timeScale << "\n";
       str << "Frame Time: " << (int)(Timer::PerfTimeToMillis(m_lastFrameDuration)) << "ms\n";
+
+      {
+        std::vector<ConjunctionScreener::Event> const& events = m_conjunctionScreener->getEvents();
+        str << "Conjunctions: " << events.size() << "\n";
+        // Events are from when the run started, so some may be in the past already
+        for (size_t i = 0; i < events.size(); ++i) {
+          if (events[i].m_time >= m_simTime) {
+            str << "Next Conjunction: " << (int)(events[i].m_time - m_simTime) << "s, " << events[i].m_missDistance / 1000.0 << "km\n";
+            break;
+          }
+        }
+      }
+
+      if (m_transferSearch) {
+        if (!m_transferSearch->isComplete()) {
+          str << "Transfer Search: " << (int)(100 * m_transferSearch->getProgress()) << "%\n";
+        } else {
+          TransferPlanner::Solution const& best = m_transferSearch->getBestSolution();
+          if (best.m_valid) {
+            str << "Transfer: depart " << calendarDateFromSimTime(best.m_departTime)
+                << ", " << (int)(best.m_flightTime / SECONDS_PER_DAY) << " days"
+                << ", dv " << best.m_deltaV / 1000.0 << " km/s\n";
+          } else {
+            str << "Transfer: no solution\n";
+          }
+        }
+      }
+
+      if (m_integrationMethod == PhysicsSystem::IntegrationMethod_FixedLeapfrog) {
+        // Compare between lockstep runs to check they haven't diverged
+        str << "Fixed point physics, state hash " << std::hex << m_physicsSystem.stateHash() << std::dec << "\n";
+      }
+
+      if (m_showSchedulerStats) {
+        std::vector<orTask::WorkerTelemetry> const& telemetry = m_taskScheduler->getFrameTelemetry();
+        for (size_t i = 0; i < telemetry.size(); ++i) {
+          uint64_t const* const counters = telemetry[i].counters;
+          uint64_t const totalTime = counters[orTask::WorkerTelemetry::Counter_WorkingTime]
+            + counters[orTask::WorkerTelemetry::Counter_StealingTime]
+            + counters[orTask::WorkerTelemetry::Counter_ParkedTime];
+          int const parkedPercent = totalTime ? (int)(100 * counters[orTask::WorkerTelemetry::Counter_ParkedTime] / totalTime) : 0;
+          str << "Thread " << i << ": " << counters[orTask::WorkerTelemetry::Counter_TasksExecuted] << " tasks"
+              << ", steals " << counters[orTask::WorkerTelemetry::Counter_Steals] << "/" << counters[orTask::WorkerTelemetry::Counter_StealAttempts]
+              << ", queue " << telemetry[i].queueHighWater
+              << ", " << parkedPercent << "% parked\n";
+        }
+      }
+
+      if (m_showArenaStats) {
+        orbital::FrameArenas::Stats const& stats = orbital::FrameArenas::GetStats();
+        for (int s = 0; s < orbital::ArenaSystem_Count; ++s) {
+          str << "Arena " << orbital::FrameArenas::SystemName((orbital::ArenaSystem)s) << ": "
+              << stats.frameBytes[s] / 1024 << " KB, peak " << stats.peakBytes[s] / 1024 << " KB\n";
+        }
+        str << "Arenas peak: " << stats.totalPeakBytes / 1024 << " KB\n";
+      }
+
+      if (PerfTimer::IsCapturing()) {
+        str << "Capturing trace\n";
+      }
+
       // str << "Cam Dist: " << m_camDist << "\n";
       // str << "Cam Theta:" << m_camTheta << "\n";
       // str << "Cam Phi:" << m_camPhi << "\n";
@@ -1237,74 +1554,91 @@ void orApp::updateOrbitHighlight()
   orRay3 mouseRay = getMouseRay();
   Eigen::Vector3d camPos = m_cameraSystem.getCamera(m_cameraId).m_pos;
 
-  // TODO player orbit, find (true anomaly, pos) for closest pos to mouse ray
-  EntitySystem::Ship const& playerShip = m_entitySystem.getShip(m_playerShipId);
-  PhysicsSystem::ParticleBody const& playerBody = m_physicsSystem.getParticleBody(playerShip.m_particleBodyId);
-  orEphemerisHybrid const& orbitParams = playerBody.m_osculatingOrbit;
-  // TODO subdivide based on some threshold
-  enum { NUM_STEPS = 1000 };
-  orVec3 posData[NUM_STEPS];
-  double trueAnomalyData[NUM_STEPS];
-  double times[NUM_STEPS];
-  orVec3 origin = playerBody.m_soiParentPos;
-  // TODO only sample future
-  sampleOrbit(orbitParams, origin, NUM_STEPS, posData, trueAnomalyData);
-  PhysicsSystem::GravBody const& parentGravBody = m_physicsSystem.findSOIGravBody(playerBody);
-  getTimeFromTrueAnomaly(parentGravBody.m_mass, orbitParams, NUM_STEPS, trueAnomalyData, times);
-  int closest_idx = -1;
-  double closest_dist = DBL_MAX;
-  double mouse_true_anomaly = DBL_MAX;
-  double mouse_time = DBL_MAX;
-  for (int i = 0; i < NUM_STEPS; ++i) {
-    double const dist = orRayPointDistance(mouseRay, posData[i]);
+  // Find (true anomaly, pos) for closest pos to mouse ray on every ship orbit, and highlight the one
+  // that's closest to the cursor on screen (smallest angle from the ray rather than smallest distance,
+  // otherwise far away orbits always win)
+  std::vector<EntitySystem::OrbitPick> picks;
+  m_entitySystem.pickShipOrbits(mouseRay, picks);
 
-    if (dist < closest_dist) {
+  int closest_idx = -1;
+  double closest_angle = DBL_MAX;
+  for (int i = 0; i < (int)picks.size(); ++i) {
+    if (picks[i].m_rayDepth <= 0) {
+      continue; // Behind the camera
+    }
+    double const angle = atan2(picks[i].m_rayDistance, picks[i].m_rayDepth);
+    if (angle < closest_angle) {
       closest_idx = i;
-      closest_dist = dist;
-      mouse_true_anomaly = trueAnomalyData[i];
-      mouse_time = times[i];
+      closest_angle = angle;
     }
   }
-  assert(closest_idx != -1);
-  m_renderSystem.getPoint(m_mousePointId).m_pos = orVec3(Eigen::Vector3d(posData[closest_idx]) - camPos);
+
+  if (closest_idx == -1) {
+    return;
+  }
+
+  EntitySystem::OrbitPick const& pick = picks[closest_idx];
+  double const mouse_time = pick.m_time;
+  m_renderSystem.getPoint(m_mousePointId).m_pos = orVec3(Eigen::Vector3d(pick.m_pos) - camPos);
 
   RenderSystem::Label2D& mouseLabel = m_renderSystem.getLabel2D(m_mouseLabelId);
   // Offset label from cursor
   mouseLabel.m_pos = getRenderMousePos();
   mouseLabel.m_pos[0] += 10.0;
   mouseLabel.m_pos[1] += 10.0;
+  CameraSystem::Target const& shipCamTarget = m_cameraSystem.getTarget(m_entitySystem.getShip(pick.m_shipId).m_cameraTargetId);
   char buf[128];
-  snprintf(buf, sizeof(buf), "%3.3f", mouse_time);
+  snprintf(buf, sizeof(buf), "%s %3.3f", shipCamTarget.m_name.c_str(), mouse_time);
   mouseLabel.m_text = std::string(buf);
 }
 
-void orApp::RenderState()
+void orApp::PublishState(orTask::ThreadIdx)
+{
+  RenderSystem::Frame& frame = m_renderSystem.backFrame();
+
+  frame.m_screenFromProj = calcScreenMatrix();
+  frame.m_projFromCam = calcProjMatrix();
+  frame.m_camFromWorld = calcCamMatrix();
+
+  orbital::Id<PhysicsSystem::ParticleBody> pid = m_entitySystem.getShip(m_playerShipId).m_particleBodyId;
+  Eigen::Vector3d cameraPos = m_cameraSystem.getCamera(m_cameraId).m_pos;
+  Eigen::Vector3d pos = m_physicsSystem.getParticlePos(pid);
+  Eigen::Vector3d dir = m_physicsSystem.getParticleUserAcc(pid);
+  double scale = 1000000;
+  RenderSystem::Line thrustLine;
+  thrustLine.m_start = orVec3(pos - cameraPos);
+  thrustLine.m_end = orVec3(pos - cameraPos + scale * dir);
+  thrustLine.m_col = orVec3(1.0, 1.0, 1.0);
+  frame.m_lines.push_back(thrustLine);
+
+  m_renderSystem.publishFrame();
+}
+
+void orApp::RenderState(orTask::ThreadIdx)
 {
   PERFTIMER("RenderState");
 
+  // Only looks at the last published frame, never at the systems, so this can run alongside the next
+  // frame's update
+  RenderSystem::Frame const* const frame = m_renderSystem.acquireFrame();
+  if (!frame) {
+    return; // First frame; nothing to draw yet
+  }
+
   // TODO remove duplicate constants
-  double const minZ = 1e6; // meters
   double const maxZ = 1e13; // meters
 
-  Eigen::Matrix4d screenFromProj = calcScreenMatrix();
-  Eigen::Matrix4d projFromCam = calcProjMatrix();
-  Eigen::Matrix4d camFromWorld = calcCamMatrix();
-
   RenderSystem::Colour clearCol = m_colG[0];
 
-  m_renderSystem.render(m_frameBuffer, clearCol, maxZ, screenFromProj, projFromCam, camFromWorld);
-
-  orbital::Id<PhysicsSystem::ParticleBody> pid = m_entitySystem.getShip(m_playerShipId).m_particleBodyId;
-  Eigen::Vector3d cameraPos = m_cameraSystem.getCamera(m_cameraId).m_pos;
-  Eigen::Vector3d pos = m_physicsSystem.getParticleBody(pid).m_pos;
-  Eigen::Vector3d dir = m_physicsSystem.getParticleBody(pid).m_userAcc;
-  double scale = 1000000;
-  m_renderSystem.drawLine(pos - cameraPos, pos - cameraPos + scale * dir, Eigen::Vector3d(1.0, 1.0, 1.0));
+  {
+    GPUTIMER(m_gpuTimers, "Render");
+    m_renderSystem.render(m_frameBuffer, clearCol, maxZ, *frame);
+  }
 
   {
     PERFTIMER("Render2D");
-    Eigen::Matrix4d screenFromWorld = screenFromProj * projFromCam * camFromWorld;
-    m_renderSystem.render2D(m_frameBuffer.width, m_frameBuffer.height, screenFromWorld);
+    GPUTIMER(m_gpuTimers, "Render2D");
+    m_renderSystem.render2D(*frame, m_frameBuffer.width, m_frameBuffer.height);
   }
 
   GL_CHECK(glColor3d(1.0, 1.0, 1.0)); // TODO ??? this colour seems to affect the colour
@@ -1313,6 +1647,7 @@ void orApp::RenderState()
 
   {
     PERFTIMER("PostEffect");
+    GPUTIMER(m_gpuTimers, "PostEffect");
 
     // Render from 2D framebuffer to screen
     GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, 0));
@@ -1346,6 +1681,7 @@ void orApp::RenderState()
   }
 
   SDL_GL_SwapWindow(m_window);
+  m_gpuTimers.endFrame();
 
   // printf("Frame Time: %04.1f ms Total Sim Time: %04.1f s \n", Timer::PerfTimeToMillis(m_lastFrameDuration), m_simTime / 1000);
 }
@@ -91,3 +91,54 @@ Eigen::Matrix4d CameraSystem::calcCameraMatrix( orbital::Id<Camera> cameraId, or
 
   return camT.inverse().matrix();
 }
+
+namespace {
+  uint32_t const SNAPSHOT_TAG = orbital::snapshotTag('C', 'A', 'M', 'R');
+  uint32_t const SNAPSHOT_VERSION = 1;
+}
+
+void CameraSystem::save(orbital::SnapshotWriter& _writer) const
+{
+  _writer.beginBlock(SNAPSHOT_TAG, SNAPSHOT_VERSION);
+  orbital::writeIdArray(_writer, m_instancedCameras);
+  orbital::writeIdArray(_writer, m_instancedTargets);
+}
+
+bool CameraSystem::check(orbital::SnapshotReader const& _reader) const
+{
+  uint32_t version = 0;
+  orbital::SnapshotReader::Cursor cursor;
+  if (!_reader.findBlock(SNAPSHOT_TAG, &version, &cursor) || version != SNAPSHOT_VERSION) {
+    return false;
+  }
+  return orbital::checkIdArray(cursor, m_instancedCameras)
+      && orbital::checkIdArray(cursor, m_instancedTargets);
+}
+
+bool CameraSystem::load(orbital::SnapshotReader const& _reader)
+{
+  uint32_t version = 0;
+  orbital::SnapshotReader::Cursor cursor;
+  if (!_reader.findBlock(SNAPSHOT_TAG, &version, &cursor) || version != SNAPSHOT_VERSION) {
+    return false;
+  }
+  return orbital::readIdArray(cursor, m_instancedCameras)
+      && orbital::readIdArray(cursor, m_instancedTargets);
+}
+
+void snapshotWriteObjects(orbital::SnapshotWriter& _writer, CameraSystem::Target const* const _targets, uint32_t const _count)
+{
+  for (uint32_t i = 0; i < _count; ++i) {
+    _writer.writeValue(_targets[i].m_pos);
+    _writer.writeString(_targets[i].m_name);
+  }
+}
+
+bool snapshotReadObjects(orbital::SnapshotReader::Cursor& _cursor, CameraSystem::Target* const o_targets, uint32_t const _count)
+{
+  for (uint32_t i = 0; i < _count; ++i) {
+    _cursor.readValue(&o_targets[i].m_pos);
+    _cursor.readString(&o_targets[i].m_name);
+  }
+  return _cursor.ok();
+}
@@ -0,0 +1,410 @@
+#include "orStd.h"
+
+#include "orConjunction.h"
+
+#include "orPlatform/atomic.h"
+
+#include <algorithm>
+
+namespace {
+  bool lessByPairThenTime(ConjunctionScreener::Event const& _a, ConjunctionScreener::Event const& _b) {
+    if (_a.m_bodyA.sparse_idx != _b.m_bodyA.sparse_idx) { return _a.m_bodyA.sparse_idx < _b.m_bodyA.sparse_idx; }
+    if (_a.m_bodyB.sparse_idx != _b.m_bodyB.sparse_idx) { return _a.m_bodyB.sparse_idx < _b.m_bodyB.sparse_idx; }
+    return _a.m_time < _b.m_time;
+  }
+
+  bool samePair(ConjunctionScreener::Event const& _a, ConjunctionScreener::Event const& _b) {
+    return _a.m_bodyA.sparse_idx == _b.m_bodyA.sparse_idx && _a.m_bodyA.generation == _b.m_bodyA.generation
+        && _a.m_bodyB.sparse_idx == _b.m_bodyB.sparse_idx && _a.m_bodyB.generation == _b.m_bodyB.generation;
+  }
+
+  bool lessByTime(ConjunctionScreener::Event const& _a, ConjunctionScreener::Event const& _b) {
+    return _a.m_time < _b.m_time;
+  }
+
+  struct BoxMinXLess {
+    BoxMinXLess(std::vector<double> const& _minX) : m_minX(_minX) {}
+    bool operator()(int _a, int _b) const { return m_minX[_a] < m_minX[_b]; }
+    std::vector<double> const& m_minX;
+  };
+} // namespace
+
+ConjunctionScreener::ConjunctionScreener(orTask::TaskScheduler& _scheduler, PhysicsSystem const& _physicsSystem) :
+  m_scheduler(_scheduler),
+  m_physicsSystem(_physicsSystem),
+  m_startTime(0),
+  m_params(),
+  m_parents(),
+  m_bodies(),
+  m_parentSamples(),
+  m_jobs(),
+  m_phase(Phase_Parents),
+  m_pendingJobs(0),
+  m_running(0),
+  m_complete(0),
+  m_workEvents(),
+  m_events(),
+  m_group()
+{
+}
+
+ConjunctionScreener::~ConjunctionScreener() {
+  // TODO assumes we are destroyed on the main thread
+  m_scheduler.waitForTaskGroup(0, &m_group);
+}
+
+bool ConjunctionScreener::isRunning() const {
+  return m_running != 0;
+}
+
+bool ConjunctionScreener::poll() {
+  orPlatform::readBarrier();
+  if (!m_running || !m_complete) {
+    return false;
+  }
+
+  m_events.swap(m_workEvents);
+  m_running = 0;
+  return true;
+}
+
+void ConjunctionScreener::start(int const _threadIdx, double const _simTime, Params const& _params, std::vector< orbital::Id<PhysicsSystem::ParticleBody> > const& _bodyIds) {
+  ensure(!isRunning(), "Previous screening still running!");
+  ensure(_params.m_numIntervals > 0 && _params.m_horizon > 0);
+
+  m_startTime = _simTime;
+  m_params = _params;
+  m_parents.clear();
+  m_bodies.clear();
+  m_workEvents.clear();
+
+  // Snapshot everything the tasks need so they never touch the physics system
+  for (size_t i = 0; i < _bodyIds.size(); ++i) {
+    orVec3 const particlePos = m_physicsSystem.getParticlePos(_bodyIds[i]);
+    orbital::Id<PhysicsSystem::GravBody> const parentId = m_physicsSystem.getParticleSoiParentId(_bodyIds[i]);
+
+    // Only a handful of distinct parents, linear search is fine
+    int parentIdx = -1;
+    for (int pi = 0; pi < (int)m_parents.size(); ++pi) {
+      if (m_parents[pi].m_gravBodyId.sparse_idx == parentId.sparse_idx && m_parents[pi].m_gravBodyId.generation == parentId.generation) {
+        parentIdx = pi;
+        break;
+      }
+    }
+
+    if (parentIdx < 0) {
+      parentIdx = (int)m_parents.size();
+      m_parents.push_back(Parent());
+      Parent& parent = m_parents.back();
+      parent.m_gravBodyId = parentId;
+      parent.m_mu = GRAV_CONSTANT * m_physicsSystem.getGravBody(parentId).m_mass;
+      for (orbital::Id<PhysicsSystem::GravBody> chainId = parentId; chainId; chainId = m_physicsSystem.getGravBody(chainId).m_parentBodyId) {
+        parent.m_chain.push_back(m_physicsSystem.getGravBody(chainId).m_ephemeris);
+      }
+    }
+
+    PhysicsSystem::GravBody const& parentBody = m_physicsSystem.getGravBody(parentId);
+
+    BodyState body;
+    body.m_id = _bodyIds[i];
+    body.m_parentIdx = parentIdx;
+    body.m_cart.pos = Vector3d(particlePos) - Vector3d(parentBody.m_pos);
+    body.m_cart.vel = Vector3d(m_physicsSystem.getParticleVel(_bodyIds[i])) - Vector3d(parentBody.m_vel);
+    m_bodies.push_back(body);
+  }
+
+  int const numSamples = m_params.m_numIntervals + 1;
+  m_parentSamples.resize(m_parents.size() * numSamples);
+
+  m_running = 1;
+  m_complete = 0;
+  startPhase(_threadIdx, Phase_Parents);
+}
+
+void ConjunctionScreener::startPhase(int const _threadIdx, Phase const _phase) {
+  m_phase = _phase;
+  m_jobs.clear();
+
+  int count = 0;
+  int perJob = 1;
+  switch (_phase) {
+    case Phase_Parents: count = (int)m_parents.size(); perJob = 1; break;
+    case Phase_Intervals: count = (m_bodies.size() > 1) ? m_params.m_numIntervals : 0; perJob = INTERVALS_PER_JOB; break;
+    default: ensure(false); break;
+  }
+
+  for (int begin = 0; begin < count; begin += perJob) {
+    m_jobs.push_back(Job());
+    Job& job = m_jobs.back();
+    job.m_screener = this;
+    job.m_phase = _phase;
+    job.m_begin = begin;
+    job.m_end = std::min(begin + perJob, count);
+  }
+
+  int const numJobs = (int)m_jobs.size();
+  if (numJobs == 0) {
+    finishPhase(_threadIdx);
+    return;
+  }
+
+  m_pendingJobs = numJobs;
+  orPlatform::writeBarrier();
+
+  for (int i = 0; i < numJobs; ++i) {
+    m_scheduler.submitTaskForGroup(_threadIdx, &m_group, &runJob, &m_jobs[i]);
+  }
+}
+
+// Called by whichever task finished the last job of a phase. Next phase must be submitted from
+// here, before that task completes, so the group never hits zero until the whole run is done.
+void ConjunctionScreener::finishPhase(int const _threadIdx) {
+  orPlatform::readBarrier();
+
+  if (m_phase + 1 < Phase_Count) {
+    startPhase(_threadIdx, Phase(m_phase + 1));
+    return;
+  }
+
+  mergeEvents();
+
+  orPlatform::writeBarrier();
+  m_complete = 1;
+}
+
+void ConjunctionScreener::runJob(orTask::ThreadIdx const _threadIdx, void* const _userData) {
+  Job* const job = (Job*)_userData;
+  ConjunctionScreener* const screener = job->m_screener;
+
+  switch (job->m_phase) {
+    case Phase_Parents: screener->sampleParents(job->m_begin, job->m_end); break;
+    case Phase_Intervals: screener->screenIntervals(job->m_begin, job->m_end, job->m_events); break;
+    default: ensure(false); break;
+  }
+
+  orPlatform::writeBarrier();
+  if (orPlatform::atomicDec(&screener->m_pendingJobs) == 1) {
+    screener->finishPhase(_threadIdx);
+  }
+}
+
+void ConjunctionScreener::calcParentCartesian(int const _parentIdx, double const _t, orEphemerisCartesian& o_cart) const {
+  Parent const& parent = m_parents[_parentIdx];
+  o_cart.pos = Vector3d::Zero();
+  o_cart.vel = Vector3d::Zero();
+  for (size_t i = 0; i < parent.m_chain.size(); ++i) {
+    orEphemerisCartesian cart;
+    ephemerisCartesianFromJPL(parent.m_chain[i], _t, cart);
+    o_cart.pos += cart.pos;
+    o_cart.vel += cart.vel;
+  }
+}
+
+void ConjunctionScreener::sampleParents(int const _begin, int const _end) {
+  int const numSamples = m_params.m_numIntervals + 1;
+  for (int pi = _begin; pi < _end; ++pi) {
+    for (int k = 0; k < numSamples; ++k) {
+      calcParentCartesian(pi, sampleTime(k), m_parentSamples[pi * numSamples + k]);
+    }
+  }
+}
+
+// Relative state of body B from body A at time t
+void ConjunctionScreener::calcRelativeState(int const _bodyA, int const _bodyB, double const _t, Vector3d& o_dr, Vector3d& o_dv) const {
+  BodyState const& bodyA = m_bodies[_bodyA];
+  BodyState const& bodyB = m_bodies[_bodyB];
+
+  Vector3d posA, velA, posB, velB;
+  orMath::propagateKepler(bodyA.m_cart.pos, bodyA.m_cart.vel, m_parents[bodyA.m_parentIdx].m_mu, _t - m_startTime, posA, velA);
+  orMath::propagateKepler(bodyB.m_cart.pos, bodyB.m_cart.vel, m_parents[bodyB.m_parentIdx].m_mu, _t - m_startTime, posB, velB);
+
+  o_dr = posB - posA;
+  o_dv = velB - velA;
+
+  // Parents cancel out in the common case; evaluating the ephemerides is the expensive part
+  if (bodyA.m_parentIdx != bodyB.m_parentIdx) {
+    orEphemerisCartesian parentA;
+    orEphemerisCartesian parentB;
+    calcParentCartesian(bodyA.m_parentIdx, _t, parentA);
+    calcParentCartesian(bodyB.m_parentIdx, _t, parentB);
+    o_dr += parentB.pos - parentA.pos;
+    o_dv += parentB.vel - parentA.vel;
+  }
+}
+
+void ConjunctionScreener::screenIntervals(int const _begin, int const _end, std::vector<Event>& o_events) const {
+  int const numSamples = m_params.m_numIntervals + 1;
+  int const numBodies = (int)m_bodies.size();
+  int const numLocalSamples = _end - _begin + 1;
+
+  // Absolute states of every body at each interval boundary we cover, [bi * numLocalSamples + (k - _begin)].
+  // Always propagate from the start state rather than sample to sample so error doesn't accumulate.
+  std::vector<orEphemerisCartesian> samples(numBodies * numLocalSamples);
+  for (int bi = 0; bi < numBodies; ++bi) {
+    BodyState const& body = m_bodies[bi];
+    double const mu = m_parents[body.m_parentIdx].m_mu;
+    for (int k = _begin; k <= _end; ++k) {
+      orEphemerisCartesian& sample = samples[bi * numLocalSamples + (k - _begin)];
+      orMath::propagateKepler(body.m_cart.pos, body.m_cart.vel, mu, sampleTime(k) - m_startTime, sample.pos, sample.vel);
+      orEphemerisCartesian const& parent = m_parentSamples[body.m_parentIdx * numSamples + k];
+      sample.pos += parent.pos;
+      sample.vel += parent.vel;
+    }
+  }
+
+  std::vector<Box> boxes(numBodies);
+  std::vector<double> minX(numBodies);
+  std::vector<int> order(numBodies);
+  std::vector<int> active;
+
+  for (int k = _begin; k < _end; ++k) {
+    double const intervalDuration = sampleTime(k + 1) - sampleTime(k);
+
+    // Bounding box of each body's path over the interval. The path bulges away from the chord between
+    // the end points by at most about dt * |dv| / 8 for constant acceleration; use double that for safety,
+    // plus half the threshold on each box so overlapping boxes means "might get within threshold".
+    for (int bi = 0; bi < numBodies; ++bi) {
+      orEphemerisCartesian const& s0 = samples[bi * numLocalSamples + (k - _begin)];
+      orEphemerisCartesian const& s1 = samples[bi * numLocalSamples + (k + 1 - _begin)];
+
+      double const inflate = intervalDuration * (s1.vel - s0.vel).norm() / 4 + m_params.m_threshold / 2;
+
+      Box& box = boxes[bi];
+      for (int d = 0; d < 3; ++d) {
+        box.m_min[d] = std::min(s0.pos[d], s1.pos[d]) - inflate;
+        box.m_max[d] = std::max(s0.pos[d], s1.pos[d]) + inflate;
+      }
+      minX[bi] = box.m_min[0];
+      order[bi] = bi;
+    }
+
+    // Sweep and prune along X
+    std::sort(order.begin(), order.end(), BoxMinXLess(minX));
+
+    active.clear();
+    for (int oi = 0; oi < numBodies; ++oi) {
+      int const bi = order[oi];
+      Box const& box = boxes[bi];
+
+      // Drop boxes that end before this one starts
+      int numActive = 0;
+      for (size_t ai = 0; ai < active.size(); ++ai) {
+        if (boxes[active[ai]].m_max[0] >= box.m_min[0]) {
+          active[numActive++] = active[ai];
+        }
+      }
+      active.resize(numActive);
+
+      for (size_t ai = 0; ai < active.size(); ++ai) {
+        int const bj = active[ai];
+        Box const& other = boxes[bj];
+        bool const overlap =
+          box.m_min[1] <= other.m_max[1] && other.m_min[1] <= box.m_max[1] &&
+          box.m_min[2] <= other.m_max[2] && other.m_min[2] <= box.m_max[2];
+
+        if (!overlap) {
+          continue;
+        }
+
+        // Boxes are a loose test since they bound each path separately. Before doing the expensive refinement,
+        // check the closest approach of the chord of the relative path, allowing for the relative path bulging
+        // away from its chord by the same margin as above.
+        orEphemerisCartesian const& a0 = samples[bi * numLocalSamples + (k - _begin)];
+        orEphemerisCartesian const& a1 = samples[bi * numLocalSamples + (k + 1 - _begin)];
+        orEphemerisCartesian const& b0 = samples[bj * numLocalSamples + (k - _begin)];
+        orEphemerisCartesian const& b1 = samples[bj * numLocalSamples + (k + 1 - _begin)];
+
+        Vector3d const dr0 = b0.pos - a0.pos;
+        Vector3d const dr1 = b1.pos - a1.pos;
+        Vector3d const chord = dr1 - dr0;
+        double const chordLen2 = chord.squaredNorm();
+        double const u = (chordLen2 > 0) ? std::max(0.0, std::min(1.0, -dr0.dot(chord) / chordLen2)) : 0.0;
+        double const chordMinDist = (dr0 + u * chord).norm();
+        double const margin = intervalDuration * ((b1.vel - a1.vel) - (b0.vel - a0.vel)).norm() / 4;
+
+        if (chordMinDist - margin >= m_params.m_threshold) {
+          continue;
+        }
+
+        Event event;
+        if (refinePair(std::min(bi, bj), std::max(bi, bj), k, event)) {
+          o_events.push_back(event);
+        }
+      }
+
+      active.push_back(bi);
+    }
+  }
+}
+
+// Find the time of closest approach within interval k: Newton iteration on f(t) = dr . dv, which is
+// half the derivative of |dr|^2. We approximate f'(t) by |dv|^2, ignoring the relative acceleration,
+// which is small over an interval.
+bool ConjunctionScreener::refinePair(int const _bodyA, int const _bodyB, int const _k, Event& o_event) const {
+  double const t0 = sampleTime(_k);
+  double const t1 = sampleTime(_k + 1);
+
+  Vector3d dr;
+  Vector3d dv;
+  double t = 0.5 * (t0 + t1);
+  calcRelativeState(_bodyA, _bodyB, t, dr, dv);
+
+  for (int i = 0; i < 8; ++i) {
+    double const dv2 = dv.squaredNorm();
+    if (dv2 <= 0) {
+      break;
+    }
+
+    double const tNext = std::max(t0, std::min(t1, t - dr.dot(dv) / dv2));
+    double const step = tNext - t;
+    t = tNext;
+
+    calcRelativeState(_bodyA, _bodyB, t, dr, dv);
+
+    // TODO arbitrary threshold
+    if (fabs(step) < 1e-3) {
+      break;
+    }
+  }
+
+  double const missDistance = dr.norm();
+  if (missDistance >= m_params.m_threshold) {
+    return false;
+  }
+
+  o_event.m_bodyA = m_bodies[_bodyA].m_id;
+  o_event.m_bodyB = m_bodies[_bodyB].m_id;
+  o_event.m_time = t;
+  o_event.m_missDistance = missDistance;
+  return true;
+}
+
+void ConjunctionScreener::mergeEvents() {
+  m_workEvents.clear();
+  for (size_t ji = 0; ji < m_jobs.size(); ++ji) {
+    m_workEvents.insert(m_workEvents.end(), m_jobs[ji].m_events.begin(), m_jobs[ji].m_events.end());
+  }
+
+  // A close approach near an interval boundary gets found from both sides, and a pair flying in formation
+  // gets found in every interval; collapse runs of events for the same pair into the closest one.
+  std::sort(m_workEvents.begin(), m_workEvents.end(), lessByPairThenTime);
+
+  double const intervalDuration = m_params.m_horizon / m_params.m_numIntervals;
+  size_t numMerged = 0;
+  double prevTime = 0;
+  for (size_t ei = 0; ei < m_workEvents.size(); ++ei) {
+    Event const& event = m_workEvents[ei];
+    if (numMerged > 0 && samePair(m_workEvents[numMerged - 1], event) && event.m_time - prevTime <= intervalDuration * 1.01) {
+      Event& merged = m_workEvents[numMerged - 1];
+      if (event.m_missDistance < merged.m_missDistance) {
+        merged = event;
+      }
+    } else {
+      m_workEvents[numMerged++] = event;
+    }
+    prevTime = event.m_time;
+  }
+  m_workEvents.resize(numMerged);
+
+  std::sort(m_workEvents.begin(), m_workEvents.end(), lessByTime);
+}
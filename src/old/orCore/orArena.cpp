@@ -0,0 +1,238 @@
+#include "orStd.h"
+
+#include "orCore/orArena.h"
+
+#include "orPlatform/memory.h"
+
+#include "boost_begin.h"
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include "boost_end.h"
+
+#include <algorithm>
+
+namespace {
+
+size_t const MIN_ALIGN = 16;
+size_t const COMMIT_CHUNK = 1 << 20; // Commit this much at a time, so we aren't in the kernel every page
+
+// Address space only; what's committed is what's been used
+size_t const FRAME_ARENA_RESERVE = size_t(256) << 20;
+size_t const TWO_FRAME_ARENA_RESERVE = size_t(64) << 20;
+
+size_t roundUp(size_t const _n, size_t const _to) {
+  return (_n + _to - 1) / _to * _to;
+}
+
+} // namespace
+
+namespace orbital {
+
+Arena::Arena(size_t const _reserveBytes) :
+  m_base(NULL),
+  m_reserved(roundUp(_reserveBytes, orPlatform::memoryPageSize())),
+  m_committed(0),
+  m_used(0),
+  m_peak(0),
+  m_overflow(),
+  m_overflowBytes(0)
+{
+  m_base = static_cast<char*>(orPlatform::reserveMemory(m_reserved));
+  ensure(m_base != NULL);
+}
+
+Arena::~Arena()
+{
+  reset();
+  orPlatform::releaseMemory(m_base, m_reserved);
+}
+
+void* Arena::alloc(size_t const _size, size_t const _align)
+{
+  size_t const align = std::max(_align, MIN_ALIGN);
+  size_t const begin = roundUp(m_used, align);
+  size_t const end = begin + _size;
+
+  if (end > m_committed) {
+    if (end > m_reserved) {
+      return allocOverflow(_size, align);
+    }
+    size_t const newCommitted = std::min(roundUp(end, COMMIT_CHUNK), m_reserved);
+    bool const ok = orPlatform::commitMemory(m_base + m_committed, newCommitted - m_committed);
+    ensure(ok);
+    m_committed = newCommitted;
+  }
+
+  m_used = end;
+  m_peak = std::max(m_peak, used());
+  return m_base + begin;
+}
+
+void* Arena::allocOverflow(size_t const _size, size_t const _align)
+{
+  // Should be rare enough that the malloc doesn't matter; if it isn't, reserve more
+  ensure(false, "Arena reservation exhausted; falling back to the heap");
+
+  // Over-allocate so we can align, and keep the block itself to free later
+  char* const block = static_cast<char*>(malloc(_size + _align));
+  ensure(block != NULL);
+  m_overflow.push_back(block);
+  m_overflowBytes += _size;
+  m_peak = std::max(m_peak, used());
+
+  uintptr_t const aligned = roundUp((uintptr_t)block, _align);
+  return reinterpret_cast<void*>(aligned);
+}
+
+void Arena::reset()
+{
+  for (size_t i = 0; i < m_overflow.size(); ++i) {
+    free(m_overflow[i]);
+  }
+  m_overflow.clear();
+  m_overflowBytes = 0;
+  m_used = 0;
+  m_peak = 0;
+}
+
+struct FrameArenas::ThreadArenas {
+  ThreadArenas() :
+    frame(FRAME_ARENA_RESERVE)
+  {
+    twoFrames[0] = new Arena(TWO_FRAME_ARENA_RESERVE);
+    twoFrames[1] = new Arena(TWO_FRAME_ARENA_RESERVE);
+    std::fill(systemPeak, systemPeak + ArenaSystem_Count, 0);
+  }
+
+  ~ThreadArenas() {
+    delete twoFrames[0];
+    delete twoFrames[1];
+  }
+
+  Arena frame;
+  Arena* twoFrames[2]; // Frame N uses [N & 1]
+  size_t systemPeak[ArenaSystem_Count]; // This frame, from FrameArenaScopes on this thread
+};
+
+namespace {
+
+// Every thread's arenas, for EndFrame()
+boost::mutex s_registryMutex;
+std::vector<FrameArenas::ThreadArenas*>* s_registry = NULL;
+
+thread_local FrameArenas::ThreadArenas* s_threadArenas = NULL;
+
+// Only changes in EndFrame(), when no frame tasks are running; the scheduler's synchronisation
+// orders that before anything the next frame's tasks do
+uint32_t s_frameIdx = 0;
+
+FrameArenas::Stats s_stats;
+
+} // namespace
+
+FrameArenas::ThreadArenas& FrameArenas::GetThreadArenas()
+{
+  if (s_threadArenas == NULL) {
+    s_threadArenas = new ThreadArenas();
+    boost::lock_guard<boost::mutex> lock(s_registryMutex);
+    if (s_registry == NULL) {
+      s_registry = new std::vector<ThreadArenas*>();
+    }
+    s_registry->push_back(s_threadArenas);
+  }
+  return *s_threadArenas;
+}
+
+Arena& FrameArenas::Get(ArenaLifetime const _lifetime)
+{
+  ThreadArenas& arenas = GetThreadArenas();
+  if (_lifetime == ArenaLifetime_TwoFrames) {
+    return *arenas.twoFrames[s_frameIdx & 1];
+  }
+  return arenas.frame;
+}
+
+void FrameArenas::EndFrame()
+{
+  boost::lock_guard<boost::mutex> lock(s_registryMutex);
+  if (s_registry == NULL) {
+    return;
+  }
+
+  std::fill(s_stats.frameBytes, s_stats.frameBytes + ArenaSystem_Count, 0);
+  size_t totalBytes = 0;
+  for (size_t i = 0; i < s_registry->size(); ++i) {
+    ThreadArenas& arenas = *(*s_registry)[i];
+    for (int s = 0; s < ArenaSystem_Count; ++s) {
+      s_stats.frameBytes[s] += arenas.systemPeak[s];
+      arenas.systemPeak[s] = 0;
+    }
+    totalBytes += arenas.frame.peak() + arenas.twoFrames[0]->used() + arenas.twoFrames[1]->used();
+
+    arenas.frame.reset();
+    // What the last frame allocated for this one to render is done with now
+    arenas.twoFrames[(s_frameIdx + 1) & 1]->reset();
+  }
+  for (int s = 0; s < ArenaSystem_Count; ++s) {
+    s_stats.peakBytes[s] = std::max(s_stats.peakBytes[s], s_stats.frameBytes[s]);
+  }
+  s_stats.totalPeakBytes = std::max(s_stats.totalPeakBytes, totalBytes);
+
+  ++s_frameIdx;
+}
+
+void FrameArenas::StaticShutdown()
+{
+  boost::lock_guard<boost::mutex> lock(s_registryMutex);
+  if (s_registry == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < s_registry->size(); ++i) {
+    delete (*s_registry)[i];
+  }
+  delete s_registry; s_registry = NULL;
+  // Other threads' pointers dangle now, but they should all be gone
+  s_threadArenas = NULL;
+}
+
+FrameArenas::Stats const& FrameArenas::GetStats()
+{
+  return s_stats;
+}
+
+char const* FrameArenas::SystemName(ArenaSystem const _system)
+{
+  switch (_system) {
+    case ArenaSystem_Physics: return "Physics";
+    case ArenaSystem_Render: return "Render";
+    case ArenaSystem_Tasks: return "Tasks";
+    default: return "?";
+  }
+}
+
+FrameArenaScope::FrameArenaScope(ArenaSystem const _system) :
+  m_system(_system),
+  m_arenas(FrameArenas::GetThreadArenas())
+{
+  Arena* const arenas[2] = { &m_arenas.frame, m_arenas.twoFrames[s_frameIdx & 1] };
+  for (int i = 0; i < 2; ++i) {
+    m_startUsed[i] = arenas[i]->used();
+    m_outerPeak[i] = arenas[i]->peak();
+    // Measure the peak from here
+    arenas[i]->setPeak(m_startUsed[i]);
+  }
+}
+
+FrameArenaScope::~FrameArenaScope()
+{
+  Arena* const arenas[2] = { &m_arenas.frame, m_arenas.twoFrames[s_frameIdx & 1] };
+  size_t bytes = 0;
+  for (int i = 0; i < 2; ++i) {
+    size_t const peak = arenas[i]->peak();
+    bytes += peak - m_startUsed[i];
+    arenas[i]->setPeak(std::max(peak, m_outerPeak[i]));
+  }
+  m_arenas.systemPeak[m_system] = std::max(m_arenas.systemPeak[m_system], bytes);
+}
+
+} // namespace orbital
@@ -0,0 +1,334 @@
+#include "orStd.h"
+
+#include "orCore/orSnapshot.h"
+
+#include "orProfile/perftimer.h"
+
+namespace {
+
+uint32_t const SNAPSHOT_MAGIC = orbital::snapshotTag('O', 'R', 'S', 'N');
+uint32_t const SNAPSHOT_FORMAT_VERSION = 1; // Of the header and block layout, not of any system's data
+
+uint64_t const CHECKSUM_SEED = 0x6a09e667f3bcc908ULL;
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t formatVersion;
+  uint32_t numBlocks;
+  uint32_t pad;
+};
+
+struct BlockHeader {
+  uint32_t tag;
+  uint32_t version;
+  uint64_t size; // Of the contents, including padding
+  uint64_t checksum; // Of the contents
+};
+
+static_assert(sizeof(FileHeader) % 8 == 0 && sizeof(BlockHeader) % 8 == 0, "Headers must keep contents 8 byte aligned");
+
+uint8_t const s_zeroes[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+
+inline size_t padding(size_t const _size) { return (8 - (_size & 7)) & 7; }
+
+inline uint64_t mixWord(uint64_t const _checksum, uint64_t const _word) {
+  uint64_t const h = (_checksum ^ _word) * 0x9E3779B97F4A7C15ULL;
+  return h ^ (h >> 29);
+}
+
+} // namespace
+
+uint64_t orbital::snapshotChecksum(void const* const _data, size_t const _size, uint64_t _checksum) {
+  uint8_t const* const bytes = static_cast<uint8_t const*>(_data);
+  size_t const words = _size / 8;
+  for (size_t i = 0; i < words; ++i) {
+    uint64_t word;
+    memcpy(&word, bytes + 8 * i, 8);
+    _checksum = mixWord(_checksum, word);
+  }
+  if (_size & 7) {
+    uint64_t word = 0;
+    memcpy(&word, bytes + 8 * words, _size & 7);
+    _checksum = mixWord(_checksum, word);
+  }
+  return _checksum;
+}
+
+// SnapshotWriter
+
+orbital::SnapshotWriter::SnapshotWriter() :
+  m_buffer(),
+  m_pieces(),
+  m_blocks()
+{
+  FileHeader const header = { SNAPSHOT_MAGIC, SNAPSHOT_FORMAT_VERSION, 0, 0 }; // numBlocks filled in on save
+  write(&header, sizeof(header));
+}
+
+void orbital::SnapshotWriter::beginBlock(uint32_t const _tag, uint32_t const _version) {
+  BlockHeader const header = { _tag, _version, 0, 0 }; // size, checksum filled in on save
+  // A piece of its own, so it can be found and patched later
+  Block block;
+  block.headerPiece = m_pieces.size();
+  addPiece(true, &header, sizeof(header));
+  block.firstPiece = m_pieces.size();
+  m_blocks.push_back(block);
+}
+
+void orbital::SnapshotWriter::write(void const* const _data, size_t const _size) {
+  ensure(!m_blocks.empty() || m_pieces.empty(), "Begin a block first!");
+  size_t const offset = m_buffer.size();
+  m_buffer.resize(offset + _size + padding(_size));
+  memcpy(m_buffer.data() + offset, _data, _size);
+  memset(m_buffer.data() + offset + _size, 0, padding(_size));
+
+  // Merge into the last piece if that's ours too, so lots of small values are one piece
+  if (!m_pieces.empty() && m_pieces.back().owned && m_pieces.size() - 1 != (m_blocks.empty() ? 0 : m_blocks.back().headerPiece)) {
+    m_pieces.back().size += _size + padding(_size);
+    return;
+  }
+  Piece piece = { true, offset, NULL, _size + padding(_size) };
+  m_pieces.push_back(piece);
+}
+
+void orbital::SnapshotWriter::writeString(std::string const& _str) {
+  writeValue((uint64_t)_str.size());
+  write(_str.data(), _str.size());
+}
+
+void orbital::SnapshotWriter::writeBulk(void const* const _data, size_t const _size) {
+  ensure(!m_blocks.empty(), "Begin a block first!");
+  addPiece(false, _data, _size);
+}
+
+void orbital::SnapshotWriter::addPiece(bool const _owned, void const* const _data, size_t const _size) {
+  if (_owned) {
+    size_t const offset = m_buffer.size();
+    m_buffer.resize(offset + _size);
+    memcpy(m_buffer.data() + offset, _data, _size);
+    Piece const piece = { true, offset, NULL, _size };
+    m_pieces.push_back(piece);
+  } else {
+    Piece const piece = { false, 0, _data, _size };
+    m_pieces.push_back(piece);
+  }
+  pad(_size);
+}
+
+void orbital::SnapshotWriter::pad(size_t const _size) {
+  if (padding(_size) != 0) {
+    Piece const piece = { false, 0, s_zeroes, padding(_size) };
+    m_pieces.push_back(piece);
+  }
+}
+
+bool orbital::SnapshotWriter::save(char const* const _path) {
+  PERFTIMER("SaveSnapshot");
+
+  // m_buffer won't move any more, so everything can be pointers now
+  std::vector<orPlatform::FilePiece> filePieces(m_pieces.size());
+  for (size_t i = 0; i < m_pieces.size(); ++i) {
+    filePieces[i].data = m_pieces[i].owned ? m_buffer.data() + m_pieces[i].offset : m_pieces[i].data;
+    filePieces[i].size = m_pieces[i].size;
+  }
+
+  reinterpret_cast<FileHeader*>(m_buffer.data())->numBlocks = (uint32_t)m_blocks.size();
+
+  for (size_t bi = 0; bi < m_blocks.size(); ++bi) {
+    size_t const endPiece = (bi + 1 < m_blocks.size()) ? m_blocks[bi + 1].headerPiece : m_pieces.size();
+    uint64_t size = 0;
+    uint64_t checksum = CHECKSUM_SEED;
+    for (size_t pi = m_blocks[bi].firstPiece; pi < endPiece; ++pi) {
+      // Every piece ends on a word once its padding's added, so checksumming them one at a time
+      // matches checksumming the file. The checksum already pads with zeroes, so padding pieces are
+      // skipped, or they'd count twice.
+      if (filePieces[pi].data != s_zeroes) {
+        checksum = snapshotChecksum(filePieces[pi].data, filePieces[pi].size, checksum);
+      }
+      size += filePieces[pi].size;
+    }
+    BlockHeader* const header = reinterpret_cast<BlockHeader*>(m_buffer.data() + m_pieces[m_blocks[bi].headerPiece].offset);
+    header->size = size;
+    header->checksum = checksum;
+  }
+
+  return orPlatform::writeFileGather(_path, filePieces.data(), filePieces.size());
+}
+
+// SnapshotReader
+
+orbital::SnapshotReader::SnapshotReader() :
+  m_file(),
+  m_blocks()
+{
+}
+
+orbital::SnapshotReader::~SnapshotReader() {
+  orPlatform::unmapFile(&m_file);
+}
+
+bool orbital::SnapshotReader::open(char const* const _path) {
+  PERFTIMER("OpenSnapshot");
+
+  orPlatform::unmapFile(&m_file);
+  m_blocks.clear();
+
+  if (!orPlatform::mapFile(_path, &m_file)) {
+    orErr("Could not open snapshot '%s'\n", _path);
+    return false;
+  }
+
+  uint8_t const* pos = static_cast<uint8_t const*>(m_file.data);
+  uint8_t const* const end = pos + m_file.size;
+
+  FileHeader header;
+  if (m_file.size < sizeof(header)) {
+    orErr("Snapshot '%s' is truncated\n", _path);
+    return false;
+  }
+  memcpy(&header, pos, sizeof(header));
+  pos += sizeof(header);
+  if (header.magic != SNAPSHOT_MAGIC || header.formatVersion != SNAPSHOT_FORMAT_VERSION) {
+    orErr("'%s' is not a snapshot, or from an incompatible version\n", _path);
+    return false;
+  }
+
+  for (uint32_t i = 0; i < header.numBlocks; ++i) {
+    BlockHeader blockHeader;
+    if ((size_t)(end - pos) < sizeof(blockHeader)) {
+      orErr("Snapshot '%s' is truncated\n", _path);
+      return false;
+    }
+    memcpy(&blockHeader, pos, sizeof(blockHeader));
+    pos += sizeof(blockHeader);
+    if ((uint64_t)(end - pos) < blockHeader.size) {
+      orErr("Snapshot '%s' is truncated\n", _path);
+      return false;
+    }
+    if (snapshotChecksum(pos, (size_t)blockHeader.size, CHECKSUM_SEED) != blockHeader.checksum) {
+      orErr("Snapshot '%s' is damaged (block %u)\n", _path, i);
+      return false;
+    }
+    BlockInfo const block = { blockHeader.tag, blockHeader.version, pos, pos + blockHeader.size };
+    m_blocks.push_back(block);
+    pos += blockHeader.size;
+  }
+  return true;
+}
+
+bool orbital::SnapshotReader::findBlock(uint32_t const _tag, uint32_t* const o_version, Cursor* const o_cursor) const {
+  for (size_t i = 0; i < m_blocks.size(); ++i) {
+    if (m_blocks[i].tag == _tag) {
+      *o_version = m_blocks[i].version;
+      *o_cursor = Cursor(m_blocks[i].begin, m_blocks[i].end);
+      return true;
+    }
+  }
+  return false;
+}
+
+void const* orbital::SnapshotReader::Cursor::readBulk(size_t const _size) {
+  size_t const padded = _size + padding(_size);
+  if (!m_ok || padded < _size || (size_t)(m_end - m_pos) < padded) {
+    m_ok = false;
+    return NULL;
+  }
+  void const* const p = m_pos;
+  m_pos += padded;
+  return p;
+}
+
+bool orbital::SnapshotReader::Cursor::readString(std::string* const o_str) {
+  uint64_t size = 0;
+  if (!readValue(&size) || size > (uint64_t)(m_end - m_pos)) {
+    m_ok = false;
+    return false;
+  }
+  char const* const data = static_cast<char const*>(readBulk((size_t)size));
+  if (!data) { return false; }
+  o_str->assign(data, (size_t)size);
+  return true;
+}
+
+// Tables
+
+void orbital::writeTable(SnapshotWriter& _writer, ortable::Table const& _table) {
+  _writer.writeValue((uint64_t)_table.size);
+  _writer.writeValue((uint64_t)_table.num_attributes);
+  for (size_t i = 0; i < _table.num_attributes; ++i) {
+    ortable::Attribute const& attribute = _table.attributes[i];
+    _writer.writeValue((uint64_t)attribute.size);
+    _writer.writeValue((uint64_t)attribute.count);
+  }
+  for (size_t i = 0; i < _table.num_attributes; ++i) {
+    ortable::Attribute const& attribute = _table.attributes[i];
+    for (size_t lane = 0; lane < attribute.count; ++lane) {
+      _writer.writeBulk(static_cast<uint8_t const*>(_table.buffer) + attribute.offset + lane * attribute.stride, _table.size * attribute.size);
+    }
+  }
+}
+
+bool orbital::checkTable(SnapshotReader::Cursor& _cursor, ortable::Table const& _table, size_t* const o_size) {
+  uint64_t size = 0;
+  uint64_t numAttributes = 0;
+  _cursor.readValue(&size);
+  _cursor.readValue(&numAttributes);
+  if (!_cursor.ok() || numAttributes != _table.num_attributes) {
+    return false;
+  }
+  for (size_t i = 0; i < _table.num_attributes; ++i) {
+    uint64_t attributeSize = 0;
+    uint64_t attributeCount = 0;
+    _cursor.readValue(&attributeSize);
+    _cursor.readValue(&attributeCount);
+    if (!_cursor.ok() || attributeSize != _table.attributes[i].size || attributeCount != _table.attributes[i].count) {
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < _table.num_attributes; ++i) {
+    ortable::Attribute const& attribute = _table.attributes[i];
+    for (size_t lane = 0; lane < attribute.count; ++lane) {
+      if ((attribute.size != 0 && size > SIZE_MAX / attribute.size) || !_cursor.readBulk((size_t)size * attribute.size)) {
+        return false;
+      }
+    }
+  }
+  if (o_size) {
+    *o_size = (size_t)size;
+  }
+  return true;
+}
+
+bool orbital::readTable(SnapshotReader::Cursor& _cursor, ortable::Table& _table) {
+  uint64_t size = 0;
+  uint64_t numAttributes = 0;
+  _cursor.readValue(&size);
+  _cursor.readValue(&numAttributes);
+  if (!_cursor.ok() || numAttributes != _table.num_attributes) {
+    return false;
+  }
+  for (size_t i = 0; i < _table.num_attributes; ++i) {
+    uint64_t attributeSize = 0;
+    uint64_t attributeCount = 0;
+    _cursor.readValue(&attributeSize);
+    _cursor.readValue(&attributeCount);
+    if (!_cursor.ok() || attributeSize != _table.attributes[i].size || attributeCount != _table.attributes[i].count) {
+      return false;
+    }
+  }
+
+  if (_table.size > 0) {
+    ortable::Clear(&_table);
+  }
+  ortable::Append(&_table, (size_t)size);
+  for (size_t i = 0; i < _table.num_attributes; ++i) {
+    ortable::Attribute const& attribute = _table.attributes[i];
+    for (size_t lane = 0; lane < attribute.count; ++lane) {
+      if (!_cursor.read(static_cast<uint8_t*>(_table.buffer) + attribute.offset + lane * attribute.stride, _table.size * attribute.size)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
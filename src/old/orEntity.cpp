@@ -6,7 +6,13 @@
 
 #include "constants.h"
 
-void EntitySystem::updateRenderObjects(double const _dt, const orVec3 _origin)
+#include "orTask/parallelFor.h"
+
+namespace {
+  uint32_t const SHIP_GRAIN = 256; // Ships per block; a few microseconds of work when orbits change
+}
+
+void EntitySystem::updateRenderObjects(orTask::TaskScheduler& _scheduler, orTask::ThreadIdx const _threadIdx, double const _dt, const orVec3 _origin)
 {
   // Update Bodies
   for (uint32_t i = 0; i < ::orbital::id_array::num_objects(m_instancedBodies); ++i) {
@@ -18,7 +24,12 @@ void EntitySystem::updateRenderObjects(double const _dt, const orVec3 _origin)
     if (body.m_orbitId && gravBody.m_parentBodyId) {
       RenderSystem::Orbit& orbit = m_renderSystem.getOrbit(body.m_orbitId);
       PhysicsSystem::GravBody const& parentGravBody = m_physicsSystem.getGravBody(gravBody.m_parentBodyId);
-      updateOrbit(gravBody, parentGravBody, orbit.m_params);
+
+      // Only copy the conic when PhysicsSystem has recomputed it; drawing doesn't use theta
+      if (body.m_orbitVersion != gravBody.m_orbitVersion) {
+        orbit.m_params = gravBody.m_orbit;
+        body.m_orbitVersion = gravBody.m_orbitVersion;
+      }
 
       // Origin of an orbit is the position of the parent body
       // For all rendering objects we subtract the camera position to reduce error
@@ -46,25 +57,30 @@ void EntitySystem::updateRenderObjects(double const _dt, const orVec3 _origin)
   }
 
   // Update ships
-  // TODO put orEntity in orbital namespace and remove the ::orbital::
-  for (uint32_t i = 0; i < ::orbital::id_array::num_objects(m_instancedShips); ++i) {
-    Ship& ship = ::orbital::id_array::objects(m_instancedShips)[i];
-
+  // Fleets can be thousands of ships, and each only touches its own render objects and its own row of
+  // derived physics data, so they can go in parallel
+  orTask::parallel_for(_scheduler, _threadIdx, m_instancedShips, SHIP_GRAIN, [&](orTask::ThreadIdx, Ship& ship) {
     // TODO more of this should be in PhysicsSystem
 
-    PhysicsSystem::ParticleBody& body = m_physicsSystem.getParticleBody(ship.m_particleBodyId);
-    orVec3 offset_pos = orVec3(Vector3d(body.m_pos) - Vector3d(_origin));
+    orVec3 offset_pos = orVec3(Vector3d(m_physicsSystem.getParticlePos(ship.m_particleBodyId)) - Vector3d(_origin));
 
-    RenderSystem::Orbit& orbit = m_renderSystem.getOrbit(ship.m_orbitId);
-    PhysicsSystem::GravBody const& parentGravBody = m_physicsSystem.findSOIGravBody(body);
-    updateOrbit(body, parentGravBody, body.m_osculatingOrbit);
-    body.m_soiParentPos = parentGravBody.m_pos;
+    // Fleet ships don't have their own orbit or camera target
+    if (ship.m_orbitId)
+    {
+      RenderSystem::Orbit& orbit = m_renderSystem.getOrbit(ship.m_orbitId);
 
-    // Origin of an orbit is the position of the parent body
-    // For all rendering objects we subtract the camera position to reduce error
-    // in the render pipeline
-    orbit.m_pos = orVec3(Vector3d(parentGravBody.m_pos) - Vector3d(_origin));
-    orbit.m_params = body.m_osculatingOrbit;
+      // Origin of an orbit is the position of the parent body
+      // For all rendering objects we subtract the camera position to reduce error
+      // in the render pipeline
+      orbit.m_pos = orVec3(Vector3d(m_physicsSystem.getParticleSoiParentPos(ship.m_particleBodyId)) - Vector3d(_origin));
+
+      // Coasting ships keep the same orbit; see PhysicsSystem::UpdateParticleDerived
+      uint32_t const orbitVersion = m_physicsSystem.getParticleOrbitVersion(ship.m_particleBodyId);
+      if (ship.m_orbitVersion != orbitVersion) {
+        orbit.m_params = m_physicsSystem.getParticleOsculatingOrbit(ship.m_particleBodyId);
+        ship.m_orbitVersion = orbitVersion;
+      }
+    }
 
 #if 0
     {
@@ -78,12 +94,43 @@ void EntitySystem::updateRenderObjects(double const _dt, const orVec3 _origin)
       RenderSystem::Point& point = m_renderSystem.getPoint(ship.m_pointId);
       point.m_pos = offset_pos;
     }
-  }
+  });
 
   // Update POIs
   // TODO?
 }
 
+void EntitySystem::getShipParticleBodyIds(std::vector< orbital::Id<PhysicsSystem::ParticleBody> >& o_ids) const
+{
+  o_ids.clear();
+  for (uint32_t i = 0; i < ::orbital::id_array::num_objects(m_instancedShips); ++i) {
+    Ship const& ship = ::orbital::id_array::objects(m_instancedShips)[i];
+    o_ids.push_back(ship.m_particleBodyId);
+  }
+}
+
+void EntitySystem::pickShipOrbits(orRay3 const& _ray, std::vector<OrbitPick>& o_picks) const
+{
+  o_picks.clear();
+  for (uint32_t i = 0; i < ::orbital::id_array::num_objects(m_instancedShips); ++i) {
+    Ship const& ship = ::orbital::id_array::objects(m_instancedShips)[i];
+    if (!ship.m_orbitId) { continue; } // Can only pick orbits that are drawn
+
+    orEphemerisHybrid const orbitParams = m_physicsSystem.getParticleOsculatingOrbit(ship.m_particleBodyId);
+
+    OrbitPick pick;
+    pick.m_shipId = ::orbital::id_array::get_id(m_instancedShips, &ship);
+    pick.m_trueAnomaly = findClosestTrueAnomalyToRay(orbitParams, m_physicsSystem.getParticleSoiParentPos(ship.m_particleBodyId), _ray, &pick.m_pos, &pick.m_rayDistance);
+    pick.m_rayDepth = Vector3d(_ray.dir).normalized().dot(Vector3d(pick.m_pos) - Vector3d(_ray.pos));
+
+    // Only need the time for the one point
+    PhysicsSystem::GravBody const& parentGravBody = m_physicsSystem.getGravBody(m_physicsSystem.getParticleSoiParentId(ship.m_particleBodyId));
+    getTimeFromTrueAnomaly(parentGravBody.m_mass, orbitParams, 1, &pick.m_trueAnomaly, &pick.m_time);
+
+    o_picks.push_back(pick);
+  }
+}
+
 void EntitySystem::updateCamTargets(double const _dt, const orVec3 _origin)
 {
   // Update Bodies
@@ -101,10 +148,10 @@ void EntitySystem::updateCamTargets(double const _dt, const orVec3 _origin)
   for (uint32_t i = 0; i < ::orbital::id_array::num_objects(m_instancedShips); ++i) {
     Ship& ship = ::orbital::id_array::objects(m_instancedShips)[i];
 
-    PhysicsSystem::ParticleBody& body = m_physicsSystem.getParticleBody(ship.m_particleBodyId);
+    if (ship.m_cameraTargetId)
     {
       CameraSystem::Target& camTarget = m_cameraSystem.getTarget(ship.m_cameraTargetId);
-      camTarget.m_pos = body.m_pos; // Only RenderSystem objects get the origin shift...is that right?
+      camTarget.m_pos = m_physicsSystem.getParticlePos(ship.m_particleBodyId); // Only RenderSystem objects get the origin shift...is that right?
     }
   }
 
@@ -112,22 +159,39 @@ void EntitySystem::updateCamTargets(double const _dt, const orVec3 _origin)
   // TODO?
 }
 
-void EntitySystem::updateOrbit(
-  PhysicsSystem::Body const& body,
-  PhysicsSystem::GravBody const& parentBody,
-  orEphemerisHybrid& o_params
-) {
-  // TODO will want to just forward-project instead, this is broken with >1 body
-
-  Vector3d const bodyPos(body.m_pos);
-  Vector3d const parentPos(parentBody.m_pos);
+namespace {
+  uint32_t const SNAPSHOT_TAG = orbital::snapshotTag('E', 'N', 'T', 'Y');
+  uint32_t const SNAPSHOT_VERSION = 1;
+}
 
-  Vector3d const bodyVel(body.m_vel);
-  Vector3d const parentVel(parentBody.m_vel);
+void EntitySystem::save(orbital::SnapshotWriter& _writer) const
+{
+  _writer.beginBlock(SNAPSHOT_TAG, SNAPSHOT_VERSION);
+  orbital::writeIdArray(_writer, m_instancedShips);
+  orbital::writeIdArray(_writer, m_instancedBodies);
+  orbital::writeIdArray(_writer, m_instancedPois);
+}
 
-  orEphemerisCartesian cart;
-  cart.pos = bodyPos - parentPos;
-  cart.vel = bodyVel - parentVel;
+bool EntitySystem::check(orbital::SnapshotReader const& _reader) const
+{
+  uint32_t version = 0;
+  orbital::SnapshotReader::Cursor cursor;
+  if (!_reader.findBlock(SNAPSHOT_TAG, &version, &cursor) || version != SNAPSHOT_VERSION) {
+    return false;
+  }
+  return orbital::checkIdArray(cursor, m_instancedShips)
+      && orbital::checkIdArray(cursor, m_instancedBodies)
+      && orbital::checkIdArray(cursor, m_instancedPois);
+}
 
-  ephemerisHybridFromCartesian(cart, parentBody.m_mass, o_params);
-}
\ No newline at end of file
+bool EntitySystem::load(orbital::SnapshotReader const& _reader)
+{
+  uint32_t version = 0;
+  orbital::SnapshotReader::Cursor cursor;
+  if (!_reader.findBlock(SNAPSHOT_TAG, &version, &cursor) || version != SNAPSHOT_VERSION) {
+    return false;
+  }
+  return orbital::readIdArray(cursor, m_instancedShips)
+      && orbital::readIdArray(cursor, m_instancedBodies)
+      && orbital::readIdArray(cursor, m_instancedPois);
+}
@@ -5,6 +5,8 @@
 
 #include "constants.h"
 
+#include <string.h>
+
 // TODO new concept is to have some bodies 'on rails' with their position
 // computed according to the current mean anomaly (this is the parameter than
 // increases at a constant rate with time, the rate is the mean motion 'n')
@@ -57,28 +59,290 @@
 // start earlier than the command horizon
 
 
+PhysicsSystem::PhysicsSystem() :
+  m_stateSerial(1)
+{
+  ortable::Init(&m_particleTable);
+  m_particleColumns.m_pos = ortable::AddAttribute<double>(&m_particleTable, 3);
+  m_particleColumns.m_vel = ortable::AddAttribute<double>(&m_particleTable, 3);
+  m_particleColumns.m_userAcc = ortable::AddAttribute<double>(&m_particleTable, 3);
+  m_particleColumns.m_fixedPos = ortable::AddAttribute<Fixed64>(&m_particleTable, 3);
+  m_particleColumns.m_fixedVel = ortable::AddAttribute<Fixed64>(&m_particleTable, 3);
+  m_particleColumns.m_fixedValid = ortable::AddAttribute<uint8_t>(&m_particleTable, 1);
+
+  ortable::Init(&m_particleDerivedTable);
+  m_particleDerivedColumns.m_serial = ortable::AddAttribute<uint32_t>(&m_particleDerivedTable, 1);
+  m_particleDerivedColumns.m_soiParentId = ortable::AddAttribute< orbital::Id<GravBody> >(&m_particleDerivedTable, 1);
+  m_particleDerivedColumns.m_soiParentPos = ortable::AddAttribute<double>(&m_particleDerivedTable, 3);
+  m_particleDerivedColumns.m_osculatingOrbit = ortable::AddAttribute<double>(&m_particleDerivedTable, OrbitLane_Count);
+  m_particleDerivedColumns.m_orbitValid = ortable::AddAttribute<uint8_t>(&m_particleDerivedTable, 1);
+  m_particleDerivedColumns.m_orbitVersion = ortable::AddAttribute<uint32_t>(&m_particleDerivedTable, 1);
+}
+
+PhysicsSystem::~PhysicsSystem() {
+  ortable::Destroy(&m_particleTable);
+  ortable::Destroy(&m_particleDerivedTable);
+}
+
+orbital::Id<PhysicsSystem::ParticleBody> PhysicsSystem::makeParticleBody() {
+  orbital::Id<ParticleBody> const id = orbital::id_array::add(m_particleBodyIds);
+  size_t const row = ortable::Append(&m_particleTable, 1);
+  ortable::Append(&m_particleDerivedTable, 1); // Zeroed, so not computed yet
+  ensure(row == orbital::id_array::get_idx(m_particleBodyIds, id));
+  return id;
+}
+
+void PhysicsSystem::makeParticleBodies(uint32_t const _count, std::vector< orbital::Id<ParticleBody> >& o_ids) {
+  o_ids.resize(_count);
+  for (uint32_t i = 0; i < _count; ++i) {
+    o_ids[i] = orbital::id_array::add(m_particleBodyIds);
+  }
+  ortable::Append(&m_particleTable, _count);
+  ortable::Append(&m_particleDerivedTable, _count);
+  ensure(ortable::Size(&m_particleTable) == numParticleBodies());
+}
+
+void PhysicsSystem::removeParticleBody(orbital::Id<ParticleBody> const _id) {
+  // Both move the last entry into the hole, so rows stay matched up with dense indices
+  uint32_t const row = orbital::id_array::get_idx(m_particleBodyIds, _id);
+  orbital::id_array::remove(m_particleBodyIds, _id);
+  ortable::SwapRemove(&m_particleTable, row);
+  ortable::SwapRemove(&m_particleDerivedTable, row);
+}
+
+struct PhysicsSystem::ParticleQueue : public orbital::CommandBuffer::Queue {
+  explicit ParticleQueue(PhysicsSystem& _physics) : m_physics(_physics) {}
+
+  virtual void applyMakes() {
+    if (m_makes.empty()) { return; }
+    uint32_t const count = (uint32_t)m_makes.size();
+    orbital::id_array::add_reserved(m_physics.m_particleBodyIds, m_makes.data(), count);
+    size_t const first = ortable::Append(&m_physics.m_particleTable, count);
+    ortable::Append(&m_physics.m_particleDerivedTable, count);
+    ensure(ortable::Size(&m_physics.m_particleTable) == m_physics.numParticleBodies());
+
+    // Lane at a time, rather than a row at a time through the setters
+    ParticleColumns const& columns = m_physics.m_particleColumns;
+    for (int k = 0; k < 3; ++k) {
+      ortable::Span<double> const pos = ortable::Lane(&m_physics.m_particleTable, columns.m_pos, k);
+      ortable::Span<double> const vel = ortable::Lane(&m_physics.m_particleTable, columns.m_vel, k);
+      for (uint32_t i = 0; i < count; ++i) {
+        pos[first + i] = m_makePos[i][k];
+        vel[first + i] = m_makeVel[i][k];
+      }
+    }
+
+    m_makes.clear();
+    m_makePos.clear();
+    m_makeVel.clear();
+  }
+
+  virtual void applyRemoves() {
+    if (m_removes.empty()) { return; }
+    orbital::id_array::remove_batch(m_physics.m_particleBodyIds, m_removes.data(), (uint32_t)m_removes.size(), m_keep);
+    ortable::Compact(&m_physics.m_particleTable, m_keep.data());
+    ortable::Compact(&m_physics.m_particleDerivedTable, m_keep.data());
+    ensure(ortable::Size(&m_physics.m_particleTable) == m_physics.numParticleBodies());
+    m_removes.clear();
+  }
+
+  virtual bool empty() const { return m_makes.empty() && m_removes.empty(); }
+
+  PhysicsSystem& m_physics;
+  std::vector< orbital::Id<ParticleBody> > m_makes;
+  std::vector<orVec3> m_makePos;
+  std::vector<orVec3> m_makeVel;
+  std::vector< orbital::Id<ParticleBody> > m_removes;
+  std::vector<uint8_t> m_keep;
+};
+
+orbital::Id<PhysicsSystem::ParticleBody> PhysicsSystem::makeParticleBodyDeferred(orbital::CommandBuffer& _commands, orVec3 const& _pos, orVec3 const& _vel) {
+  ParticleQueue& queue = _commands.getQueue<ParticleQueue>(&m_particleBodyIds, *this);
+  orbital::Id<ParticleBody> const id = orbital::id_array::reserve_id(m_particleBodyIds);
+  queue.m_makes.push_back(id);
+  queue.m_makePos.push_back(_pos);
+  queue.m_makeVel.push_back(_vel);
+  return id;
+}
+
+void PhysicsSystem::removeParticleBodyDeferred(orbital::CommandBuffer& _commands, orbital::Id<ParticleBody> const _id) {
+  _commands.getQueue<ParticleQueue>(&m_particleBodyIds, *this).m_removes.push_back(_id);
+}
+
+orVec3 PhysicsSystem::getParticleVec3(ortable::Table const& _table, ortable::Column<double> const _column, orbital::Id<ParticleBody> const _id) const {
+  ortable::StridedSpan<double const> const v = ortable::Row(&_table, _column, orbital::id_array::get_idx(m_particleBodyIds, _id));
+  return orVec3(v[0], v[1], v[2]);
+}
+
+void PhysicsSystem::setParticleVec3(ortable::Column<double> const _column, orbital::Id<ParticleBody> const _id, orVec3 const& _v) {
+  ortable::StridedSpan<double> const v = ortable::Row(&m_particleTable, _column, orbital::id_array::get_idx(m_particleBodyIds, _id));
+  for (int k = 0; k < 3; ++k) {
+    v[k] = _v[k];
+  }
+}
+
+void PhysicsSystem::invalidateParticle(orbital::Id<ParticleBody> const _id) {
+  uint32_t const row = orbital::id_array::get_idx(m_particleBodyIds, _id);
+  ortable::Lane(&m_particleTable, m_particleColumns.m_fixedValid, 0)[row] = 0;
+  ortable::Lane(&m_particleDerivedTable, m_particleDerivedColumns.m_serial, 0)[row] = 0;
+  ortable::Lane(&m_particleDerivedTable, m_particleDerivedColumns.m_orbitValid, 0)[row] = 0;
+}
+
+// Thrust changes the orbit; coasting bodies keep theirs. See UpdateParticleDerived.
+void PhysicsSystem::InvalidateThrustingOrbits() {
+  uint32_t const numParticles = numParticleBodies();
+  ortable::Span<uint8_t> const orbitValid = ortable::Lane(&m_particleDerivedTable, m_particleDerivedColumns.m_orbitValid, 0);
+  for (int k = 0; k < 3; ++k) {
+    ortable::Span<double> const userAcc = ortable::Lane(&m_particleTable, m_particleColumns.m_userAcc, k);
+    for (uint32_t i = 0; i < numParticles; ++i) {
+      if (userAcc[i] != 0) { orbitValid[i] = 0; }
+    }
+  }
+}
+
+// Row in m_particleDerivedTable, brought up to date first if needed
+uint32_t PhysicsSystem::derivedParticleRow(orbital::Id<ParticleBody> const _id) const {
+  uint32_t const row = orbital::id_array::get_idx(m_particleBodyIds, _id);
+  if (ortable::Lane(&m_particleDerivedTable, m_particleDerivedColumns.m_serial, 0)[row] != m_stateSerial) {
+    UpdateParticleDerived(row);
+  }
+  return row;
+}
+
+orbital::Id<PhysicsSystem::GravBody> PhysicsSystem::getParticleSoiParentId(orbital::Id<ParticleBody> const _id) const {
+  return ortable::Lane(&m_particleDerivedTable, m_particleDerivedColumns.m_soiParentId, 0)[derivedParticleRow(_id)];
+}
+
+orVec3 PhysicsSystem::getParticleSoiParentPos(orbital::Id<ParticleBody> const _id) const {
+  ortable::StridedSpan<double> const v = ortable::Row(&m_particleDerivedTable, m_particleDerivedColumns.m_soiParentPos, derivedParticleRow(_id));
+  return orVec3(v[0], v[1], v[2]);
+}
+
+orEphemerisHybrid PhysicsSystem::getParticleOsculatingOrbit(orbital::Id<ParticleBody> const _id) const {
+  ortable::StridedSpan<double> const v = ortable::Row(&m_particleDerivedTable, m_particleDerivedColumns.m_osculatingOrbit, derivedParticleRow(_id));
+  orEphemerisHybrid orbit;
+  orbit.p = v[OrbitLane_P];
+  orbit.e = v[OrbitLane_E];
+  orbit.theta = v[OrbitLane_Theta];
+  for (int k = 0; k < 3; ++k) {
+    orbit.x_dir[k] = v[OrbitLane_XDir + k];
+    orbit.y_dir[k] = v[OrbitLane_YDir + k];
+  }
+  return orbit;
+}
+
+uint32_t PhysicsSystem::getParticleOrbitVersion(orbital::Id<ParticleBody> const _id) const {
+  return ortable::Lane(&m_particleDerivedTable, m_particleDerivedColumns.m_orbitVersion, 0)[derivedParticleRow(_id)];
+}
+
+void PhysicsSystem::UpdateParticleDerived(uint32_t const row) const {
+  ortable::StridedSpan<double const> const pos = ortable::Row(&m_particleTable, m_particleColumns.m_pos, row);
+  ortable::StridedSpan<double const> const vel = ortable::Row(&m_particleTable, m_particleColumns.m_vel, row);
+  Vector3d const bodyPos(pos[0], pos[1], pos[2]);
+  Vector3d const bodyVel(vel[0], vel[1], vel[2]);
+
+  GravBody const& parentBody = findSOIGravBody(orVec3(bodyPos));
+  orbital::Id<GravBody> const parentBodyId = orbital::id_array::get_id(m_instancedGravBodies, &parentBody);
+
+  orEphemerisCartesian cart;
+  cart.pos = bodyPos - Vector3d(parentBody.m_pos);
+  cart.vel = bodyVel - Vector3d(parentBody.m_vel);
+
+  orbital::Id<GravBody>& soiParentId = ortable::Lane(&m_particleDerivedTable, m_particleDerivedColumns.m_soiParentId, 0)[row];
+  uint8_t& orbitValid = ortable::Lane(&m_particleDerivedTable, m_particleDerivedColumns.m_orbitValid, 0)[row];
+  ortable::StridedSpan<double> const soiParentPos = ortable::Row(&m_particleDerivedTable, m_particleDerivedColumns.m_soiParentPos, row);
+  ortable::StridedSpan<double> const v = ortable::Row(&m_particleDerivedTable, m_particleDerivedColumns.m_osculatingOrbit, row);
+
+  bool reuseOrbit = orbitValid && soiParentId == parentBodyId;
+  if (reuseOrbit) {
+    // Coasting in the same SOI: only theta has moved on, unless other bodies have pulled it off the conic
+    orEphemerisHybrid orbit;
+    orbit.p = v[OrbitLane_P];
+    orbit.e = v[OrbitLane_E];
+    for (int k = 0; k < 3; ++k) {
+      orbit.x_dir[k] = v[OrbitLane_XDir + k];
+      orbit.y_dir[k] = v[OrbitLane_YDir + k];
+    }
+    double const theta = trueAnomalyOnConic(orbit, cart.pos);
+    double const r = cart.pos.norm();
+    double const expectedR = orbit.p / (1 + orbit.e * cos(theta));
+    double const ORBIT_DRIFT_TOLERANCE = 1e-4; // Fraction of the radius
+    if (fabs(r - expectedR) <= ORBIT_DRIFT_TOLERANCE * r) {
+      v[OrbitLane_Theta] = theta;
+    } else {
+      reuseOrbit = false;
+    }
+  }
+
+  if (!reuseOrbit) {
+    orEphemerisHybrid orbit;
+    ephemerisHybridFromCartesian(cart, parentBody.m_mass, orbit);
+
+    v[OrbitLane_P] = orbit.p;
+    v[OrbitLane_E] = orbit.e;
+    v[OrbitLane_Theta] = orbit.theta;
+    for (int k = 0; k < 3; ++k) {
+      v[OrbitLane_XDir + k] = orbit.x_dir[k];
+      v[OrbitLane_YDir + k] = orbit.y_dir[k];
+    }
+
+    uint32_t& orbitVersion = ortable::Lane(&m_particleDerivedTable, m_particleDerivedColumns.m_orbitVersion, 0)[row];
+    orbitVersion = (orbitVersion == UINT32_MAX) ? 1 : orbitVersion + 1;
+    orbitValid = 1;
+  }
+
+  soiParentId = parentBodyId;
+  for (int k = 0; k < 3; ++k) {
+    soiParentPos[k] = parentBody.m_pos[k];
+  }
+
+  ortable::Lane(&m_particleDerivedTable, m_particleDerivedColumns.m_serial, 0)[row] = m_stateSerial;
+}
+
+void PhysicsSystem::setParticleFixedState(orbital::Id<ParticleBody> const _id, orFixedVec3 const& _pos, orFixedVec3 const& _vel) {
+  uint32_t const row = orbital::id_array::get_idx(m_particleBodyIds, _id);
+  ortable::StridedSpan<Fixed64> const fixedPos = ortable::Row(&m_particleTable, m_particleColumns.m_fixedPos, row);
+  ortable::StridedSpan<Fixed64> const fixedVel = ortable::Row(&m_particleTable, m_particleColumns.m_fixedVel, row);
+  ortable::StridedSpan<double> const pos = ortable::Row(&m_particleTable, m_particleColumns.m_pos, row);
+  ortable::StridedSpan<double> const vel = ortable::Row(&m_particleTable, m_particleColumns.m_vel, row);
+  for (int k = 0; k < 3; ++k) {
+    fixedPos[k] = _pos[k];
+    fixedVel[k] = _vel[k];
+    pos[k] = Fixed64::toDouble(_pos[k]);
+    vel[k] = Fixed64::toDouble(_vel[k]);
+  }
+  ortable::Row(&m_particleTable, m_particleColumns.m_fixedValid, row)[0] = 1;
+  ortable::Lane(&m_particleDerivedTable, m_particleDerivedColumns.m_serial, 0)[row] = 0;
+  ortable::Lane(&m_particleDerivedTable, m_particleDerivedColumns.m_orbitValid, 0)[row] = 0;
+}
+
 void PhysicsSystem::update(IntegrationMethod const integrationMethod, double const t, double const dt) {
+  orbital::FrameArenaScope const arenaScope(orbital::ArenaSystem_Physics);
+
+  InvalidateThrustingOrbits();
+
+  if (integrationMethod == IntegrationMethod_FixedLeapfrog) {
+    UpdateFixed(t, dt);
+    return;
+  }
+
+  // Any other method moves the double state on, so the fixed state needs reloading if we switch back
+  ortable::Span<uint8_t> const fixedValid = ortable::Lane(&m_particleTable, m_particleColumns.m_fixedValid, 0);
+  memset(fixedValid.data, 0, fixedValid.size);
 
   int const numParticles = (int)numParticleBodies();
-  int const stateSize = numParticles;
 
-  // State:
-  // numParticles * particle positions
-  // numParticles * particle velocities
-  Eigen::Array3Xd x_0(3, 2*stateSize);
-  Eigen::Array3Xd x_1;
+  // State: one column per lane
+  // 3 * particle position lanes
+  // 3 * particle velocity lanes
+  Eigen::ArrayXXd x_0(numParticles, 6);
+  Eigen::ArrayXXd x_1;
 
   // Load world state into state array
 
-  int curIdx = 0;
-  for (uint32_t i = 0; i < orbital::id_array::num_objects(m_instancedParticleBodies); ++i, ++curIdx) {
-    Body& body = orbital::id_array::objects(m_instancedParticleBodies)[i];
-    x_0.col(curIdx) = Vector3d(body.m_pos);
-  }
-
-  for (uint32_t i = 0; i < orbital::id_array::num_objects(m_instancedParticleBodies); ++i, ++curIdx) {
-    Body& body = orbital::id_array::objects(m_instancedParticleBodies)[i];
-    x_0.col(curIdx) = Vector3d(body.m_vel);
+  for (int k = 0; k < 3; ++k) {
+    x_0.col(k) = Eigen::Map<Eigen::ArrayXd const>(ortable::Lane(&m_particleTable, m_particleColumns.m_pos, k).data, numParticles);
+    x_0.col(3 + k) = Eigen::Map<Eigen::ArrayXd const>(ortable::Lane(&m_particleTable, m_particleColumns.m_vel, k).data, numParticles);
   }
 
   switch (integrationMethod) {
@@ -89,7 +353,7 @@ void PhysicsSystem::update(IntegrationMethod const integrationMethod, double con
       // Vector3d const p1 = p0 + v0 * dt;
       // Vector3d const v1 = v0 + a0 * dt;
 
-      Eigen::Array3Xd dxdt_0(3, 2*stateSize);
+      Eigen::ArrayXXd dxdt_0(numParticles, 6);
       CalcDxDt(numParticles, t, x_0, dxdt_0);
 
       x_1 = x_0 + dxdt_0 * dt;
@@ -109,14 +373,14 @@ void PhysicsSystem::update(IntegrationMethod const integrationMethod, double con
       // Vector3d const p1 = p0 + .5f * (v0 + vt) * dt;
       // Vector3d const v1 = v0 + .5f * (a0 + at) * dt;
 
-      Eigen::Array3Xd dxdt_0(3, 2*stateSize);
+      Eigen::ArrayXXd dxdt_0(numParticles, 6);
       CalcDxDt(numParticles, t, x_0, dxdt_0);
 
       x_1 = x_0 + dxdt_0 * dt;
 
-      Eigen::Array3Xd x_t = x_0 + dxdt_0 * dt;
+      Eigen::ArrayXXd x_t = x_0 + dxdt_0 * dt;
 
-      Eigen::Array3Xd dxdt_t(3, 2*stateSize);
+      Eigen::ArrayXXd dxdt_t(numParticles, 6);
       CalcDxDt(numParticles, t + dt, x_t, dxdt_t);
 
       x_1 = x_0 + .5 * (dxdt_0 + dxdt_t) * dt;
@@ -124,13 +388,13 @@ void PhysicsSystem::update(IntegrationMethod const integrationMethod, double con
     }
     case IntegrationMethod_RK4: { // Stable up to around 65535x...
 
-      Eigen::Array3Xd k_1(3, 2*stateSize);
+      Eigen::ArrayXXd k_1(numParticles, 6);
       CalcDxDt(numParticles, t,           x_0,                 k_1);
-      Eigen::Array3Xd k_2(3, 2*stateSize);
+      Eigen::ArrayXXd k_2(numParticles, 6);
       CalcDxDt(numParticles, t + .5 * dt, x_0 + k_1 * .5 * dt, k_2);
-      Eigen::Array3Xd k_3(3, 2*stateSize);
+      Eigen::ArrayXXd k_3(numParticles, 6);
       CalcDxDt(numParticles, t + .5 * dt, x_0 + k_2 * .5 * dt, k_3);
-      Eigen::Array3Xd k_4(3, 2*stateSize);
+      Eigen::ArrayXXd k_4(numParticles, 6);
       CalcDxDt(numParticles, t + dt,      x_0 + k_3 * dt,      k_4);
 
       x_1 = x_0 + ((k_1 + 2.0 * k_2 + 2.0 * k_3 + k_4) / 6.0) * dt;
@@ -145,44 +409,229 @@ void PhysicsSystem::update(IntegrationMethod const integrationMethod, double con
 
   // Store world state from array
 
-  curIdx = 0;
-  for (uint32_t i = 0; i < orbital::id_array::num_objects(m_instancedParticleBodies); ++i, ++curIdx) {
-    Body& body = orbital::id_array::objects(m_instancedParticleBodies)[i];
+  for (int k = 0; k < 3; ++k) {
+    Eigen::Map<Eigen::ArrayXd>(ortable::Lane(&m_particleTable, m_particleColumns.m_pos, k).data, numParticles) = x_1.col(k);
+    Eigen::Map<Eigen::ArrayXd>(ortable::Lane(&m_particleTable, m_particleColumns.m_vel, k).data, numParticles) = x_1.col(3 + k);
+  }
 
-    const double* const bodyPos = x_1.col(curIdx).data();
+  // Update grav body state at end of timestep
+  UpdateGravBodies(t+dt);
+}
 
-    body.m_pos[0] = bodyPos[0];
-    body.m_pos[1] = bodyPos[1];
-    body.m_pos[2] = bodyPos[2];
+void PhysicsSystem::UpdateGravBodies(double t) {
+  // Everything moved, so all derived particle data is stale. Skip 0, which means never computed.
+  m_stateSerial = (m_stateSerial == UINT32_MAX) ? 1 : m_stateSerial + 1;
+
+  orbital::Arena::Scope const scratch(orbital::FrameArenas::Get());
+  orbital::FrameVector<orEphemerisCartesian> gravCartesian;
+  CalcGravEphemerisCartesian(t, gravCartesian);
+  for (uint32_t gi = 0; gi < orbital::id_array::num_objects(m_instancedGravBodies); ++gi) {
+    GravBody& gravBody = orbital::id_array::objects(m_instancedGravBodies)[gi];
+    gravBody.m_pos = orVec3(gravCartesian[gi].pos);
+    gravBody.m_vel = orVec3(gravCartesian[gi].vel);
   }
 
-  for (uint32_t i = 0; i < orbital::id_array::num_objects(m_instancedParticleBodies); ++i, ++curIdx) {
-    Body& body = orbital::id_array::objects(m_instancedParticleBodies)[i];
+  // On-rails conics come straight from the elements, which only change over centuries
+  double const ORBIT_REFRESH_TIME = SECONDS_PER_DAY;
+  for (uint32_t gi = 0; gi < orbital::id_array::num_objects(m_instancedGravBodies); ++gi) {
+    GravBody& gravBody = orbital::id_array::objects(m_instancedGravBodies)[gi];
+    if (!gravBody.m_parentBodyId) { continue; }
 
-    const double* const bodyVel = x_1.col(curIdx).data();
+    if (gravBody.m_orbitVersion == 0 || fabs(t - gravBody.m_orbitTime) >= ORBIT_REFRESH_TIME) {
+      ephemerisHybridFromJPL(gravBody.m_ephemeris, t, gravBody.m_orbit);
+      gravBody.m_orbitTime = t;
+      gravBody.m_orbitVersion = (gravBody.m_orbitVersion == UINT32_MAX) ? 1 : gravBody.m_orbitVersion + 1;
+    } else {
+      GravBody const& parentBody = getGravBody(gravBody.m_parentBodyId);
+      gravBody.m_orbit.theta = trueAnomalyOnConic(gravBody.m_orbit, Vector3d(gravBody.m_pos) - Vector3d(parentBody.m_pos));
+    }
+  }
+}
 
-    body.m_vel[0] = bodyVel[0];
-    body.m_vel[1] = bodyVel[1];
-    body.m_vel[2] = bodyVel[2];
+// Deterministic mode. Particle state is kept in 64.64 fixed point and everything that feeds into it
+// (grav body positions, gravity, the integrator) is integer arithmetic, so the same inputs give
+// bit-identical results on any machine or compiler; no FPU modes, FMA contraction or libm differences.
+// Inputs coming in as doubles (dt, t, user accelerations, masses) are converted exactly.
+// Kick-drift-kick leapfrog: symplectic, so no energy drift on long runs, and cheap since the
+// accelerations are the expensive part.
+// Grav bodies' double state (used for display, SOI etc) still comes from the double ephemeris.
+// TODO reuse the end of step acceleration for the start of the next step when dt and thrust are unchanged
+void PhysicsSystem::UpdateFixed(double const t, double const dt) {
+  uint32_t const numParticles = numParticleBodies();
+
+  orbital::Arena::Scope const scratch(orbital::FrameArenas::Get());
+  orbital::FrameVector<orFixedVec3> pos(numParticles);
+  orbital::FrameVector<orFixedVec3> vel(numParticles);
+  ortable::Span<uint8_t> const fixedValid = ortable::Lane(&m_particleTable, m_particleColumns.m_fixedValid, 0);
+  for (int k = 0; k < 3; ++k) {
+    ortable::Span<Fixed64> const fixedPos = ortable::Lane(&m_particleTable, m_particleColumns.m_fixedPos, k);
+    ortable::Span<Fixed64> const fixedVel = ortable::Lane(&m_particleTable, m_particleColumns.m_fixedVel, k);
+    ortable::Span<double> const doublePos = ortable::Lane(&m_particleTable, m_particleColumns.m_pos, k);
+    ortable::Span<double> const doubleVel = ortable::Lane(&m_particleTable, m_particleColumns.m_vel, k);
+    for (uint32_t i = 0; i < numParticles; ++i) {
+      if (!fixedValid[i]) {
+        fixedPos[i] = Fixed64::fromDouble(doublePos[i]);
+        fixedVel[i] = Fixed64::fromDouble(doubleVel[i]);
+      }
+      pos[i][k] = fixedPos[i];
+      vel[i][k] = fixedVel[i];
+    }
   }
+  memset(fixedValid.data, 1, fixedValid.size);
 
-  // Update grav body state at end of timestep
-  std::vector<orEphemerisCartesian> gravCartesian;
-  CalcGravEphemerisCartesian(t+dt, gravCartesian);
+  Fixed64 const h = Fixed64::fromDouble(dt);
+  Fixed64 const half_h = h.scaleBy2(-1);
+
+  orbital::FrameVector<orFixedVec3> gravPos;
+  orbital::FrameVector<orFixedVec3> acc;
+
+  CalcGravPositionsFixed(CalcCenturiesSinceJ2000Fixed(t), gravPos);
+  CalcParticleAccelFixed(gravPos, pos, acc);
+  for (uint32_t i = 0; i < numParticles; ++i) {
+    for (int k = 0; k < 3; ++k) {
+      vel[i][k] += acc[i][k] * half_h;
+      pos[i][k] += vel[i][k] * h;
+    }
+  }
+
+  CalcGravPositionsFixed(CalcCenturiesSinceJ2000Fixed(t + dt), gravPos);
+  CalcParticleAccelFixed(gravPos, pos, acc);
+  for (uint32_t i = 0; i < numParticles; ++i) {
+    for (int k = 0; k < 3; ++k) {
+      vel[i][k] += acc[i][k] * half_h;
+    }
+  }
+
+  for (int k = 0; k < 3; ++k) {
+    ortable::Span<Fixed64> const fixedPos = ortable::Lane(&m_particleTable, m_particleColumns.m_fixedPos, k);
+    ortable::Span<Fixed64> const fixedVel = ortable::Lane(&m_particleTable, m_particleColumns.m_fixedVel, k);
+    ortable::Span<double> const doublePos = ortable::Lane(&m_particleTable, m_particleColumns.m_pos, k);
+    ortable::Span<double> const doubleVel = ortable::Lane(&m_particleTable, m_particleColumns.m_vel, k);
+    for (uint32_t i = 0; i < numParticles; ++i) {
+      fixedPos[i] = pos[i][k];
+      fixedVel[i] = vel[i][k];
+      doublePos[i] = Fixed64::toDouble(pos[i][k]);
+      doubleVel[i] = Fixed64::toDouble(vel[i][k]);
+    }
+  }
+
+  UpdateGravBodies(t+dt);
+}
+
+Fixed64 PhysicsSystem::CalcCenturiesSinceJ2000Fixed(double t) {
+  // Same as in ephemerisCartesianFromJPL, but only the constant offset goes through doubles
+  double const days_at_start = julianDateFromSimTime(0.0) - 2451545.0;
+  Fixed64 const days = Fixed64::fromDouble(days_at_start) + Fixed64::fromDouble(t).divInt((int64_t)SECONDS_PER_DAY);
+  return days.divInt((int64_t)DAYS_PER_CENTURY);
+}
+
+void PhysicsSystem::CalcGravPositionsFixed(Fixed64 t_C, orbital::FrameVector<orFixedVec3>& out) {
+  out.resize(orbital::id_array::num_objects(m_instancedGravBodies));
   for (uint32_t gi = 0; gi < orbital::id_array::num_objects(m_instancedGravBodies); ++gi) {
     GravBody& gravBody = orbital::id_array::objects(m_instancedGravBodies)[gi];
-    gravBody.m_pos = orVec3(gravCartesian[gi].pos);
-    gravBody.m_vel = orVec3(gravCartesian[gi].vel);
+    ephemerisPositionFromJPLFixed(gravBody.m_ephemeris, t_C, out[gi]);
+    if (gravBody.m_parentBodyId) {
+      uint32_t pi = orbital::id_array::get_idx(m_instancedGravBodies, gravBody.m_parentBodyId);
+      ensure(pi < gi);
+      for (int k = 0; k < 3; ++k) {
+        out[gi][k] += out[pi][k];
+      }
+    }
   }
 }
 
-PhysicsSystem::GravBody const& PhysicsSystem::findSOIGravBody(ParticleBody const& _body) const {
+void PhysicsSystem::CalcParticleAccelFixed(orbital::FrameVector<orFixedVec3> const& gravPos, orbital::FrameVector<orFixedVec3> const& pos, orbital::FrameVector<orFixedVec3>& o_a) {
+  uint32_t const numParticles = numParticleBodies();
+  uint32_t const numGrav = orbital::id_array::num_objects(m_instancedGravBodies);
+
+  o_a.resize(numParticles);
+
+  ortable::Span<double> userAcc[3];
+  for (int k = 0; k < 3; ++k) {
+    userAcc[k] = ortable::Lane(&m_particleTable, m_particleColumns.m_userAcc, k);
+  }
+
+  for (uint32_t pi = 0; pi < numParticles; ++pi) {
+    orFixedVec3 a = orFixedVec3::fromVec3(orVec3(userAcc[0][pi], userAcc[1][pi], userAcc[2][pi]));
+
+    for (uint32_t gi = 0; gi < numGrav; ++gi) {
+      GravBody const& gravBody = orbital::id_array::objects(m_instancedGravBodies)[gi];
+
+      orFixedVec3 r;
+      for (int k = 0; k < 3; ++k) {
+        r[k] = gravPos[gi][k] - pos[pi][k];
+      }
+
+      // Squaring interplanetary distances in meters would overflow the integer part, so scale r down
+      // by a power of two until it's around 2^16, then scale mu to match:
+      // a = mu * r / |r|^3 = (mu * 2^-2s) * r_s / |r_s|^3 where r = r_s * 2^s
+      int64_t maxComponent = 0;
+      for (int k = 0; k < 3; ++k) {
+        maxComponent = std::max(maxComponent, Fixed64::toInt(r[k].abs()));
+      }
+      int shift = 0;
+      while ((maxComponent >> shift) >= (1 << 16)) { ++shift; }
+      for (int k = 0; k < 3; ++k) {
+        r[k] = r[k].scaleBy2(-shift);
+      }
+
+      Fixed64 const r_mag_sq = r[0] * r[0] + r[1] * r[1] + r[2] * r[2];
+      if (r_mag_sq.isZero()) { continue; } // At the center of the body
+
+      // Multiplying a double by a power of two is exact, so this is deterministic too.
+      // Only overflows if we're practically at the center of the Sun.
+      double const mu = GRAV_CONSTANT * gravBody.m_mass;
+      double const muScaled = std::min(ldexp(mu, -2 * shift), ldexp(1.0, 62));
+      Fixed64 const r_mag = Fixed64::sqrt(r_mag_sq);
+      Fixed64 const k = (Fixed64::fromDouble(muScaled) / r_mag_sq) / r_mag;
+
+      for (int c = 0; c < 3; ++c) {
+        a[c] += r[c] * k;
+      }
+    }
+
+    o_a[pi] = a;
+  }
+}
+
+uint64_t PhysicsSystem::stateHash() const {
+  uint64_t hash = 14695981039346656037ULL;
+  uint64_t const prime = 1099511628211ULL;
+  ortable::Span<uint8_t const> const fixedValid = ortable::Lane(&m_particleTable, m_particleColumns.m_fixedValid, 0);
+  for (uint32_t i = 0; i < numParticleBodies(); ++i) {
+    uint64_t words[12];
+    for (int k = 0; k < 3; ++k) {
+      if (fixedValid[i]) {
+        Fixed64 const& fixedPos = ortable::Lane(&m_particleTable, m_particleColumns.m_fixedPos, k)[i];
+        Fixed64 const& fixedVel = ortable::Lane(&m_particleTable, m_particleColumns.m_fixedVel, k)[i];
+        words[2*k]     = (uint64_t)fixedPos.getIntegralPart();
+        words[2*k + 1] = fixedPos.getFractionalPart();
+        words[6 + 2*k]     = (uint64_t)fixedVel.getIntegralPart();
+        words[6 + 2*k + 1] = fixedVel.getFractionalPart();
+      } else {
+        memcpy(&words[2*k], &ortable::Lane(&m_particleTable, m_particleColumns.m_pos, k)[i], sizeof(double));
+        words[2*k + 1] = 0;
+        memcpy(&words[6 + 2*k], &ortable::Lane(&m_particleTable, m_particleColumns.m_vel, k)[i], sizeof(double));
+        words[6 + 2*k + 1] = 0;
+      }
+    }
+    for (int w = 0; w < 12; ++w) {
+      for (int b = 0; b < 8; ++b) {
+        hash ^= (words[w] >> (8 * b)) & 0xff;
+        hash *= prime;
+      }
+    }
+  }
+  return hash;
+}
+
+PhysicsSystem::GravBody const& PhysicsSystem::findSOIGravBody(orVec3 const& _pos) const {
   // TODO HACK
   // SOI really requires each body to have a "parent body" for the SOI computation.
   // At the moment we hack in the parent for all grav bodies...
   ensure(numGravBodies() > 0);
 
-  Vector3d const bodyPos(_body.m_pos);
+  Vector3d const bodyPos(_pos);
 
   double minDist = DBL_MAX;
   int minDistIdx = 0;
@@ -219,27 +668,31 @@ PhysicsSystem::GravBody const& PhysicsSystem::findSOIGravBody(ParticleBody const
   return orbital::id_array::objects(m_instancedGravBodies)[minDistIdx];
 }
 
+orbital::Id<PhysicsSystem::GravBody> PhysicsSystem::findSOIGravBodyId(orVec3 const& _pos) const {
+  return orbital::id_array::get_id(m_instancedGravBodies, &findSOIGravBody(_pos));
+}
+
 void PhysicsSystem::CalcDxDt(
   int numParticles,
   double t,
-  Eigen::Array3Xd const& x0, // initial states (pos+vel)
-  Eigen::Array3Xd& dxdt0 // output, rate of change in state
+  Eigen::ArrayXXd const& x0, // initial states (pos xyz lanes, vel xyz lanes)
+  Eigen::ArrayXXd& dxdt0 // output, rate of change in state
 ) {
   // State: positions, velocities
   // DStateDt: velocities, accelerations
-  dxdt0.block(0, 0, 3, numParticles) = x0.block(0, numParticles, 3, numParticles);
-  CalcAccel(t, numParticles, x0.block(0, 0, 3, numParticles), dxdt0.block(0, numParticles, 3, numParticles));
+  dxdt0.leftCols(3) = x0.rightCols(3);
+  CalcAccel(t, numParticles, x0.leftCols(3), dxdt0.rightCols(3));
 }
 
 template< class P, class OA >
 void PhysicsSystem::CalcAccel(
   double t,
   int numParticles,
-  P const& p, // position for each body
+  P const& p, // position for each body, one column per lane
   OA /* would be & but doesn't work with temporary from Eigen's .block() */ o_a // output, accelerations
 )
 {
-  CalcParticleAccel(t, numParticles, p.block(0, 0, 3, numParticles), o_a.block(0, 0, 3, numParticles));
+  CalcParticleAccel(t, numParticles, p.topRows(numParticles), o_a.topRows(numParticles));
 }
 
 template< class PP, class OA >
@@ -254,46 +707,55 @@ void PhysicsSystem::CalcParticleAccel(
   CalcParticleUserAcc(numParticles, o_a);
 }
 
-// Calculates acceleration on first body by second body
-// TODO make this make sense again. Vectorise better?
+// Gravity from each grav body on all particles at once, a lane at a time.
+// TODO particles that are very close to a grav body's center will blow up, as before
 template< class PP, class OA >
 void PhysicsSystem::CalcParticleGrav(double t, int numParticles, PP const& pp, OA /* would be & but doesn't work with temporary from Eigen's .block() */ o_a)
 {
   double const G = GRAV_CONSTANT;
-  
-  std::vector<orEphemerisCartesian> gravCartesian;
+
+  orbital::Arena& arena = orbital::FrameArenas::Get();
+  orbital::Arena::Scope const scratch(arena);
+
+  orbital::FrameVector<orEphemerisCartesian> gravCartesian;
   CalcGravEphemerisCartesian(t, gravCartesian);
 
-  for (uint32_t pi = 0; pi < orbital::id_array::num_objects(m_instancedParticleBodies); ++pi) {
-    Vector3d a(0.0, 0.0, 0.0);
-    for (uint32_t gi = 0; gi < orbital::id_array::num_objects(m_instancedGravBodies); ++gi) {
-      GravBody& gravBody = orbital::id_array::objects(m_instancedGravBodies)[gi];
-      double const M = gravBody.m_mass;
+  // Lane temporaries, reused for each grav body
+  Eigen::Map<Eigen::ArrayXd> rx(arena.allocArray<double>(numParticles), numParticles);
+  Eigen::Map<Eigen::ArrayXd> ry(arena.allocArray<double>(numParticles), numParticles);
+  Eigen::Map<Eigen::ArrayXd> rz(arena.allocArray<double>(numParticles), numParticles);
+  Eigen::Map<Eigen::ArrayXd> r_mag_sq(arena.allocArray<double>(numParticles), numParticles);
+  Eigen::Map<Eigen::ArrayXd> k(arena.allocArray<double>(numParticles), numParticles);
 
-      double const mu = M * G;
+  o_a.setZero();
+  for (uint32_t gi = 0; gi < orbital::id_array::num_objects(m_instancedGravBodies); ++gi) {
+    GravBody& gravBody = orbital::id_array::objects(m_instancedGravBodies)[gi];
+    double const M = gravBody.m_mass;
 
-      // Calc acceleration due to gravity
-      Vector3d const r = gravCartesian[gi].pos - Vector3d(pp.col(pi));
-      double const r_mag = r.norm();
+    double const mu = M * G;
 
-      Vector3d const r_dir = r / r_mag;
+    // Calc acceleration due to gravity: mu * r / |r|^3
+    rx = gravCartesian[gi].pos[0] - pp.col(0);
+    ry = gravCartesian[gi].pos[1] - pp.col(1);
+    rz = gravCartesian[gi].pos[2] - pp.col(2);
+    r_mag_sq = rx.square() + ry.square() + rz.square();
+    k = mu / (r_mag_sq * r_mag_sq.sqrt());
 
-      Vector3d const a_grav = r_dir * mu / (r_mag * r_mag);
-      a += a_grav;
-    }
-    o_a.col(pi) = a;
+    o_a.col(0) += rx * k;
+    o_a.col(1) += ry * k;
+    o_a.col(2) += rz * k;
   }
 }
 
 template< class OA >
 void PhysicsSystem::CalcParticleUserAcc(int numParticles, OA /* would be & but doesn't work with temporary from Eigen's .block() */ o_a)
 {
-  for (uint32_t pi = 0; pi < orbital::id_array::num_objects(m_instancedParticleBodies); ++pi) {
-    o_a.col(pi) += Eigen::Array<double, 3, 1>(orbital::id_array::objects(m_instancedParticleBodies)[pi].m_userAcc.data);
+  for (int k = 0; k < 3; ++k) {
+    o_a.col(k) += Eigen::Map<Eigen::ArrayXd const>(ortable::Lane(&m_particleTable, m_particleColumns.m_userAcc, k).data, numParticles);
   }
 }
 
-void PhysicsSystem::CalcGravEphemerisCartesian(double t, std::vector<orEphemerisCartesian>& out)
+void PhysicsSystem::CalcGravEphemerisCartesian(double t, orbital::FrameVector<orEphemerisCartesian>& out)
 {
   out.resize(orbital::id_array::num_objects(m_instancedGravBodies));
   for (uint32_t gi = 0; gi < orbital::id_array::num_objects(m_instancedGravBodies); ++gi) {
@@ -308,4 +770,52 @@ void PhysicsSystem::CalcGravEphemerisCartesian(double t, std::vector<orEphemeris
       out[gi].vel += out[pi].vel;
     }
   }
-}
\ No newline at end of file
+}
+
+namespace {
+  uint32_t const SNAPSHOT_TAG = orbital::snapshotTag('P', 'H', 'Y', 'S');
+  uint32_t const SNAPSHOT_VERSION = 1;
+}
+
+void PhysicsSystem::save(orbital::SnapshotWriter& _writer) const {
+  _writer.beginBlock(SNAPSHOT_TAG, SNAPSHOT_VERSION);
+  orbital::writeIdArray(_writer, m_instancedGravBodies);
+  orbital::writeIdArray(_writer, m_particleBodyIds);
+  orbital::writeTable(_writer, m_particleTable);
+}
+
+bool PhysicsSystem::check(orbital::SnapshotReader const& _reader) const {
+  uint32_t version = 0;
+  orbital::SnapshotReader::Cursor cursor;
+  if (!_reader.findBlock(SNAPSHOT_TAG, &version, &cursor) || version != SNAPSHOT_VERSION) {
+    return false;
+  }
+  uint32_t numParticles = 0;
+  size_t numRows = 0;
+  return orbital::checkIdArray(cursor, m_instancedGravBodies)
+      && orbital::checkIdArray(cursor, m_particleBodyIds, &numParticles)
+      && orbital::checkTable(cursor, m_particleTable, &numRows)
+      && numRows == numParticles;
+}
+
+bool PhysicsSystem::load(orbital::SnapshotReader const& _reader) {
+  uint32_t version = 0;
+  orbital::SnapshotReader::Cursor cursor;
+  if (!_reader.findBlock(SNAPSHOT_TAG, &version, &cursor) || version != SNAPSHOT_VERSION) {
+    return false;
+  }
+  if (!orbital::readIdArray(cursor, m_instancedGravBodies)
+   || !orbital::readIdArray(cursor, m_particleBodyIds)
+   || !orbital::readTable(cursor, m_particleTable)
+   || ortable::Size(&m_particleTable) != numParticleBodies()) {
+    return false;
+  }
+
+  // Zeroed rows are "not computed yet"
+  if (ortable::Size(&m_particleDerivedTable) > 0) {
+    ortable::Clear(&m_particleDerivedTable);
+  }
+  ortable::Append(&m_particleDerivedTable, numParticleBodies());
+  ++m_stateSerial;
+  return true;
+}
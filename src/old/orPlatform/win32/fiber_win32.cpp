@@ -0,0 +1,55 @@
+#include "orPlatform/win32/fiber_win32.h"
+
+#include <Windows.h>
+
+namespace {
+  VOID CALLBACK fiberStart(LPVOID _param) {
+    orPlatform::Fiber* const fiber = static_cast<orPlatform::Fiber*>(_param);
+    fiber->fn(fiber->userData);
+  }
+} // namespace
+
+orPlatform::Fiber* orPlatform::convertThreadToFiber() {
+  Fiber* const fiber = new Fiber();
+  fiber->fn = NULL;
+  fiber->userData = NULL;
+  if (::IsThreadAFiber()) {
+    // Someone else converted it, so they get to convert it back
+    fiber->handle = ::GetCurrentFiber();
+    fiber->ownsThread = false;
+  } else {
+    fiber->handle = ::ConvertThreadToFiber(NULL);
+    fiber->ownsThread = true;
+  }
+  return fiber;
+}
+
+void orPlatform::convertFiberToThread(Fiber* const _fiber) {
+  if (_fiber->ownsThread) {
+    ::ConvertFiberToThread();
+  }
+  delete _fiber;
+}
+
+// Windows commits the stack as it's used, with its own guard page
+orPlatform::Fiber* orPlatform::createFiber(size_t const _stackSize, FiberFn* const _fn, void* const _userData) {
+  Fiber* const fiber = new Fiber();
+  fiber->ownsThread = false;
+  fiber->fn = _fn;
+  fiber->userData = _userData;
+  fiber->handle = ::CreateFiber(_stackSize, &fiberStart, fiber);
+  if (!fiber->handle) {
+    delete fiber;
+    return NULL;
+  }
+  return fiber;
+}
+
+void orPlatform::deleteFiber(Fiber* const _fiber) {
+  ::DeleteFiber(_fiber->handle);
+  delete _fiber;
+}
+
+void orPlatform::switchToFiber(Fiber* const /*_from*/, Fiber* const _to) {
+  ::SwitchToFiber(_to->handle);
+}
@@ -0,0 +1,62 @@
+#include "orPlatform/win32/file_win32.h"
+
+#include <Windows.h>
+
+#include <string>
+
+bool orPlatform::writeFileGather(char const* const _path, FilePiece const* const _pieces, size_t const _count) {
+  std::string const tmpPath = std::string(_path) + ".tmp";
+  HANDLE const file = ::CreateFileA(tmpPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE) { return false; }
+
+  // WriteFileGather wants page aligned, page sized buffers, so just write each piece
+  bool ok = true;
+  for (size_t i = 0; ok && i < _count; ++i) {
+    char const* data = static_cast<char const*>(_pieces[i].data);
+    size_t left = _pieces[i].size;
+    while (ok && left > 0) {
+      DWORD const chunk = (left > 0x40000000) ? 0x40000000 : (DWORD)left;
+      DWORD written = 0;
+      ok = ::WriteFile(file, data, chunk, &written, NULL) != 0;
+      data += written;
+      left -= written;
+    }
+  }
+
+  ok = (::CloseHandle(file) != 0) && ok;
+  if (ok) {
+    ok = ::MoveFileExA(tmpPath.c_str(), _path, MOVEFILE_REPLACE_EXISTING) != 0;
+  }
+  if (!ok) {
+    ::DeleteFileA(tmpPath.c_str());
+  }
+  return ok;
+}
+
+bool orPlatform::mapFile(char const* const _path, MappedFile* const o_file) {
+  HANDLE const file = ::CreateFileA(_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) { return false; }
+
+  LARGE_INTEGER size;
+  void* p = NULL;
+  if (::GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+    HANDLE const mapping = ::CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping) {
+      p = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      ::CloseHandle(mapping); // The view keeps the mapping alive
+    }
+  }
+  ::CloseHandle(file);
+  if (!p) { return false; }
+  o_file->data = p;
+  o_file->size = (size_t)size.QuadPart;
+  return true;
+}
+
+void orPlatform::unmapFile(MappedFile* const _file) {
+  if (_file->data) {
+    ::UnmapViewOfFile(_file->data);
+  }
+  _file->data = NULL;
+  _file->size = 0;
+}
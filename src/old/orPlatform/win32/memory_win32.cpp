@@ -0,0 +1,21 @@
+#include "orPlatform/win32/memory_win32.h"
+
+#include <Windows.h>
+
+size_t orPlatform::memoryPageSize() {
+  SYSTEM_INFO info;
+  ::GetSystemInfo(&info);
+  return (size_t)info.dwPageSize;
+}
+
+void* orPlatform::reserveMemory(size_t const _size) {
+  return ::VirtualAlloc(NULL, _size, MEM_RESERVE, PAGE_NOACCESS);
+}
+
+bool orPlatform::commitMemory(void* const _p, size_t const _size) {
+  return ::VirtualAlloc(_p, _size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+}
+
+void orPlatform::releaseMemory(void* const _p, size_t const /*_size*/) {
+  ::VirtualFree(_p, 0, MEM_RELEASE);
+}
@@ -0,0 +1,71 @@
+#include "orPlatform/win32/topology_win32.h"
+
+#include <Windows.h>
+
+#include <algorithm>
+
+namespace {
+  bool lessByPlacement(orPlatform::CpuInfo const& _a, orPlatform::CpuInfo const& _b) {
+    if (_a.node != _b.node) { return _a.node < _b.node; }
+    if (_a.package != _b.package) { return _a.package < _b.package; }
+    if (_a.cache != _b.cache) { return _a.cache < _b.cache; }
+    if (_a.core != _b.core) { return _a.core < _b.core; }
+    return _a.cpu < _b.cpu;
+  }
+} // namespace
+
+// Only sees the first processor group (64 CPUs), same as SetThreadAffinityMask
+bool orPlatform::getCpuTopology(std::vector<CpuInfo>* const o_cpus) {
+  o_cpus->clear();
+
+  DWORD_PTR processMask = 0;
+  DWORD_PTR systemMask = 0;
+  if (!::GetProcessAffinityMask(::GetCurrentProcess(), &processMask, &systemMask)) { return false; }
+
+  DWORD size = 0;
+  ::GetLogicalProcessorInformation(NULL, &size);
+  std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(size / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+  if (infos.empty() || !::GetLogicalProcessorInformation(infos.data(), &size)) { return false; }
+
+  int const numCpus = (int)(sizeof(DWORD_PTR) * 8);
+  std::vector<CpuInfo> cpus(numCpus);
+  for (int cpu = 0; cpu < numCpus; ++cpu) {
+    // Anything not mentioned (e.g. no L3) counts as shared by all
+    CpuInfo const info = { cpu, -1, 0, 0, 0 };
+    cpus[cpu] = info;
+  }
+
+  // Each relationship lists the CPUs it covers; number them in the order they come
+  int numCores = 0, numCaches = 0, numNodes = 0, numPackages = 0;
+  for (size_t i = 0; i < infos.size(); ++i) {
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION const& info = infos[i];
+    int CpuInfo::* field = NULL;
+    int id = 0;
+    switch (info.Relationship) {
+      case RelationProcessorCore: field = &CpuInfo::core; id = numCores++; break;
+      case RelationCache: if (info.Cache.Level == 3) { field = &CpuInfo::cache; id = numCaches++; } break;
+      case RelationNumaNode: field = &CpuInfo::node; id = numNodes++; break;
+      case RelationProcessorPackage: field = &CpuInfo::package; id = numPackages++; break;
+      default: break;
+    }
+    if (!field) { continue; }
+    for (int cpu = 0; cpu < numCpus; ++cpu) {
+      if (info.ProcessorMask & ((ULONG_PTR)1 << cpu)) {
+        cpus[cpu].*field = id;
+      }
+    }
+  }
+
+  for (int cpu = 0; cpu < numCpus; ++cpu) {
+    if (!(processMask & ((DWORD_PTR)1 << cpu))) { continue; }
+    if (cpus[cpu].core < 0) { cpus[cpu].core = numCores++; }
+    o_cpus->push_back(cpus[cpu]);
+  }
+
+  std::sort(o_cpus->begin(), o_cpus->end(), &lessByPlacement);
+  return !o_cpus->empty();
+}
+
+bool orPlatform::pinCurrentThread(int const _cpu) {
+  return ::SetThreadAffinityMask(::GetCurrentThread(), (DWORD_PTR)1 << _cpu) != 0;
+}
@@ -0,0 +1,101 @@
+#include "orStd.h"
+
+#include "orProfile/gpuTimer.h"
+
+#include "orGfx.h"
+#include "orRender.h" // For GL_CHECK
+
+GpuTimers::GpuTimers() :
+  m_enabled(false),
+  m_frameIdx(0),
+  m_ticksPerNano(0),
+  m_log(NULL)
+{
+  for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+    m_frames[i].numTimers = 0;
+  }
+}
+
+void GpuTimers::init()
+{
+  m_enabled = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+  if (!m_enabled) {
+    orLog("No GL timer queries; GPU times won't be recorded\n");
+    return;
+  }
+
+  for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+    GL_CHECK(glGenQueries(MAX_TIMERS * 2, m_frames[i].queries));
+    m_frames[i].numTimers = 0;
+  }
+  // PerfTimeToMillis() is only float; fine for the scale
+  m_ticksPerNano = 1e9 / (1e6 * (double)Timer::PerfTimeToMillis(1000000000));
+  m_log = PerfTimer::AddLog("GPU");
+}
+
+void GpuTimers::shutdown()
+{
+  if (!m_enabled) {
+    return;
+  }
+  for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+    GL_CHECK(glDeleteQueries(MAX_TIMERS * 2, m_frames[i].queries));
+  }
+  m_enabled = false;
+}
+
+int GpuTimers::begin(PerfTimer::Id const _id)
+{
+  Frame& frame = m_frames[m_frameIdx % FRAMES_IN_FLIGHT];
+  if (!m_enabled || frame.numTimers == MAX_TIMERS) {
+    return -1;
+  }
+  int const timer = frame.numTimers++;
+  frame.ids[timer] = _id;
+  GL_CHECK(glQueryCounter(frame.queries[timer * 2], GL_TIMESTAMP));
+  return timer;
+}
+
+void GpuTimers::end(int const _timer)
+{
+  if (_timer < 0) {
+    return;
+  }
+  Frame& frame = m_frames[m_frameIdx % FRAMES_IN_FLIGHT];
+  GL_CHECK(glQueryCounter(frame.queries[_timer * 2 + 1], GL_TIMESTAMP));
+}
+
+void GpuTimers::endFrame()
+{
+  if (!m_enabled) {
+    return;
+  }
+
+  // The oldest frame, which we're about to reuse
+  ++m_frameIdx;
+  Frame& frame = m_frames[m_frameIdx % FRAMES_IN_FLIGHT];
+  if (frame.numTimers == 0) {
+    return;
+  }
+
+  // Commands complete in order, so if the last is done they all are
+  GLint available = 0;
+  GL_CHECK(glGetQueryObjectiv(frame.queries[frame.numTimers * 2 - 1], GL_QUERY_RESULT_AVAILABLE, &available));
+  if (available) {
+    // Line the GPU's clock up with ours; it only has to be close enough to read a trace by
+    GLint64 gpuNow = 0;
+    GL_CHECK(glGetInteger64v(GL_TIMESTAMP, &gpuNow));
+    Timer::PerfTime const cpuNow = Timer::GetPerfTime();
+
+    for (int i = 0; i < frame.numTimers; ++i) {
+      GLuint64 gpuTimes[2];
+      for (int j = 0; j < 2; ++j) {
+        GL_CHECK(glGetQueryObjectui64v(frame.queries[i * 2 + j], GL_QUERY_RESULT, &gpuTimes[j]));
+      }
+      Timer::PerfTime const start = cpuNow - (Timer::PerfTime)(((double)gpuNow - (double)gpuTimes[0]) * m_ticksPerNano);
+      Timer::PerfTime const end = cpuNow - (Timer::PerfTime)(((double)gpuNow - (double)gpuTimes[1]) * m_ticksPerNano);
+      PerfTimer::Record(*m_log, frame.ids[i], start, end);
+    }
+  }
+  frame.numTimers = 0;
+}
@@ -1,10 +1,352 @@
 #include "orStd.h"
 
 #include "orProfile/perftimer.h"
+#include "orProfile/traceExport.h"
 
-std::stack<PerfTimer::Entry*> PerfTimer::s_stack;
-PerfTimer::Entry PerfTimer::s_parent;
-Timer::PerfTime PerfTimer::s_startTime;
+#include "boost_begin.h"
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include "boost_end.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace {
+
+uint32_t const MAX_NAMES = 1024;
+uint32_t const RING_SIZE = 1 << 14; // Spans per thread; plenty for a frame
+uint32_t const RING_MASK = RING_SIZE - 1;
+
+// Only Intern() writes these, under the lock; an id is published to other threads by whatever
+// publishes the code that uses it (the call site's static), so Name() doesn't need it
+boost::mutex s_namesMutex;
+char const* s_names[MAX_NAMES] = { "(too many names)" };
+uint32_t s_numNames = 1;
+
+} // namespace
+
+struct PerfTimer::ThreadLog
+{
+  explicit ThreadLog(std::string const& _name) :
+    name(_name),
+    started(0),
+    committed(0),
+    read(0),
+    dropped(0),
+    root()
+  {
+  }
+
+  // Relaxed atomics, so Collect() can read a span while the thread overwrites it and then throw it
+  // away, without it being a data race. They're plain moves on x86.
+  struct Span
+  {
+    std::atomic<Timer::PerfTime> start;
+    std::atomic<Timer::PerfTime> end;
+    std::atomic<uint32_t> arg;
+    std::atomic<Id> id;
+    std::atomic<uint8_t> kind;
+  };
+
+  std::string name; // Under the registry lock
+
+  Span spans[RING_SIZE];
+  // Only the thread writes these. A span is being written from when started passes it until
+  // committed does.
+  std::atomic<uint64_t> started;
+  std::atomic<uint64_t> committed;
+
+  // Only Collect()
+  uint64_t read;
+  uint64_t dropped; // Overwritten before they were collected
+  Entry root; // time is the time profiled, set by StaticShutdown()
+};
+
+namespace {
+
+// Every thread's log, for Collect()
+boost::mutex s_registryMutex;
+std::vector<PerfTimer::ThreadLog*>* s_registry = NULL;
+
+thread_local PerfTimer::ThreadLog* s_threadLog = NULL;
+
+Timer::PerfTime s_startTime;
+Timer::PerfTime s_lastCollectTime = 0;
+
+// Under the registry lock. A requested capture starts at the end of the next Collect(), so it
+// covers whole frames.
+uint32_t s_captureRequestFrames = 0;
+std::string s_captureRequestPath;
+TraceExport::Capture* s_capture = NULL;
+uint32_t s_captureFramesLeft = 0;
+uint32_t s_captureFrames = 0;
+
+// What Collect() copies out of a ring; kept to save allocating every frame
+struct CollectedSpan
+{
+  Timer::PerfTime start;
+  Timer::PerfTime end;
+  uint32_t arg;
+  PerfTimer::Id id;
+  uint8_t kind;
+};
+std::vector<CollectedSpan> s_collected;
+std::vector< std::pair<Timer::PerfTime, PerfTimer::Entry*> > s_open; // (end, entry) of the enclosing spans
+
+// Starting first, and of those the longest, so parents come before their children
+bool spanOrder(CollectedSpan const& _a, CollectedSpan const& _b)
+{
+  return (_a.start != _b.start) ? (_a.start < _b.start) : (_a.end > _b.end);
+}
+
+} // namespace
+
+std::atomic<bool> PerfTimer::s_capturing(false);
+
+PerfTimer::Id PerfTimer::Intern(char const* const _name)
+{
+  boost::lock_guard<boost::mutex> lock(s_namesMutex);
+  for (uint32_t i = 1; i < s_numNames; ++i) {
+    if (strcmp(s_names[i], _name) == 0) {
+      return (Id)i;
+    }
+  }
+  if (s_numNames == MAX_NAMES) {
+    ensure(false, "Too many PerfTimer names");
+    return 0;
+  }
+  s_names[s_numNames] = _name;
+  return (Id)s_numNames++;
+}
+
+char const* PerfTimer::Name(Id const _id)
+{
+  return s_names[_id];
+}
+
+PerfTimer::ThreadLog& PerfTimer::GetThreadLog()
+{
+  if (s_threadLog == NULL) {
+    boost::lock_guard<boost::mutex> lock(s_registryMutex);
+    if (s_registry == NULL) {
+      s_registry = new std::vector<ThreadLog*>();
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "Thread %u", (uint32_t)s_registry->size());
+    s_threadLog = new ThreadLog(name);
+    s_registry->push_back(s_threadLog);
+  }
+  return *s_threadLog;
+}
+
+void PerfTimer::NameThread(char const* const _name)
+{
+  ThreadLog& log = GetThreadLog();
+  boost::lock_guard<boost::mutex> lock(s_registryMutex);
+  log.name = _name;
+}
+
+PerfTimer::ThreadLog* PerfTimer::AddLog(char const* const _name)
+{
+  boost::lock_guard<boost::mutex> lock(s_registryMutex);
+  if (s_registry == NULL) {
+    s_registry = new std::vector<ThreadLog*>();
+  }
+  ThreadLog* const log = new ThreadLog(_name);
+  s_registry->push_back(log);
+  return log;
+}
+
+void PerfTimer::Record(Id const _id, Timer::PerfTime const _start, Timer::PerfTime const _end, SpanKind const _kind, uint32_t const _arg)
+{
+  Record(GetThreadLog(), _id, _start, _end, _kind, _arg);
+}
+
+void PerfTimer::Record(ThreadLog& _log, Id const _id, Timer::PerfTime const _start, Timer::PerfTime const _end, SpanKind const _kind, uint32_t const _arg)
+{
+  uint64_t const idx = _log.started.load(std::memory_order_relaxed);
+  // Claim the slot before overwriting it, so Collect() can tell if it read it half written
+  _log.started.store(idx + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  ThreadLog::Span& span = _log.spans[idx & RING_MASK];
+  span.start.store(_start, std::memory_order_relaxed);
+  span.end.store(_end, std::memory_order_relaxed);
+  span.arg.store(_arg, std::memory_order_relaxed);
+  span.id.store(_id, std::memory_order_relaxed);
+  span.kind.store((uint8_t)_kind, std::memory_order_relaxed);
+
+  _log.committed.store(idx + 1, std::memory_order_release);
+}
+
+void PerfTimer::StaticInit()
+{
+  s_startTime = Timer::GetPerfTime();
+  s_lastCollectTime = s_startTime;
+  NameThread("Main");
+}
+
+void PerfTimer::StartCapture(uint32_t const _numFrames, char const* const _path)
+{
+  boost::lock_guard<boost::mutex> lock(s_registryMutex);
+  if (s_capture || s_captureRequestFrames || _numFrames == 0) {
+    return;
+  }
+  s_captureRequestFrames = _numFrames;
+  s_captureRequestPath = _path;
+}
+
+void PerfTimer::Collect()
+{
+  boost::lock_guard<boost::mutex> lock(s_registryMutex);
+  if (s_registry == NULL) {
+    return;
+  }
+  Timer::PerfTime const now = Timer::GetPerfTime();
+
+  for (size_t t = 0; t < s_registry->size(); ++t) {
+    ThreadLog& log = *(*s_registry)[t];
+
+    uint64_t const committed = log.committed.load(std::memory_order_acquire);
+    uint64_t begin = std::max(log.read, (committed > RING_SIZE) ? committed - RING_SIZE : 0);
+    s_collected.clear();
+    for (uint64_t i = begin; i < committed; ++i) {
+      ThreadLog::Span const& span = log.spans[i & RING_MASK];
+      CollectedSpan const collected = {
+        span.start.load(std::memory_order_relaxed),
+        span.end.load(std::memory_order_relaxed),
+        span.arg.load(std::memory_order_relaxed),
+        span.id.load(std::memory_order_relaxed),
+        span.kind.load(std::memory_order_relaxed)
+      };
+      s_collected.push_back(collected);
+    }
+
+    // Anything the thread has started writing over since is garbage
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t const started = log.started.load(std::memory_order_relaxed);
+    uint64_t const firstIntact = (started > RING_SIZE) ? started - RING_SIZE : 0;
+    if (firstIntact > begin) {
+      s_collected.erase(s_collected.begin(), s_collected.begin() + (size_t)std::min(firstIntact - begin, committed - begin));
+      begin = std::max(begin, firstIntact);
+    }
+    log.dropped += begin - log.read;
+    log.read = committed;
+
+    if (s_capture) {
+      for (size_t i = 0; i < s_collected.size(); ++i) {
+        CollectedSpan const& span = s_collected[i];
+        TraceExport::Event const event = { span.start, span.end, span.arg, span.id, span.kind, (uint16_t)(t + 1) };
+        s_capture->events.push_back(event);
+      }
+    }
+
+    // Spans arrive as they end, children first; put them back in the order they started and nest
+    // each one in whatever's still open around it. Spans open across calls are only seen when
+    // they end, so their children from earlier calls land at the top level.
+    std::sort(s_collected.begin(), s_collected.end(), &spanOrder);
+    s_open.clear();
+    for (size_t i = 0; i < s_collected.size(); ++i) {
+      CollectedSpan const& span = s_collected[i];
+      if (span.kind != SpanKind_Scope) {
+        continue;
+      }
+      while (!s_open.empty() && s_open.back().first <= span.start) {
+        s_open.pop_back();
+      }
+      Entry& parent = s_open.empty() ? log.root : *s_open.back().second;
+      Entry& entry = parent.children[span.id];
+      entry.time += span.end - span.start;
+      ++entry.count;
+      s_open.push_back(std::make_pair(span.end, &entry));
+    }
+  }
+
+  if (s_capture) {
+    static Id const frameId = Intern("Frame");
+    // Frames get the first track; the logs' come after
+    TraceExport::Event const frame = { s_lastCollectTime, now, ++s_captureFrames, frameId, SpanKind_Frame, 0 };
+    s_capture->events.push_back(frame);
+    if (--s_captureFramesLeft == 0) {
+      FinishCapture();
+    }
+  } else if (s_captureRequestFrames) {
+    s_capture = new TraceExport::Capture();
+    s_capture->path = s_captureRequestPath;
+    s_capture->startTime = now;
+    s_captureFramesLeft = s_captureRequestFrames;
+    s_captureFrames = 0;
+    s_captureRequestFrames = 0;
+    s_capturing.store(true, std::memory_order_relaxed);
+    orLog("Capturing %u frames to %s\n", s_captureFramesLeft, s_capture->path.c_str());
+  }
+  s_lastCollectTime = now;
+}
+
+// Under the registry lock
+void PerfTimer::FinishCapture()
+{
+  s_capturing.store(false, std::memory_order_relaxed);
+  s_capture->trackNames.push_back("Frames");
+  for (size_t i = 0; i < s_registry->size(); ++i) {
+    s_capture->trackNames.push_back((*s_registry)[i]->name);
+  }
+  TraceExport::WriteAsync(s_capture);
+  s_capture = NULL;
+}
+
+void PerfTimer::StaticShutdown()
+{
+  Collect();
+
+  {
+    boost::lock_guard<boost::mutex> lock(s_registryMutex);
+    if (s_registry == NULL) {
+      return;
+    }
+    // Write what there is
+    if (s_capture) {
+      FinishCapture();
+    }
+    Timer::PerfTime const profiledTime = Timer::GetPerfTime() - s_startTime;
+    for (size_t i = 0; i < s_registry->size(); ++i) {
+      (*s_registry)[i]->root.time = profiledTime;
+    }
+  }
+
+  Print();
+  TraceExport::WaitForWrites();
+
+  boost::lock_guard<boost::mutex> lock(s_registryMutex);
+  for (size_t i = 0; i < s_registry->size(); ++i) {
+    delete (*s_registry)[i];
+  }
+  delete s_registry; s_registry = NULL;
+  // Other threads' pointers dangle now, but they should all be gone
+  s_threadLog = NULL;
+}
+
+void PerfTimer::Print()
+{
+  boost::lock_guard<boost::mutex> lock(s_registryMutex);
+  if (s_registry == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < s_registry->size(); ++i) {
+    ThreadLog const& log = *(*s_registry)[i];
+    if (log.root.children.empty()) {
+      continue;
+    }
+    orLog("%s:\n", log.name.c_str());
+    if (log.dropped) {
+      orLog("  (%llu spans overwritten before they were collected)\n", (unsigned long long)log.dropped);
+    }
+    Print(&log.root, std::string("  "));
+  }
+}
 
 void PerfTimer::Print(Entry const* const _entry, std::string const& _indent)
 {
@@ -12,12 +354,11 @@ void PerfTimer::Print(Entry const* const _entry, std::string const& _indent)
   std::string const childIndent = _indent + std::string("  ");
   for (Iter i = _entry->children.begin(); i != _entry->children.end(); ++i)
   {
-    std::string const& childName = i->first;
+    char const* const childName = Name(i->first);
     Entry const* const childEntry = &i->second;
     float const childTime = Timer::PerfTimeToMillis(childEntry->time);
     float const childPc = 100.f * childTime / parentTime;
-    orLog("%s%s: %3.3f ms (%f%%)\n", _indent.c_str(), childName.c_str(), childTime, childPc);
+    orLog("%s%s: %3.3f ms (%f%%, %llu times)\n", _indent.c_str(), childName, childTime, childPc, (unsigned long long)childEntry->count);
     Print(childEntry, childIndent);
   }
 }
-
@@ -0,0 +1,108 @@
+#include "orStd.h"
+
+#include "orProfile/traceExport.h"
+#include "orProfile/perftimer.h"
+
+#include "boost_begin.h"
+#include <boost/thread.hpp>
+#include "boost_end.h"
+
+#include <stdio.h>
+
+#include <memory>
+
+namespace {
+
+boost::thread* s_writer = NULL;
+
+// Names are identifiers and literals, but a stray quote would make the whole file unreadable
+void writeString(FILE* const _file, char const* _str)
+{
+  fputc('"', _file);
+  for (; *_str; ++_str) {
+    if (*_str == '"' || *_str == '\\') {
+      fputc('\\', _file);
+    }
+    fputc((unsigned char)*_str < 0x20 ? ' ' : *_str, _file);
+  }
+  fputc('"', _file);
+}
+
+void writeAndFree(TraceExport::Capture* const _capture)
+{
+  std::unique_ptr<TraceExport::Capture> const capture(_capture);
+  if (TraceExport::Write(*capture)) {
+    orLog("Wrote %u trace events to %s\n", (uint32_t)capture->events.size(), capture->path.c_str());
+  }
+}
+
+} // namespace
+
+void TraceExport::WriteAsync(Capture* const _capture)
+{
+  WaitForWrites();
+  s_writer = new boost::thread(&writeAndFree, _capture);
+}
+
+void TraceExport::WaitForWrites()
+{
+  if (s_writer) {
+    s_writer->join();
+    delete s_writer; s_writer = NULL;
+  }
+}
+
+bool TraceExport::Write(Capture const& _capture)
+{
+  FILE* const file = fopen(_capture.path.c_str(), "w");
+  if (!file) {
+    orErr("Couldn't open %s to write the trace\n", _capture.path.c_str());
+    return false;
+  }
+
+  // PerfTimeToMillis() is float, which runs out of precision a few minutes in; just get the scale
+  // from it. The file's times are in microseconds.
+  double const ticksPerMicro = 1e9 / (1000.0 * Timer::PerfTimeToMillis(1000000000));
+
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (size_t i = 0; i < _capture.trackNames.size(); ++i) {
+    fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", i ? ",\n" : "", (uint32_t)i);
+    writeString(file, _capture.trackNames[i].c_str());
+    fprintf(file, "}},\n{\"ph\":\"M\",\"name\":\"thread_sort_index\",\"pid\":1,\"tid\":%u,\"args\":{\"sort_index\":%u}}", (uint32_t)i, (uint32_t)i);
+  }
+
+  for (size_t i = 0; i < _capture.events.size(); ++i) {
+    Event const& event = _capture.events[i];
+    // Spans can start before the capture, if they were open when it began
+    double const ts = ((double)event.start - (double)_capture.startTime) / ticksPerMicro;
+    double const dur = (double)(event.end - event.start) / ticksPerMicro;
+
+    fprintf(file, "%s{\"name\":", (i || !_capture.trackNames.empty()) ? ",\n" : "");
+    writeString(file, PerfTimer::Name(event.id));
+    switch (event.kind) {
+      case PerfTimer::SpanKind_Instant:
+        // Scheduler events; the arg is a thread: whose queue a task went on, or who was stolen from
+        fprintf(file, ",\"cat\":\"scheduler\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"thread\":%u}}",
+          ts, event.track, event.arg);
+        break;
+      case PerfTimer::SpanKind_Frame:
+        fprintf(file, ",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"frame\":%u}}",
+          ts, dur, event.track, event.arg);
+        break;
+      case PerfTimer::SpanKind_Task:
+      case PerfTimer::SpanKind_Scope:
+      default:
+        fprintf(file, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+          (event.kind == PerfTimer::SpanKind_Task) ? "task" : "scope", ts, dur, event.track);
+        break;
+    }
+  }
+  fprintf(file, "\n]}\n");
+
+  bool const ok = !ferror(file);
+  if (fclose(file) != 0 || !ok) {
+    orErr("Error writing the trace to %s\n", _capture.path.c_str());
+    return false;
+  }
+  return true;
+}
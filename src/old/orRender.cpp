@@ -4,11 +4,16 @@
 #include "orRender.h"
 
 #include "orProfile/perftimer.h"
+#include "orPlatform/atomic.h"
 
 #include "SDL_log.h"
 #include "SDL_surface.h"
 
 RenderSystem::RenderSystem() :
+  m_backFrameIdx(0),
+  m_frontFrameIdx(1),
+  m_frontFrameValid(false),
+  m_readyFrame(2),
   m_fontImage(NULL)
 {
 }
@@ -52,6 +57,70 @@ void RenderSystem::initRender()
   GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
 }
 
+namespace {
+
+template <typename T, typename A>
+void copyObjects(A const& _array, std::vector<T>& o_objects) {
+  o_objects.assign(_array.begin(), _array.end()); // Keeps the vector's capacity from the last time
+}
+
+// As copyObjects, but the text goes in _arena rather than a std::string per label per frame
+template <typename L, typename A>
+void copyLabels(A const& _array, orbital::Arena& _arena, std::vector<L>& o_labels) {
+  o_labels.resize(_array.end() - _array.begin());
+  L* label = o_labels.data();
+  for (auto const& object : _array) {
+    label->m_text = _arena.copyString(object.m_text.c_str());
+    label->m_pos = object.m_pos;
+    label->m_col = object.m_col;
+    ++label;
+  }
+}
+
+uint32_t exchangeFrame(uint32_t* const _readyFrame, uint32_t const _frame) {
+  for (;;) {
+    uint32_t const oldFrame = *_readyFrame;
+    if (orPlatform::atomicCompareAndSwap(_readyFrame, oldFrame, _frame) == oldFrame) {
+      return oldFrame;
+    }
+  }
+}
+
+} // namespace
+
+void RenderSystem::publishFrame()
+{
+  PERFTIMER("PublishFrame");
+  orbital::FrameArenaScope const arenaScope(orbital::ArenaSystem_Render);
+
+  // The renderer draws this frame during this frame or the next (see Frame), so the label text only
+  // has to last that long
+  orbital::Arena& textArena = orbital::FrameArenas::Get(orbital::ArenaLifetime_TwoFrames);
+
+  Frame& frame = m_frames[m_backFrameIdx];
+  copyObjects(m_instancedPoints, frame.m_points);
+  copyLabels(m_instancedLabel2Ds, textArena, frame.m_label2Ds);
+  copyLabels(m_instancedLabel3Ds, textArena, frame.m_label3Ds);
+  copyObjects(m_instancedSpheres, frame.m_spheres);
+  copyObjects(m_instancedOrbits, frame.m_orbits);
+
+  // The CAS is a full barrier, so the renderer sees all of the above once it sees the index
+  m_backFrameIdx = exchangeFrame(&m_readyFrame, m_backFrameIdx | FRAME_FRESH) & FRAME_INDEX_MASK;
+
+  // Lines only last the one frame
+  m_frames[m_backFrameIdx].m_lines.clear();
+}
+
+RenderSystem::Frame const* RenderSystem::acquireFrame()
+{
+  orPlatform::readBarrier();
+  if (m_readyFrame & FRAME_FRESH) {
+    m_frontFrameIdx = exchangeFrame(&m_readyFrame, m_frontFrameIdx) & FRAME_INDEX_MASK;
+    m_frontFrameValid = true;
+  }
+  return m_frontFrameValid ? &m_frames[m_frontFrameIdx] : NULL;
+}
+
 void RenderSystem::shutdownRender()
 {
   // TODO free opengl resources
@@ -335,11 +404,11 @@ void RenderSystem::drawAxes(Vector3d const pos, double const size) const
   drawLine(pos, pos + size * Vector3d::UnitZ(), Vector3d(0.0, 0.0, 1.0));
 }
 
-void RenderSystem::renderPoints() const
+void RenderSystem::renderPoints(Frame const& frame) const
 {
   PERFTIMER("RenderPoints");
   GL_CHECK(glDisable(GL_LIGHTING));
-  for (Point const& point : m_instancedPoints) {
+  for (Point const& point : frame.m_points) {
     GL_CHECK(glColor3d(point.m_col[0], point.m_col[1], point.m_col[2]));
 
     GL_CHECK(glPointSize(8.0));
@@ -351,11 +420,13 @@ void RenderSystem::renderPoints() const
 }
 
 // TODO these are still unstable
-void RenderSystem::projectLabel3Ds(Eigen::Matrix4d const& screenFromWorld)
+void RenderSystem::projectLabel3Ds(Frame const& frame)
 {
   PERFTIMER("ProjectLabel3Ds");
+
+  Eigen::Matrix4d const screenFromWorld = Eigen::Matrix4d(frame.m_screenFromProj) * Eigen::Matrix4d(frame.m_projFromCam) * Eigen::Matrix4d(frame.m_camFromWorld);
   
-  for (Label3D const& label3D : m_instancedLabel3Ds) {
+  for (FrameLabel3D const& label3D : frame.m_label3Ds) {
     Eigen::Vector4d pos3d;
     pos3d.x() = label3D.m_pos[0]; // is this really the best way?
     pos3d.y() = label3D.m_pos[1];
@@ -366,8 +437,8 @@ void RenderSystem::projectLabel3Ds(Eigen::Matrix4d const& screenFromWorld)
 
     pos2d /= pos2d.w();
 
-    m_label2DBuffer.push_back(Label2D());
-    Label2D& label2D = m_label2DBuffer.back();
+    m_label2DBuffer.push_back(FrameLabel2D());
+    FrameLabel2D& label2D = m_label2DBuffer.back();
 
     label2D.m_text = label3D.m_text;
     label2D.m_col = label3D.m_col;
@@ -375,7 +446,7 @@ void RenderSystem::projectLabel3Ds(Eigen::Matrix4d const& screenFromWorld)
   }
 }
 
-void RenderSystem::renderLabels( int w_px, int h_px )
+void RenderSystem::renderLabels(Frame const& frame, int w_px, int h_px)
 {
   PERFTIMER("RenderLabels");
 
@@ -405,12 +476,12 @@ void RenderSystem::renderLabels( int w_px, int h_px )
 
   // thing_measure[_space]_unit?
 
-  for (Label2D const& label2D : m_instancedLabel2Ds) {
+  for (FrameLabel2D const& label2D : frame.m_label2Ds) {
     glColor3d(label2D.m_col[0], label2D.m_col[1], label2D.m_col[2]);
     drawString(label2D.m_text, (int)label2D.m_pos[0], (int)label2D.m_pos[1]);
   }
 
-  for (Label2D const& label2D : m_label2DBuffer) {
+  for (FrameLabel2D const& label2D : m_label2DBuffer) {
     glColor3d(label2D.m_col[0], label2D.m_col[1], label2D.m_col[2]);
     drawString(label2D.m_text, (int)label2D.m_pos[0], (int)label2D.m_pos[1]);
   }
@@ -418,7 +489,7 @@ void RenderSystem::renderLabels( int w_px, int h_px )
   GL_CHECK(glEnd());
 }
 
-void RenderSystem::drawString(std::string const& str, int pos_x, int pos_y)
+void RenderSystem::drawString(char const* str, int pos_x, int pos_y)
 {
   int const char_w_px = 8;
   int const char_h_px = 8;
@@ -446,7 +517,7 @@ void RenderSystem::drawString(std::string const& str, int pos_x, int pos_y)
   int char_x_px = pos_x;
   int char_y_px = pos_y;
 
-  for (int i = 0; i < (int)str.length(); ++i) {
+  for (int i = 0; str[i] != '\0'; ++i) {
     int const char_idx = str[i];
 
     if (char_idx == '\n') {
@@ -480,28 +551,28 @@ void RenderSystem::drawString(std::string const& str, int pos_x, int pos_y)
   }
 }
 
-void RenderSystem::renderSpheres() const
+void RenderSystem::renderSpheres(Frame const& frame) const
 {
   GL_CHECK(glEnable(GL_LIGHTING));
 
   PERFTIMER("RenderSpheres");
-  for (Sphere const& sphere : m_instancedSpheres) {
+  for (Sphere const& sphere : frame.m_spheres) {
     GL_CHECK(glColor3d(sphere.m_col[0], sphere.m_col[1], sphere.m_col[2]));
 
     drawSolidSphere(Vector3d(sphere.m_pos), sphere.m_radius, 16, 16);
   }
 
   GL_CHECK(glDisable(GL_LIGHTING));
-  for (Sphere const& sphere : m_instancedSpheres) {
+  for (Sphere const& sphere : frame.m_spheres) {
     drawAxes(Vector3d(sphere.m_pos), 3 * sphere.m_radius);
   }
 }
 
-void RenderSystem::renderOrbits() const
+void RenderSystem::renderOrbits(Frame const& frame) const
 {
   PERFTIMER("RenderOrbits");
   GL_CHECK(glDisable(GL_LIGHTING));
-  for (Orbit const& orbit : m_instancedOrbits) {
+  for (Orbit const& orbit : frame.m_orbits) {
     GL_CHECK(glColor3d(orbit.m_col[0], orbit.m_col[1], orbit.m_col[2]));
 
     enum { NUM_STEPS = 10000 };
@@ -574,17 +645,25 @@ void RenderSystem::renderTrails() const
 }
 #endif
 
-void RenderSystem::render2D(int w_px, int h_px, Eigen::Matrix4d const& screenFromWorld)
+void RenderSystem::renderLines(Frame const& frame) const
 {
-  projectLabel3Ds(screenFromWorld);
-  renderLabels(w_px, h_px);
+  for (Line const& line : frame.m_lines) {
+    drawLine(line.m_start, line.m_end, line.m_col);
+  }
 }
 
-void RenderSystem::render3D()
+void RenderSystem::render2D(Frame const& frame, int w_px, int h_px)
 {
-  renderPoints();
-  renderSpheres();
-  renderOrbits();
+  projectLabel3Ds(frame);
+  renderLabels(frame, w_px, h_px);
+}
+
+void RenderSystem::render3D(Frame const& frame)
+{
+  renderPoints(frame);
+  renderSpheres(frame);
+  renderOrbits(frame);
+  renderLines(frame);
 #if 0
   renderTrails();
 #endif
@@ -614,9 +693,7 @@ void RenderSystem::render(
   FrameBuffer const& frameBuffer,
   Colour clearCol,
   float clearDepth,
-  Eigen::Matrix4d const& screenFromProj,
-  Eigen::Matrix4d const& projFromCam,
-  Eigen::Matrix4d const& camFromWorld
+  Frame const& frame
 )
 {
   GL_CHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
@@ -642,11 +719,11 @@ void RenderSystem::render(
 
     GL_CHECK(glMatrixMode(GL_PROJECTION));
     GL_CHECK(glLoadIdentity());
-    GL_CHECK(glMultMatrix( projFromCam ));
+    GL_CHECK(glMultMatrix( Eigen::Matrix4d(frame.m_projFromCam) ));
 
     GL_CHECK(glMatrixMode(GL_MODELVIEW));
     GL_CHECK(glLoadIdentity());
-    GL_CHECK(glMultMatrix( camFromWorld ));
+    GL_CHECK(glMultMatrix( Eigen::Matrix4d(frame.m_camFromWorld) ));
 
     GL_CHECK(glEnable(GL_TEXTURE_2D));
 
@@ -694,7 +771,7 @@ void RenderSystem::render(
 
   {
     PERFTIMER("Render3D");
-    render3D();
+    render3D(frame);
   }
 }
 
@@ -759,4 +836,85 @@ void RenderSystem::Trail::Update(double const _dt, Vector3d const _pos)
   }
 #endif
 }
-#endif
\ No newline at end of file
+#endif
+
+namespace {
+  uint32_t const SNAPSHOT_TAG = orbital::snapshotTag('R', 'N', 'D', 'R');
+  uint32_t const SNAPSHOT_VERSION = 1;
+}
+
+void RenderSystem::save(orbital::SnapshotWriter& _writer) const
+{
+  _writer.beginBlock(SNAPSHOT_TAG, SNAPSHOT_VERSION);
+  orbital::writeIdArray(_writer, m_instancedPoints);
+  orbital::writeIdArray(_writer, m_instancedLabel2Ds);
+  orbital::writeIdArray(_writer, m_instancedLabel3Ds);
+  orbital::writeIdArray(_writer, m_instancedSpheres);
+  orbital::writeIdArray(_writer, m_instancedOrbits);
+}
+
+bool RenderSystem::check(orbital::SnapshotReader const& _reader) const
+{
+  uint32_t version = 0;
+  orbital::SnapshotReader::Cursor cursor;
+  if (!_reader.findBlock(SNAPSHOT_TAG, &version, &cursor) || version != SNAPSHOT_VERSION) {
+    return false;
+  }
+  return orbital::checkIdArray(cursor, m_instancedPoints)
+      && orbital::checkIdArray(cursor, m_instancedLabel2Ds)
+      && orbital::checkIdArray(cursor, m_instancedLabel3Ds)
+      && orbital::checkIdArray(cursor, m_instancedSpheres)
+      && orbital::checkIdArray(cursor, m_instancedOrbits);
+}
+
+bool RenderSystem::load(orbital::SnapshotReader const& _reader)
+{
+  uint32_t version = 0;
+  orbital::SnapshotReader::Cursor cursor;
+  if (!_reader.findBlock(SNAPSHOT_TAG, &version, &cursor) || version != SNAPSHOT_VERSION) {
+    return false;
+  }
+  return orbital::readIdArray(cursor, m_instancedPoints)
+      && orbital::readIdArray(cursor, m_instancedLabel2Ds)
+      && orbital::readIdArray(cursor, m_instancedLabel3Ds)
+      && orbital::readIdArray(cursor, m_instancedSpheres)
+      && orbital::readIdArray(cursor, m_instancedOrbits);
+}
+
+void snapshotWriteObjects(orbital::SnapshotWriter& _writer, RenderSystem::Label2D const* const _labels, uint32_t const _count)
+{
+  for (uint32_t i = 0; i < _count; ++i) {
+    _writer.writeValue(_labels[i].m_pos);
+    _writer.writeValue(_labels[i].m_col);
+    _writer.writeString(_labels[i].m_text);
+  }
+}
+
+bool snapshotReadObjects(orbital::SnapshotReader::Cursor& _cursor, RenderSystem::Label2D* const o_labels, uint32_t const _count)
+{
+  for (uint32_t i = 0; i < _count; ++i) {
+    _cursor.readValue(&o_labels[i].m_pos);
+    _cursor.readValue(&o_labels[i].m_col);
+    _cursor.readString(&o_labels[i].m_text);
+  }
+  return _cursor.ok();
+}
+
+void snapshotWriteObjects(orbital::SnapshotWriter& _writer, RenderSystem::Label3D const* const _labels, uint32_t const _count)
+{
+  for (uint32_t i = 0; i < _count; ++i) {
+    _writer.writeValue(_labels[i].m_pos);
+    _writer.writeValue(_labels[i].m_col);
+    _writer.writeString(_labels[i].m_text);
+  }
+}
+
+bool snapshotReadObjects(orbital::SnapshotReader::Cursor& _cursor, RenderSystem::Label3D* const o_labels, uint32_t const _count)
+{
+  for (uint32_t i = 0; i < _count; ++i) {
+    _cursor.readValue(&o_labels[i].m_pos);
+    _cursor.readValue(&o_labels[i].m_col);
+    _cursor.readString(&o_labels[i].m_text);
+  }
+  return _cursor.ok();
+}
@@ -0,0 +1,238 @@
+#include "orStd.h"
+
+#include "taskScheduler.h"
+
+// Task graphs
+//
+// Each graph task has two counters:
+// - startDepCount: its dependency, if any, plus one held by add_tasks while the batch is wired up.
+//   Whoever takes it to 0 submits the task.
+// - endDepCount: its own work item, plus one per child. Whoever takes it to 0 completes the task,
+//   which starts its dependents and counts down its parent.
+// Dependents are kept on a lock-free list on the task they depend on, which is swapped for
+// DEPENDENTS_CLOSED on completion; a dependent that finds the list closed knows its dependency is
+// already done.
+//
+// Tasks that can run anywhere go on the starting thread's work-stealing queue. Tasks with an
+// aversion go on the pinned queue of a thread they're allowed on (the starting thread if possible),
+// since anything on a stealable queue could end up on any thread.
+
+struct orTask::TaskScheduler::GraphTask
+{
+  TaskScheduler* scheduler;
+  TaskId id;
+  WorkItem work;
+  GraphTask* parent;
+  ThreadAversion allowedThreads; // 0 if it can run anywhere
+
+  int startDepCount;
+  int endDepCount;
+
+  GraphTask* dependents; // Linked through nextDependent
+  GraphTask* nextDependent;
+
+  TaskGroup done; // One task until this is complete, so wait() can use waitForTaskGroup
+
+  static GraphTask* const DEPENDENTS_CLOSED;
+};
+
+orTask::TaskScheduler::GraphTask* const orTask::TaskScheduler::GraphTask::DEPENDENTS_CLOSED = reinterpret_cast<orTask::TaskScheduler::GraphTask*>(uintptr_t(1));
+
+namespace {
+
+int const MAX_THREADS = sizeof(orTask::ThreadAversion) * 8;
+
+// Mask of the scheduler's threads the task may run on, or 0 if that's all of them
+orTask::ThreadAversion allowedThreadsFromAversion(orTask::ThreadAversion const aversion, int const numThreads) {
+  orTask::ThreadAversion const allThreads = (numThreads >= MAX_THREADS) ? ~orTask::ThreadAversion(0) : ((orTask::ThreadAversion(1) << numThreads) - 1);
+  orTask::ThreadAversion const allowed = ~aversion & allThreads;
+  ensure(allowed != 0, "Task can't run on any thread!");
+  return (allowed == allThreads) ? 0 : allowed;
+}
+
+// The starting thread if it's allowed, so the task stays warm in its cache, otherwise the next one along
+int pickAllowedThread(orTask::ThreadAversion const allowed, int const threadIdx, int const numThreads) {
+  for (int i = 0; i < numThreads && i < MAX_THREADS; ++i) {
+    int const candidate = (threadIdx + i) % numThreads;
+    if (allowed & (orTask::ThreadAversion(1) << candidate)) {
+      return candidate;
+    }
+  }
+  return 0;
+}
+
+} // namespace
+
+orTask::TaskScheduler::TaskScheduler(int numThreads) :
+  numThreads_(numThreads),
+  m_graphTasks(new GraphTask[MAX_GRAPH_TASKS]()),
+  m_lastId(TaskId_None),
+  m_liveTelemetry(new LiveTelemetry[numThreads]),
+  m_lastTelemetry(numThreads),
+  m_frameTelemetry(numThreads)
+{
+}
+
+orTask::TaskScheduler::~TaskScheduler() {
+  delete[] m_liveTelemetry;
+  delete[] m_graphTasks;
+}
+
+// Telemetry
+
+orTask::TaskScheduler::LiveTelemetry::LiveTelemetry() {
+  for (int i = 0; i < WorkerTelemetry::Counter_Count; ++i) {
+    counters[i].store(0, std::memory_order_relaxed);
+  }
+  queueHighWater.store(0, std::memory_order_relaxed);
+}
+
+char const* orTask::WorkerTelemetry::counterName(Counter const counter) {
+  static char const* const s_names[Counter_Count] = {
+    "tasks", "steal attempts", "empty victims", "lost races", "steals", "tasks stolen", "suspends",
+    "working", "stealing", "parked"
+  };
+  return s_names[counter];
+}
+
+void orTask::TaskScheduler::endTelemetryFrame() {
+  for (int threadIdx = 0; threadIdx < numThreads_; ++threadIdx) {
+    LiveTelemetry& live = m_liveTelemetry[threadIdx];
+    WorkerTelemetry& last = m_lastTelemetry[threadIdx];
+    WorkerTelemetry& frame = m_frameTelemetry[threadIdx];
+    for (int i = 0; i < WorkerTelemetry::Counter_Count; ++i) {
+      uint64_t const total = live.counters[i].load(std::memory_order_relaxed);
+      frame.counters[i] = total - last.counters[i];
+      last.counters[i] = total;
+    }
+    // Can lose a racing update from the thread; it's only telemetry
+    frame.queueHighWater = live.queueHighWater.exchange(0, std::memory_order_relaxed);
+  }
+}
+
+orTask::TaskScheduler::GraphTask* orTask::TaskScheduler::graphTask(TaskId const id) {
+  return &m_graphTasks[id % MAX_GRAPH_TASKS];
+}
+
+orTask::TaskId orTask::TaskScheduler::next_id() {
+  for (;;) {
+    TaskId const lastId = m_lastId;
+    if (orPlatform::atomicCompareAndSwap(&m_lastId, lastId, lastId + 1) == lastId) {
+      return lastId + 1;
+    }
+  }
+}
+
+void orTask::TaskScheduler::add_tasks(int const threadIdx, size_t const n, TaskMeta const* const tasks) {
+  ensure(n <= MAX_GRAPH_TASKS, "Too many tasks in one batch!");
+
+  // Fill in everything first, holding an extra start count on each task so nothing in the batch can
+  // start before its dependencies are wired up
+  for (size_t i = 0; i < n; ++i) {
+    TaskMeta const& meta = tasks[i];
+    GraphTask* const task = graphTask(meta.id);
+    // The slot's last task (MAX_GRAPH_TASKS ids ago) should be long done; if not, help it along rather
+    // than trampling it
+    if (task->done.tasks != 0) {
+      waitForTaskGroup(threadIdx, &task->done);
+    }
+
+    task->scheduler = this;
+    task->id = meta.id;
+    task->work = meta.work;
+    task->parent = (meta.parent != TaskId_None) ? graphTask(meta.parent) : NULL;
+    task->allowedThreads = allowedThreadsFromAversion(meta.aversion, numThreads_);
+    task->startDepCount = 1 + (int)meta.startDepCount;
+    task->endDepCount = 1 + (int)meta.endDepCount;
+    task->dependents = NULL;
+    task->nextDependent = NULL;
+    task->done.tasks = 1;
+  }
+  orPlatform::fullBarrier();
+
+  for (size_t i = 0; i < n; ++i) {
+    TaskMeta const& meta = tasks[i];
+    if (meta.startDep == TaskId_None) {
+      continue;
+    }
+    GraphTask* const task = graphTask(meta.id);
+    GraphTask* const dep = graphTask(meta.startDep);
+
+    // If the slot has moved on, the dependency completed long ago
+    bool waiting = false;
+    while (dep->id == meta.startDep) {
+      GraphTask* const head = dep->dependents;
+      if (head == GraphTask::DEPENDENTS_CLOSED) {
+        break;
+      }
+      task->nextDependent = head;
+      if (orPlatform::atomicCompareAndSwap(&dep->dependents, head, task) == head) {
+        waiting = true;
+        break;
+      }
+    }
+    if (!waiting) {
+      orPlatform::atomicDec(&task->startDepCount); // Can't reach 0; still holding ours
+    }
+  }
+
+  // Drop our hold; anything with nothing left to wait for starts now
+  for (size_t i = 0; i < n; ++i) {
+    GraphTask* const task = graphTask(tasks[i].id);
+    if (orPlatform::atomicDec(&task->startDepCount) == 1) {
+      startGraphTask(threadIdx, task);
+    }
+  }
+}
+
+void orTask::TaskScheduler::wait(int const threadIdx, TaskId const id) {
+  GraphTask* const task = graphTask(id);
+  if (task->id != id) {
+    return; // Long gone
+  }
+  waitForTaskGroup(threadIdx, &task->done);
+}
+
+void orTask::TaskScheduler::startGraphTask(int const threadIdx, GraphTask* const task) {
+  if (!task->work.func) {
+    // Nothing to run, just counts as done
+    finishGraphTask(threadIdx, task);
+  } else if (task->allowedThreads != 0) {
+    submitPinnedTaskForGroup(threadIdx, pickAllowedThread(task->allowedThreads, threadIdx, numThreads_), NULL, &runGraphTask, task);
+  } else {
+    submitTaskForGroup(threadIdx, NULL, &runGraphTask, task);
+  }
+}
+
+void orTask::TaskScheduler::runGraphTask(ThreadIdx const threadIdx, void* const userData) {
+  GraphTask* const task = static_cast<GraphTask*>(userData);
+  (*task->work.func)(threadIdx, task->work.data);
+  task->scheduler->finishGraphTask(threadIdx, task);
+}
+
+// Counts down one of task's end dependencies, completing it (and maybe its parents) if it was the last
+void orTask::TaskScheduler::finishGraphTask(int const threadIdx, GraphTask* task) {
+  while (task && orPlatform::atomicDec(&task->endDepCount) == 1) {
+    GraphTask* dependents;
+    for (;;) {
+      dependents = task->dependents;
+      if (orPlatform::atomicCompareAndSwap(&task->dependents, dependents, GraphTask::DEPENDENTS_CLOSED) == dependents) {
+        break;
+      }
+    }
+
+    while (dependents) {
+      GraphTask* const next = dependents->nextDependent; // Read first; starting it could finish it
+      if (orPlatform::atomicDec(&dependents->startDepCount) == 1) {
+        startGraphTask(threadIdx, dependents);
+      }
+      dependents = next;
+    }
+
+    GraphTask* const parent = task->parent;
+    if (task->done.remTask()) { // The slot can be reused after this
+      onGroupDone(&task->done);
+    }
+    task = parent;
+  }
+}
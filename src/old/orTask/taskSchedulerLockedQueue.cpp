@@ -0,0 +1,118 @@
+#include "orStd.h"
+
+#include "taskSchedulerLockedQueue.h"
+
+#include "timer.h"
+
+orTask::TaskSchedulerLockedQueue::TaskSchedulerLockedQueue(int numThreads) :
+  TaskScheduler(numThreads),
+  m_mutex(),
+  m_wakeup(),
+  m_tasks(),
+  m_pinnedTasks(numThreads),
+  m_exit(false),
+  m_threads()
+{
+  for (int threadIdx = 1; threadIdx < numThreads_; ++threadIdx) {
+    m_threads.add_thread(new boost::thread(&TaskSchedulerLockedQueue::thread_fn, this, threadIdx));
+  }
+}
+
+orTask::TaskSchedulerLockedQueue::~TaskSchedulerLockedQueue() {
+  {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    m_exit = true;
+  }
+  m_wakeup.notify_all();
+  m_threads.join_all();
+}
+
+void orTask::TaskSchedulerLockedQueue::thread_fn(int threadIdx) {
+  run(threadIdx, NULL);
+}
+
+void orTask::TaskSchedulerLockedQueue::submitTaskForGroup(int threadIdx, TaskGroup* group, TaskFn* fn, void* userData) {
+  Task task;
+  task.exit = false;
+  task.group = group;
+  task.taskUserFn = fn;
+  task.taskUserData = userData;
+
+  if (group) {
+    group->addTask();
+  }
+
+  size_t size;
+  {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    m_tasks.push_back(task);
+    size = m_tasks.size();
+  }
+  noteQueueSize(threadIdx, size);
+  m_wakeup.notify_one();
+}
+
+void orTask::TaskSchedulerLockedQueue::submitPinnedTaskForGroup(int /*threadIdx*/, int targetThreadIdx, TaskGroup* group, TaskFn* fn, void* userData) {
+  Task task;
+  task.exit = false;
+  task.group = group;
+  task.taskUserFn = fn;
+  task.taskUserData = userData;
+
+  if (group) {
+    group->addTask();
+  }
+
+  {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    m_pinnedTasks[targetThreadIdx].push_back(task);
+  }
+  // Can't pick who wakes, so wake everyone
+  m_wakeup.notify_all();
+}
+
+void orTask::TaskSchedulerLockedQueue::waitForTaskGroup(int threadIdx, TaskGroup* group) {
+  run(threadIdx, group);
+}
+
+// Everything on the queue could go to any thread
+bool orTask::TaskSchedulerLockedQueue::isLocalQueueEmpty(int /*threadIdx*/) const {
+  boost::lock_guard<boost::mutex> lock(m_mutex);
+  return m_tasks.empty();
+}
+
+void orTask::TaskSchedulerLockedQueue::onGroupDone(TaskGroup const* /*group*/) {
+  // Under the lock, so a waiter can't check the group and then miss this before it sleeps
+  {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+  }
+  m_wakeup.notify_all();
+}
+
+void orTask::TaskSchedulerLockedQueue::run(int const threadIdx, TaskGroup const* group) {
+  boost::unique_lock<boost::mutex> lock(m_mutex);
+  for (;;) {
+    if (group ? group->tasks == 0 : m_exit) {
+      break;
+    }
+
+    std::deque<Task>& pinned = m_pinnedTasks[threadIdx];
+    std::deque<Task>& queue = pinned.empty() ? m_tasks : pinned;
+    if (queue.empty()) {
+      Timer::PerfTime const parkStart = Timer::GetPerfTime();
+      m_wakeup.wait(lock);
+      addTelemetry(threadIdx, WorkerTelemetry::Counter_ParkedTime, Timer::GetPerfTime() - parkStart);
+      continue;
+    }
+    Task const task = queue.front();
+    queue.pop_front();
+
+    lock.unlock();
+    (*task.taskUserFn)(threadIdx, task.taskUserData);
+    addTelemetry(threadIdx, WorkerTelemetry::Counter_TasksExecuted, 1);
+    if (task.group && task.group->remTask()) {
+      onGroupDone(task.group);
+    }
+    lock.lock();
+  }
+}
@@ -26,57 +26,198 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "taskSchedulerWorkStealing.h"
 
-#include "boost_begin.h"
-#include "boost/date_time/posix_time/ptime.hpp"
-#include "boost/date_time/posix_time/time_formatters.hpp"
-#include "boost/property_tree/ptree.hpp"
-#include "boost_end.h"
+#include "orPlatform/topology.h"
+#include "orProfile/perftimer.h"
+
+#include <algorithm>
 
 void orTask::TaskSchedulerWorkStealing::thread_fn(ThreadData* threadData) {
-  // TODO refactor out common code with waitForTaskGroup
-  while (threadData->curState != ThreadData::STATE_EXIT) {
-    ThreadData::State startState = threadData->curState;
-    
-    boost::posix_time::ptime startTime = boost::posix_time::microsec_clock::universal_time();
-  
-    threadData->curState = thread_step(threadData);
-    
-    boost::posix_time::ptime endTime = boost::posix_time::microsec_clock::universal_time();
-    
-    if (startState == ThreadData::STATE_WORKING) {
-      threadData->activeTime += (endTime - startTime);
-    } else {
-      threadData->inactiveTime += (endTime - startTime);
-    }
+  if (threadData->cpu >= 0) {
+    orPlatform::pinCurrentThread(threadData->cpu);
   }
+  threadData->ownFiber.fiber = orPlatform::convertThreadToFiber();
+  threadData->stateStartTime = Timer::GetPerfTime();
+
+  char name[32];
+  snprintf(name, sizeof(name), "Worker %d", threadData->threadIdx);
+  PerfTimer::NameThread(name);
+
+  thread_run(threadData, NULL);
+
+  // Exiting on another fiber switches back here to finish
+  orPlatform::convertFiberToThread(threadData->ownFiber.fiber);
+}
+
+// Pooled fibers start here, in the middle of a task that's just been suspended
+void orTask::TaskSchedulerWorkStealing::fiber_fn(void* userData) {
+  ThreadData* const threadData = static_cast<ThreadData*>(userData);
+  thread_run(threadData, NULL);
+
+  // Only the thread's own fiber can return from the thread. Nothing's suspended by the time we exit,
+  // so it's free, and carries on from its own loop, which sees we're exiting.
+  ensure(threadData->suspendedFibers.empty());
+  thread_switch(threadData, &threadData->ownFiber);
+  ensure(false, "Exited fiber resumed!");
 }
 
 void orTask::TaskSchedulerWorkStealing::waitForTaskGroup(int threadIdx, TaskGroup* group) {
   ThreadData* curThreadData = &threadData[threadIdx];
-  while (group->tasks != 0 && curThreadData->curState != ThreadData::STATE_EXIT) {
-    orPlatform::readBarrier(); // ensures read to group->tasks isn't optimised out
-    
-    ThreadData::State startState = curThreadData->curState;
-    
-    boost::posix_time::ptime startTime = boost::posix_time::microsec_clock::universal_time();
-  
-    curThreadData->curState = thread_step(curThreadData);
-    
-    boost::posix_time::ptime endTime = boost::posix_time::microsec_clock::universal_time();
-    
-    if (startState == ThreadData::STATE_WORKING) {
-      curThreadData->activeTime += (endTime - startTime);
-    } else {
-      curThreadData->inactiveTime += (endTime - startTime);
+
+  orPlatform::readBarrier();
+  if (group->tasks == 0) {
+    return;
+  }
+
+  // Thread 0's own fiber is the caller's, outside the scheduler; time spent there isn't ours to count
+  if (threadIdx == 0 && curThreadData->curFiber == &curThreadData->ownFiber) {
+    curThreadData->stateStartTime = Timer::GetPerfTime();
+  }
+
+  TaskFiber* const loopFiber = thread_getfreefiber(curThreadData);
+  if (loopFiber) {
+    // Carry on with other tasks on another fiber; the loop switches back here once the group's done
+    TaskFiber* const self = curThreadData->curFiber;
+    self->waitingFor = group;
+    curThreadData->suspendedFibers.push_back(self);
+    orPlatform::atomicInc(&curThreadData->numSuspended);
+    orPlatform::atomicInc(&numGroupWaiters); // Full barrier: before the loop looks at group->tasks
+    addTelemetry(threadIdx, WorkerTelemetry::Counter_Suspends, 1);
+
+    thread_switch(curThreadData, loopFiber);
+  } else {
+    // Out of address space for stacks: run tasks on this one until the group's done. Tasks suspended
+    // on this thread can't resume until then.
+    TaskGroup* const outerGroup = curThreadData->waitingFor;
+    curThreadData->waitingFor = group;
+    orPlatform::atomicInc(&curThreadData->numSuspended);
+    orPlatform::atomicInc(&numGroupWaiters); // Full barrier: before we look at group->tasks
+
+    thread_run(curThreadData, group);
+
+    orPlatform::atomicDec(&numGroupWaiters);
+    orPlatform::atomicDec(&curThreadData->numSuspended);
+    curThreadData->waitingFor = outerGroup;
+  }
+
+  // Either way we only get back here once the group's done: a thread doesn't exit while it has a
+  // task waiting
+  ensure(group->tasks == 0);
+}
+
+// Steps until told to exit or, if there is one, the group is done. Only runs nested, on the stack
+// of a task waiting for the group, if there's no fiber to suspend it on.
+void orTask::TaskSchedulerWorkStealing::thread_run(ThreadData* threadData, TaskGroup const* group) {
+  // Inside a task, so the time until now was working
+  if (group) {
+    thread_chargetime(threadData);
+  }
+
+  while (threadData->curState != ThreadData::STATE_EXIT) {
+    if (group) {
+      orPlatform::readBarrier(); // ensures read to group->tasks isn't optimised out
+      if (group->tasks == 0) {
+        break;
+      }
+    } else if (thread_resumeready(threadData)) {
+      continue; // Someone's switched back to this fiber
+    } else if (threadData->exitRequested && thread_canexit(threadData)) {
+      // The last suspended task's finished since we got the exit task
+      if (threadData->curState == ThreadData::STATE_WORKING) {
+        threadData->barrier->decActive();
+      }
+      thread_chargetime(threadData);
+      threadData->curState = ThreadData::STATE_EXIT;
+      break;
+    }
+
+    ThreadData::State const nextState = thread_step(threadData);
+    if (nextState != threadData->curState) {
+      thread_chargetime(threadData);
+      threadData->curState = nextState;
     }
   }
-  // We got an exit task on the waiting thread (Why?)
-  // So just sleep until the group is completed
-  boost::posix_time::millisec const sleepTime = boost::posix_time::millisec(1);
-  while (group->tasks != 0) {
-    orPlatform::readBarrier();
-    boost::this_thread::sleep(sleepTime);
+
+  // Also resets the start time, so the task we're nested in doesn't count this time again
+  thread_chargetime(threadData);
+}
+
+orTask::TaskSchedulerWorkStealing::TaskFiber* orTask::TaskSchedulerWorkStealing::thread_getfreefiber(ThreadData* threadData) {
+  if (!threadData->freeFibers.empty()) {
+    TaskFiber* const fiber = threadData->freeFibers.back();
+    threadData->freeFibers.pop_back();
+    return fiber;
+  }
+
+  orPlatform::Fiber* const fiber = orPlatform::createFiber(FIBER_STACK_SIZE, &fiber_fn, threadData);
+  if (!fiber) {
+    return NULL;
+  }
+  TaskFiber* const taskFiber = new TaskFiber();
+  taskFiber->fiber = fiber;
+  threadData->pooledFibers.push_back(taskFiber);
+  return taskFiber;
+}
+
+// Between tasks: switches to a suspended task whose group is done, if there is one. This fiber goes
+// back in the pool, and carries on from here when it's next needed.
+bool orTask::TaskSchedulerWorkStealing::thread_resumeready(ThreadData* threadData) {
+  std::vector< TaskFiber* >& suspended = threadData->suspendedFibers;
+  if (suspended.empty()) {
+    return false;
+  }
+
+  orPlatform::readBarrier();
+  for (size_t i = 0; i < suspended.size(); ++i) {
+    TaskFiber* const ready = suspended[i];
+    if (ready->waitingFor->tasks != 0) {
+      continue;
+    }
+    suspended.erase(suspended.begin() + i);
+    ready->waitingFor = NULL;
+    orPlatform::atomicDec(&threadData->numSuspended);
+    orPlatform::atomicDec(&threadData->scheduler->numGroupWaiters);
+
+    // The task was working when it suspended, and is again
+    if (threadData->curState != ThreadData::STATE_WORKING) {
+      threadData->barrier->incActive();
+    }
+    thread_startworking(threadData);
+
+    threadData->freeFibers.push_back(threadData->curFiber);
+    thread_switch(threadData, ready);
+    return true;
+  }
+  return false;
+}
+
+bool orTask::TaskSchedulerWorkStealing::thread_canexit(ThreadData const* threadData) {
+  return threadData->suspendedFibers.empty() && !threadData->waitingFor;
+}
+
+void orTask::TaskSchedulerWorkStealing::thread_switch(ThreadData* threadData, TaskFiber* fiber) {
+  TaskFiber* const curFiber = threadData->curFiber;
+  threadData->curFiber = fiber;
+  orPlatform::switchToFiber(curFiber->fiber, fiber->fiber);
+}
+
+// Before running a task we found while stealing, so its time counts as working
+void orTask::TaskSchedulerWorkStealing::thread_startworking(ThreadData* threadData) {
+  thread_chargetime(threadData);
+  threadData->curState = ThreadData::STATE_WORKING;
+}
+
+void orTask::TaskSchedulerWorkStealing::thread_chargetime(ThreadData* threadData) {
+  static WorkerTelemetry::Counter const s_stateCounters[] = {
+    WorkerTelemetry::Counter_WorkingTime,  // STATE_WORKING
+    WorkerTelemetry::Counter_StealingTime, // STATE_STEALING
+    WorkerTelemetry::Counter_ParkedTime,   // STATE_IDLE
+  };
+
+  Timer::PerfTime const now = Timer::GetPerfTime();
+  if (threadData->curState != ThreadData::STATE_EXIT) {
+    threadData->scheduler->addTelemetry(threadData->threadIdx, s_stateCounters[threadData->curState], now - threadData->stateStartTime);
   }
+  threadData->stateStartTime = now;
 }
 
 orTask::TaskSchedulerWorkStealing::ThreadData::State orTask::TaskSchedulerWorkStealing::thread_exectask(Task const& task, ThreadData* threadData)
@@ -89,34 +230,114 @@ orTask::TaskSchedulerWorkStealing::ThreadData::State orTask::TaskSchedulerWorkSt
   // TODO can forbid null taskFn in submit, use null to indicate exit instead of storing bool.
   // TODO assert group null?
   if (exit) {
+    threadData->exitRequested = true;
+    if (!thread_canexit(threadData)) {
+      return ThreadData::STATE_WORKING; // The loop exits once the suspended tasks are done
+    }
     threadData->barrier->decActive();
     return ThreadData::STATE_EXIT;
   }
     
-  (*taskFn)(threadData->threadIdx, taskData);
+  if (PerfTimer::IsCapturing()) {
+    static PerfTimer::Id const taskId = PerfTimer::Intern("Task");
+    // Includes any time it spent suspended; the thread's other tasks from then show up inside it
+    Timer::PerfTime const start = Timer::GetPerfTime();
+    (*taskFn)(threadData->threadIdx, taskData);
+    PerfTimer::Record(taskId, start, Timer::GetPerfTime(), PerfTimer::SpanKind_Task);
+  } else {
+    (*taskFn)(threadData->threadIdx, taskData);
+  }
+  threadData->scheduler->addTelemetry(threadData->threadIdx, WorkerTelemetry::Counter_TasksExecuted, 1);
     
-  if (group) {
-    group->remTask();
+  if (group && group->remTask()) {
+    threadData->scheduler->onGroupDone(group);
   }
   
   return ThreadData::STATE_WORKING;
 }
 
+bool orTask::TaskSchedulerWorkStealing::thread_poppinned(ThreadData* threadData, Task* o_task)
+{
+  PinnedQueue* pinned = (*threadData->pinnedQueues)[threadData->threadIdx];
+  orPlatform::readBarrier();
+  if (pinned->count == 0) {
+    return false;
+  }
+
+  boost::lock_guard<boost::mutex> lock(pinned->mutex);
+  if (pinned->tasks.empty()) {
+    return false;
+  }
+  // FIFO; there are only ever a few of these
+  *o_task = pinned->tasks.front();
+  pinned->tasks.erase(pinned->tasks.begin());
+  orPlatform::atomicDec(&pinned->count);
+  return true;
+}
+
+bool orTask::TaskSchedulerWorkStealing::thread_haswork(ThreadData const* threadData)
+{
+  if (threadData->waitingFor && threadData->waitingFor->tasks == 0) {
+    return true;
+  }
+  std::vector< TaskFiber* > const& suspended = threadData->suspendedFibers;
+  for (size_t i = 0; i < suspended.size(); ++i) {
+    if (suspended[i]->waitingFor->tasks == 0) {
+      return true;
+    }
+  }
+  if ((*threadData->pinnedQueues)[threadData->threadIdx]->count != 0) {
+    return true;
+  }
+  std::vector< Queue* > const& queues = *threadData->queues;
+  for (size_t i = 0; i < queues.size(); ++i) {
+    if (!queues[i]->isEmpty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+orTask::TaskSchedulerWorkStealing::ThreadData::State orTask::TaskSchedulerWorkStealing::thread_park(ThreadData* threadData)
+{
+  TaskSchedulerWorkStealing* const scheduler = threadData->scheduler;
+
+  // Advertise that we're parked before the last look for work, so anyone pushing after that look
+  // sees us and wakes us
+  EventCount::Key const key = threadData->wakeup.prepareWait();
+  threadData->parked = 1;
+  orPlatform::atomicInc(&scheduler->numParked); // Full barrier
+
+  if (!thread_haswork(threadData)) {
+    threadData->wakeup.wait(key);
+  } else {
+    threadData->wakeup.cancelWait();
+  }
+
+  // If whoever woke us didn't clear this, we woke ourselves
+  if (orPlatform::atomicCompareAndSwap(&threadData->parked, 1, 0) == 1) {
+    orPlatform::atomicDec(&scheduler->numParked);
+  }
+  return ThreadData::STATE_STEALING;
+}
+
 orTask::TaskSchedulerWorkStealing::ThreadData::State orTask::TaskSchedulerWorkStealing::thread_step(ThreadData* threadData)
 {
-  VictimPicker* victimPicker = threadData->victimPicker;
+  VictimPicker& victimPicker = threadData->victimPicker;
+  TaskSchedulerWorkStealing* const scheduler = threadData->scheduler;
 
   std::vector< Queue* >& queues = *threadData->queues;
   int id = threadData->threadIdx;
   TerminationBarrier* barrier = threadData->barrier;
 
-  boost::posix_time::millisec const sleepTime = boost::posix_time::millisec(1);
-  
   switch (threadData->curState) {
     case ThreadData::STATE_WORKING: {
-      // Take work from own queue
+      // Take work pinned to this thread, then from own queue
       
       Task task;
+      if (thread_poppinned(threadData, &task)) {
+        return thread_exectask(task, threadData);
+      }
       if (!queues[id]->popBottom(&task)) {
         barrier->decActive();
         return ThreadData::STATE_STEALING;
@@ -125,19 +346,32 @@ orTask::TaskSchedulerWorkStealing::ThreadData::State orTask::TaskSchedulerWorkSt
       return thread_exectask(task, threadData);
     }
     case ThreadData::STATE_STEALING: {
+      // Work pinned to this thread can't be taken by anyone else, so check that first
+      {
+        barrier->incActive();
+        Task task;
+        if (thread_poppinned(threadData, &task)) {
+          thread_startworking(threadData);
+          return thread_exectask(task, threadData);
+        }
+        barrier->decActive();
+      }
+
       // Try stealing work
       
-      int victim = victimPicker->pick();
+      int victim = victimPicker.pick();
+      scheduler->addTelemetry(id, WorkerTelemetry::Counter_StealAttempts, 1);
 
       if (queues[victim]->isEmpty()) {
-        // Queue was empty
-        // TODO Could probably have idle threads sleep:
-        // just sleep longer and check barrier->allInactive()...
-        // if (barrier->allInactive()) {
-        //   return WorkerData::STATE_IDLE;
-        // }
-        // Other threads are still active; we've remained in the stealing state, but didn't manage to steal anything this time. Sleep before retrying.
-        boost::this_thread::sleep(sleepTime);
+        scheduler->addTelemetry(id, WorkerTelemetry::Counter_EmptyVictims, 1);
+        // Queue was empty. If nobody's working, nobody's about to push anything, so there's no point
+        // spinning; otherwise keep trying for a bit before parking.
+        if (barrier->allInactive() || ++threadData->failedSteals >= SPIN_STEALS) {
+          threadData->failedSteals = 0;
+          victimPicker.reset();
+          return ThreadData::STATE_IDLE;
+        }
+        boost::this_thread::yield();
         return ThreadData::STATE_STEALING;
       }
       
@@ -145,23 +379,42 @@ orTask::TaskSchedulerWorkStealing::ThreadData::State orTask::TaskSchedulerWorkSt
       barrier->incActive();
 
       Task task;
-      if (!queues[victim]->popTop(&task)) {
+      if (!queues[victim]->popTop(id, &task)) {
         // Queue was non-empty but we didn't manage to steal - 
+        scheduler->addTelemetry(id, WorkerTelemetry::Counter_LostRaces, 1);
         barrier->decActive();
         return ThreadData::STATE_STEALING;
       }
+      threadData->failedSteals = 0;
+      victimPicker.onSteal(victim);
+      scheduler->addTelemetry(id, WorkerTelemetry::Counter_Steals, 1);
+      if (PerfTimer::IsCapturing()) {
+        static PerfTimer::Id const stealId = PerfTimer::Intern("Steal");
+        PerfTimer::RecordInstant(stealId, victim);
+      }
 
-      // TODO should this execution count towards active time?
-      // What does active/inactive time mean across different schedulers?
-      // It's certainly not the same as time spent in job vs time spent in scheduler
+      // Take more while we're here, onto our own queue so others can steal them from us in turn
+      size_t const extra = std::min<size_t>(queues[victim]->sizeEstimate() / 2, STEAL_BATCH_MAX);
+      size_t taken = 0;
+      for (; taken < extra; ++taken) {
+        Task extraTask;
+        if (!queues[victim]->popTop(id, &extraTask)) {
+          break;
+        }
+        queues[id]->pushBottom(extraTask);
+      }
+      scheduler->addTelemetry(id, WorkerTelemetry::Counter_TasksStolen, 1 + taken);
+      if (taken > 0) {
+        scheduler->noteQueueSize(id, queues[id]->sizeEstimate());
+        scheduler->wakeOne();
+      }
+
+      thread_startworking(threadData);
       return thread_exectask(task, threadData);
     }
     case ThreadData::STATE_IDLE: {
-      // TODO need to do something useful instead. Sleep, woken on event? Then need to think about race conditions.
-      // ensure(false);
-      // return;
-      boost::this_thread::sleep(sleepTime);
-      return ThreadData::STATE_IDLE;
+      // Out of work; sleep until there might be some
+      return thread_park(threadData);
     }
     case ThreadData::STATE_EXIT:
     default:
@@ -179,7 +432,14 @@ void orTask::TaskSchedulerWorkStealing::submitExit(int threadIdx) {
   task.taskUserFn = NULL;
   task.taskUserData = NULL;
   
-  queues[threadIdx]->pushBottom( task );
+  // Pinned: only the queue's owner may push onto a work-stealing queue, and each thread needs its own
+  PinnedQueue* pinned = pinnedQueues[threadIdx];
+  {
+    boost::lock_guard<boost::mutex> lock(pinned->mutex);
+    pinned->tasks.push_back(task);
+    orPlatform::atomicInc(&pinned->count);
+  }
+  wakeThread(&threadData[threadIdx]);
 }
 
 void orTask::TaskSchedulerWorkStealing::submitTaskForGroup(int threadIdx, TaskGroup* group, TaskFn* fn, void* userData) {
@@ -194,9 +454,165 @@ void orTask::TaskSchedulerWorkStealing::submitTaskForGroup(int threadIdx, TaskGr
   }
   
   queues[threadIdx]->pushBottom( task );
+  noteQueueSize(threadIdx, queues[threadIdx]->sizeEstimate());
+  if (PerfTimer::IsCapturing()) {
+    static PerfTimer::Id const submitId = PerfTimer::Intern("Submit");
+    PerfTimer::RecordInstant(submitId, threadIdx);
+  }
+  wakeOne();
+}
+
+void orTask::TaskSchedulerWorkStealing::submitPinnedTaskForGroup(int /*threadIdx*/, int targetThreadIdx, TaskGroup* group, TaskFn* fn, void* userData) {
+  Task task;
+  task.exit = false;
+  task.group = group;
+  task.taskUserFn = fn;
+  task.taskUserData = userData;
+  
+  if (group) {
+    group->addTask();
+  }
+  
+  if (PerfTimer::IsCapturing()) {
+    static PerfTimer::Id const submitPinnedId = PerfTimer::Intern("SubmitPinned");
+    PerfTimer::RecordInstant(submitPinnedId, targetThreadIdx);
+  }
+
+  PinnedQueue* pinned = pinnedQueues[targetThreadIdx];
+  {
+    boost::lock_guard<boost::mutex> lock(pinned->mutex);
+    pinned->tasks.push_back(task);
+    orPlatform::atomicInc(&pinned->count);
+  }
+  // Nobody else can take it
+  wakeThread(&threadData[targetThreadIdx]);
+}
+
+void orTask::TaskSchedulerWorkStealing::onGroupDone(TaskGroup const* /*group*/) {
+  orPlatform::fullBarrier(); // The group's count is visible before we look for waiters
+  if (numGroupWaiters == 0) {
+    return;
+  }
+  // Which threads have something suspended on this group is only known to them, so wake any thread
+  // with something suspended; the others just go back to sleep
+  for (int threadIdx = 0; threadIdx < numThreads_; ++threadIdx) {
+    if (threadData[threadIdx].numSuspended != 0) {
+      wakeThread(&threadData[threadIdx]);
+    }
+  }
+}
+
+// Wakes a parked thread, if there are any; the new task could go to any of them
+void orTask::TaskSchedulerWorkStealing::wakeOne() {
+  orPlatform::fullBarrier(); // The push is visible before we look for parked threads
+  if (numParked == 0) {
+    return;
+  }
+  for (int threadIdx = 0; threadIdx < numThreads_; ++threadIdx) {
+    ThreadData* const parkedData = &threadData[threadIdx];
+    if (parkedData->parked && orPlatform::atomicCompareAndSwap(&parkedData->parked, 1, 0) == 1) {
+      orPlatform::atomicDec(&numParked);
+      parkedData->wakeup.notifyAll();
+      return;
+    }
+  }
+}
+
+void orTask::TaskSchedulerWorkStealing::wakeThread(ThreadData* const targetData) {
+  orPlatform::fullBarrier();
+  if (orPlatform::atomicCompareAndSwap(&targetData->parked, 1, 0) == 1) {
+    orPlatform::atomicDec(&numParked);
+  }
+  targetData->wakeup.notifyAll(); // Might be just about to park, so do this either way; it's cheap if not
 }
 
 // TODO inline & remove
+namespace {
+  // How far apart two CPUs are, for stealing: lower is closer. Only the first few are worth trying
+  // before random victims.
+  enum CpuDistance {
+    CpuDistance_Core, // SMT siblings
+    CpuDistance_Cache,
+    CpuDistance_Node,
+    CpuDistance_Far
+  };
+
+  CpuDistance cpuDistance(orPlatform::CpuInfo const& _a, orPlatform::CpuInfo const& _b) {
+    if (_a.core == _b.core) { return CpuDistance_Core; }
+    if (_a.cache == _b.cache) { return CpuDistance_Cache; }
+    if (_a.node == _b.node) { return CpuDistance_Node; }
+    return CpuDistance_Far;
+  }
+
+  struct Neighbour {
+    CpuDistance distance;
+    int offset; // Between thread indices, to break ties
+    int threadIdx;
+  };
+
+  bool lessByDistance(Neighbour const& _a, Neighbour const& _b) {
+    if (_a.distance != _b.distance) { return _a.distance < _b.distance; }
+    return _a.offset < _b.offset;
+  }
+} // namespace
+
+// Spreads the threads over the cores, one per core before doubling up on SMT siblings, with threads
+// next to each other in index on CPUs close to each other. Each thread then tries stealing from the
+// threads sharing its cache or NUMA node before random ones; across sockets, stealing drags the
+// task's data over the interconnect.
+// Workers are pinned; thread 0 is the caller's, and is left alone, but counts as on the first CPU
+// (which no worker takes).
+// With more threads than CPUs, pinning would only stop the OS balancing them, so nothing's placed.
+void orTask::TaskSchedulerWorkStealing::placeThreads()
+{
+  std::vector<orPlatform::CpuInfo> cpus;
+  if (!orPlatform::getCpuTopology(&cpus) || (int)cpus.size() < numThreads_) {
+    return;
+  }
+
+  std::vector<orPlatform::CpuInfo> placement;
+  {
+    std::vector<bool> coreTaken;
+    std::vector<bool> cpuTaken(cpus.size(), false);
+    for (size_t i = 0; i < cpus.size(); ++i) {
+      size_t const core = (size_t)cpus[i].core;
+      if (core >= coreTaken.size()) { coreTaken.resize(core + 1, false); }
+      if (!coreTaken[core]) {
+        coreTaken[core] = true;
+        cpuTaken[i] = true;
+        placement.push_back(cpus[i]);
+      }
+    }
+    for (size_t i = 0; i < cpus.size(); ++i) {
+      if (!cpuTaken[i]) {
+        placement.push_back(cpus[i]);
+      }
+    }
+  }
+
+  for (int threadIdx = 0; threadIdx < numThreads_; ++threadIdx) {
+    if (threadIdx != 0) {
+      threadData[threadIdx].cpu = placement[threadIdx].cpu;
+    }
+
+    std::vector<Neighbour> neighbours;
+    for (int otherIdx = 0; otherIdx < numThreads_; ++otherIdx) {
+      CpuDistance const distance = cpuDistance(placement[threadIdx], placement[otherIdx]);
+      if (otherIdx != threadIdx && distance != CpuDistance_Far) {
+        Neighbour const neighbour = { distance, std::abs(otherIdx - threadIdx), otherIdx };
+        neighbours.push_back(neighbour);
+      }
+    }
+    std::sort(neighbours.begin(), neighbours.end(), &lessByDistance);
+
+    std::vector<int> neighbourIdxs;
+    for (size_t i = 0; i < neighbours.size(); ++i) {
+      neighbourIdxs.push_back(neighbours[i].threadIdx);
+    }
+    threadData[threadIdx].victimPicker.setNeighbours(neighbourIdxs);
+  }
+}
+
 void orTask::TaskSchedulerWorkStealing::initThreads()
 {
   // Start the worker threads, index [1 -- numThreads]
@@ -205,10 +621,36 @@ void orTask::TaskSchedulerWorkStealing::initThreads()
   }
 }
 
-// TODO inline & remove
+void orTask::TaskSchedulerWorkStealing::noop_fn(ThreadIdx, void*)
+{
+}
+
+// Tasks suspended on thread 0 only get to resume while it's waiting for something; it only runs the
+// scheduling loop then. Wait until none are left, or workers that are waiting on them could never
+// exit.
+void orTask::TaskSchedulerWorkStealing::drainMainThread()
+{
+  ThreadData* const mainData = &threadData[0];
+  while (!mainData->suspendedFibers.empty()) {
+    TaskGroup* const group = mainData->suspendedFibers.front()->waitingFor;
+    orPlatform::readBarrier();
+    if (group->tasks != 0) {
+      waitForTaskGroup(0, group);
+    } else {
+      // Already done, just not resumed yet; any wait runs the loop, which resumes it
+      TaskGroup resumeGroup;
+      submitPinnedTaskForGroup(0, 0, &resumeGroup, &noop_fn, NULL);
+      waitForTaskGroup(0, &resumeGroup);
+    }
+  }
+}
+
+// Workers finish any tasks they have suspended before they exit
 void orTask::TaskSchedulerWorkStealing::exitThreads()
 {
-  for (int threadIdx = 0; threadIdx < numThreads_; ++threadIdx) {
+  drainMainThread();
+
+  for (int threadIdx = 1; threadIdx < numThreads_; ++threadIdx) {
     submitExit(threadIdx);
   }
 
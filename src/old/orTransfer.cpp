@@ -0,0 +1,382 @@
+#include "orStd.h"
+
+#include "orTransfer.h"
+
+#include "orPlatform/atomic.h"
+
+// Tiles whose best value is within this factor of the best value found so far get refined
+static double const REFINE_FACTOR = 1.25;
+
+bool TransferPlanner::Query::operator<(Query const& _other) const {
+  // Lexicographic compare on every field
+  if (m_departBodyId.sparse_idx != _other.m_departBodyId.sparse_idx) { return m_departBodyId.sparse_idx < _other.m_departBodyId.sparse_idx; }
+  if (m_departBodyId.generation != _other.m_departBodyId.generation) { return m_departBodyId.generation < _other.m_departBodyId.generation; }
+  if (m_arriveBodyId.sparse_idx != _other.m_arriveBodyId.sparse_idx) { return m_arriveBodyId.sparse_idx < _other.m_arriveBodyId.sparse_idx; }
+  if (m_arriveBodyId.generation != _other.m_arriveBodyId.generation) { return m_arriveBodyId.generation < _other.m_arriveBodyId.generation; }
+  if (m_departTimeMin != _other.m_departTimeMin) { return m_departTimeMin < _other.m_departTimeMin; }
+  if (m_departTimeMax != _other.m_departTimeMax) { return m_departTimeMax < _other.m_departTimeMax; }
+  if (m_flightTimeMin != _other.m_flightTimeMin) { return m_flightTimeMin < _other.m_flightTimeMin; }
+  if (m_flightTimeMax != _other.m_flightTimeMax) { return m_flightTimeMax < _other.m_flightTimeMax; }
+  if (m_numDepartSteps != _other.m_numDepartSteps) { return m_numDepartSteps < _other.m_numDepartSteps; }
+  return m_numFlightSteps < _other.m_numFlightSteps;
+}
+
+TransferPlanner::Search::Search(orTask::TaskScheduler& _scheduler, Query const& _query) :
+  m_scheduler(_scheduler),
+  m_query(_query),
+  m_mu(0),
+  m_departEphemeris(),
+  m_arriveEphemeris(),
+  m_numTilesX((_query.m_numDepartSteps + TILE_SIZE - 1) / TILE_SIZE),
+  m_numTilesY((_query.m_numFlightSteps + TILE_SIZE - 1) / TILE_SIZE),
+  m_deltaV(_query.m_numDepartSteps * _query.m_numFlightSteps, FLT_MAX),
+  m_tileMinDeltaV(m_numTilesX * m_numTilesY, FLT_MAX),
+  m_tileMinCell(m_numTilesX * m_numTilesY, -1),
+  m_tileStride(m_numTilesX * m_numTilesY, 0),
+  m_tileJobs(),
+  m_stride(COARSE_STRIDE),
+  m_pendingTiles(0),
+  m_cancelled(0),
+  m_complete(0),
+  m_tilesPlanned(0),
+  m_tilesDone(0),
+  m_bestSolution(),
+  m_group(),
+  m_lastRequested(0)
+{
+}
+
+double TransferPlanner::Search::getDepartTime(int _departIdx) const {
+  return orLerp(m_query.m_departTimeMin, m_query.m_departTimeMax, _departIdx / (double)(m_query.m_numDepartSteps - 1));
+}
+
+double TransferPlanner::Search::getFlightTime(int _flightIdx) const {
+  return orLerp(m_query.m_flightTimeMin, m_query.m_flightTimeMax, _flightIdx / (double)(m_query.m_numFlightSteps - 1));
+}
+
+double TransferPlanner::Search::getProgress() const {
+  orPlatform::readBarrier();
+  if (m_complete) {
+    return 1.0;
+  }
+  // TODO later passes are smaller than the first, so this runs backwards a bit when a pass gets planned
+  return m_tilesPlanned ? (m_tilesDone / (double)m_tilesPlanned) : 0.0;
+}
+
+double TransferPlanner::Search::evaluate(double const _departTime, double const _flightTime, Solution* o_solution) const {
+  orEphemerisCartesian depart;
+  ephemerisCartesianFromJPL(m_departEphemeris, _departTime, depart);
+
+  orEphemerisCartesian arrive;
+  ephemerisCartesianFromJPL(m_arriveEphemeris, _departTime + _flightTime, arrive);
+
+  Vector3d v1;
+  Vector3d v2;
+  if (!orMath::solveLambert(depart.pos, arrive.pos, _flightTime, m_mu, v1, v2)) {
+    return DBL_MAX;
+  }
+
+  double const deltaV = (v1 - depart.vel).norm() + (arrive.vel - v2).norm();
+
+  if (o_solution) {
+    o_solution->m_valid = true;
+    o_solution->m_departTime = _departTime;
+    o_solution->m_flightTime = _flightTime;
+    o_solution->m_deltaV = deltaV;
+    o_solution->m_departVel = v1;
+    o_solution->m_arriveVel = v2;
+  }
+
+  return deltaV;
+}
+
+void TransferPlanner::Search::startPass(int const _threadIdx, int const _stride) {
+  m_stride = _stride;
+  m_tileJobs.clear();
+
+  int const numTiles = m_numTilesX * m_numTilesY;
+
+  if (_stride == COARSE_STRIDE) {
+    for (int tileIdx = 0; tileIdx < numTiles; ++tileIdx) {
+      TileJob job = { this, tileIdx };
+      m_tileJobs.push_back(job);
+    }
+  } else {
+    // Refine tiles close to the best value, and their neighbours since the coarse samples may have
+    // just missed a minimum on the other side of a tile boundary.
+    float bestDeltaV = FLT_MAX;
+    for (int tileIdx = 0; tileIdx < numTiles; ++tileIdx) {
+      bestDeltaV = std::min(bestDeltaV, m_tileMinDeltaV[tileIdx]);
+    }
+
+    if (bestDeltaV == FLT_MAX) {
+      // No solutions anywhere, nothing to refine
+      finishPass(_threadIdx);
+      return;
+    }
+
+    std::vector<bool> refine(numTiles, false);
+    for (int ty = 0; ty < m_numTilesY; ++ty) {
+      for (int tx = 0; tx < m_numTilesX; ++tx) {
+        if (m_tileMinDeltaV[ty * m_numTilesX + tx] > bestDeltaV * REFINE_FACTOR) {
+          continue;
+        }
+        for (int ny = std::max(ty - 1, 0); ny <= std::min(ty + 1, m_numTilesY - 1); ++ny) {
+          for (int nx = std::max(tx - 1, 0); nx <= std::min(tx + 1, m_numTilesX - 1); ++nx) {
+            refine[ny * m_numTilesX + nx] = true;
+          }
+        }
+      }
+    }
+
+    for (int tileIdx = 0; tileIdx < numTiles; ++tileIdx) {
+      if (refine[tileIdx]) {
+        TileJob job = { this, tileIdx };
+        m_tileJobs.push_back(job);
+      }
+    }
+  }
+
+  int const numJobs = (int)m_tileJobs.size();
+  ensure(numJobs > 0);
+
+  m_pendingTiles = numJobs;
+  m_tilesPlanned += numJobs;
+  orPlatform::writeBarrier();
+
+  for (int i = 0; i < numJobs; ++i) {
+    m_scheduler.submitTaskForGroup(_threadIdx, &m_group, &runTile, &m_tileJobs[i]);
+  }
+}
+
+// Called by whichever task finished the last tile of a pass. Any follow-up work must be submitted from
+// here, before that task completes, so the group never hits zero until the whole search is done.
+void TransferPlanner::Search::finishPass(int const _threadIdx) {
+  orPlatform::readBarrier();
+
+  if (!m_cancelled && m_stride > 1) {
+    startPass(_threadIdx, m_stride / 2);
+    return;
+  }
+
+  if (!m_cancelled) {
+    polishBestSolution();
+  }
+
+  orPlatform::writeBarrier();
+  m_complete = 1;
+}
+
+void TransferPlanner::Search::runTile(orTask::ThreadIdx const _threadIdx, void* const _userData) {
+  // Copy out the job; once we decrement the pending count the job array can be rebuilt under us
+  TileJob const job = *(TileJob const*)_userData;
+  Search* const search = job.m_search;
+
+  orPlatform::readBarrier();
+  if (!search->m_cancelled) {
+    search->evaluateTile(job.m_tileIdx);
+  }
+
+  orPlatform::writeBarrier();
+  orPlatform::atomicInc(&search->m_tilesDone);
+
+  if (orPlatform::atomicDec(&search->m_pendingTiles) == 1) {
+    search->finishPass(_threadIdx);
+  }
+}
+
+void TransferPlanner::Search::evaluateTile(int const _tileIdx) {
+  int const stride = m_stride;
+  int const width = getWidth();
+  int const height = getHeight();
+
+  int const tx = _tileIdx % m_numTilesX;
+  int const ty = _tileIdx / m_numTilesX;
+
+  int const x0 = tx * TILE_SIZE;
+  int const y0 = ty * TILE_SIZE;
+  int const x1 = std::min(x0 + TILE_SIZE, width);
+  int const y1 = std::min(y0 + TILE_SIZE, height);
+
+  float tileMin = m_tileMinDeltaV[_tileIdx];
+  int tileMinCell = m_tileMinCell[_tileIdx];
+
+  // Tiles start on multiples of every stride, so the samples this tile had at its last pass are
+  // exactly the ones on that pass's lattice. Those are skipped; everything else on ours is new.
+  int const prevStride = m_tileStride[_tileIdx];
+
+  for (int y = y0; y < y1; y += stride) {
+    double const flightTime = getFlightTime(y);
+    for (int x = x0; x < x1; x += stride) {
+      bool const isEvaluated = (prevStride != 0) && (x % prevStride == 0) && (y % prevStride == 0);
+      if (isEvaluated) {
+        continue;
+      }
+
+      double const deltaV = evaluate(getDepartTime(x), flightTime, NULL);
+      float const deltaVf = (deltaV < FLT_MAX) ? (float)deltaV : FLT_MAX;
+
+      // Fill the whole block this sample represents at this resolution, so the plot has no holes
+      for (int by = y; by < std::min(y + stride, y1); ++by) {
+        for (int bx = x; bx < std::min(x + stride, x1); ++bx) {
+          m_deltaV[by * width + bx] = deltaVf;
+        }
+      }
+
+      if (deltaVf < tileMin) {
+        tileMin = deltaVf;
+        tileMinCell = y * width + x;
+      }
+    }
+  }
+
+  m_tileMinDeltaV[_tileIdx] = tileMin;
+  m_tileMinCell[_tileIdx] = tileMinCell;
+  m_tileStride[_tileIdx] = stride;
+}
+
+// The grid only gets us to within a cell of the minimum; finish off with a compass search
+// in continuous (departure time, flight time) so the reported solution doesn't depend on resolution.
+void TransferPlanner::Search::polishBestSolution() {
+  int bestCell = -1;
+  float bestDeltaV = FLT_MAX;
+  for (int tileIdx = 0; tileIdx < (int)m_tileMinDeltaV.size(); ++tileIdx) {
+    if (m_tileMinDeltaV[tileIdx] < bestDeltaV) {
+      bestDeltaV = m_tileMinDeltaV[tileIdx];
+      bestCell = m_tileMinCell[tileIdx];
+    }
+  }
+
+  if (bestCell < 0) {
+    m_bestSolution = Solution();
+    return;
+  }
+
+  double departTime = getDepartTime(bestCell % getWidth());
+  double flightTime = getFlightTime(bestCell / getWidth());
+  double best = evaluate(departTime, flightTime, NULL);
+
+  double departStep = (m_query.m_departTimeMax - m_query.m_departTimeMin) / (m_query.m_numDepartSteps - 1);
+  double flightStep = (m_query.m_flightTimeMax - m_query.m_flightTimeMin) / (m_query.m_numFlightSteps - 1);
+  double const minDepartStep = departStep / 256;
+
+  int const MAX_ITERATIONS = 64;
+  for (int i = 0; i < MAX_ITERATIONS && departStep > minDepartStep; ++i) {
+    double const candidates[4][2] = {
+      { departTime + departStep, flightTime },
+      { departTime - departStep, flightTime },
+      { departTime, flightTime + flightStep },
+      { departTime, flightTime - flightStep }
+    };
+
+    bool improved = false;
+    for (int c = 0; c < 4; ++c) {
+      double const t0 = candidates[c][0];
+      double const tf = candidates[c][1];
+      if (t0 < m_query.m_departTimeMin || t0 > m_query.m_departTimeMax || tf < m_query.m_flightTimeMin || tf > m_query.m_flightTimeMax) {
+        continue;
+      }
+      double const deltaV = evaluate(t0, tf, NULL);
+      if (deltaV < best) {
+        best = deltaV;
+        departTime = t0;
+        flightTime = tf;
+        improved = true;
+      }
+    }
+
+    if (!improved) {
+      departStep *= 0.5;
+      flightStep *= 0.5;
+    }
+  }
+
+  evaluate(departTime, flightTime, &m_bestSolution);
+}
+
+TransferPlanner::TransferPlanner(orTask::TaskScheduler& _scheduler, PhysicsSystem const& _physicsSystem) :
+  m_scheduler(_scheduler),
+  m_physicsSystem(_physicsSystem),
+  m_searches(),
+  m_numRequests(0)
+{
+}
+
+TransferPlanner::~TransferPlanner() {
+  // TODO assumes we are destroyed on the main thread
+  clear(0);
+}
+
+TransferPlanner::Search const* TransferPlanner::requestSearch(int const _threadIdx, Query const& _query) {
+  SearchCache::const_iterator it = m_searches.find(_query);
+  if (it != m_searches.end()) {
+    it->second->m_lastRequested = ++m_numRequests;
+    return it->second;
+  }
+
+  ensure(_query.m_numDepartSteps > 1 && _query.m_numFlightSteps > 1);
+  ensure(_query.m_departTimeMax >= _query.m_departTimeMin);
+  ensure(_query.m_flightTimeMax >= _query.m_flightTimeMin && _query.m_flightTimeMin > 0);
+
+  if (!_query.m_departBodyId || !_query.m_arriveBodyId) {
+    return NULL;
+  }
+
+  PhysicsSystem::GravBody const& departBody = m_physicsSystem.getGravBody(_query.m_departBodyId);
+  PhysicsSystem::GravBody const& arriveBody = m_physicsSystem.getGravBody(_query.m_arriveBodyId);
+
+  orbital::Id<PhysicsSystem::GravBody> const parentId = departBody.m_parentBodyId;
+  if (!parentId
+    || arriveBody.m_parentBodyId.sparse_idx != parentId.sparse_idx
+    || arriveBody.m_parentBodyId.generation != parentId.generation) {
+    orErr("Transfer search needs two bodies orbiting the same parent\n");
+    return NULL;
+  }
+
+  Search* const search = new Search(m_scheduler, _query);
+  search->m_mu = GRAV_CONSTANT * m_physicsSystem.getGravBody(parentId).m_mass;
+  search->m_departEphemeris = departBody.m_ephemeris;
+  search->m_arriveEphemeris = arriveBody.m_ephemeris;
+
+  if ((int)m_searches.size() >= MAX_CACHED_SEARCHES) {
+    evictOldestSearch(_threadIdx);
+  }
+  search->m_lastRequested = ++m_numRequests;
+  m_searches[_query] = search;
+
+  search->startPass(_threadIdx, Search::COARSE_STRIDE);
+
+  return search;
+}
+
+void TransferPlanner::evictOldestSearch(int const _threadIdx) {
+  SearchCache::iterator oldest = m_searches.begin();
+  for (SearchCache::iterator it = m_searches.begin(); it != m_searches.end(); ++it) {
+    if (it->second->m_lastRequested < oldest->second->m_lastRequested) {
+      oldest = it;
+    }
+  }
+  ensure(oldest != m_searches.end());
+
+  // Cancelled tiles return straight away, so this only waits for the ones already running
+  Search* const search = oldest->second;
+  search->m_cancelled = 1;
+  orPlatform::writeBarrier();
+  m_scheduler.waitForTaskGroup(_threadIdx, &search->m_group);
+  delete search;
+  m_searches.erase(oldest);
+}
+
+void TransferPlanner::clear(int const _threadIdx) {
+  // Cancel everything first so the searches wind down in parallel
+  for (SearchCache::iterator it = m_searches.begin(); it != m_searches.end(); ++it) {
+    it->second->m_cancelled = 1;
+  }
+  orPlatform::writeBarrier();
+
+  for (SearchCache::iterator it = m_searches.begin(); it != m_searches.end(); ++it) {
+    m_scheduler.waitForTaskGroup(_threadIdx, &it->second->m_group);
+    delete it->second;
+  }
+  m_searches.clear();
+}
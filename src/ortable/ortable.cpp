@@ -0,0 +1,150 @@
+#include "ortable/ortable.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace ortable {
+
+namespace {
+
+inline size_t RoundUp(size_t v, size_t multiple) { return (v + multiple - 1) / multiple * multiple; }
+
+inline uint8_t* LaneData(void* buffer, Attribute const& attribute, size_t lane) {
+  return static_cast<uint8_t*>(buffer) + attribute.offset + lane * attribute.stride;
+}
+
+// Lays out every attribute for the given capacity, and returns the total bytes needed
+size_t Layout(Table* table, size_t capacity) {
+  size_t offset = 0;
+  for (size_t i = 0; i < table->num_attributes; ++i) {
+    Attribute& attribute = table->attributes[i];
+    attribute.stride = RoundUp(capacity * attribute.size, ALIGNMENT);
+    attribute.offset = offset;
+    offset += attribute.count * attribute.stride;
+  }
+  return offset;
+}
+
+}  // namespace
+
+void Init(Table* table) {
+  table->buffer = NULL;
+  table->allocation = NULL;
+  table->size = 0;
+  table->capacity = 0;
+  table->num_attributes = 0;
+}
+
+void Destroy(Table* table) {
+  free(table->allocation);
+  Init(table);
+}
+
+size_t AddAttribute(Table* table, size_t size, size_t count) {
+  assert(table->size == 0);
+  assert(table->num_attributes < MAX_ATTRIBUTES);
+  assert(size > 0 && count > 0);
+  size_t const index = table->num_attributes++;
+  Attribute& attribute = table->attributes[index];
+  attribute.size = size;
+  attribute.count = count;
+  // Redo the layout with the new attribute in it; the table is empty so nothing to copy
+  size_t const bytes = Layout(table, table->capacity);
+  if (bytes > 0) {
+    free(table->allocation);
+    table->allocation = malloc(bytes + ALIGNMENT);
+    table->buffer = reinterpret_cast<void*>(RoundUp(reinterpret_cast<uintptr_t>(table->allocation), ALIGNMENT));
+    memset(table->buffer, 0, bytes);
+  }
+  return index;
+}
+
+void Reserve(Table* table, size_t capacity) {
+  capacity = RoundUp(capacity, ROW_PADDING);
+  if (capacity <= table->capacity) { return; }
+
+  Attribute old_attributes[MAX_ATTRIBUTES];
+  memcpy(old_attributes, table->attributes, sizeof(old_attributes));
+
+  size_t const bytes = Layout(table, capacity);
+  void* const allocation = malloc(bytes + ALIGNMENT);
+  assert(allocation);
+  void* const buffer = reinterpret_cast<void*>(RoundUp(reinterpret_cast<uintptr_t>(allocation), ALIGNMENT));
+
+  // Zero everything, including padding rows, then copy the live rows across lane by lane
+  memset(buffer, 0, bytes);
+  for (size_t i = 0; i < table->num_attributes && table->size > 0; ++i) {
+    for (size_t lane = 0; lane < table->attributes[i].count; ++lane) {
+      memcpy(LaneData(buffer, table->attributes[i], lane), LaneData(table->buffer, old_attributes[i], lane), table->size * table->attributes[i].size);
+    }
+  }
+
+  free(table->allocation);
+  table->allocation = allocation;
+  table->buffer = buffer;
+  table->capacity = capacity;
+}
+
+size_t Append(Table* table, size_t count) {
+  size_t const first = table->size;
+  if (first + count > table->capacity) {
+    size_t const doubled = table->capacity * 2;
+    Reserve(table, (first + count > doubled) ? first + count : doubled);
+  }
+  // Rows past size are kept zeroed, so nothing to clear here
+  table->size += count;
+  return first;
+}
+
+void SwapRemove(Table* table, size_t row) {
+  assert(row < table->size);
+  size_t const last = table->size - 1;
+  for (size_t i = 0; i < table->num_attributes; ++i) {
+    Attribute const& attribute = table->attributes[i];
+    for (size_t lane = 0; lane < attribute.count; ++lane) {
+      uint8_t* const data = LaneData(table->buffer, attribute, lane);
+      if (row != last) {
+        memcpy(data + row * attribute.size, data + last * attribute.size, attribute.size);
+      }
+      memset(data + last * attribute.size, 0, attribute.size);
+    }
+  }
+  table->size = last;
+}
+
+void Compact(Table* table, uint8_t const* keep) {
+  size_t new_size = 0;
+  for (size_t row = 0; row < table->size; ++row) {
+    if (keep[row]) { ++new_size; }
+  }
+  if (new_size == table->size) { return; }
+
+  for (size_t i = 0; i < table->num_attributes; ++i) {
+    Attribute const& attribute = table->attributes[i];
+    for (size_t lane = 0; lane < attribute.count; ++lane) {
+      uint8_t* const data = LaneData(table->buffer, attribute, lane);
+      size_t out = 0;
+      for (size_t row = 0; row < table->size; ++row) {
+        if (!keep[row]) { continue; }
+        if (out != row) {
+          memcpy(data + out * attribute.size, data + row * attribute.size, attribute.size);
+        }
+        ++out;
+      }
+      memset(data + new_size * attribute.size, 0, (table->size - new_size) * attribute.size);
+    }
+  }
+  table->size = new_size;
+}
+
+void Clear(Table* table) {
+  for (size_t i = 0; i < table->num_attributes; ++i) {
+    Attribute const& attribute = table->attributes[i];
+    for (size_t lane = 0; lane < attribute.count; ++lane) {
+      memset(LaneData(table->buffer, attribute, lane), 0, table->size * attribute.size);
+    }
+  }
+  table->size = 0;
+}
+
+}  // namespace ortable